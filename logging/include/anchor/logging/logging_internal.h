@@ -25,7 +25,6 @@ void logging_log_impl(logging_level_t level, const char* file, int line, const c
 
 #ifdef LOGGING_MODULE_NAME
 #define _LOGGING_MODULE_PREFIX LOGGING_MODULE_NAME ":"
-#undef LOGGING_MODULE_NAME
 #else
 #define _LOGGING_MODULE_PREFIX 0
 #endif
@@ -114,8 +114,8 @@ static void log_line_helper(logging_level_t level, const char* file, int line, c
         .module_prefix = module_prefix,
         .timestamp = m_init.time_ms_function ? m_init.time_ms_function() : 0,
         .fmt = fmt,
-        .args = args,
     };
+    va_copy(log_line.args, args);
     get_timestamp_components(log_line.timestamp, &log_line.timestamp_components);
 
 #if LOGGING_CUSTOM_HANDLER
@@ -186,7 +186,7 @@ void logging_format_line(const logging_line_t* log_line, char* buffer, uint32_t
     BUFFER_PRINTF(buffer, size, ":%d: ", log_line->line);
 
     // Add the formatted log message
-    BUFFER_VA_PRINTF(buffer, size, log_line->fmt, log_line->args);
+    BUFFER_VA_PRINTF(buffer, size, log_line->fmt, ((logging_line_t*)log_line)->args);
 
     // Always add a newline, even if it means truncating the message
     if (strlen(buffer) == size - 1) {
@@ -21,7 +21,7 @@ typedef enum {
 
 struct sonar_attribute_def {
     // Allocated private context space - should only be accessed by the SONAR implementation
-    uint8_t _private[sizeof(void*) * 2];
+    uint8_t _private[sizeof(void*) + sizeof(uint32_t) * 4];
     // The ID of the attribute
     const uint16_t attribute_id:12;
     // The maximum size of the attribute data
@@ -32,6 +32,14 @@ struct sonar_attribute_def {
     uint8_t* const request_buffer;
     // Pointer to a statically-allocated data buffer for the attribute which is used internally by SONAR for responses
     uint8_t* const response_buffer;
+    // Pointer to a statically-allocated buffer which holds the last value of a delta attribute (NULL otherwise)
+    uint8_t* const delta_buffer;
+    // Pointer to a statically-allocated buffer which holds the latest value of a coalesced attribute while a notify is
+    // pending (NULL otherwise)
+    uint8_t* const coalesce_buffer;
+    // The priority of requests for the attribute, with higher priority ones being sent ahead of queued lower priority
+    // ones on the same link (defaults to 0 and may be set before the attribute is registered)
+    uint8_t priority;
 };
 
 
@@ -61,3 +69,47 @@ struct sonar_attribute_def {
         .response_buffer = _##NAME##_response_buffer, \
     }; \
     static const sonar_attribute_t NAME = &_##NAME##_def;
+
+// The size of the request / response buffers of delta attributes, which hold the encoded notify data
+#define SONAR_ATTR_DELTA_BUFFER_SIZE(MAX_SIZE) ((MAX_SIZE) + ((MAX_SIZE) + 7) / 8 + 5)
+
+/*
+ * The SONAR_ATTR_DEF_DELTA macro below is used to define SONAR attributes which send notifies as a delta against the
+ * last value acknowledged by the client. It takes the same parameters as SONAR_ATTR_DEF and both the client and server
+ * must define the attribute this way.
+ */
+#define SONAR_ATTR_DEF_DELTA(NAME, ID, MAX_SIZE, OPS) \
+    static uint8_t _##NAME##_request_buffer[SONAR_ATTR_DELTA_BUFFER_SIZE(MAX_SIZE)] SONAR_ATTR_BUFFER_ATTRIBUTES; \
+    static uint8_t _##NAME##_response_buffer[SONAR_ATTR_DELTA_BUFFER_SIZE(MAX_SIZE)] SONAR_ATTR_BUFFER_ATTRIBUTES; \
+    static uint8_t _##NAME##_delta_buffer[(MAX_SIZE) ? (MAX_SIZE) : 1] SONAR_ATTR_BUFFER_ATTRIBUTES; \
+    static sonar_attribute_def_t _##NAME##_def = { \
+        ._private = {0}, \
+        .attribute_id = ID, \
+        .max_size = MAX_SIZE, \
+        .ops = SONAR_ATTRIBUTE_OPS_##OPS, \
+        .request_buffer = _##NAME##_request_buffer, \
+        .response_buffer = _##NAME##_response_buffer, \
+        .delta_buffer = _##NAME##_delta_buffer, \
+    }; \
+    static const sonar_attribute_t NAME = &_##NAME##_def;
+
+/*
+ * The SONAR_ATTR_DEF_COALESCED macro below is used to define SONAR attributes where only the latest value matters, so
+ * notifying one while a notify is already pending replaces any value which is waiting to be sent (rather than failing),
+ * and the latest value is sent once the pending notify completes. It takes the same parameters as SONAR_ATTR_DEF and
+ * only the server needs to define the attribute this way.
+ */
+#define SONAR_ATTR_DEF_COALESCED(NAME, ID, MAX_SIZE, OPS) \
+    static uint8_t _##NAME##_request_buffer[(MAX_SIZE) ? (MAX_SIZE) : 1] SONAR_ATTR_BUFFER_ATTRIBUTES; \
+    static uint8_t _##NAME##_response_buffer[(MAX_SIZE) ? (MAX_SIZE) : 1] SONAR_ATTR_BUFFER_ATTRIBUTES; \
+    static uint8_t _##NAME##_coalesce_buffer[(MAX_SIZE) ? (MAX_SIZE) : 1] SONAR_ATTR_BUFFER_ATTRIBUTES; \
+    static sonar_attribute_def_t _##NAME##_def = { \
+        ._private = {0}, \
+        .attribute_id = ID, \
+        .max_size = MAX_SIZE, \
+        .ops = SONAR_ATTRIBUTE_OPS_##OPS, \
+        .request_buffer = _##NAME##_request_buffer, \
+        .response_buffer = _##NAME##_response_buffer, \
+        .coalesce_buffer = _##NAME##_coalesce_buffer, \
+    }; \
+    static const sonar_attribute_t NAME = &_##NAME##_def;
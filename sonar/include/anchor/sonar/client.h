@@ -1,31 +1,57 @@
 #pragma once
 
 #include "anchor/sonar/error_types.h"
+#include "anchor/sonar/rtt_types.h"
 #include "anchor/sonar/attribute.h"
+#include "anchor/sonar/rx_ring.h"
+#include "anchor/sonar/sonar_config.h"
 
 #include <inttypes.h>
 #include <stdbool.h>
 
 // The context size depends on whether we're compiling for a 64-bit or 32-bit system due to struct padding
-#define _SONAR_CLIENT_CONTEXT_SIZE_32   340
-#define _SONAR_CLIENT_CONTEXT_SIZE_64   560
+#define _SONAR_CLIENT_CONTEXT_SIZE_32   648
+#define _SONAR_CLIENT_CONTEXT_SIZE_64   1000
 #define _SONAR_CLIENT_CONTEXT_SIZE ( \
     sizeof(sonar_client_init_t) + \
-    ((sizeof(uintptr_t) == 8) ? _SONAR_CLIENT_CONTEXT_SIZE_64 : _SONAR_CLIENT_CONTEXT_SIZE_32))
+    ((sizeof(uintptr_t) == 8) ? _SONAR_CLIENT_CONTEXT_SIZE_64 : _SONAR_CLIENT_CONTEXT_SIZE_32) + \
+    (SONAR_MAX_WINDOW_SIZE - 1) * sizeof(uint64_t) * 3 + \
+    SONAR_REQUEST_QUEUE_SIZE * sizeof(void*) * 11)
 
 // Defines a SONAR client object which can support attributes of up to MAX_ATTR_SIZE
 #define SONAR_CLIENT_DEF(NAME, MAX_ATTR_SIZE) \
     static uint8_t _##NAME##_receive_buffer[MAX_ATTR_SIZE + 6]; \
+    static uint8_t _##NAME##_transmit_buffer[SONAR_TRANSMIT_BUFFER_SIZE(MAX_ATTR_SIZE) ? SONAR_TRANSMIT_BUFFER_SIZE(MAX_ATTR_SIZE) : 1]; \
+    static uint8_t _##NAME##_retransmit_cache[SONAR_RETRANSMIT_CACHE_SIZE(MAX_ATTR_SIZE) ? 2 * SONAR_RETRANSMIT_CACHE_SIZE(MAX_ATTR_SIZE) : 1]; \
+    static uint8_t _##NAME##_compression_buffer[SONAR_COMPRESSION_BUFFER_SIZE(MAX_ATTR_SIZE) ? SONAR_COMPRESSION_BUFFER_SIZE(MAX_ATTR_SIZE) : 1]; \
+    static uint8_t _##NAME##_transmit_ring[SONAR_TRANSMIT_RING_SIZE(MAX_ATTR_SIZE) ? SONAR_TRANSMIT_RING_SIZE(MAX_ATTR_SIZE) : 1]; \
     static sonar_client_context_t _##NAME##_context = { \
         ._private = {0}, \
         .receive_buffer = _##NAME##_receive_buffer, \
         .receive_buffer_size = sizeof(_##NAME##_receive_buffer), \
+        .transmit_buffer = _##NAME##_transmit_buffer, \
+        .transmit_buffer_size = SONAR_TRANSMIT_BUFFER_SIZE(MAX_ATTR_SIZE), \
+        .retransmit_cache = _##NAME##_retransmit_cache, \
+        .retransmit_cache_size = SONAR_RETRANSMIT_CACHE_SIZE(MAX_ATTR_SIZE), \
+        .compression_buffer = _##NAME##_compression_buffer, \
+        .compression_buffer_size = SONAR_COMPRESSION_BUFFER_SIZE(MAX_ATTR_SIZE), \
+        .transmit_ring = _##NAME##_transmit_ring, \
+        .transmit_ring_size = SONAR_TRANSMIT_RING_SIZE(MAX_ATTR_SIZE), \
     }; \
     static sonar_client_handle_t NAME = &_##NAME##_context
 
+// Function prototype for per-request completion callbacks (data is only set for successful read requests)
+typedef void (*sonar_client_request_complete_callback_t)(void* context, bool success, const void* data, uint32_t length);
+
 typedef struct {
     // A function which writes a single byte over the physical layer
     void (*write_byte)(uint8_t byte);
+    // A function which writes multiple bytes over the physical layer (optional - takes precedence over write_byte)
+    void (*write_bytes)(const uint8_t* data, uint32_t length);
+    // A function which starts writing a buffer of data over the physical layer (e.g. via DMA), after which
+    // sonar_client_tx_complete() must be called (optional - takes precedence over write_byte / write_bytes and requires a
+    // transmit ring, see SONAR_TRANSMIT_RING_SIZE())
+    void (*start_tx)(const uint8_t* data, uint32_t length);
     // A function which gets the current system time in ms
     uint64_t (*get_system_time_ms)(void);
     // Callback when the connection state changes
@@ -36,6 +62,34 @@ typedef struct {
     void (*attribute_write_complete_handler)(bool success);
     // Callback when a notify request is received
     bool (*attribute_notify_handler)(sonar_attribute_t attr, const void* data, uint32_t length);
+    // The maximum number of requests which may be outstanding at once (optional - defaults to 1, limited to SONAR_MAX_WINDOW_SIZE)
+    uint8_t window_size;
+    // Whether or not to send a response and the next request in a single packet where possible (optional - requires
+    // the server to also support it)
+    bool enable_piggyback;
+    // Whether or not to accept fragmented requests, and to split ones which don't fit in the server's receive buffer
+    // into fragments (optional - requires the server to also support it)
+    bool enable_fragmentation;
+    // The bounds on the request retry interval, which is otherwise derived from the measured round-trip time
+    // (optional - they default to 20ms and 125ms, and a larger max extends the connection timeout, so should also be
+    // set on the server)
+    uint16_t min_retry_interval_ms;
+    uint16_t max_retry_interval_ms;
+    // Whether or not to combine the packets which are sent within each call to process into a single frame (optional -
+    // requires the server to also support it)
+    bool enable_aggregation;
+    // How long to hold a combined frame open for more packets (optional - defaults to 0 and is limited to a quarter of
+    // min_retry_interval_ms)
+    uint16_t aggregation_delay_ms;
+    // Whether or not to encode frames with COBS rather than HDLC byte stuffing once connected (optional - requires the
+    // server to also support it, as well as write_bytes and the default transmit buffer size)
+    bool enable_cobs;
+    // Whether or not to accept compressed write / notify requests, and to compress ones which are sent when the server
+    // also accepts them (optional - sending them also requires a compression buffer, see SONAR_COMPRESSION_BUFFER_SIZE())
+    bool enable_compression;
+    // The number of times a queued request can be overtaken by higher priority requests (see `sonar_attribute_def_t`)
+    // before it's sent ahead of any further ones (optional - 0 means higher priority requests always go first)
+    uint8_t max_priority_overtakes;
 } sonar_client_init_t;
 
 typedef struct {
@@ -45,6 +99,22 @@ typedef struct {
     uint8_t* receive_buffer;
     // The size of the receive buffer in bytes
     uint32_t receive_buffer_size;
+    // Transmit buffer used by SONAR to stage encoded packets for write_bytes() - see SONAR_TRANSMIT_BUFFER_SIZE()
+    uint8_t* transmit_buffer;
+    // The size of the transmit buffer in bytes
+    uint32_t transmit_buffer_size;
+    // Buffer used by SONAR to cache the last encoded request and response for retransmissions (two halves) - see SONAR_RETRANSMIT_CACHE_SIZE()
+    uint8_t* retransmit_cache;
+    // The size of each half of the retransmit cache buffer in bytes
+    uint32_t retransmit_cache_size;
+    // Buffer used by SONAR to compress a write / notify request into before it's sent - see SONAR_COMPRESSION_BUFFER_SIZE()
+    uint8_t* compression_buffer;
+    // The size of the compression buffer in bytes
+    uint32_t compression_buffer_size;
+    // Ring used by SONAR to queue encoded packets for start_tx() - see SONAR_TRANSMIT_RING_SIZE()
+    uint8_t* transmit_ring;
+    // The size of the transmit ring in bytes
+    uint32_t transmit_ring_size;
 } sonar_client_context_t;
 
 typedef sonar_client_context_t* sonar_client_handle_t;
@@ -53,20 +123,45 @@ typedef sonar_client_context_t* sonar_client_handle_t;
 void sonar_client_init(sonar_client_handle_t handle, const sonar_client_init_t* init);
 
 // The main process function for the SONAR client which gets passed data received since the last call
-// This should be called regularly even if there's no received data
+// This should be called regularly even if there's no received data, or by the time
+// returned by sonar_client_get_next_deadline_ms()
 void sonar_client_process(sonar_client_handle_t handle, const uint8_t* received_data, uint32_t received_data_length);
 
+// Alternative to sonar_client_process() which decodes all the data currently in a receive ring in place, with the
+// data being pushed into the ring from an interrupt handler (see sonar_rx_ring_push())
+void sonar_client_process_rx_ring(sonar_client_handle_t handle, sonar_rx_ring_handle_t ring);
+
+// Returns the system time (in ms) by which sonar_client_process() next needs to be called if no data is received
+// (UINT64_MAX if there's no deadline), so that the caller can sleep until then or until data is received
+// NOTE: The deadline may change after any call into SONAR, so this should be called right before sleeping
+uint64_t sonar_client_get_next_deadline_ms(sonar_client_handle_t handle);
+
+// Called once the data passed to start_tx() has been written, which starts writing any more queued data
+// NOTE: This must not be called concurrently with other SONAR APIs (i.e. from an interrupt handler)
+void sonar_client_tx_complete(sonar_client_handle_t handle);
+
 // Returns whether or not a client is connected to the SONAR client
 bool sonar_client_is_connected(sonar_client_handle_t handle);
 
 // Register a SONAR client attribute which was defined with `SONAR_CLIENT_ATTR_DEF()`
 void sonar_client_register(sonar_client_handle_t handle, sonar_attribute_t attr);
 
-// Sends a read request for the specified attribute
+// Queues a read request for the specified attribute
 bool sonar_client_read(sonar_client_handle_t handle, sonar_attribute_t attr);
 
-// Sends a write request for the specified attribute
+// Queues a write request for the specified attribute
 bool sonar_client_write(sonar_client_handle_t handle, sonar_attribute_t attr, const void* data, uint32_t length);
 
+// Queues a read request for the specified attribute, with the callback being called with the context once it completes
+// (instead of attribute_read_complete_handler())
+bool sonar_client_read_with_callback(sonar_client_handle_t handle, sonar_attribute_t attr, sonar_client_request_complete_callback_t callback, void* context);
+
+// Queues a write request for the specified attribute, with the callback being called with the context once it completes
+// (instead of attribute_write_complete_handler())
+bool sonar_client_write_with_callback(sonar_client_handle_t handle, sonar_attribute_t attr, const void* data, uint32_t length, sonar_client_request_complete_callback_t callback, void* context);
+
 // Gets the error counters and then clears them
 void sonar_client_get_and_clear_errors(sonar_client_handle_t handle, sonar_errors_t* errors);
+
+// Gets the current round-trip time estimates
+void sonar_client_get_rtt(sonar_client_handle_t handle, sonar_rtt_t* rtt);
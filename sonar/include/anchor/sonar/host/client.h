@@ -0,0 +1,100 @@
+#pragma once
+
+#include "anchor/sonar/client.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// A wrapper for running a SONAR client on a dedicated I/O thread on Linux hosts, which allows requests to be issued
+// from any thread without waiting on the I/O thread. Requests are passed to the I/O thread through a lock-free queue and complete
+// asynchronously via a callback (or synchronously via the *_sync() APIs).
+
+// The context size is made up of the init struct, the thread and its mutex, the request queue, and the request lists
+// and flags
+#define _SONAR_HOST_CLIENT_CONTEXT_SIZE ( \
+    sizeof(sonar_host_client_init_t) + \
+    sizeof(pthread_t) + \
+    sizeof(pthread_mutex_t) + \
+    sizeof(sonar_host_client_request_t) + \
+    sizeof(void*) * 6 + \
+    sizeof(uint32_t) * 2 + \
+    sizeof(bool) * 4)
+
+typedef struct sonar_host_client_request sonar_host_client_request_t;
+
+// Function prototype for request complete handlers (called from the I/O thread)
+typedef void (*sonar_host_client_complete_handler_t)(sonar_host_client_request_t* request, bool success);
+
+// A request which is queued with sonar_host_client_read() / sonar_host_client_write() and must remain valid until its
+// complete handler is called
+struct sonar_host_client_request {
+    // Allocated space for private context to be used by the SONAR implementation only
+    void* _private[2];
+    // The attribute to read / write
+    sonar_attribute_t attr;
+    // The data to write, or the buffer to read into
+    void* data;
+    // The length of the data to write, or the size of the buffer to read into (updated to the length which was read)
+    uint32_t length;
+    // Called from the I/O thread once the request completes (or fails)
+    sonar_host_client_complete_handler_t complete_handler;
+    // Opaque handle for use by the complete handler
+    void* handle;
+};
+
+typedef struct {
+    // The SONAR client to run (defined with SONAR_CLIENT_DEF() and not yet initialized)
+    sonar_client_handle_t client;
+    // The file descriptor for the link (i.e. a serial port or socket), which is put into non-blocking mode
+    int fd;
+    // The options to initialize the client with (the physical layer, time, callback and handler fields are ignored)
+    sonar_client_init_t client_init;
+    // Callback when the connection state changes (optional - called from the I/O thread)
+    void (*connection_changed_callback)(void* handle, bool connected);
+    // Callback when a notify request is received (optional - called from the I/O thread)
+    bool (*attribute_notify_handler)(void* handle, sonar_attribute_t attr, const void* data, uint32_t length);
+    // Opaque handle which is passed to the callbacks
+    void* handle;
+} sonar_host_client_init_t;
+
+typedef struct {
+    // Allocated space for private context to be used by the SONAR implementation only
+    void* _private[(_SONAR_HOST_CLIENT_CONTEXT_SIZE + sizeof(void*) - 1) / sizeof(void*)];
+} sonar_host_client_context_t;
+
+typedef sonar_host_client_context_t* sonar_host_client_handle_t;
+
+// Defines a SONAR host client object
+#define SONAR_HOST_CLIENT_DEF(NAME) \
+    static sonar_host_client_context_t _##NAME##_context; \
+    static sonar_host_client_handle_t NAME = &_##NAME##_context
+
+// Initialize the SONAR host client (attributes should then be registered before it's started)
+bool sonar_host_client_init(sonar_host_client_handle_t handle, const sonar_host_client_init_t* init);
+
+// Register a SONAR client attribute which was defined with `SONAR_ATTR_DEF()` (must be done before starting)
+void sonar_host_client_register(sonar_host_client_handle_t handle, sonar_attribute_t attr);
+
+// Starts the I/O thread
+bool sonar_host_client_start(sonar_host_client_handle_t handle);
+
+// Stops the I/O thread, failing any requests which haven't completed (from the calling thread)
+void sonar_host_client_stop(sonar_host_client_handle_t handle);
+
+// Returns whether or not the client is connected to the server (from any thread)
+bool sonar_host_client_is_connected(sonar_host_client_handle_t handle);
+
+// Queues a read request (from any thread), which fails if the client isn't connected by the time it's sent
+bool sonar_host_client_read(sonar_host_client_handle_t handle, sonar_host_client_request_t* request);
+
+// Queues a write request (from any thread), which fails if the client isn't connected by the time it's sent
+bool sonar_host_client_write(sonar_host_client_handle_t handle, sonar_host_client_request_t* request);
+
+// Reads an attribute and blocks until the request completes, with `length` being set to the length which was read
+// NOTE: This must not be called from the I/O thread (i.e. from a callback)
+bool sonar_host_client_read_sync(sonar_host_client_handle_t handle, sonar_attribute_t attr, void* data, uint32_t* length);
+
+// Writes an attribute and blocks until the request completes
+// NOTE: This must not be called from the I/O thread (i.e. from a callback)
+bool sonar_host_client_write_sync(sonar_host_client_handle_t handle, sonar_attribute_t attr, const void* data, uint32_t length);
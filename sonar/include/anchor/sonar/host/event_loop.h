@@ -0,0 +1,98 @@
+#pragma once
+
+#include "anchor/sonar/client.h"
+#include "anchor/sonar/server.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// An event loop for Linux hosts which drives many SONAR clients and servers from a single thread using epoll. Each
+// link is bound to a file descriptor (i.e. a serial port, pseudo-terminal or socket) which is read without blocking,
+// and has a timerfd which is armed with the next deadline of its SONAR instance, so each instance is only processed
+// when it has data or a deadline to handle.
+//
+// The clients / servers must be initialized with sonar_host_loop_write_bytes() and
+// sonar_host_loop_get_system_time_ms() as their write_bytes and get_system_time_ms functions. Since those (and the
+// client callbacks) don't take a handle, the loop tracks the link which it's currently processing, which can be
+// retrieved with sonar_host_loop_get_current_link(). Requests must then be issued through the sonar_host_link_*()
+// APIs so that the loop knows which link they're for.
+
+// The context sizes are made up of the link init struct, the epoll / timer fds, the armed deadline, and the flags
+#define _SONAR_HOST_LOOP_CONTEXT_SIZE (sizeof(uint32_t) * 2)
+#define _SONAR_HOST_LINK_CONTEXT_SIZE ( \
+    sizeof(sonar_host_link_init_t) + \
+    sizeof(void*) * 3 + \
+    sizeof(uint64_t) + \
+    sizeof(uint32_t) * 2)
+
+typedef struct {
+    // The file descriptor for the link, which is put into non-blocking mode
+    int fd;
+    // The SONAR client to drive (exactly one of client / server must be set)
+    sonar_client_handle_t client;
+    // The SONAR server to drive (exactly one of client / server must be set)
+    sonar_server_handle_t server;
+    // Opaque handle which can be retrieved with sonar_host_link_get_handle()
+    void* handle;
+} sonar_host_link_init_t;
+
+typedef struct {
+    // Allocated space for private context to be used by the SONAR implementation only
+    uint32_t _private[_SONAR_HOST_LOOP_CONTEXT_SIZE / sizeof(uint32_t)];
+} sonar_host_loop_context_t;
+typedef sonar_host_loop_context_t* sonar_host_loop_handle_t;
+
+typedef struct {
+    // Allocated space for private context to be used by the SONAR implementation only
+    uint64_t _private[(_SONAR_HOST_LINK_CONTEXT_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+} sonar_host_link_context_t;
+typedef sonar_host_link_context_t* sonar_host_link_handle_t;
+
+// Defines a SONAR host event loop object
+#define SONAR_HOST_LOOP_DEF(NAME) \
+    static sonar_host_loop_context_t _##NAME##_context; \
+    static sonar_host_loop_handle_t NAME = &_##NAME##_context
+
+// Defines a SONAR host link object
+#define SONAR_HOST_LINK_DEF(NAME) \
+    static sonar_host_link_context_t _##NAME##_context; \
+    static sonar_host_link_handle_t NAME = &_##NAME##_context
+
+// Initialize the event loop
+bool sonar_host_loop_init(sonar_host_loop_handle_t handle);
+
+// Closes the event loop (any links must have been removed first)
+void sonar_host_loop_deinit(sonar_host_loop_handle_t handle);
+
+// Adds a link for an initialized SONAR client / server to the event loop
+bool sonar_host_loop_add_link(sonar_host_loop_handle_t handle, sonar_host_link_handle_t link, const sonar_host_link_init_t* init);
+
+// Removes a link from the event loop (the link's file descriptor is left open)
+void sonar_host_loop_remove_link(sonar_host_loop_handle_t handle, sonar_host_link_handle_t link);
+
+// Waits for up to `timeout_ms` (or forever if negative) for links to have data or deadlines, and processes them
+bool sonar_host_loop_run(sonar_host_loop_handle_t handle, int timeout_ms);
+
+// Returns the link which the event loop is currently processing (or NULL)
+sonar_host_link_handle_t sonar_host_loop_get_current_link(void);
+
+// The write_bytes function for SONAR clients / servers driven by the event loop
+void sonar_host_loop_write_bytes(const uint8_t* data, uint32_t length);
+
+// The get_system_time_ms function for SONAR clients / servers driven by the event loop
+uint64_t sonar_host_loop_get_system_time_ms(void);
+
+// Returns the opaque handle of the link
+void* sonar_host_link_get_handle(sonar_host_link_handle_t link);
+
+// Returns whether or not the link's file descriptor is still open (i.e. the peer hasn't closed it)
+bool sonar_host_link_is_open(sonar_host_link_handle_t link);
+
+// Wrapper around sonar_client_read() for a client link
+bool sonar_host_link_client_read(sonar_host_link_handle_t link, sonar_attribute_t attr);
+
+// Wrapper around sonar_client_write() for a client link
+bool sonar_host_link_client_write(sonar_host_link_handle_t link, sonar_attribute_t attr, const void* data, uint32_t length);
+
+// Wrapper around sonar_server_notify() for a server link
+bool sonar_host_link_server_notify(sonar_host_link_handle_t link, sonar_server_attribute_t attr, const void* data, uint32_t length);
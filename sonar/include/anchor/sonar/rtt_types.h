@@ -0,0 +1,12 @@
+#pragma once
+
+#include <inttypes.h>
+
+typedef struct {
+    // The smoothed round-trip time in ms (0 if no round-trip time has been measured yet)
+    uint32_t srtt_ms;
+    // The round-trip time variation in ms
+    uint32_t rttvar_ms;
+    // The current request retry interval in ms (requests time out after 3 retry intervals)
+    uint32_t retry_interval_ms;
+} sonar_rtt_t;
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// The context size includes padding to pointer alignment on 64-bit systems
+#define _SONAR_RX_RING_CONTEXT_SIZE (sizeof(void*) * 2 + sizeof(uint32_t) * 2)
+
+// A single-producer / single-consumer ring which received data can be pushed into from an interrupt handler and then
+// passed to sonar_server_process_rx_ring() / sonar_client_process_rx_ring() without any locking
+// NOTE: The ring holds up to one byte less than the size of its buffer
+typedef struct {
+    // Allocated space for private context to be used by the SONAR implementation only (pointer-aligned for the atomic
+    // indexes)
+    uintptr_t _private[_SONAR_RX_RING_CONTEXT_SIZE / sizeof(uintptr_t)];
+} sonar_rx_ring_t;
+typedef sonar_rx_ring_t* sonar_rx_ring_handle_t;
+
+// Defines a SONAR receive ring with a buffer of SIZE bytes (which must then be initialized with SONAR_RX_RING_INIT())
+#define SONAR_RX_RING_DEF(NAME, SIZE) \
+    static uint8_t _##NAME##_buffer[SIZE]; \
+    static sonar_rx_ring_t _##NAME##_ring; \
+    static sonar_rx_ring_handle_t NAME = &_##NAME##_ring
+
+// Initializes a SONAR receive ring which was defined with SONAR_RX_RING_DEF()
+#define SONAR_RX_RING_INIT(NAME) sonar_rx_ring_init(NAME, _##NAME##_buffer, sizeof(_##NAME##_buffer))
+
+// Initializes a receive ring (must be done before the producer or consumer starts using it)
+void sonar_rx_ring_init(sonar_rx_ring_handle_t handle, uint8_t* buffer, uint32_t size);
+
+// Pushes received data into the ring, returning the number of bytes which fit (producer only - e.g. from a UART RX ISR)
+uint32_t sonar_rx_ring_push(sonar_rx_ring_handle_t handle, const uint8_t* data, uint32_t length);
+
+// Pushes a single received byte into the ring, returning false if it's full (producer only)
+bool sonar_rx_ring_push_byte(sonar_rx_ring_handle_t handle, uint8_t byte);
+
+// Gets the next contiguous span of data in the ring, returning its length (consumer only)
+uint32_t sonar_rx_ring_peek(sonar_rx_ring_handle_t handle, const uint8_t** data);
+
+// Releases the first `length` bytes of data in the ring after they've been handled (consumer only)
+void sonar_rx_ring_consume(sonar_rx_ring_handle_t handle, uint32_t length);
@@ -1,26 +1,43 @@
 #pragma once
 
 #include "anchor/sonar/error_types.h"
+#include "anchor/sonar/rtt_types.h"
 #include "anchor/sonar/attribute.h"
+#include "anchor/sonar/rx_ring.h"
+#include "anchor/sonar/sonar_config.h"
 
 #include <inttypes.h>
 #include <stdbool.h>
 
 // The context size depends on whether we're compiling for a 64-bit or 32-bit system due to struct padding
 // TODO: haven't figured out the correct 32-bit value yet
-#define _SONAR_SERVER_CONTEXT_SIZE_32   352
-#define _SONAR_SERVER_CONTEXT_SIZE_64   576
+#define _SONAR_SERVER_CONTEXT_SIZE_32   696
+#define _SONAR_SERVER_CONTEXT_SIZE_64   1080
 #define _SONAR_SERVER_CONTEXT_SIZE ( \
     sizeof(sonar_server_init_t) + \
-    ((sizeof(uintptr_t) == 8) ? _SONAR_SERVER_CONTEXT_SIZE_64 : _SONAR_SERVER_CONTEXT_SIZE_32))
+    ((sizeof(uintptr_t) == 8) ? _SONAR_SERVER_CONTEXT_SIZE_64 : _SONAR_SERVER_CONTEXT_SIZE_32) + \
+    (SONAR_MAX_WINDOW_SIZE - 1) * sizeof(uint64_t) * 3 + \
+    SONAR_REQUEST_QUEUE_SIZE * sizeof(void*) * 11)
 
 // Defines a SONAR server object which can support attributes of up to MAX_ATTR_SIZE
 #define SONAR_SERVER_DEF(NAME, MAX_ATTR_SIZE) \
     static uint8_t _##NAME##_receive_buffer[MAX_ATTR_SIZE + 6 /* protocol overhead */]; \
+    static uint8_t _##NAME##_transmit_buffer[SONAR_TRANSMIT_BUFFER_SIZE(MAX_ATTR_SIZE) ? SONAR_TRANSMIT_BUFFER_SIZE(MAX_ATTR_SIZE) : 1]; \
+    static uint8_t _##NAME##_retransmit_cache[SONAR_RETRANSMIT_CACHE_SIZE(MAX_ATTR_SIZE) ? 2 * SONAR_RETRANSMIT_CACHE_SIZE(MAX_ATTR_SIZE) : 1]; \
+    static uint8_t _##NAME##_compression_buffer[SONAR_COMPRESSION_BUFFER_SIZE(MAX_ATTR_SIZE) ? SONAR_COMPRESSION_BUFFER_SIZE(MAX_ATTR_SIZE) : 1]; \
+    static uint8_t _##NAME##_transmit_ring[SONAR_TRANSMIT_RING_SIZE(MAX_ATTR_SIZE) ? SONAR_TRANSMIT_RING_SIZE(MAX_ATTR_SIZE) : 1]; \
     static struct sonar_server_context _##NAME##_context = { \
         ._private = {0}, \
         .receive_buffer = _##NAME##_receive_buffer, \
         .receive_buffer_size = sizeof(_##NAME##_receive_buffer), \
+        .transmit_buffer = _##NAME##_transmit_buffer, \
+        .transmit_buffer_size = SONAR_TRANSMIT_BUFFER_SIZE(MAX_ATTR_SIZE), \
+        .retransmit_cache = _##NAME##_retransmit_cache, \
+        .retransmit_cache_size = SONAR_RETRANSMIT_CACHE_SIZE(MAX_ATTR_SIZE), \
+        .compression_buffer = _##NAME##_compression_buffer, \
+        .compression_buffer_size = SONAR_COMPRESSION_BUFFER_SIZE(MAX_ATTR_SIZE), \
+        .transmit_ring = _##NAME##_transmit_ring, \
+        .transmit_ring_size = SONAR_TRANSMIT_RING_SIZE(MAX_ATTR_SIZE), \
     }; \
     static sonar_server_handle_t NAME = &_##NAME##_context;
 
@@ -29,7 +46,25 @@
     _SONAR_SERVER_ATTR_HANDLERS_##OPS(ATTR_NAME) \
     SONAR_SERVER_ATTR_DEF_NO_PROTOTYPES(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS)
 #define SONAR_SERVER_ATTR_DEF_NO_PROTOTYPES(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS) \
-    SONAR_ATTR_DEF(_##VAR_NAME##_attr, ID, MAX_SIZE, OPS); \
+    _SONAR_SERVER_ATTR_DEF_IMPL(SONAR_ATTR_DEF, ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS)
+
+// Defines a SONAR server attribute object which sends notifies as a delta (see SONAR_ATTR_DEF_DELTA())
+#define SONAR_SERVER_ATTR_DEF_DELTA(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS) \
+    _SONAR_SERVER_ATTR_HANDLERS_##OPS(ATTR_NAME) \
+    SONAR_SERVER_ATTR_DEF_DELTA_NO_PROTOTYPES(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS)
+#define SONAR_SERVER_ATTR_DEF_DELTA_NO_PROTOTYPES(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS) \
+    _SONAR_SERVER_ATTR_DEF_IMPL(SONAR_ATTR_DEF_DELTA, ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS)
+
+// Defines a SONAR server attribute object whose notifies are coalesced (see SONAR_ATTR_DEF_COALESCED())
+#define SONAR_SERVER_ATTR_DEF_COALESCED(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS) \
+    _SONAR_SERVER_ATTR_HANDLERS_##OPS(ATTR_NAME) \
+    SONAR_SERVER_ATTR_DEF_COALESCED_NO_PROTOTYPES(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS)
+#define SONAR_SERVER_ATTR_DEF_COALESCED_NO_PROTOTYPES(ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS) \
+    _SONAR_SERVER_ATTR_DEF_IMPL(SONAR_ATTR_DEF_COALESCED, ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS)
+
+// Helper macros for SONAR_SERVER_ATTR_DEF()
+#define _SONAR_SERVER_ATTR_DEF_IMPL(ATTR_DEF_MACRO, ATTR_NAME, VAR_NAME, ID, MAX_SIZE, OPS) \
+    ATTR_DEF_MACRO(_##VAR_NAME##_attr, ID, MAX_SIZE, OPS); \
     static struct sonar_server_attribute _##VAR_NAME##_server_attr = { \
         ._private = {0}, \
         .attr = _##VAR_NAME##_attr, \
@@ -37,8 +72,6 @@
         .write_handler = ATTR_NAME##_write_handler, \
     }; \
     static sonar_server_attribute_t VAR_NAME = &_##VAR_NAME##_server_attr
-
-// Helper macros for SONAR_SERVER_ATTR_DEF()
 #define _SONAR_SERVER_ATTR_HANDLERS_R(NAME) \
     static uint32_t NAME##_read_handler(void* response_data, uint32_t response_max_size); \
     static const void* const NAME##_write_handler = NULL;
@@ -61,15 +94,52 @@ typedef struct sonar_server_context* sonar_server_handle_t;
 struct sonar_server_attribute;
 typedef struct sonar_server_attribute* sonar_server_attribute_t;
 
+// Function prototype for per-request notify completion callbacks
+typedef void (*sonar_server_notify_complete_callback_t)(void* context, bool success);
+
 typedef struct {
     // A function which writes a single byte over the physical layer
     void (*write_byte)(uint8_t byte);
+    // A function which writes multiple bytes over the physical layer (optional - takes precedence over write_byte)
+    void (*write_bytes)(const uint8_t* data, uint32_t length);
+    // A function which starts writing a buffer of data over the physical layer (e.g. via DMA), after which
+    // sonar_server_tx_complete() must be called (optional - takes precedence over write_byte / write_bytes and requires a
+    // transmit ring, see SONAR_TRANSMIT_RING_SIZE())
+    void (*start_tx)(const uint8_t* data, uint32_t length);
     // A function which gets the current system time in ms
     uint64_t (*get_system_time_ms)(void);
     // Callback when the connection state changes
     void (*connection_changed_callback)(sonar_server_handle_t handle, bool connected);
     // Attribute notify complete handler
     void (*attribute_notify_complete_handler)(sonar_server_handle_t handle, bool success);
+    // The maximum number of requests which may be outstanding at once (optional - defaults to 1, limited to SONAR_MAX_WINDOW_SIZE)
+    uint8_t window_size;
+    // Whether or not to send a response and the next request in a single packet where possible (optional - requires
+    // the client to also support it)
+    bool enable_piggyback;
+    // Whether or not to accept fragmented requests, and to split ones which don't fit in the client's receive buffer
+    // into fragments (optional - requires the client to also support it)
+    bool enable_fragmentation;
+    // The bounds on the request retry interval, which is otherwise derived from the measured round-trip time
+    // (optional - they default to 20ms and 125ms, and a larger max extends the connection timeout, so should also be
+    // set on the client)
+    uint16_t min_retry_interval_ms;
+    uint16_t max_retry_interval_ms;
+    // Whether or not to combine the packets which are sent within each call to process into a single frame (optional -
+    // requires the client to also support it)
+    bool enable_aggregation;
+    // How long to hold a combined frame open for more packets (optional - defaults to 0 and is limited to a quarter of
+    // min_retry_interval_ms)
+    uint16_t aggregation_delay_ms;
+    // Whether or not to encode frames with COBS rather than HDLC byte stuffing once connected (optional - requires the
+    // client to also support it, as well as write_bytes and the default transmit buffer size)
+    bool enable_cobs;
+    // Whether or not to accept compressed write / notify requests, and to compress ones which are sent when the client
+    // also accepts them (optional - sending them also requires a compression buffer, see SONAR_COMPRESSION_BUFFER_SIZE())
+    bool enable_compression;
+    // The number of times a queued request can be overtaken by higher priority requests (see `sonar_attribute_def_t`)
+    // before it's sent ahead of any further ones (optional - 0 means higher priority requests always go first)
+    uint8_t max_priority_overtakes;
 } sonar_server_init_t;
 
 // Function prototype for attribute read handlers
@@ -97,27 +167,80 @@ struct sonar_server_context {
     uint8_t* receive_buffer;
     // The size of the receive buffer in bytes
     uint32_t receive_buffer_size;
+    // Transmit buffer used by SONAR to stage encoded packets for write_bytes() - see SONAR_TRANSMIT_BUFFER_SIZE()
+    uint8_t* transmit_buffer;
+    // The size of the transmit buffer in bytes
+    uint32_t transmit_buffer_size;
+    // Buffer used by SONAR to cache the last encoded request and response for retransmissions (two halves) - see SONAR_RETRANSMIT_CACHE_SIZE()
+    uint8_t* retransmit_cache;
+    // The size of each half of the retransmit cache buffer in bytes
+    uint32_t retransmit_cache_size;
+    // Buffer used by SONAR to compress a write / notify request into before it's sent - see SONAR_COMPRESSION_BUFFER_SIZE()
+    uint8_t* compression_buffer;
+    // The size of the compression buffer in bytes
+    uint32_t compression_buffer_size;
+    // Ring used by SONAR to queue encoded packets for start_tx() - see SONAR_TRANSMIT_RING_SIZE()
+    uint8_t* transmit_ring;
+    // The size of the transmit ring in bytes
+    uint32_t transmit_ring_size;
 };
 
 // Initialize the SONAR server
 void sonar_server_init(sonar_server_handle_t handle, const sonar_server_init_t* init);
 
+// Initialize a SONAR server as an additional link of the `primary` server, so that one attribute table can be served
+// over several physical links (i.e. UART and USB) at once. The link has its own connection and transport state, but
+// shares the attributes (which must be registered with the primary) and their buffers, and notifies sent via either
+// handle are sent to all connected links with the primary's notify complete handler called once they all complete.
+// Since the response buffers are shared, a link without a retransmit cache reads an attribute again when a read is
+// retried after another link overwrote its buffer, so the retried response may contain a newer value.
+void sonar_server_init_link(sonar_server_handle_t handle, sonar_server_handle_t primary, const sonar_server_init_t* init);
+
 // The main process function for the SONAR server which gets passed data received since the last call
-// This should be called regularly even if there's no received data
+// This should be called regularly even if there's no received data, or by the time
+// returned by sonar_server_get_next_deadline_ms()
 void sonar_server_process(sonar_server_handle_t handle, const uint8_t* received_data, uint32_t received_data_length);
 
+// Alternative to sonar_server_process() which decodes all the data currently in a receive ring in place, with the
+// data being pushed into the ring from an interrupt handler (see sonar_rx_ring_push())
+void sonar_server_process_rx_ring(sonar_server_handle_t handle, sonar_rx_ring_handle_t ring);
+
+// Returns the system time (in ms) by which sonar_server_process() next needs to be called if no data is received
+// (UINT64_MAX if there's no deadline), so that the caller can sleep until then or until data is received
+// NOTE: The deadline may change after any call into SONAR, so this should be called right before sleeping
+uint64_t sonar_server_get_next_deadline_ms(sonar_server_handle_t handle);
+
+// Called once the data passed to start_tx() has been written, which starts writing any more queued data
+// NOTE: This must not be called concurrently with other SONAR APIs (i.e. from an interrupt handler)
+void sonar_server_tx_complete(sonar_server_handle_t handle);
+
 // Returns whether or not a client is connected to the SONAR server
 bool sonar_server_is_connected(sonar_server_handle_t handle);
 
 // Function to register a SONAR server attribute which was defined with `SONAR_SERVER_ATTR_DEF()`
 void sonar_server_register(sonar_server_handle_t handle, sonar_server_attribute_t attr);
 
-// Sends a notify request for the specified attribute
-// NOTE: the data passed to this function must remain valid until attribute_notify_complete_handler() is called
+// Queues a notify request for the specified attribute (the data is copied)
+// NOTE: this fails if a notify is already pending for the attribute, unless it's coalesced, in which case the latest
+// value is sent once the pending one completes and attribute_notify_complete_handler() is only called after that
 bool sonar_server_notify(sonar_server_handle_t handle, sonar_server_attribute_t attr, const void* data, uint32_t length);
 
-// Sends a notify request for the specified attribute based on the data returned by the attribute_read_handler()
+// Queues a notify request for the specified attribute (the data is copied), with the callback being called with the
+// context once it completes (instead of attribute_notify_complete_handler())
+// NOTE: this isn't supported for coalesced attributes, since their notifies may be superseded by later ones
+bool sonar_server_notify_with_callback(sonar_server_handle_t handle, sonar_server_attribute_t attr, const void* data, uint32_t length, sonar_server_notify_complete_callback_t callback, void* context);
+
+// Queues a notify request for the specified attribute based on the data returned by the attribute_read_handler()
 bool sonar_server_notify_read_data(sonar_server_handle_t handle, sonar_server_attribute_t attr);
 
+// Schedules a notify request for the specified attribute, which is sent with the data returned by the
+// attribute_read_handler() once the link is free (with the highest priority scheduled attribute going first, and
+// round-robin between attributes of the same priority)
+// NOTE: attribute_notify_complete_handler() isn't called for scheduled notifies
+bool sonar_server_notify_schedule(sonar_server_handle_t handle, sonar_server_attribute_t attr);
+
 // Gets the error counters and then clears them
 void sonar_server_get_and_clear_errors(sonar_server_handle_t handle, sonar_errors_t* errors);
+
+// Gets the current round-trip time estimates
+void sonar_server_get_rtt(sonar_server_handle_t handle, sonar_rtt_t* rtt);
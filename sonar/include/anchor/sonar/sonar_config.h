@@ -0,0 +1,46 @@
+#pragma once
+
+// See the README for documentation on these options.
+
+// The size of the largest possible encoded frame (i.e. fully-escaped) for a given MAX_ATTR_SIZE
+#define SONAR_MAX_FRAME_SIZE(MAX_ATTR_SIZE) (((MAX_ATTR_SIZE) + 6 /* protocol overhead */) * 2 /* escaping */ + 2 /* flags */)
+
+#ifndef SONAR_TRANSMIT_BUFFER_SIZE
+#define SONAR_TRANSMIT_BUFFER_SIZE(MAX_ATTR_SIZE) 0
+#endif
+
+#define SONAR_CRC16_BACKEND_BITWISE       0
+#define SONAR_CRC16_BACKEND_TABLE         1
+#define SONAR_CRC16_BACKEND_SLICING_BY_4  2
+#define SONAR_CRC16_BACKEND_SLICING_BY_8  3
+#define SONAR_CRC16_BACKEND_CLMUL         4
+
+#ifndef SONAR_CRC16_BACKEND
+#define SONAR_CRC16_BACKEND SONAR_CRC16_BACKEND_BITWISE
+#endif
+
+#ifndef SONAR_RETRANSMIT_CACHE_SIZE
+#define SONAR_RETRANSMIT_CACHE_SIZE(MAX_ATTR_SIZE) 0
+#endif
+
+#ifndef SONAR_COMPRESSION_BUFFER_SIZE
+#define SONAR_COMPRESSION_BUFFER_SIZE(MAX_ATTR_SIZE) 0
+#endif
+
+#ifndef SONAR_TRANSMIT_RING_SIZE
+#define SONAR_TRANSMIT_RING_SIZE(MAX_ATTR_SIZE) 0
+#endif
+
+#ifndef SONAR_MAX_WINDOW_SIZE
+#define SONAR_MAX_WINDOW_SIZE 1
+#endif
+#if SONAR_MAX_WINDOW_SIZE < 1 || SONAR_MAX_WINDOW_SIZE > 127
+#error "SONAR_MAX_WINDOW_SIZE must be between 1 and 127"
+#endif
+
+#ifndef SONAR_REQUEST_QUEUE_SIZE
+#define SONAR_REQUEST_QUEUE_SIZE 4
+#endif
+#if SONAR_REQUEST_QUEUE_SIZE < 1 || SONAR_REQUEST_QUEUE_SIZE > 255
+#error "SONAR_REQUEST_QUEUE_SIZE must be between 1 and 255"
+#endif
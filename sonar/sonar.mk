@@ -5,9 +5,18 @@ SONAR_C_SOURCES := \
 	$(SONAR_BASE_DIR)/src/server.c \
 	$(SONAR_BASE_DIR)/src/common/buffer_chain.c \
 	$(SONAR_BASE_DIR)/src/common/crc16.c \
+	$(SONAR_BASE_DIR)/src/common/lz4.c \
+	$(SONAR_BASE_DIR)/src/common/rx_ring.c \
+	$(SONAR_BASE_DIR)/src/link_layer/encoding.c \
 	$(SONAR_BASE_DIR)/src/link_layer/link_layer.c \
 	$(SONAR_BASE_DIR)/src/link_layer/receive.c \
 	$(SONAR_BASE_DIR)/src/link_layer/transmit.c \
 	$(SONAR_BASE_DIR)/src/application_layer/application_layer.c \
 	$(SONAR_BASE_DIR)/src/attribute/attribute_server.c \
-	$(SONAR_BASE_DIR)/src/attribute/attribute_client.c
+	$(SONAR_BASE_DIR)/src/attribute/attribute_client.c \
+	$(SONAR_BASE_DIR)/src/attribute/delta.c
+
+# Optional modules for Linux hosts (require pthreads)
+SONAR_HOST_C_SOURCES := \
+	$(SONAR_BASE_DIR)/src/host/event_loop.c \
+	$(SONAR_BASE_DIR)/src/host/host_client.c
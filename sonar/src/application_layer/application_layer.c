@@ -1,31 +1,561 @@
 #include "application_layer.h"
 
 #include "types.h"
+#include "../common/lz4.h"
 
 #define LOGGING_MODULE_NAME "SONAR"
 #include "anchor/logging/logging.h"
 
 #include <string.h>
 
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+
+typedef struct {
+    sonar_application_layer_header_t header;
+    uint8_t priority;
+    union {
+        // The number of higher priority requests which have been queued ahead of this one (before it's sent)
+        uint8_t num_overtakes;
+        // Whether or not the request succeeded, if its response is being held (see read_retry_t)
+        bool held_success;
+    };
+    buffer_chain_entry_t header_buffer_chain;
+    buffer_chain_entry_t data_buffer_chain;
+    sonar_application_layer_request_complete_callback_t callback;
+    void* context;
+    // Buffer which the response is reassembled into if it's fragmented, or held in (read requests only)
+    uint8_t* read_buffer;
+    union {
+        uint32_t read_buffer_size;
+        // The length of the response data which is held in the read buffer
+        uint32_t held_length;
+    };
+} request_entry_t;
+
+typedef struct {
+    // The queued requests are stored in the order they're sent (oldest first unless overtaken by a higher priority
+    // request) starting at `head` within `entries`, with the first `num_sent` of them having been sent
+    uint8_t head;
+    uint8_t num_queued;
+    uint8_t num_sent;
+    request_entry_t entries[SONAR_REQUEST_QUEUE_SIZE];
+} request_queue_t;
+
 typedef struct {
+    // Whether or not the oldest queued request is being sent as a sequence of fragments (nothing else is sent until
+    // it completes, other than a higher priority request between fragments)
     bool is_active;
-    bool pending_read_response;
+    // Whether or not the current fragment still needs to be passed to the lower layer
+    bool is_send_pending;
+    // Whether or not a higher priority request was sent ahead of the current fragment (only one is sent between each
+    // pair of fragments so that the fragmented request still makes progress)
+    bool has_interleaved;
+    // Whether or not the request which was sent ahead of the current fragment (the second queued one) is still waiting
+    // for its response
+    bool is_interleaved_pending;
+    // The offset and length of the data within the current fragment (the length is unused for reads)
+    uint32_t offset;
+    uint32_t length;
     sonar_application_layer_header_t header;
+    sonar_application_layer_fragment_header_t fragment_header;
     buffer_chain_entry_t header_buffer_chain;
+    buffer_chain_entry_t fragment_header_buffer_chain;
     buffer_chain_entry_t data_buffer_chain;
-} pending_request_info_t;
+} outgoing_fragment_t;
+
+typedef struct {
+    // The attribute ID (including the op) of the fragmented request being received, or 0 if there isn't one
+    uint16_t attribute_id;
+    // The total length of the data and how much of it has been received (write / notify) or sent (read)
+    uint32_t length;
+    uint32_t offset;
+    union {
+        // The buffer which a fragmented write / notify request is reassembled into
+        uint8_t* reassembly_buffer;
+        // The data which is returned by a fragmented read request
+        const uint8_t* read_data;
+    };
+} incoming_fragment_t;
+
+typedef struct {
+    // Whether or not the oldest queued request is a read whose response was lost (the lower layer acknowledged it
+    // along with a later request), and which is being sent again
+    bool is_active;
+    // Whether or not the read has been passed to the lower layer again
+    bool is_sent;
+    // The number of requests after the read whose responses have been received, and which are held so that they're
+    // completed after the read
+    uint8_t num_held;
+} read_retry_t;
+
+typedef struct {
+    // The attribute ID of the last request received if it was a read (0 otherwise), whose response may be sent again
+    uint16_t attribute_id;
+    // Whether or not the read was fragmented
+    bool is_fragmented;
+} last_read_t;
 
 typedef struct {
     sonar_application_layer_init_t init;
-    pending_request_info_t request;
+    bool is_connected;
+    bool pending_read_response;
+    bool is_fragmented_read_response;
+    // Whether or not the compression buffer holds the data of a queued request
+    bool is_compression_buffer_in_use;
+    request_queue_t request_queue;
+    outgoing_fragment_t outgoing_fragment;
+    incoming_fragment_t incoming_fragment;
+    read_retry_t read_retry;
+    last_read_t last_read;
 } instance_impl_t;
 _Static_assert(sizeof(sonar_application_layer_context_t) == sizeof(instance_impl_t), "Invalid context size");
 
-static bool issue_request(instance_impl_t* inst, uint16_t attribute_id, uint16_t op, const uint8_t* data, uint32_t length) {
-    if (inst->request.is_active) {
-        LOG_ERROR("Application layer request already pending");
+static request_entry_t* get_request_entry(instance_impl_t* inst, uint8_t index) {
+    // an index of 0 is the first queued request to be sent
+    return &inst->request_queue.entries[(inst->request_queue.head + index) % SONAR_REQUEST_QUEUE_SIZE];
+}
+
+static void move_request_entry(request_entry_t* dst, const request_entry_t* src) {
+    // the buffer chain entries point within their own entry, so only the data they represent is copied
+    dst->header = src->header;
+    dst->priority = src->priority;
+    dst->num_overtakes = src->num_overtakes;
+    buffer_chain_set_data(&dst->data_buffer_chain, src->data_buffer_chain.data, src->data_buffer_chain.length);
+    dst->callback = src->callback;
+    dst->context = src->context;
+    dst->read_buffer = src->read_buffer;
+    dst->read_buffer_size = src->read_buffer_size;
+}
+
+static bool can_complete_out_of_order(const request_entry_t* entry, sonar_application_layer_request_complete_callback_t callback) {
+    // requests without a per-request callback are completed through the init handlers, which can't tell them apart, so
+    // they always complete in the order they were issued relative to each other
+    return entry->callback || callback;
+}
+
+static bool can_overtake(const instance_impl_t* inst, const request_entry_t* entry, uint8_t priority, sonar_application_layer_request_complete_callback_t callback) {
+    return entry->priority < priority && can_complete_out_of_order(entry, callback) &&
+        (!inst->init.max_priority_overtakes || entry->num_overtakes < inst->init.max_priority_overtakes);
+}
+
+static request_entry_t* insert_request_entry(instance_impl_t* inst, uint16_t attribute_id, sonar_application_layer_request_complete_callback_t callback) {
+    // new requests go ahead of any unsent ones with a lower priority (which haven't already been overtaken too often)
+    const uint8_t priority = inst->init.attribute_priority_handler ?
+        inst->init.attribute_priority_handler(inst->init.attr_handler_handle, attribute_id) : 0;
+    uint8_t index = inst->request_queue.num_queued;
+    while (index > inst->request_queue.num_sent && can_overtake(inst, get_request_entry(inst, index - 1), priority, callback)) {
+        index--;
+    }
+    for (uint8_t i = inst->request_queue.num_queued; i > index; i--) {
+        request_entry_t* entry = get_request_entry(inst, i);
+        move_request_entry(entry, get_request_entry(inst, i - 1));
+        entry->num_overtakes++;
+    }
+    request_entry_t* entry = get_request_entry(inst, index);
+    entry->priority = priority;
+    entry->num_overtakes = 0;
+    return entry;
+}
+
+static uint32_t get_max_packet_size(const instance_impl_t* inst) {
+    // the largest packet the peer can receive (0 if fragmentation is disabled)
+    return inst->init.get_max_packet_size_function ? inst->init.get_max_packet_size_function(inst->init.send_data_handle) : 0;
+}
+
+static uint32_t get_fragment_size(const instance_impl_t* inst) {
+    // the maximum amount of data per fragment (0 if fragmentation is disabled)
+    const uint32_t overhead = sizeof(sonar_application_layer_header_t) + sizeof(sonar_application_layer_fragment_header_t);
+    const uint32_t max_packet_size = get_max_packet_size(inst);
+    return max_packet_size > overhead ? max_packet_size - overhead : 0;
+}
+
+static bool is_fragmented_request(const instance_impl_t* inst, const request_entry_t* entry) {
+    const uint32_t fragment_size = get_fragment_size(inst);
+    if (!fragment_size) {
+        return false;
+    } else if ((entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) == SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ) {
+        return entry->read_buffer && entry->read_buffer_size > fragment_size;
+    } else {
+        return entry->data_buffer_chain.length > fragment_size;
+    }
+}
+
+static void compress_request(instance_impl_t* inst, request_entry_t* entry) {
+    // compresses the data of a write / notify request into the compression buffer if it's free and the peer accepts it
+    const uint32_t length = entry->data_buffer_chain.length;
+    if ((entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) == SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ ||
+        (entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_COMPRESSED_FLAG) || !length ||
+        !inst->init.compression_buffer || inst->is_compression_buffer_in_use || !inst->init.can_compress_data_function ||
+        !inst->init.can_compress_data_function(inst->init.send_data_handle)) {
+        return;
+    }
+    // the compressed data is only used if it's smaller, and (if fragmentation is enabled) fits in a single packet since
+    // fragments can't be decompressed on their own
+    const sonar_application_layer_compression_header_t header = {
+        .length = length,
+    };
+    uint32_t max_length = MIN(inst->init.compression_buffer_size, length - 1);
+    if (get_fragment_size(inst)) {
+        max_length = MIN(max_length, get_max_packet_size(inst) - sizeof(sonar_application_layer_header_t));
+    }
+    if (max_length <= sizeof(header)) {
+        return;
+    }
+    const uint32_t compressed_length = lz4_compress(entry->data_buffer_chain.data, length, &inst->init.compression_buffer[sizeof(header)], max_length - sizeof(header));
+    if (!compressed_length) {
+        return;
+    }
+    memcpy(inst->init.compression_buffer, &header, sizeof(header));
+    entry->header.attribute_id |= SONAR_APPLICATION_ATTRIBUTE_ID_COMPRESSED_FLAG;
+    buffer_chain_set_data(&entry->data_buffer_chain, inst->init.compression_buffer, sizeof(header) + compressed_length);
+    inst->is_compression_buffer_in_use = true;
+}
+
+static void prepare_fragment(instance_impl_t* inst) {
+    // prepare the next fragment of the oldest queued request to be sent
+    const request_entry_t* entry = get_request_entry(inst, 0);
+    outgoing_fragment_t* fragment = &inst->outgoing_fragment;
+    const uint32_t fragment_size = get_fragment_size(inst);
+    fragment->header.attribute_id = entry->header.attribute_id | SONAR_APPLICATION_ATTRIBUTE_ID_FRAGMENT_FLAG;
+    if ((entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) == SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ) {
+        fragment->length = 0;
+        fragment->fragment_header = (sonar_application_layer_fragment_header_t) {
+            .offset = fragment->offset,
+            .length = fragment_size,
+        };
+    } else {
+        fragment->length = MIN(entry->data_buffer_chain.length - fragment->offset, fragment_size);
+        fragment->fragment_header = (sonar_application_layer_fragment_header_t) {
+            .offset = fragment->offset,
+            .length = entry->data_buffer_chain.length,
+        };
+    }
+    buffer_chain_set_data(&fragment->data_buffer_chain, fragment->length ? &entry->data_buffer_chain.data[fragment->offset] : NULL, fragment->length);
+    fragment->is_send_pending = true;
+}
+
+static bool can_send_data(instance_impl_t* inst) {
+    return !inst->init.can_send_data_function || inst->init.can_send_data_function(inst->init.send_data_handle);
+}
+
+static bool can_interleave_request(instance_impl_t* inst) {
+    // whether or not the request behind the fragmented one can be sent ahead of its next fragment, which is only done
+    // for a higher priority request which fits in a single packet and is for a different attribute (since the peer
+    // may be using the attribute's buffer for the fragments)
+    if (inst->outgoing_fragment.has_interleaved || inst->request_queue.num_queued < 2) {
+        return false;
+    }
+    const request_entry_t* fragmented_entry = get_request_entry(inst, 0);
+    request_entry_t* entry = get_request_entry(inst, 1);
+    if (entry->priority <= fragmented_entry->priority || !can_complete_out_of_order(fragmented_entry, entry->callback) ||
+        ((entry->header.attribute_id ^ fragmented_entry->header.attribute_id) & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK) == 0) {
+        return false;
+    }
+    compress_request(inst, entry);
+    return !is_fragmented_request(inst, entry);
+}
+
+static void send_queued_requests(instance_impl_t* inst) {
+    if (inst->is_connected && inst->read_retry.is_active && !inst->read_retry.is_sent) {
+        // the read is sent again once all the requests which were sent after it have completed, so that responses
+        // still arrive in the order the requests were sent
+        if (inst->read_retry.num_held + 1 < inst->request_queue.num_sent || !can_send_data(inst) ||
+            !inst->init.send_data_function(inst->init.send_data_handle, &get_request_entry(inst, 0)->header_buffer_chain)) {
+            return;
+        }
+        inst->read_retry.is_sent = true;
+    }
+    while (inst->is_connected) {
+        if (inst->outgoing_fragment.is_active) {
+            outgoing_fragment_t* fragment = &inst->outgoing_fragment;
+            if (!fragment->is_send_pending || fragment->is_interleaved_pending || !can_send_data(inst)) {
+                return;
+            } else if (can_interleave_request(inst)) {
+                if (inst->init.send_data_function(inst->init.send_data_handle, &get_request_entry(inst, 1)->header_buffer_chain)) {
+                    fragment->has_interleaved = true;
+                    fragment->is_interleaved_pending = true;
+                    inst->request_queue.num_sent++;
+                }
+            } else if (inst->init.send_data_function(inst->init.send_data_handle, &fragment->header_buffer_chain)) {
+                fragment->is_send_pending = false;
+                fragment->has_interleaved = false;
+            }
+            return;
+        } else if (inst->request_queue.num_sent == inst->request_queue.num_queued) {
+            return;
+        }
+        request_entry_t* entry = get_request_entry(inst, inst->request_queue.num_sent);
+        compress_request(inst, entry);
+        if (is_fragmented_request(inst, entry)) {
+            if (inst->request_queue.num_sent) {
+                // wait for the earlier requests to complete before sending the fragments
+                return;
+            }
+            inst->outgoing_fragment.is_active = true;
+            inst->outgoing_fragment.has_interleaved = false;
+            inst->outgoing_fragment.is_interleaved_pending = false;
+            inst->outgoing_fragment.offset = 0;
+            prepare_fragment(inst);
+            inst->request_queue.num_sent++;
+            continue;
+        }
+        if (!can_send_data(inst)) {
+            // try again once the lower layer can accept another request
+            return;
+        }
+        if (!inst->init.send_data_function(inst->init.send_data_handle, &entry->header_buffer_chain)) {
+            return;
+        }
+        inst->request_queue.num_sent++;
+    }
+}
+
+static bool handle_fragment_response(instance_impl_t* inst, bool* success, const uint8_t** data, uint32_t* length) {
+    // handles the response to a fragment of the oldest queued request, returning true if there are more fragments to send
+    const request_entry_t* entry = get_request_entry(inst, 0);
+    outgoing_fragment_t* fragment = &inst->outgoing_fragment;
+    bool is_complete = true;
+    if (!*success) {
+        // the request failed
+    } else if ((entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) == SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ) {
+        if (!*data) {
+            // the response data was lost, which is handled by complete_request()
+        } else if (*length > fragment->fragment_header.length || *length > entry->read_buffer_size - fragment->offset) {
+            LOG_ERROR("Invalid read response fragment (%"PRIu32")", *length);
+            *success = false;
+            *data = NULL;
+            *length = 0;
+        } else {
+            memcpy(&entry->read_buffer[fragment->offset], *data, *length);
+            fragment->offset += *length;
+            // the read is complete once we get less data than we asked for
+            is_complete = *length < fragment->fragment_header.length;
+            *data = entry->read_buffer;
+            *length = fragment->offset;
+        }
+    } else {
+        fragment->offset += fragment->length;
+        is_complete = fragment->offset == entry->data_buffer_chain.length;
+    }
+    if (!is_complete) {
+        prepare_fragment(inst);
+        return true;
+    }
+    fragment->is_active = false;
+    return false;
+}
+
+static bool handle_incoming_fragment(instance_impl_t* inst, uint16_t attribute_id, uint16_t op, const sonar_application_layer_fragment_header_t* fragment_header, const uint8_t** data, uint32_t* length) {
+    // reassembles a fragment of a write / notify request, setting `data` to NULL if there are more fragments to come
+    incoming_fragment_t* incoming = &inst->incoming_fragment;
+    if (fragment_header->offset == 0) {
+        uint8_t* buffer = NULL;
+        if (inst->init.attribute_buffer_handler) {
+            buffer = inst->init.attribute_buffer_handler(inst->init.attr_handler_handle, attribute_id, fragment_header->length);
+        }
+        if (!buffer) {
+            LOG_ERROR("No buffer for fragmented request (0x%x)", attribute_id);
+            return false;
+        } else if (inst->outgoing_fragment.is_active && buffer == get_request_entry(inst, 0)->read_buffer) {
+            LOG_ERROR("Buffer for fragmented request (0x%x) is in use by a read request", attribute_id);
+            return false;
+        }
+        *incoming = (incoming_fragment_t) {
+            .attribute_id = attribute_id | op,
+            .length = fragment_header->length,
+            .offset = 0,
+            .reassembly_buffer = buffer,
+        };
+    } else if (incoming->attribute_id != (attribute_id | op) || fragment_header->offset != incoming->offset) {
+        LOG_ERROR("Unexpected fragment (0x%x)", attribute_id);
+        return false;
+    }
+    if (fragment_header->length != incoming->length || *length > incoming->length - incoming->offset) {
+        LOG_ERROR("Invalid fragment length (%"PRIu32")", *length);
+        incoming->attribute_id = 0;
+        return false;
+    }
+    memcpy(&incoming->reassembly_buffer[incoming->offset], *data, *length);
+    incoming->offset += *length;
+    if (incoming->offset < incoming->length) {
+        *data = NULL;
+        return true;
+    }
+    incoming->attribute_id = 0;
+    *data = incoming->reassembly_buffer;
+    *length = incoming->length;
+    return true;
+}
+
+static bool handle_compressed_request(instance_impl_t* inst, uint16_t attribute_id, uint16_t op, const uint8_t** data, uint32_t* length) {
+    // decompresses a write / notify request into the attribute's buffer
+    sonar_application_layer_compression_header_t header;
+    if (*length < sizeof(header)) {
+        LOG_ERROR("Invalid application layer packet: compressed request too short");
+        return false;
+    }
+    memcpy(&header, *data, sizeof(header));
+    uint8_t* buffer = NULL;
+    if (inst->init.attribute_buffer_handler) {
+        buffer = inst->init.attribute_buffer_handler(inst->init.attr_handler_handle, attribute_id, header.length);
+    }
+    if (!buffer) {
+        LOG_ERROR("No buffer for compressed request (0x%x)", attribute_id);
+        return false;
+    } else if (inst->outgoing_fragment.is_active && buffer == get_request_entry(inst, 0)->read_buffer) {
+        LOG_ERROR("Buffer for compressed request (0x%x) is in use by a read request", attribute_id);
+        return false;
+    }
+    if (inst->incoming_fragment.attribute_id == (attribute_id | op)) {
+        // this overwrites the buffer which a fragmented request for the same attribute was being reassembled into
+        inst->incoming_fragment.attribute_id = 0;
+    }
+    if (!header.length || lz4_decompress(*data + sizeof(header), *length - sizeof(header), buffer, header.length) != header.length) {
+        LOG_ERROR("Invalid compressed request (0x%x)", attribute_id);
+        return false;
+    }
+    *data = buffer;
+    *length = header.length;
+    return true;
+}
+
+static bool handle_read_request(instance_impl_t* inst, uint16_t attribute_id, const sonar_application_layer_fragment_header_t* fragment_header) {
+    incoming_fragment_t* incoming = &inst->incoming_fragment;
+    if (fragment_header && fragment_header->offset) {
+        // send the next fragment of the data we got from the read handler for the first fragment
+        if (incoming->attribute_id != (attribute_id | SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ) || fragment_header->offset > incoming->length) {
+            LOG_ERROR("Unexpected read request fragment (0x%x)", attribute_id);
+            return false;
+        }
+        incoming->offset = fragment_header->offset;
+        inst->init.set_response_function(inst->init.send_data_handle, &incoming->read_data[incoming->offset], MIN(incoming->length - incoming->offset, fragment_header->length));
+        if (fragment_header->length >= incoming->length - incoming->offset) {
+            // this is the last fragment
+            incoming->attribute_id = 0;
+        }
+        inst->last_read = (last_read_t){ .attribute_id = attribute_id, .is_fragmented = true };
+        return true;
+    }
+
+    inst->pending_read_response = true;
+    inst->is_fragmented_read_response = fragment_header != NULL;
+    const bool success = inst->init.attribute_read_handler(inst->init.attr_handler_handle, attribute_id);
+    const bool set_response = !inst->pending_read_response;
+    inst->pending_read_response = false;
+    inst->is_fragmented_read_response = false;
+    if (!success) {
+        return false;
+    } else if (!set_response) {
+        // should never happen
+        LOG_ERROR("No read response was set");
         return false;
-    } else if (attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) {
+    }
+    if (fragment_header) {
+        // send the first fragment of the data, with the rest being sent in response to the following fragments
+        incoming->attribute_id = fragment_header->length < incoming->length ? (attribute_id | SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ) : 0;
+        incoming->offset = 0;
+        inst->init.set_response_function(inst->init.send_data_handle, incoming->read_data, MIN(incoming->length, fragment_header->length));
+    }
+    inst->last_read = (last_read_t){ .attribute_id = attribute_id, .is_fragmented = fragment_header != NULL };
+    return true;
+}
+
+static void complete_request(instance_impl_t* inst, const request_entry_t* entry, bool success, const uint8_t* data, uint32_t length) {
+    const uint16_t attribute_id = entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK;
+    const uint16_t op = entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK;
+    if (op == SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ && success && !data) {
+        // the link layer acknowledged the request without its response data, so the read result was lost
+        LOG_ERROR("Read response lost (0x%x)", attribute_id);
+        success = false;
+    }
+    switch (op) {
+        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ:
+            inst->init.read_request_complete_handler(inst->init.request_complete_handle, attribute_id, success, data, length, entry->callback, entry->context);
+            break;
+        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_WRITE:
+            inst->init.write_request_complete_handler(inst->init.request_complete_handle, attribute_id, success, entry->callback, entry->context);
+            break;
+        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_NOTIFY:
+            inst->init.notify_request_complete_handler(inst->init.request_complete_handle, attribute_id, success, entry->callback, entry->context);
+            break;
+        default:
+            // should never happen
+            LOG_ERROR("Invalid operation (0x%x)", entry->header.attribute_id);
+            break;
+    }
+}
+
+static request_entry_t pop_request(instance_impl_t* inst) {
+    // copy the entry out so that its slot can be reused by the completion callback
+    const request_entry_t entry = *get_request_entry(inst, 0);
+    if (entry.header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_COMPRESSED_FLAG) {
+        inst->is_compression_buffer_in_use = false;
+    }
+    inst->request_queue.head = (inst->request_queue.head + 1) % SONAR_REQUEST_QUEUE_SIZE;
+    inst->request_queue.num_queued--;
+    if (inst->request_queue.num_sent) {
+        inst->request_queue.num_sent--;
+    }
+    return entry;
+}
+
+static request_entry_t pop_interleaved_request(instance_impl_t* inst) {
+    // the interleaved request is right behind the fragmented one, which is moved back into its slot
+    const request_entry_t entry = *get_request_entry(inst, 1);
+    if (entry.header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_COMPRESSED_FLAG) {
+        inst->is_compression_buffer_in_use = false;
+    }
+    move_request_entry(get_request_entry(inst, 1), get_request_entry(inst, 0));
+    inst->request_queue.head = (inst->request_queue.head + 1) % SONAR_REQUEST_QUEUE_SIZE;
+    inst->request_queue.num_queued--;
+    inst->request_queue.num_sent--;
+    inst->outgoing_fragment.is_interleaved_pending = false;
+    return entry;
+}
+
+static bool is_lost_read_response(const request_entry_t* entry, bool success, const uint8_t* data) {
+    return (entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) == SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ &&
+        success && !data;
+}
+
+static bool hold_response(instance_impl_t* inst, request_entry_t* entry, bool success, const uint8_t* data, uint32_t length) {
+    // holds the response to a request which was sent after the read being retried, returning false if it doesn't fit
+    if (is_lost_read_response(entry, success, data)) {
+        // only one read is retried at a time, so this one fails
+        LOG_ERROR("Read response lost (0x%x)", entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK);
+        success = false;
+        length = 0;
+    } else if ((entry->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) != SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ ||
+        !success) {
+        length = 0;
+    } else if (length > entry->read_buffer_size) {
+        return false;
+    } else if (length) {
+        memcpy(entry->read_buffer, data, length);
+    }
+    entry->held_success = success;
+    entry->held_length = length;
+    return true;
+}
+
+static void complete_held_requests(instance_impl_t* inst) {
+    // completes the requests which were held while a read was being retried (which has now completed)
+    const uint8_t num_held = inst->read_retry.num_held;
+    inst->read_retry = (read_retry_t){0};
+    for (uint8_t i = 0; i < num_held; i++) {
+        const request_entry_t entry = pop_request(inst);
+        complete_request(inst, &entry, entry.held_success, entry.held_success ? entry.read_buffer : NULL, entry.held_length);
+    }
+}
+
+static bool issue_request(instance_impl_t* inst, uint16_t attribute_id, uint16_t op, const uint8_t* data, uint32_t length, uint8_t* read_buffer, uint32_t read_buffer_size, sonar_application_layer_request_complete_callback_t callback, void* context) {
+    if (!inst->is_connected) {
+        LOG_ERROR("Not connected");
+        return false;
+    } else if (inst->request_queue.num_queued == SONAR_REQUEST_QUEUE_SIZE) {
+        LOG_ERROR("Application layer request queue full");
+        return false;
+    } else if (attribute_id & ~SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK) {
         LOG_ERROR("Invalid attribute ID: 0x%x", attribute_id);
         return false;
     }
@@ -49,15 +579,17 @@ static bool issue_request(instance_impl_t* inst, uint16_t attribute_id, uint16_t
         return false;
     }
 
-    inst->request.is_active = true;
-    inst->request.header = (sonar_application_layer_header_t) {
+    request_entry_t* entry = insert_request_entry(inst, attribute_id, callback);
+    entry->header = (sonar_application_layer_header_t) {
         .attribute_id = attribute_id | op,
     };
-    buffer_chain_set_data(&inst->request.data_buffer_chain, data, length);
-    if (!inst->init.send_data_function(inst->init.send_data_handle, &inst->request.header_buffer_chain)) {
-        inst->request.is_active = false;
-        return false;
-    }
+    buffer_chain_set_data(&entry->data_buffer_chain, data, length);
+    entry->callback = callback;
+    entry->context = context;
+    entry->read_buffer = read_buffer;
+    entry->read_buffer_size = read_buffer ? read_buffer_size : 0;
+    inst->request_queue.num_queued++;
+    send_queued_requests(inst);
     return true;
 }
 
@@ -66,23 +598,79 @@ void sonar_application_layer_init(sonar_application_layer_handle_t handle, const
     *inst = (instance_impl_t){
         .init = *init,
     };
-    buffer_chain_set_data(&inst->request.header_buffer_chain, (const uint8_t*)&inst->request.header, sizeof(inst->request.header));
-    buffer_chain_push_back(&inst->request.header_buffer_chain, &inst->request.data_buffer_chain);
+    for (uint8_t i = 0; i < SONAR_REQUEST_QUEUE_SIZE; i++) {
+        request_entry_t* entry = &inst->request_queue.entries[i];
+        buffer_chain_set_data(&entry->header_buffer_chain, (const uint8_t*)&entry->header, sizeof(entry->header));
+        buffer_chain_push_back(&entry->header_buffer_chain, &entry->data_buffer_chain);
+    }
+    outgoing_fragment_t* fragment = &inst->outgoing_fragment;
+    buffer_chain_set_data(&fragment->header_buffer_chain, (const uint8_t*)&fragment->header, sizeof(fragment->header));
+    buffer_chain_set_data(&fragment->fragment_header_buffer_chain, (const uint8_t*)&fragment->fragment_header, sizeof(fragment->fragment_header));
+    buffer_chain_push_back(&fragment->header_buffer_chain, &fragment->fragment_header_buffer_chain);
+    buffer_chain_push_back(&fragment->header_buffer_chain, &fragment->data_buffer_chain);
 }
 
-bool sonar_application_layer_read_request(sonar_application_layer_handle_t handle, uint16_t attribute_id) {
+void sonar_application_layer_connection_changed(sonar_application_layer_handle_t handle, bool connected) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    return issue_request(inst, attribute_id, SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ, NULL, 0);
+    inst->is_connected = connected;
+    if (connected) {
+        return;
+    }
+    inst->incoming_fragment.attribute_id = 0;
+    // all of the queued requests are failed, including any which was compressed
+    inst->is_compression_buffer_in_use = false;
+    if (inst->outgoing_fragment.is_active && inst->outgoing_fragment.is_interleaved_pending) {
+        // the lower layer will fail the interleaved request, so fail the fragmented one (which is ahead of it) here
+        const request_entry_t entry = pop_request(inst);
+        complete_request(inst, &entry, false, NULL, 0);
+    } else if (inst->outgoing_fragment.is_active && inst->outgoing_fragment.is_send_pending) {
+        // the current fragment was never passed to the lower layer, so fail the request along with the unsent ones
+        inst->request_queue.num_sent--;
+    }
+    // otherwise the lower layer will fail the request the current fragment is part of
+    inst->outgoing_fragment.is_active = false;
+    inst->outgoing_fragment.is_interleaved_pending = false;
+    if (inst->read_retry.is_active && !inst->read_retry.is_sent) {
+        // the read which was going to be sent again fails, along with the requests which were held behind it
+        const request_entry_t entry = pop_request(inst);
+        complete_request(inst, &entry, false, NULL, 0);
+        complete_held_requests(inst);
+    }
+    // otherwise the lower layer will fail the read being retried, which completes the held requests
+    // the lower layer fails any requests which were sent, so fail the rest of the queued requests (their slots can't be
+    // reused by the callbacks since new requests are rejected while disconnected)
+    const uint8_t num_unsent = inst->request_queue.num_queued - inst->request_queue.num_sent;
+    inst->request_queue.num_queued = inst->request_queue.num_sent;
+    for (uint8_t i = 0; i < num_unsent; i++) {
+        complete_request(inst, get_request_entry(inst, inst->request_queue.num_sent + i), false, NULL, 0);
+    }
+}
+
+void sonar_application_layer_process(sonar_application_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    send_queued_requests(inst);
+}
+
+bool sonar_application_layer_can_send_request(sonar_application_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return inst->is_connected && !inst->outgoing_fragment.is_active &&
+        inst->request_queue.num_queued < SONAR_REQUEST_QUEUE_SIZE &&
+        inst->request_queue.num_sent == inst->request_queue.num_queued && can_send_data(inst);
 }
 
-bool sonar_application_layer_write_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
+bool sonar_application_layer_read_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, uint8_t* buffer, uint32_t buffer_size, sonar_application_layer_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    return issue_request(inst, attribute_id, SONAR_APPLICATION_ATTRIBUTE_ID_OP_WRITE, data, length);
+    return issue_request(inst, attribute_id, SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ, NULL, 0, buffer, buffer_size, callback, context);
 }
 
-bool sonar_application_layer_notify_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
+bool sonar_application_layer_write_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_application_layer_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    return issue_request(inst, attribute_id, SONAR_APPLICATION_ATTRIBUTE_ID_OP_NOTIFY, data, length);
+    return issue_request(inst, attribute_id, SONAR_APPLICATION_ATTRIBUTE_ID_OP_WRITE, data, length, NULL, 0, callback, context);
+}
+
+bool sonar_application_layer_notify_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_application_layer_request_complete_callback_t callback, void* context) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return issue_request(inst, attribute_id, SONAR_APPLICATION_ATTRIBUTE_ID_OP_NOTIFY, data, length, NULL, 0, callback, context);
 }
 
 bool sonar_application_layer_handle_request(sonar_application_layer_handle_t handle, const uint8_t* data, uint32_t length) {
@@ -92,16 +680,50 @@ bool sonar_application_layer_handle_request(sonar_application_layer_handle_t han
         return false;
     }
 
+    inst->last_read.attribute_id = 0;
+
     // grab the header off the front of the data
     const sonar_application_layer_header_t* header = (const sonar_application_layer_header_t*)data;
     data += sizeof(*header);
     length -= sizeof(*header);
 
+    // grab the fragment header (if there is one) off the front of the data
+    sonar_application_layer_fragment_header_t fragment_header_storage;
+    const sonar_application_layer_fragment_header_t* fragment_header = NULL;
+    if (header->attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_FRAGMENT_FLAG) {
+        if (!get_fragment_size(inst)) {
+            // the peer can only send fragments once fragmentation has been negotiated
+            LOG_ERROR("Invalid application layer packet: fragmentation isn't enabled");
+            return false;
+        } else if (length < sizeof(fragment_header_storage)) {
+            LOG_ERROR("Invalid application layer packet: fragment too short");
+            return false;
+        }
+        memcpy(&fragment_header_storage, data, sizeof(fragment_header_storage));
+        fragment_header = &fragment_header_storage;
+        data += sizeof(fragment_header_storage);
+        length -= sizeof(fragment_header_storage);
+    }
+
     // decode the header and call the corresponding operation handler
     const uint16_t op = header->attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK;
     const uint16_t attribute_id = header->attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK;
+    if (header->attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_COMPRESSED_FLAG) {
+        // only write requests (to the server) and notify requests (to the client) can be compressed, and never fragmented
+        const uint16_t compressed_op = inst->init.is_server ? SONAR_APPLICATION_ATTRIBUTE_ID_OP_WRITE : SONAR_APPLICATION_ATTRIBUTE_ID_OP_NOTIFY;
+        if (!inst->init.can_compress_data_function || !inst->init.can_compress_data_function(inst->init.send_data_handle)) {
+            // the peer can only send compressed requests once compression has been negotiated
+            LOG_ERROR("Invalid application layer packet: compression isn't enabled");
+            return false;
+        } else if (fragment_header || op != compressed_op) {
+            LOG_ERROR("Invalid application layer packet: unexpected compressed request (0x%x)", attribute_id);
+            return false;
+        } else if (!handle_compressed_request(inst, attribute_id, op, &data, &length)) {
+            return false;
+        }
+    }
     switch (op) {
-        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ: {
+        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ:
             if (!inst->init.is_server) {
                 LOG_ERROR("Invalid application layer packet: read request from server");
                 return false;
@@ -110,24 +732,21 @@ bool sonar_application_layer_handle_request(sonar_application_layer_handle_t han
                 LOG_ERROR("Invalid application layer packet: read request with data (%"PRIu32")", length);
                 return false;
             }
-            inst->request.pending_read_response = true;
-            const bool success = inst->init.attribute_read_handler(inst->init.attr_handler_handle, attribute_id);
-            const bool set_response = !inst->request.pending_read_response;
-            inst->request.pending_read_response = false;
-            if (!success) {
-                return false;
-            } else if (!set_response) {
-                // should never happen
-                LOG_ERROR("No read response was set");
-                return false;
-            }
-            return true;
-        }
+            return handle_read_request(inst, attribute_id, fragment_header);
         case SONAR_APPLICATION_ATTRIBUTE_ID_OP_WRITE:
             if (!inst->init.is_server) {
                 LOG_ERROR("Invalid application layer packet: write request from server");
                 return false;
             }
+            if (fragment_header) {
+                if (!handle_incoming_fragment(inst, attribute_id, op, fragment_header, &data, &length)) {
+                    return false;
+                } else if (!data) {
+                    // wait for the rest of the fragments
+                    inst->init.set_response_function(inst->init.send_data_handle, NULL, 0);
+                    return true;
+                }
+            }
             if (!inst->init.attribute_write_handler(inst->init.attr_handler_handle, attribute_id, data, length)) {
                 return false;
             }
@@ -138,6 +757,15 @@ bool sonar_application_layer_handle_request(sonar_application_layer_handle_t han
                 LOG_ERROR("Invalid application layer packet: notify request from client");
                 return false;
             }
+            if (fragment_header) {
+                if (!handle_incoming_fragment(inst, attribute_id, op, fragment_header, &data, &length)) {
+                    return false;
+                } else if (!data) {
+                    // wait for the rest of the fragments
+                    inst->init.set_response_function(inst->init.send_data_handle, NULL, 0);
+                    return true;
+                }
+            }
             if (!inst->init.attribute_notify_handler(inst->init.attr_handler_handle, attribute_id, data, length)) {
                 return false;
             }
@@ -151,36 +779,86 @@ bool sonar_application_layer_handle_request(sonar_application_layer_handle_t han
 
 void sonar_application_layer_handle_response(sonar_application_layer_handle_t handle, bool success, const uint8_t* data, uint32_t length) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    if (!inst->request.is_active) {
+    if (!inst->request_queue.num_sent) {
         // should never happen
         LOG_ERROR("Unexpected response");
         return;
     }
-    inst->request.is_active = false;
-    const uint16_t attribute_id = inst->request.header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK;
-    switch (inst->request.header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) {
-        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ:
-            inst->init.read_request_complete_handler(inst->init.request_complete_handle, attribute_id, success, data, length);
-            break;
-        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_WRITE:
-            inst->init.write_request_complete_handler(inst->init.request_complete_handle, attribute_id, success);
-            break;
-        case SONAR_APPLICATION_ATTRIBUTE_ID_OP_NOTIFY:
-            inst->init.notify_request_complete_handler(inst->init.request_complete_handle, attribute_id, success);
-            break;
-        default:
-            // should never happen
-            LOG_ERROR("Invalid operation (0x%x)", inst->request.header.attribute_id);
+    if (inst->outgoing_fragment.is_active && inst->outgoing_fragment.is_interleaved_pending) {
+        // this is the response to the request which was sent between fragments, so complete it and carry on with them
+        const request_entry_t entry = pop_interleaved_request(inst);
+        complete_request(inst, &entry, success, data, length);
+        send_queued_requests(inst);
+        return;
+    } else if (inst->outgoing_fragment.is_active && handle_fragment_response(inst, &success, &data, &length)) {
+        // send the next fragment right away
+        send_queued_requests(inst);
+        return;
+    }
+    if (inst->read_retry.is_active && !inst->read_retry.is_sent) {
+        // this is the response to a request which was sent after the read being retried
+        request_entry_t* entry = get_request_entry(inst, inst->read_retry.num_held + 1);
+        if (hold_response(inst, entry, success, data, length)) {
+            inst->read_retry.num_held++;
+            send_queued_requests(inst);
             return;
+        }
+        // the response data can't be held, so give up on the read rather than completing requests out of order
+        LOG_ERROR("Read response lost (0x%x)", get_request_entry(inst, 0)->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK);
+        const request_entry_t read_entry = pop_request(inst);
+        complete_request(inst, &read_entry, false, NULL, 0);
+        complete_held_requests(inst);
+    } else if (!inst->outgoing_fragment.is_active && is_lost_read_response(get_request_entry(inst, 0), success, data)) {
+        // reads don't have any side effects, so the read is sent again rather than failed
+        LOG_WARN("Read response lost, retrying (0x%x)", get_request_entry(inst, 0)->header.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK);
+        inst->read_retry.is_active = true;
+        inst->read_retry.is_sent = false;
+        send_queued_requests(inst);
+        return;
     }
+    // responses are received in the order the requests were sent
+    const request_entry_t entry = pop_request(inst);
+    complete_request(inst, &entry, success, data, length);
+    complete_held_requests(inst);
+    // send the next request(s) right away
+    send_queued_requests(inst);
+}
+
+bool sonar_application_layer_handle_response_retry(sonar_application_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    const uint16_t attribute_id = inst->last_read.attribute_id;
+    if (!attribute_id || !inst->init.attribute_read_stale_handler ||
+        !inst->init.attribute_read_stale_handler(inst->init.attr_handler_handle, attribute_id)) {
+        // the response still points to the data which was originally sent
+        return true;
+    } else if (inst->last_read.is_fragmented) {
+        // reading the attribute again could mix fragments of different values, so let the read fail instead
+        LOG_ERROR("Read response fragment was overwritten (0x%x)", attribute_id);
+        return false;
+    }
+    // read the attribute again, which sets the response
+    LOG_WARN("Read response was overwritten, reading again (0x%x)", attribute_id);
+    return handle_read_request(inst, attribute_id, NULL);
 }
 
 void sonar_application_layer_read_response(sonar_application_layer_handle_t handle, const uint8_t* data, uint32_t length) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    if (!inst->request.pending_read_response) {
+    if (!inst->pending_read_response) {
         LOG_ERROR("Unexpected read response");
         return;
     }
-    inst->request.pending_read_response = false;
+    inst->pending_read_response = false;
+    if (inst->is_fragmented_read_response) {
+        // the data is sent in fragments, so hold onto it
+        inst->incoming_fragment.read_data = data;
+        inst->incoming_fragment.length = length;
+        return;
+    }
     inst->init.set_response_function(inst->init.send_data_handle, data, length);
 }
+
+bool sonar_application_layer_is_fragment_in_progress(sonar_application_layer_handle_t handle, uint16_t attribute_id) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return inst->incoming_fragment.attribute_id &&
+        (inst->incoming_fragment.attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK) == attribute_id;
+}
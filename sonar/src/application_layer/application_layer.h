@@ -1,13 +1,17 @@
 #pragma once
 
 #include "../common/buffer_chain.h"
+#include "anchor/sonar/sonar_config.h"
 
 #include <inttypes.h>
 #include <stdbool.h>
 
 #define _SONAR_APPLICATION_LAYER_CONTEXT_SIZE ( \
-    sizeof(uintptr_t) + /* pending_request_info_t.{is_active,header} */ \
-    sizeof(buffer_chain_entry_t) * 2 + /* pending_request_info_t.{header_buffer_chain,data_buffer_chain} */ \
+    sizeof(uintptr_t) * 2 + /* {is_connected,pending_read_response,is_fragmented_read_response,is_compression_buffer_in_use}, request_queue_t.{head,num_queued,num_sent} */ \
+    (sizeof(void*) * 5 + sizeof(buffer_chain_entry_t) * 2) * SONAR_REQUEST_QUEUE_SIZE + /* request_queue_t.entries */ \
+    sizeof(uint32_t) * 6 + sizeof(buffer_chain_entry_t) * 3 + /* outgoing_fragment_t */ \
+    sizeof(uint32_t) * 2 + sizeof(uintptr_t) * 2 + /* incoming_fragment_t */ \
+    sizeof(uint32_t) * 2 + /* read_retry_t, last_read_t */ \
     sizeof(sonar_application_layer_init_t))
 
 // Handle type passed to send_data_function()
@@ -19,11 +23,20 @@ typedef void* sonar_application_layer_attribute_handler_handle_t;
 // Handle type passed to *_request_complete_handler()
 typedef void* sonar_application_layer_request_complete_handler_handle_t;
 
+// Opaque per-request completion callback, which is passed back to the *_request_complete_handler() along with its
+// context for the upper layer to cast back to its own prototype and call
+typedef void (*sonar_application_layer_request_complete_callback_t)(void);
+
 typedef struct {
     // Whether or not this is the server (vs. client)
     bool is_server;
     // Function which is called to write a buffer chain over the physical link
     bool (*send_data_function)(sonar_application_layer_send_data_handle_t handle, const buffer_chain_entry_t* data);
+    // Function which is called to check if another request can currently be sent (optional - assumed to always be true)
+    bool (*can_send_data_function)(sonar_application_layer_send_data_handle_t handle);
+    // Function which is called to check if compression was negotiated with the peer, which is required to send or accept
+    // compressed write / notify requests (optional - assumed to be false)
+    bool (*can_compress_data_function)(sonar_application_layer_send_data_handle_t handle);
     // Function which is called to set the response while handling a request
     void (*set_response_function)(sonar_application_layer_send_data_handle_t handle, const uint8_t* data, uint32_t length);
     // Handle passed to send_data_function()
@@ -35,16 +48,36 @@ typedef struct {
     bool (*attribute_write_handler)(sonar_application_layer_attribute_handler_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
     // Handler for attribute notify requests
     bool (*attribute_notify_handler)(sonar_application_layer_attribute_handler_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
+    // Handler which returns the buffer to reassemble a fragmented write / notify request of the given total length into
+    // (optional - fragmented requests are rejected if not specified or if NULL is returned)
+    uint8_t* (*attribute_buffer_handler)(sonar_application_layer_attribute_handler_handle_t handle, uint16_t attribute_id, uint32_t length);
+    // Handler which returns the priority of requests for an attribute, with queued requests being sent ahead of any
+    // unsent ones of a lower priority (optional - all requests have the same priority and are sent in order)
+    uint8_t (*attribute_priority_handler)(sonar_application_layer_attribute_handler_handle_t handle, uint16_t attribute_id);
+    // Handler which returns whether or not an attribute's buffer has been overwritten since a read response was sent from
+    // it, in which case the attribute is read again if the response has to be sent again (optional - assumed to be false)
+    bool (*attribute_read_stale_handler)(sonar_application_layer_attribute_handler_handle_t handle, uint16_t attribute_id);
     // Handle passed to attribute_*_handler()
     sonar_application_layer_attribute_handler_handle_t attr_handler_handle;
     // Handler for read request completion
-    void(*read_request_complete_handler)(sonar_application_layer_request_complete_handler_handle_t handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length);
+    void(*read_request_complete_handler)(sonar_application_layer_request_complete_handler_handle_t handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length, sonar_application_layer_request_complete_callback_t callback, void* context);
     // Handler for write request completion
-    void(*write_request_complete_handler)(sonar_application_layer_request_complete_handler_handle_t handle, uint16_t attribute_id, bool success);
+    void(*write_request_complete_handler)(sonar_application_layer_request_complete_handler_handle_t handle, uint16_t attribute_id, bool success, sonar_application_layer_request_complete_callback_t callback, void* context);
     // Handler for notify request completion
-    void(*notify_request_complete_handler)(sonar_application_layer_request_complete_handler_handle_t handle, uint16_t attribute_id, bool success);
+    void(*notify_request_complete_handler)(sonar_application_layer_request_complete_handler_handle_t handle, uint16_t attribute_id, bool success, sonar_application_layer_request_complete_callback_t callback, void* context);
     // Handle passed to *_request_complete_handler()
     sonar_application_layer_request_complete_handler_handle_t request_complete_handle;
+    // Function which is called to get the largest packet (including headers) which the peer can receive, with larger
+    // requests being split into fragments (optional - fragmentation is disabled if not specified or if 0 is returned)
+    uint32_t (*get_max_packet_size_function)(sonar_application_layer_send_data_handle_t handle);
+    // Buffer which write / notify requests are compressed into, which is used by one request at a time until it
+    // completes, with the others being sent uncompressed (optional - requests are never compressed if not specified)
+    uint8_t* compression_buffer;
+    // The size of the compression buffer in bytes
+    uint32_t compression_buffer_size;
+    // The number of times a queued request can be overtaken by higher priority requests before it's sent ahead of any
+    // further ones (optional - 0 means higher priority requests always go first)
+    uint8_t max_priority_overtakes;
 } sonar_application_layer_init_t;
 
 // The handle is a pointer to a pre-allocated context type (to be accessed by the SONAR implementation only)
@@ -54,16 +87,32 @@ typedef sonar_application_layer_context_t* sonar_application_layer_handle_t;
 // Initializes the sonar application layer code
 void sonar_application_layer_init(sonar_application_layer_handle_t handle, const sonar_application_layer_init_t* init);
 
-// Sends a SONAR application layer read request for a given attribute, with the handler specified in sonar_application_layer_init_t being being called on completion
-bool sonar_application_layer_read_request(sonar_application_layer_handle_t handle, uint16_t attribute_id);
+// Called when the low-level connection status changes (requests can only be queued while connected)
+void sonar_application_layer_connection_changed(sonar_application_layer_handle_t handle, bool connected);
+
+// Sends any queued requests which the lower layer can now accept - should be called regularly
+void sonar_application_layer_process(sonar_application_layer_handle_t handle);
+
+// Returns whether or not a request which is queued now would be sent right away
+bool sonar_application_layer_can_send_request(sonar_application_layer_handle_t handle);
+
+// NOTE: The following functions add a request to the request queue (of SONAR_REQUEST_QUEUE_SIZE entries), which are
+// sent in order (of priority, and then of being queued) as soon as the lower layer can accept them. On completion, the
+// corresponding handler specified in sonar_application_layer_init_t is called with the callback and context (optional
+// - NULL if not specified) which were passed here.
 
-// Sends a SONAR application layer write request for a given attribute, with the handler specified in sonar_application_layer_init_t being called on completion
-// NOTE: the data pointer must remain valid until the handler is called
-bool sonar_application_layer_write_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
+// Queues a SONAR application layer read request for a given attribute
+// NOTE: if the buffer is specified and larger than a single fragment, the response is read in fragments and
+// reassembled into it, so it must remain valid until the request completes
+bool sonar_application_layer_read_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, uint8_t* buffer, uint32_t buffer_size, sonar_application_layer_request_complete_callback_t callback, void* context);
 
-// Sends a SONAR application layer notify request for a given attribute, with the handler specified in sonar_application_layer_init_t being being called on completion
-// NOTE: the data pointer must remain valid until the handler is called
-bool sonar_application_layer_notify_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
+// Queues a SONAR application layer write request for a given attribute
+// NOTE: the data pointer must remain valid until the request completes
+bool sonar_application_layer_write_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_application_layer_request_complete_callback_t callback, void* context);
+
+// Queues a SONAR application layer notify request for a given attribute
+// NOTE: the data pointer must remain valid until the request completes
+bool sonar_application_layer_notify_request(sonar_application_layer_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_application_layer_request_complete_callback_t callback, void* context);
 
 // Handles a received SONAR application layer request, populating the response as applicable
 bool sonar_application_layer_handle_request(sonar_application_layer_handle_t handle, const uint8_t* data, uint32_t length);
@@ -71,5 +120,13 @@ bool sonar_application_layer_handle_request(sonar_application_layer_handle_t han
 // Handles a received SONAR application layer response
 void sonar_application_layer_handle_response(sonar_application_layer_handle_t handle, bool success, const uint8_t* data, uint32_t length);
 
+// Called before the response to the last request is sent again, which reads the attribute again if it was a read
+// whose data has since been overwritten, and returns false if the response can't be sent again
+bool sonar_application_layer_handle_response_retry(sonar_application_layer_handle_t handle);
+
 // Sends a SONAR application layer read response - should only (and must) be called from attribute_read_handler()
 void sonar_application_layer_read_response(sonar_application_layer_handle_t handle, const uint8_t* data, uint32_t length);
+
+// Returns whether or not a fragmented request for an attribute is partway through being received (write / notify) or
+// having its response sent (read), during which the attribute's buffer holds its data
+bool sonar_application_layer_is_fragment_in_progress(sonar_application_layer_handle_t handle, uint16_t attribute_id);
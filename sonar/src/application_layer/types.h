@@ -3,13 +3,32 @@
 #include <inttypes.h>
 
 #define SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK    0x0fff
-#define SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK              0xf000
+#define SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK              0x3000
 #define SONAR_APPLICATION_ATTRIBUTE_ID_OP_OFFSET            12
 #define SONAR_APPLICATION_ATTRIBUTE_ID_OP_READ              (1 << SONAR_APPLICATION_ATTRIBUTE_ID_OP_OFFSET)
 #define SONAR_APPLICATION_ATTRIBUTE_ID_OP_WRITE             (2 << SONAR_APPLICATION_ATTRIBUTE_ID_OP_OFFSET)
 #define SONAR_APPLICATION_ATTRIBUTE_ID_OP_NOTIFY            (3 << SONAR_APPLICATION_ATTRIBUTE_ID_OP_OFFSET)
+// Set if the data of a write / notify request is a sonar_application_layer_compression_header_t followed by an LZ4 block
+// (only sent to peers which negotiated SONAR_LINK_LAYER_FEATURE_COMPRESSION)
+#define SONAR_APPLICATION_ATTRIBUTE_ID_COMPRESSED_FLAG      0x4000
+// Set if the header is followed by a sonar_application_layer_fragment_header_t
+#define SONAR_APPLICATION_ATTRIBUTE_ID_FRAGMENT_FLAG        0x8000
 
 
 typedef struct {
     uint16_t attribute_id;
 } sonar_application_layer_header_t;
+
+// Header which follows sonar_application_layer_header_t for fragmented requests, which each carry the data at `offset`
+// Fragmented read requests instead set `length` to the maximum amount of data to return, with the read being complete
+// once a response contains less than that
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} sonar_application_layer_fragment_header_t;
+
+// Header at the start of the data of compressed requests
+typedef struct {
+    // The length of the data once it's decompressed
+    uint32_t length;
+} sonar_application_layer_compression_header_t;
@@ -2,6 +2,7 @@
 
 #include "../application_layer/types.h"
 #include "control_helpers.h"
+#include "delta.h"
 
 #define LOGGING_MODULE_NAME "SONAR"
 #include "anchor/logging/logging.h"
@@ -15,8 +16,14 @@ typedef struct {
     sonar_attribute_def_t* next;
     bool is_available;
     bool is_registered;
+    // Whether or not a write request (using the request buffer) is queued
+    bool is_write_pending;
+    // Whether or not the delta buffer holds the last value notified by the server
+    bool is_delta_valid;
+    uint32_t delta_length;
 } attribute_context_t;
-_Static_assert(sizeof(attribute_context_t) == sizeof(((sonar_attribute_def_t*)0)->_private), "Invalid size");
+// the context space is sized for the server, which needs more
+_Static_assert(sizeof(attribute_context_t) <= sizeof(((sonar_attribute_def_t*)0)->_private), "Invalid size");
 
 typedef struct {
     sonar_attribute_client_init_t init;
@@ -36,12 +43,17 @@ static sonar_attribute_def_t* get_def_by_id(instance_impl_t* inst, uint16_t attr
     return NULL;
 }
 
-static bool send_attribute_read(instance_impl_t* inst, uint16_t attribute_id) {
-    return inst->init.send_read_request_function(inst->init.handle, attribute_id);
+static uint32_t get_max_notify_size(const sonar_attribute_def_t* def) {
+    // notifies of delta attributes may be slightly bigger than the value itself
+    return def->delta_buffer ? SONAR_ATTR_DELTA_BUFFER_SIZE(def->max_size) : def->max_size;
 }
 
-static bool send_attribute_write(instance_impl_t* inst, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
-    return inst->init.send_write_request_function(inst->init.handle, attribute_id, data, length);
+static bool send_attribute_read(instance_impl_t* inst, uint16_t attribute_id, uint8_t* buffer, uint32_t buffer_size, sonar_attribute_client_request_complete_callback_t callback, void* context) {
+    return inst->init.send_read_request_function(inst->init.handle, attribute_id, buffer, buffer_size, callback, context);
+}
+
+static bool send_attribute_write(instance_impl_t* inst, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context) {
+    return inst->init.send_write_request_function(inst->init.handle, attribute_id, data, length, callback, context);
 }
 
 static void disconnect(instance_impl_t* inst) {
@@ -61,7 +73,7 @@ static void num_attrs_read_complete(instance_impl_t* inst, bool success, const u
 
     // set the initial offset to 0 and write it to the server
     inst->attr_offset = 0;
-    if (!send_attribute_write(inst, 0x102, (const uint8_t*)&inst->attr_offset, sizeof(inst->attr_offset))) {
+    if (!send_attribute_write(inst, 0x102, (const uint8_t*)&inst->attr_offset, sizeof(inst->attr_offset), NULL, NULL)) {
         // should never happen
         LOG_ERROR("Failed to write CTRL_ATTR_OFFSET");
     }
@@ -88,12 +100,12 @@ static void attr_list_read_complete(instance_impl_t* inst, bool success, const u
         if (!def) {
             // not supported locally, so ignore
             continue;
-        } else if (attribute_id & CTRL_ATTR_LIST_OP_BIT_RESERVED) {
-            LOG_ERROR("Invalid attribute ops for attribute (0x%x)", attribute_id);
-            continue;
-        } else if ((uint16_t)def->ops != (attribute_id & 0xf000)) {
+        } else if ((uint16_t)def->ops != (attribute_id & 0x7000)) {
             // ops mismatch between the client and the server
             continue;
+        } else if (!def->delta_buffer != !(attribute_id & CTRL_ATTR_LIST_OP_BIT_DELTA)) {
+            LOG_ERROR("Delta notify mismatch for attribute (0x%x)", attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK);
+            continue;
         }
         GET_CONTEXT(def)->is_available = true;
     }
@@ -101,7 +113,7 @@ static void attr_list_read_complete(instance_impl_t* inst, bool success, const u
     if (has_more) {
         // advance the offset to read the next chunk
         inst->attr_offset += CTRL_ATTR_LIST_LENGTH;
-        if (!send_attribute_write(inst, CTRL_ATTR_OFFSET_ID, (const uint8_t*)&inst->attr_offset, sizeof(inst->attr_offset))) {
+        if (!send_attribute_write(inst, CTRL_ATTR_OFFSET_ID, (const uint8_t*)&inst->attr_offset, sizeof(inst->attr_offset), NULL, NULL)) {
             // should never happen
             LOG_ERROR("Failed to write CTRL_ATTR_OFFSET");
             return;
@@ -123,7 +135,7 @@ static void attr_offset_write_complete(instance_impl_t* inst, bool success) {
     }
 
     // read the attr ids at this offset
-    if (!send_attribute_read(inst, CTRL_ATTR_LIST_ID)) {
+    if (!send_attribute_read(inst, CTRL_ATTR_LIST_ID, NULL, 0, NULL, NULL)) {
         // should never happen
         LOG_ERROR("Failed to read CTRL_ATTR_LIST");
         return;
@@ -144,7 +156,7 @@ void sonar_attribute_client_register(sonar_attribute_client_handle_t handle, son
         // should never happen as these are all setup by SONAR macros
         LOG_ERROR("Invalid parameters");
         return;
-    } else if (def->attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) {
+    } else if (def->attribute_id & ~SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK) {
         LOG_ERROR("Invalid attribute ID (0x%x)", def->attribute_id);
         return;
     } else if (get_def_by_id(inst, def->attribute_id)) {
@@ -156,6 +168,7 @@ void sonar_attribute_client_register(sonar_attribute_client_handle_t handle, son
         return;
     }
     GET_CONTEXT(def)->is_registered = true;
+    GET_CONTEXT(def)->is_delta_valid = false;
     if (inst->def_list) {
         // add to the front of the list
         GET_CONTEXT(def)->next = inst->def_list;
@@ -169,7 +182,7 @@ void sonar_attribute_client_low_level_connection_changed(sonar_attribute_client_
     instance_impl_t* inst = (instance_impl_t*)handle;
     if (is_connected) {
         // kick off server attribute enumeration by reading the number of attributes
-        if (!send_attribute_read(inst, CTRL_NUM_ATTRS_ID)) {
+        if (!send_attribute_read(inst, CTRL_NUM_ATTRS_ID, NULL, 0, NULL, NULL)) {
             // should never happen
             LOG_ERROR("Failed to read CTRL_NUM_ATTRS");
             return;
@@ -179,6 +192,7 @@ void sonar_attribute_client_low_level_connection_changed(sonar_attribute_client_
         LOG_INFO("Disconnected");
         for (const sonar_attribute_def_t* def = inst->def_list; def; def = GET_CONTEXT(def)->next) {
             GET_CONTEXT(def)->is_available = false;
+            GET_CONTEXT(def)->is_delta_valid = false;
         }
         inst->is_connected = false;
         inst->init.connection_changed_callback(inst->init.handle, false);
@@ -190,7 +204,7 @@ bool sonar_attribute_client_is_connected(sonar_attribute_client_handle_t handle)
     return inst->is_connected;
 }
 
-bool sonar_attribute_client_read(sonar_attribute_client_handle_t handle, sonar_attribute_t attr) {
+bool sonar_attribute_client_read(sonar_attribute_client_handle_t handle, sonar_attribute_t attr, sonar_attribute_client_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     const sonar_attribute_def_t* def = attr;
     if (!def) {
@@ -206,10 +220,10 @@ bool sonar_attribute_client_read(sonar_attribute_client_handle_t handle, sonar_a
         LOG_ERROR("Attribute not available");
         return false;
     }
-    return send_attribute_read(inst, def->attribute_id);
+    return send_attribute_read(inst, def->attribute_id, def->response_buffer, def->max_size, callback, context);
 }
 
-bool sonar_attribute_client_write(sonar_attribute_client_handle_t handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length) {
+bool sonar_attribute_client_write(sonar_attribute_client_handle_t handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     const sonar_attribute_def_t* def = attr;
     if (!def) {
@@ -227,12 +241,19 @@ bool sonar_attribute_client_write(sonar_attribute_client_handle_t handle, sonar_
     } else if (length > def->max_size) {
         LOG_ERROR("Write data is too big");
         return false;
+    } else if (GET_CONTEXT(def)->is_write_pending) {
+        LOG_ERROR("Write request already pending for attribute (0x%x)", def->attribute_id);
+        return false;
     }
     memcpy(def->request_buffer, data, length);
-    return send_attribute_write(inst, def->attribute_id, def->request_buffer, length);
+    if (!send_attribute_write(inst, def->attribute_id, def->request_buffer, length, callback, context)) {
+        return false;
+    }
+    GET_CONTEXT(def)->is_write_pending = true;
+    return true;
 }
 
-void sonar_attribute_client_handle_read_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length) {
+void sonar_attribute_client_handle_read_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     // handle control attributes explicitly inline here since they aren't registered
     if (attribute_id == CTRL_NUM_ATTRS_ID) {
@@ -243,39 +264,78 @@ void sonar_attribute_client_handle_read_response(sonar_attribute_client_handle_t
         return;
     }
     const sonar_attribute_def_t* def = get_def_by_id(inst, attribute_id);
+    bool is_valid = false;
     if (!def || !(def->ops & SONAR_ATTRIBUTE_OPS_R)) {
         // should never happen
         LOG_ERROR("Unexpected read response");
-        return;
     } else if (success && length > def->max_size) {
         LOG_ERROR("Read response is too big (%"PRIu32") for attribute (0x%x)", length, attribute_id);
-        return;
     } else if (!GET_CONTEXT(def)->is_available) {
         // this could happen if we've recently disconnected
         LOG_ERROR("Unexpected read response for unavailable attribute (0x%x)", attribute_id);
-        return;
+    } else {
+        is_valid = true;
+    }
+    if (callback) {
+        // the callback is called even for invalid responses so that the caller isn't left waiting on it
+        callback(context, success && is_valid, is_valid ? data : NULL, is_valid ? length : 0);
+    } else if (is_valid) {
+        inst->init.read_complete_handler(inst->init.handle, success, data, length);
     }
-    inst->init.read_complete_handler(inst->init.handle, success, data, length);
 }
 
-void sonar_attribute_client_handle_write_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success) {
+void sonar_attribute_client_handle_write_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success, sonar_attribute_client_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     // handle control attributes explicitly inline here since they aren't registered
     if (attribute_id == CTRL_ATTR_OFFSET_ID) {
         attr_offset_write_complete(inst, success);
         return;
     }
-    const sonar_attribute_def_t* def = get_def_by_id(inst, attribute_id);
+    sonar_attribute_def_t* def = get_def_by_id(inst, attribute_id);
+    bool is_valid = false;
     if (!def || !(def->ops & SONAR_ATTRIBUTE_OPS_W)) {
         // should never happen
         LOG_ERROR("Unexpected write response");
-        return;
+    } else {
+        GET_CONTEXT(def)->is_write_pending = false;
+        if (!GET_CONTEXT(def)->is_available) {
+            // this could happen if we've recently disconnected
+            LOG_ERROR("Unexpected write response for unavailable attribute");
+        } else {
+            is_valid = true;
+        }
+    }
+    if (callback) {
+        // the callback is called even for invalid responses so that the caller isn't left waiting on it
+        callback(context, success && is_valid, NULL, 0);
+    } else if (is_valid) {
+        inst->init.write_complete_handler(inst->init.handle, success);
+    }
+}
+
+uint8_t* sonar_attribute_client_get_notify_buffer(sonar_attribute_client_handle_t handle, uint16_t attribute_id, uint32_t length) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_attribute_def_t* def = get_def_by_id(inst, attribute_id);
+    if (!def) {
+        LOG_ERROR("Got notify request for unknown attribute (0x%x)", attribute_id);
+        return NULL;
+    } else if (!(def->ops & SONAR_ATTRIBUTE_OPS_N)) {
+        LOG_ERROR("Notify request not supported for attribute (0x%x)", attribute_id);
+        return NULL;
+    } else if (length > get_max_notify_size(def)) {
+        LOG_ERROR("Notify request is too big (%"PRIu32") for attribute (0x%x)", length, attribute_id);
+        return NULL;
     } else if (!GET_CONTEXT(def)->is_available) {
-        // this could happen if we've recently disconnected
-        LOG_ERROR("Unexpected write response for unavailable attribute");
-        return;
+        LOG_ERROR("Notify request for an attribute which is not available");
+        return NULL;
     }
-    inst->init.write_complete_handler(inst->init.handle, success);
+    return def->response_buffer;
+}
+
+uint8_t sonar_attribute_client_get_priority(sonar_attribute_client_handle_t handle, uint16_t attribute_id) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_attribute_def_t* def = get_def_by_id(inst, attribute_id);
+    return def ? def->priority : 0;
 }
 
 bool sonar_attribute_client_handle_notify_request(sonar_attribute_client_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
@@ -287,12 +347,22 @@ bool sonar_attribute_client_handle_notify_request(sonar_attribute_client_handle_
     } else if (!(def->ops & SONAR_ATTRIBUTE_OPS_N)) {
         LOG_ERROR("Notify request not supported for attribute (0x%x)", attribute_id);
         return false;
-    } else if (length > def->max_size) {
+    } else if (length > get_max_notify_size(def)) {
         LOG_ERROR("Notify request is too big (%"PRIu32") for attribute (0x%x)", length, attribute_id);
         return false;
     } else if (!GET_CONTEXT(def)->is_available) {
         LOG_ERROR("Notify request for an attribute which is not available");
         return false;
+    } else if (def->delta_buffer) {
+        // decode the delta to get the full value
+        attribute_context_t* context = GET_CONTEXT(def);
+        if (!attribute_delta_decode(data, length, def->delta_buffer, def->max_size, &context->delta_length, context->is_delta_valid)) {
+            LOG_ERROR("Invalid delta notify request for attribute (0x%x)", attribute_id);
+            context->is_delta_valid = false;
+            return false;
+        }
+        context->is_delta_valid = true;
+        return inst->init.notify_handler(inst->init.handle, def, def->delta_buffer, context->delta_length);
     }
     return inst->init.notify_handler(inst->init.handle, def, data, length);
 }
@@ -2,6 +2,7 @@
 
 #include "../application_layer/types.h"
 #include "control_helpers.h"
+#include "delta.h"
 
 #define LOGGING_MODULE_NAME "SONAR"
 #include "anchor/logging/logging.h"
@@ -13,20 +14,48 @@
 typedef struct {
     sonar_attribute_t next;
     bool is_registered;
+    // The number of links which a notify request (using the request buffer) is queued on
+    uint8_t num_notify_pending;
+    // Whether or not the notify request failed on any of the links
+    bool is_notify_failed;
+    // Whether or not the client has acknowledged the value in the delta buffer
+    bool is_delta_valid;
+    uint32_t delta_length;
+    // Whether or not the coalesce buffer holds a value to notify once the pending notify completes
+    bool is_coalesce_pending;
+    // Whether or not a notify is scheduled to be sent once the link is free
+    bool is_notify_scheduled;
+    // Whether or not the pending notify was sent by the scheduler (so the application isn't told when it completes)
+    bool is_scheduled_notify_pending;
+    uint32_t coalesce_length;
 } attribute_context_t;
 _Static_assert(sizeof(attribute_context_t) == sizeof(((sonar_attribute_t)0)->_private), "Invalid size");
 
-typedef struct {
+typedef struct instance_impl instance_impl_t;
+struct instance_impl {
     sonar_attribute_server_init_t init;
     sonar_attribute_t attr_list;
+    // The next instance which shares the attributes of the parent (the parent starts the list)
+    instance_impl_t* next_link;
+    // The scheduled attribute which was most recently notified, which the next one is searched for after (round-robin)
+    sonar_attribute_t schedule_cursor;
     CTRL_NUM_ATTRS_TYPE ctrl_num_attrs;
     CTRL_ATTR_OFFSET_TYPE ctrl_attr_offset;
     CTRL_ATTR_LIST_TYPE ctrl_attr_list;
-} instance_impl_t;
+    bool is_connected;
+    // The attribute whose buffer the last read response was sent from, and whether another link has since overwritten it
+    sonar_attribute_t read_response_attr;
+    bool is_read_response_stale;
+};
 _Static_assert(sizeof(instance_impl_t) == sizeof(sonar_attribute_server_context_t), "Invalid context size");
 
+static instance_impl_t* get_root(instance_impl_t* inst) {
+    // the attributes are registered with (and notifies are sent from) the parent instance if there is one
+    return inst->init.parent ? inst->init.parent : inst;
+}
+
 static sonar_attribute_t get_attr_by_id(instance_impl_t* inst, uint16_t attribute_id) {
-    for (sonar_attribute_t attr = inst->attr_list; attr; attr = GET_CONTEXT(attr)->next) {
+    for (sonar_attribute_t attr = get_root(inst)->attr_list; attr; attr = GET_CONTEXT(attr)->next) {
         if (attr->attribute_id == attribute_id) {
             return attr;
         }
@@ -34,6 +63,28 @@ static sonar_attribute_t get_attr_by_id(instance_impl_t* inst, uint16_t attribut
     return NULL;
 }
 
+static bool is_buffer_in_use_by_other_link(instance_impl_t* inst, sonar_attribute_t attr) {
+    // the links share each attribute's buffer, so only one of them can have a fragmented request using it at a time
+    for (instance_impl_t* link = get_root(inst); link; link = link->next_link) {
+        if (link != inst && link->init.is_fragment_in_progress_function &&
+            link->init.is_fragment_in_progress_function(link->init.handle, attr->attribute_id)) {
+            LOG_ERROR("Attribute (0x%x) is in use by another link", attr->attribute_id);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void claim_buffer(instance_impl_t* inst, sonar_attribute_t attr) {
+    // the links share each attribute's buffer, so any read response which another link sent from it no longer holds the
+    // data which was sent
+    for (instance_impl_t* link = get_root(inst); link; link = link->next_link) {
+        if (link != inst && link->read_response_attr == attr) {
+            link->is_read_response_stale = true;
+        }
+    }
+}
+
 static bool validate_attr_for_notify(instance_impl_t* inst, sonar_attribute_t attr) {
     if (!attr) {
         LOG_ERROR("Unknown attribute");
@@ -44,15 +95,125 @@ static bool validate_attr_for_notify(instance_impl_t* inst, sonar_attribute_t at
     } else if (!GET_CONTEXT(attr)->is_registered) {
         LOG_ERROR("Attribute not registered");
         return false;
+    } else if (GET_CONTEXT(attr)->num_notify_pending && !attr->coalesce_buffer) {
+        LOG_ERROR("Notify request already pending for attribute (0x%x)", attr->attribute_id);
+        return false;
     }
     return true;
 }
 
+static uint8_t* get_notify_buffer(sonar_attribute_t attr) {
+    // the value of a coalesced attribute is held back while another notify is pending
+    return GET_CONTEXT(attr)->num_notify_pending ? attr->coalesce_buffer : attr->request_buffer;
+}
+
+static bool send_notify(instance_impl_t* inst, sonar_attribute_t attr, uint32_t length, sonar_attribute_server_notify_complete_callback_t callback, void* callback_context) {
+    attribute_context_t* context = GET_CONTEXT(attr);
+    if (context->num_notify_pending) {
+        // the value was put into the coalesce buffer (replacing any older one) to be sent once the pending one completes
+        context->is_coalesce_pending = true;
+        context->coalesce_length = length;
+        return true;
+    }
+    if (attr->delta_buffer) {
+        // encode the value as a delta against the last one, which is no longer valid until this notify is acknowledged
+        // (it's never valid with multiple links as they may have acknowledged different values)
+        const uint32_t value_length = length;
+        length = attribute_delta_encode(attr->request_buffer, SONAR_ATTR_DELTA_BUFFER_SIZE(attr->max_size), length, attr->delta_buffer, context->delta_length, context->is_delta_valid);
+        context->delta_length = value_length;
+        context->is_delta_valid = false;
+    }
+    if (!inst->next_link) {
+        if (!inst->init.send_notify_request_function(inst->init.handle, attr->attribute_id, attr->request_buffer, length, callback, callback_context)) {
+            return false;
+        }
+        context->num_notify_pending = 1;
+        context->is_notify_failed = false;
+        return true;
+    }
+    // send the notify to each of the connected links, sharing the request buffer
+    uint8_t num_sent = 0;
+    for (instance_impl_t* link = inst; link; link = link->next_link) {
+        if (link->is_connected && link->init.send_notify_request_function(link->init.handle, attr->attribute_id, attr->request_buffer, length, callback, callback_context)) {
+            num_sent++;
+        }
+    }
+    context->num_notify_pending = num_sent;
+    context->is_notify_failed = false;
+    return num_sent > 0;
+}
+
+static bool can_send_scheduled_notify(instance_impl_t* inst) {
+    if (!inst->init.can_send_notify_request_function) {
+        return true;
+    } else if (!inst->next_link) {
+        return inst->init.can_send_notify_request_function(inst->init.handle);
+    }
+    // scheduled notifies go to all of the connected links, so wait for all of them
+    bool is_any_connected = false;
+    for (instance_impl_t* link = inst; link; link = link->next_link) {
+        if (!link->is_connected) {
+            continue;
+        } else if (!link->init.can_send_notify_request_function(link->init.handle)) {
+            return false;
+        }
+        is_any_connected = true;
+    }
+    return is_any_connected;
+}
+
+static sonar_attribute_t get_next_scheduled_attr(instance_impl_t* inst) {
+    // the highest priority scheduled attribute which doesn't already have a notify pending, with ties going to the
+    // first one after the cursor
+    sonar_attribute_t next_attr = NULL;
+    sonar_attribute_t attr = inst->schedule_cursor ? GET_CONTEXT(inst->schedule_cursor)->next : NULL;
+    for (CTRL_NUM_ATTRS_TYPE i = 0; i < inst->ctrl_num_attrs; i++) {
+        if (!attr) {
+            attr = inst->attr_list;
+        }
+        const attribute_context_t* context = GET_CONTEXT(attr);
+        if (context->is_notify_scheduled && !context->num_notify_pending && (!next_attr || attr->priority > next_attr->priority)) {
+            next_attr = attr;
+        }
+        attr = context->next;
+    }
+    return next_attr;
+}
+
+static void send_scheduled_notifies(instance_impl_t* inst) {
+    while (can_send_scheduled_notify(inst)) {
+        sonar_attribute_t attr = get_next_scheduled_attr(inst);
+        if (!attr) {
+            return;
+        }
+        attribute_context_t* context = GET_CONTEXT(attr);
+        inst->schedule_cursor = attr;
+        // the data is read now so that it's as fresh as possible
+        const uint32_t length = inst->init.read_handler(inst->init.handle, attr, attr->request_buffer, attr->max_size);
+        if (length > attr->max_size) {
+            LOG_ERROR("Notify data is too big");
+            context->is_notify_scheduled = false;
+            continue;
+        } else if (!send_notify(inst, attr, length, NULL, NULL)) {
+            // try again later
+            return;
+        }
+        context->is_notify_scheduled = false;
+        context->is_scheduled_notify_pending = true;
+    }
+}
+
 void sonar_attribute_server_init(sonar_attribute_server_handle_t handle, const sonar_attribute_server_init_t* init) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     *inst = (instance_impl_t){
         .init = *init,
     };
+    if (init->parent) {
+        // add ourselves to the parent's list of links
+        instance_impl_t* parent = init->parent;
+        inst->next_link = parent->next_link;
+        parent->next_link = inst;
+    }
 }
 
 void sonar_attribute_server_register(sonar_attribute_server_handle_t handle, sonar_attribute_t attr) {
@@ -61,7 +222,10 @@ void sonar_attribute_server_register(sonar_attribute_server_handle_t handle, son
         // should never happen as these are all setup by SONAR macros
         LOG_ERROR("Invalid parameters");
         return;
-    } else if (attr->attribute_id & SONAR_APPLICATION_ATTRIBUTE_ID_OP_MASK) {
+    } else if (inst->init.parent) {
+        LOG_ERROR("Attributes must be registered with the parent");
+        return;
+    } else if (attr->attribute_id & ~SONAR_APPLICATION_ATTRIBUTE_ID_ATTRIBUTE_ID_MASK) {
         LOG_ERROR("Invalid attribute ID (0x%x)", attr->attribute_id);
         return;
     } else if (get_attr_by_id(inst, attr->attribute_id)) {
@@ -69,6 +233,7 @@ void sonar_attribute_server_register(sonar_attribute_server_handle_t handle, son
         return;
     }
     GET_CONTEXT(attr)->is_registered = true;
+    GET_CONTEXT(attr)->is_delta_valid = false;
     if (inst->attr_list) {
         // add to the front of the list
         GET_CONTEXT(attr)->next = inst->attr_list;
@@ -79,38 +244,64 @@ void sonar_attribute_server_register(sonar_attribute_server_handle_t handle, son
     inst->ctrl_num_attrs++;
 }
 
-bool sonar_attribute_server_notify(sonar_attribute_server_handle_t handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length) {
-    instance_impl_t* inst = (instance_impl_t*)handle;
+bool sonar_attribute_server_notify(sonar_attribute_server_handle_t handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length, sonar_attribute_server_notify_complete_callback_t callback, void* context) {
+    instance_impl_t* inst = get_root((instance_impl_t*)handle);
     if (!validate_attr_for_notify(inst, attr)) {
         return false;
     } else if (length > attr->max_size) {
         LOG_ERROR("Notify data is too big");
         return false;
+    } else if (callback && attr->coalesce_buffer) {
+        LOG_ERROR("Notify callbacks aren't supported for coalesced attributes (0x%x)", attr->attribute_id);
+        return false;
     }
-    memcpy(attr->request_buffer, data, length);
-    return inst->init.send_notify_request_function(inst->init.handle, attr->attribute_id, attr->request_buffer, length);
+    memcpy(get_notify_buffer(attr), data, length);
+    return send_notify(inst, attr, length, callback, context);
 }
 
 bool sonar_attribute_server_notify_read_data(sonar_attribute_server_handle_t handle, sonar_attribute_t attr) {
-    instance_impl_t* inst = (instance_impl_t*)handle;
+    instance_impl_t* inst = get_root((instance_impl_t*)handle);
     if (!validate_attr_for_notify(inst, attr)) {
         return false;
     } else if (!(attr->ops & SONAR_ATTRIBUTE_OPS_R)) {
         LOG_ERROR("Read request not supported");
         return false;
     }
-    const uint32_t length = inst->init.read_handler(inst->init.handle, attr, attr->request_buffer, attr->max_size);
+    const uint32_t length = inst->init.read_handler(inst->init.handle, attr, get_notify_buffer(attr), attr->max_size);
     if (length > attr->max_size) {
         LOG_ERROR("Notify data is too big");
         return false;
     }
-    return inst->init.send_notify_request_function(inst->init.handle, attr->attribute_id, attr->request_buffer, length);
+    return send_notify(inst, attr, length, NULL, NULL);
+}
+
+bool sonar_attribute_server_notify_schedule(sonar_attribute_server_handle_t handle, sonar_attribute_t attr) {
+    instance_impl_t* inst = get_root((instance_impl_t*)handle);
+    if (!attr) {
+        LOG_ERROR("Unknown attribute");
+        return false;
+    } else if (!(attr->ops & SONAR_ATTRIBUTE_OPS_N) || !(attr->ops & SONAR_ATTRIBUTE_OPS_R)) {
+        LOG_ERROR("Scheduled notify not allowed for attribute (0x%x)", attr->attribute_id);
+        return false;
+    } else if (!GET_CONTEXT(attr)->is_registered) {
+        LOG_ERROR("Attribute not registered");
+        return false;
+    }
+    GET_CONTEXT(attr)->is_notify_scheduled = true;
+    send_scheduled_notifies(inst);
+    return true;
+}
+
+void sonar_attribute_server_process(sonar_attribute_server_handle_t handle) {
+    instance_impl_t* inst = get_root((instance_impl_t*)handle);
+    send_scheduled_notifies(inst);
 }
 
 bool sonar_attribute_server_handle_read_request(sonar_attribute_server_handle_t handle, uint16_t attribute_id) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     // handle control attributes explicitly inline here since they aren't registered
     if (attribute_id == CTRL_NUM_ATTRS_ID) {
+        inst->ctrl_num_attrs = get_root(inst)->ctrl_num_attrs;
         inst->init.read_response_handler(inst->init.handle, (const uint8_t*)&inst->ctrl_num_attrs, sizeof(inst->ctrl_num_attrs));
         return true;
     } else if (attribute_id == CTRL_ATTR_OFFSET_ID) {
@@ -120,13 +311,13 @@ bool sonar_attribute_server_handle_read_request(sonar_attribute_server_handle_t
         memset(inst->ctrl_attr_list, 0, sizeof(inst->ctrl_attr_list));
         uint16_t index = 0;
         uint16_t offset = inst->ctrl_attr_offset;
-        for (sonar_attribute_t attr = inst->attr_list; attr && index < CTRL_ATTR_LIST_LENGTH; attr = GET_CONTEXT(attr)->next) {
+        for (sonar_attribute_t attr = get_root(inst)->attr_list; attr && index < CTRL_ATTR_LIST_LENGTH; attr = GET_CONTEXT(attr)->next) {
             if (offset > 0) {
                 // offset past this one
                 offset--;
                 continue;
             }
-            inst->ctrl_attr_list[index++] = attr->attribute_id | attr->ops;
+            inst->ctrl_attr_list[index++] = attr->attribute_id | attr->ops | (attr->delta_buffer ? CTRL_ATTR_LIST_OP_BIT_DELTA : 0);
         }
         inst->init.read_response_handler(inst->init.handle, (const uint8_t*)inst->ctrl_attr_list, sizeof(inst->ctrl_attr_list));
         return true;
@@ -138,8 +329,13 @@ bool sonar_attribute_server_handle_read_request(sonar_attribute_server_handle_t
     } else if (!(attr->ops & SONAR_ATTRIBUTE_OPS_R)) {
         LOG_ERROR("Read request not supported for attribute (0x%x)", attribute_id);
         return false;
+    } else if (is_buffer_in_use_by_other_link(inst, attr)) {
+        return false;
     }
+    claim_buffer(inst, attr);
     const uint32_t response_size = inst->init.read_handler(inst->init.handle, attr, attr->response_buffer, attr->max_size);
+    inst->read_response_attr = attr;
+    inst->is_read_response_stale = false;
     inst->init.read_response_handler(inst->init.handle, attr->response_buffer, response_size);
     return true;
 }
@@ -170,13 +366,90 @@ bool sonar_attribute_server_handle_write_request(sonar_attribute_server_handle_t
     return inst->init.write_handler(inst->init.handle, attr, data, length);
 }
 
-void sonar_attribute_server_handle_notify_response(sonar_attribute_server_handle_t handle, uint16_t attribute_id, bool success) {
+uint8_t* sonar_attribute_server_get_write_buffer(sonar_attribute_server_handle_t handle, uint16_t attribute_id, uint32_t length) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_attribute_t attr = get_attr_by_id(inst, attribute_id);
+    if (!attr) {
+        LOG_ERROR("Got write request for unknown attribute (0x%x)", attribute_id);
+        return NULL;
+    } else if (!(attr->ops & SONAR_ATTRIBUTE_OPS_W)) {
+        LOG_ERROR("Write request not supported for attribute (0x%x)", attribute_id);
+        return NULL;
+    } else if (length > attr->max_size) {
+        LOG_ERROR("Write request is too big (%"PRIu32") for attribute (0x%x)", length, attribute_id);
+        return NULL;
+    } else if (is_buffer_in_use_by_other_link(inst, attr)) {
+        return NULL;
+    }
+    claim_buffer(inst, attr);
+    return attr->response_buffer;
+}
+
+bool sonar_attribute_server_is_read_response_stale(sonar_attribute_server_handle_t handle, uint16_t attribute_id) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return inst->is_read_response_stale && inst->read_response_attr->attribute_id == attribute_id;
+}
+
+uint8_t sonar_attribute_server_get_priority(sonar_attribute_server_handle_t handle, uint16_t attribute_id) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_attribute_t attr = get_attr_by_id(inst, attribute_id);
+    return attr ? attr->priority : 0;
+}
+
+void sonar_attribute_server_handle_notify_response(sonar_attribute_server_handle_t handle, uint16_t attribute_id, bool success, sonar_attribute_server_notify_complete_callback_t callback, void* callback_context) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     sonar_attribute_t attr = get_attr_by_id(inst, attribute_id);
     if (!attr || !(attr->ops & SONAR_ATTRIBUTE_OPS_N)) {
         // should never happen
         LOG_ERROR("Unexpected notify response");
+        if (callback) {
+            callback(callback_context, false);
+        }
         return;
     }
-    inst->init.notify_complete_handler(inst->init.handle, success);
+    attribute_context_t* context = GET_CONTEXT(attr);
+    context->is_notify_failed |= !success;
+    if (context->num_notify_pending > 1) {
+        // still waiting for other links to respond
+        context->num_notify_pending--;
+        return;
+    }
+    success = !context->is_notify_failed;
+    context->num_notify_pending = 0;
+    context->is_notify_failed = false;
+    instance_impl_t* root = get_root(inst);
+    if (success && attr->delta_buffer && !root->next_link) {
+        context->is_delta_valid = true;
+    }
+    const bool is_scheduled = context->is_scheduled_notify_pending;
+    context->is_scheduled_notify_pending = false;
+    if (context->is_coalesce_pending) {
+        // send the latest value, which supersedes the one which just completed
+        context->is_coalesce_pending = false;
+        memcpy(attr->request_buffer, attr->coalesce_buffer, context->coalesce_length);
+        if (send_notify(root, attr, context->coalesce_length, NULL, NULL)) {
+            send_scheduled_notifies(root);
+            return;
+        }
+        success = false;
+    } else if (is_scheduled) {
+        // the application isn't told about scheduled notifies completing
+        send_scheduled_notifies(root);
+        return;
+    }
+    if (callback) {
+        callback(callback_context, success);
+    } else {
+        root->init.notify_complete_handler(root->init.handle, success);
+    }
+    send_scheduled_notifies(root);
+}
+
+void sonar_attribute_server_connection_changed(sonar_attribute_server_handle_t handle, bool connected) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    inst->is_connected = connected;
+    // the client no longer has the last values of any delta attributes
+    for (sonar_attribute_t attr = get_root(inst)->attr_list; attr; attr = GET_CONTEXT(attr)->next) {
+        GET_CONTEXT(attr)->is_delta_valid = false;
+    }
 }
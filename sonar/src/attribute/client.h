@@ -8,9 +8,12 @@
 #define _SONAR_ATTRIBUTE_CLIENT_CONTEXT_SIZE \
     (sizeof(sonar_attribute_client_init_t) + sizeof(void*) + sizeof(uint32_t) * 2)
 
+// Function prototype for per-request completion callbacks (data is only set for successful read requests)
+typedef void (*sonar_attribute_client_request_complete_callback_t)(void* context, bool success, const void* data, uint32_t length);
+
 typedef struct {
-    bool(*send_read_request_function)(void* handle, uint16_t attribute_id);
-    bool(*send_write_request_function)(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
+    bool(*send_read_request_function)(void* handle, uint16_t attribute_id, uint8_t* buffer, uint32_t buffer_size, sonar_attribute_client_request_complete_callback_t callback, void* context);
+    bool(*send_write_request_function)(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context);
     void(*connection_changed_callback)(void* handle, bool connected);
     void(*read_complete_handler)(void* handle, bool success, const uint8_t* data, uint32_t length);
     void(*write_complete_handler)(void* handle, bool success);
@@ -34,17 +37,25 @@ void sonar_attribute_client_low_level_connection_changed(sonar_attribute_client_
 // Returns whether or not the attribute client is currently connected
 bool sonar_attribute_client_is_connected(sonar_attribute_client_handle_t handle);
 
-// Issue a read request for an attribute
-bool sonar_attribute_client_read(sonar_attribute_client_handle_t handle, sonar_attribute_t attr);
+// Issue a read request for an attribute, with the callback (if specified) being called on completion instead of the
+// read_complete_handler()
+bool sonar_attribute_client_read(sonar_attribute_client_handle_t handle, sonar_attribute_t attr, sonar_attribute_client_request_complete_callback_t callback, void* context);
+
+// Issue a write request for an attribute, with the callback (if specified) being called on completion instead of the
+// write_complete_handler()
+bool sonar_attribute_client_write(sonar_attribute_client_handle_t handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context);
+
+// Handles a received attribute read response, along with the callback and context which the request was sent with
+void sonar_attribute_client_handle_read_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context);
 
-// Issue a write request for an attribute
-bool sonar_attribute_client_write(sonar_attribute_client_handle_t handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length);
+// Handles a received attribute write response, along with the callback and context which the request was sent with
+void sonar_attribute_client_handle_write_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success, sonar_attribute_client_request_complete_callback_t callback, void* context);
 
-// Handles a received attribute read response
-void sonar_attribute_client_handle_read_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length);
+// Gets the buffer to reassemble a fragmented notify request for an attribute into
+uint8_t* sonar_attribute_client_get_notify_buffer(sonar_attribute_client_handle_t handle, uint16_t attribute_id, uint32_t length);
 
-// Handles a received attribute write response
-void sonar_attribute_client_handle_write_response(sonar_attribute_client_handle_t handle, uint16_t attribute_id, bool success);
+// Returns the priority of requests for an attribute (0 if it's unknown)
+uint8_t sonar_attribute_client_get_priority(sonar_attribute_client_handle_t handle, uint16_t attribute_id);
 
 // Handles a received attribute notify request
 bool sonar_attribute_client_handle_notify_request(sonar_attribute_client_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
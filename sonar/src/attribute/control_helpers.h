@@ -5,7 +5,7 @@
 #define CTRL_ATTR_LIST_OP_BIT_READ      (1 << 12)
 #define CTRL_ATTR_LIST_OP_BIT_WRITE     (1 << 13)
 #define CTRL_ATTR_LIST_OP_BIT_NOTIFY    (1 << 14)
-#define CTRL_ATTR_LIST_OP_BIT_RESERVED  (1 << 15)
+#define CTRL_ATTR_LIST_OP_BIT_DELTA     (1 << 15)
 
 #define CTRL_ATTR_LIST_LENGTH           8
 typedef uint16_t ctrl_attr_list_t[CTRL_ATTR_LIST_LENGTH];
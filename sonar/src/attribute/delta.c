@@ -0,0 +1,98 @@
+#include "delta.h"
+
+#include <string.h>
+
+static uint32_t encode_full(uint8_t* buffer, const uint8_t* value, uint32_t length) {
+    memmove(&buffer[1], value, length);
+    buffer[0] = ATTRIBUTE_DELTA_TYPE_FULL;
+    return length + 1;
+}
+
+uint32_t attribute_delta_encode(uint8_t* buffer, uint32_t buffer_size, uint32_t length, uint8_t* base, uint32_t base_length, bool is_base_valid) {
+    if (!is_base_valid) {
+        memcpy(base, buffer, length);
+        return encode_full(buffer, base, length);
+    }
+
+    // XOR the new value against the base in place, while updating the base to the new value
+    const uint32_t num_blocks = (length + ATTRIBUTE_DELTA_BLOCK_SIZE - 1) / ATTRIBUTE_DELTA_BLOCK_SIZE;
+    uint32_t encoded_length = ATTRIBUTE_DELTA_XOR_HEADER_SIZE + num_blocks;
+    for (uint32_t i = 0; i < length; i++) {
+        const uint8_t old_value = i < base_length ? base[i] : 0;
+        base[i] = buffer[i];
+        buffer[i] ^= old_value;
+        if (buffer[i]) {
+            encoded_length++;
+        }
+    }
+    if (encoded_length >= length + 1) {
+        // not worth sending a delta
+        return encode_full(buffer, base, length);
+    }
+
+    // move the XORed value to the end of the buffer and then encode it from the front - the slack required in the
+    // buffer guarantees that we never write past the start of the block we're currently reading
+    const uint32_t read_offset = buffer_size - length;
+    memmove(&buffer[read_offset], buffer, length);
+    buffer[0] = ATTRIBUTE_DELTA_TYPE_XOR;
+    memcpy(&buffer[1], &length, sizeof(length));
+    uint32_t write_offset = ATTRIBUTE_DELTA_XOR_HEADER_SIZE;
+    for (uint32_t i = 0; i < length; i += ATTRIBUTE_DELTA_BLOCK_SIZE) {
+        uint8_t block[ATTRIBUTE_DELTA_BLOCK_SIZE];
+        const uint32_t block_length = length - i < ATTRIBUTE_DELTA_BLOCK_SIZE ? length - i : ATTRIBUTE_DELTA_BLOCK_SIZE;
+        memcpy(block, &buffer[read_offset + i], block_length);
+        uint8_t* bitmap = &buffer[write_offset++];
+        *bitmap = 0;
+        for (uint32_t j = 0; j < block_length; j++) {
+            if (block[j]) {
+                *bitmap |= 1 << j;
+                buffer[write_offset++] = block[j];
+            }
+        }
+    }
+    return write_offset;
+}
+
+bool attribute_delta_decode(const uint8_t* data, uint32_t length, uint8_t* base, uint32_t base_size, uint32_t* base_length, bool is_base_valid) {
+    if (length < 1) {
+        return false;
+    } else if (data[0] == ATTRIBUTE_DELTA_TYPE_FULL) {
+        if (length - 1 > base_size) {
+            return false;
+        }
+        memcpy(base, &data[1], length - 1);
+        *base_length = length - 1;
+        return true;
+    } else if (data[0] != ATTRIBUTE_DELTA_TYPE_XOR || !is_base_valid || length < ATTRIBUTE_DELTA_XOR_HEADER_SIZE) {
+        return false;
+    }
+
+    uint32_t new_length;
+    memcpy(&new_length, &data[1], sizeof(new_length));
+    if (new_length > base_size) {
+        return false;
+    } else if (new_length > *base_length) {
+        // the base is treated as zero beyond its length
+        memset(&base[*base_length], 0, new_length - *base_length);
+    }
+    uint32_t offset = ATTRIBUTE_DELTA_XOR_HEADER_SIZE;
+    for (uint32_t i = 0; i < new_length; i += ATTRIBUTE_DELTA_BLOCK_SIZE) {
+        if (offset == length) {
+            return false;
+        }
+        const uint8_t bitmap = data[offset++];
+        for (uint32_t j = 0; j < ATTRIBUTE_DELTA_BLOCK_SIZE; j++) {
+            if (!(bitmap & (1 << j))) {
+                continue;
+            } else if (i + j >= new_length || offset == length) {
+                return false;
+            }
+            base[i + j] ^= data[offset++];
+        }
+    }
+    if (offset != length) {
+        return false;
+    }
+    *base_length = new_length;
+    return true;
+}
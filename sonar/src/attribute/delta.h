@@ -0,0 +1,21 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// The first byte of a notify request for a delta attribute specifies how the rest of the data is encoded
+#define ATTRIBUTE_DELTA_TYPE_FULL       0x00
+#define ATTRIBUTE_DELTA_TYPE_XOR        0x01
+
+// A XOR delta is the type, the new length (uint32_t), and then a bitmap of the changed bytes in each 8-byte block of
+// the value followed by those bytes XORed with the base value (which is treated as zero beyond its length)
+#define ATTRIBUTE_DELTA_XOR_HEADER_SIZE (1 + sizeof(uint32_t))
+#define ATTRIBUTE_DELTA_BLOCK_SIZE      8
+
+// Encodes the value in the buffer in place as either a full value or a XOR delta against the base (whichever is
+// smaller), returning the encoded length and updating the base to be the new value
+// NOTE: the buffer must be at least SONAR_ATTR_DELTA_BUFFER_SIZE(length) bytes
+uint32_t attribute_delta_encode(uint8_t* buffer, uint32_t buffer_size, uint32_t length, uint8_t* base, uint32_t base_length, bool is_base_valid);
+
+// Decodes the encoded data into the base, returning false if it's invalid or doesn't fit in the base
+bool attribute_delta_decode(const uint8_t* data, uint32_t length, uint8_t* base, uint32_t base_size, uint32_t* base_length, bool is_base_valid);
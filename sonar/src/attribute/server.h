@@ -6,15 +6,27 @@
 #include <stdbool.h>
 
 #define _SONAR_ATTRIBUTE_SERVER_CONTEXT_SIZE \
-    (sizeof(sonar_attribute_server_init_t) + sizeof(void*) + sizeof(uintptr_t) + sizeof(uint16_t) * 8)
+    (sizeof(sonar_attribute_server_init_t) + sizeof(void*) * 4 + sizeof(uintptr_t) + sizeof(uint16_t) * 12)
+
+// Function prototype for per-request notify completion callbacks
+typedef void (*sonar_attribute_server_notify_complete_callback_t)(void* context, bool success);
 
 typedef struct {
-    bool (*send_notify_request_function)(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
+    bool (*send_notify_request_function)(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_attribute_server_notify_complete_callback_t callback, void* context);
+    // Returns whether or not a notify request would be sent right away, which is when scheduled notifies are sent
+    // (optional - assumed to always be true)
+    bool (*can_send_notify_request_function)(void* handle);
     void (*read_response_handler)(void* handle, const uint8_t* data, uint32_t length);
     uint32_t (*read_handler)(void* handle, sonar_attribute_t attr, void* response_data, uint32_t response_max_size);
     bool (*write_handler)(void* handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length);
     void (*notify_complete_handler)(void* handle, bool success);
+    // Returns whether or not a fragmented request for an attribute is in progress, which is using the attribute's
+    // buffer (optional - only needed when the attributes are shared with other links)
+    bool (*is_fragment_in_progress_function)(void* handle, uint16_t attribute_id);
     void* handle;
+    // Another attribute server whose attributes this one shares rather than registering its own, which then sends
+    // notifies to both (optional)
+    void* parent;
 } sonar_attribute_server_init_t;
 
 // The handle is a pointer to a pre-allocated context type (to be accessed by the SONAR implementation only)
@@ -27,17 +39,37 @@ void sonar_attribute_server_init(sonar_attribute_server_handle_t handle, const s
 // Register an implementation for an attribute supported by the server
 void sonar_attribute_server_register(sonar_attribute_server_handle_t handle, sonar_attribute_t attribute);
 
-// Issue a notify request for an attribute
-bool sonar_attribute_server_notify(sonar_attribute_server_handle_t handle, sonar_attribute_t attribute, const uint8_t* data, uint32_t length);
+// Issue a notify request for an attribute, with the callback (if specified) being called once it completes (on all links)
+// instead of the notify_complete_handler()
+// NOTE: callbacks aren't supported for coalesced attributes, as their notifies may be superseded
+bool sonar_attribute_server_notify(sonar_attribute_server_handle_t handle, sonar_attribute_t attribute, const uint8_t* data, uint32_t length, sonar_attribute_server_notify_complete_callback_t callback, void* context);
 
 // Issue a notify request for an attribute, using the data returned by calling the read handlers
 bool sonar_attribute_server_notify_read_data(sonar_attribute_server_handle_t handle, sonar_attribute_t attribute);
 
+// Schedule a notify request for an attribute, using the data returned by calling the read handlers when it's sent
+bool sonar_attribute_server_notify_schedule(sonar_attribute_server_handle_t handle, sonar_attribute_t attribute);
+
+// Sends any scheduled notify requests which can now be sent - should be called regularly
+void sonar_attribute_server_process(sonar_attribute_server_handle_t handle);
+
 // Handles a received attribute read reqyest
 bool sonar_attribute_server_handle_read_request(sonar_attribute_server_handle_t handle, uint16_t attribute_id);
 
 // Handles a received attribute write request
 bool sonar_attribute_server_handle_write_request(sonar_attribute_server_handle_t handle, uint16_t attribute_id, const uint8_t* data, uint32_t length);
 
-// Handles a received attribute notify response
-void sonar_attribute_server_handle_notify_response(sonar_attribute_server_handle_t handle, uint16_t attribute_id, bool success);
+// Returns whether or not another link has overwritten the attribute's buffer since the last read response was sent from it
+bool sonar_attribute_server_is_read_response_stale(sonar_attribute_server_handle_t handle, uint16_t attribute_id);
+
+// Gets the buffer to reassemble a fragmented write request for an attribute into
+uint8_t* sonar_attribute_server_get_write_buffer(sonar_attribute_server_handle_t handle, uint16_t attribute_id, uint32_t length);
+
+// Returns the priority of requests for an attribute (0 if it's unknown)
+uint8_t sonar_attribute_server_get_priority(sonar_attribute_server_handle_t handle, uint16_t attribute_id);
+
+// Handles a received attribute notify response, along with the callback and context which the request was sent with
+void sonar_attribute_server_handle_notify_response(sonar_attribute_server_handle_t handle, uint16_t attribute_id, bool success, sonar_attribute_server_notify_complete_callback_t callback, void* context);
+
+// Called when the connection status changes
+void sonar_attribute_server_connection_changed(sonar_attribute_server_handle_t handle, bool connected);
@@ -7,6 +7,8 @@
 #define LOGGING_MODULE_NAME "SONAR"
 #include "anchor/logging/logging.h"
 
+#include <stddef.h>
+
 typedef struct {
     sonar_client_init_t init;
     sonar_link_layer_context_t link_layer_context;
@@ -20,7 +22,8 @@ _Static_assert(sizeof(instance_impl_t) == sizeof(((sonar_client_context_t*)0)->_
 
 static void link_layer_connection_changed_handler(void* handle, bool connected) {
     instance_impl_t* inst = handle;
-    return sonar_attribute_client_low_level_connection_changed(inst->attr_client_handle, connected);
+    sonar_application_layer_connection_changed(inst->application_layer_handle, connected);
+    sonar_attribute_client_low_level_connection_changed(inst->attr_client_handle, connected);
 }
 
 static bool link_layer_request_handler(void* handle, const uint8_t* data, uint32_t length) {
@@ -37,6 +40,18 @@ static bool application_layer_send_data_function(void* handle, const buffer_chai
     return sonar_link_layer_send_request(handle, data);
 }
 
+static bool application_layer_can_send_data_function(void* handle) {
+    return sonar_link_layer_can_send_request(handle);
+}
+
+static bool application_layer_can_compress_data_function(void* handle) {
+    return sonar_link_layer_is_compression_enabled(handle);
+}
+
+static uint32_t application_layer_get_max_packet_size_function(void* handle) {
+    return sonar_link_layer_get_max_packet_size(handle);
+}
+
 static void application_layer_set_response_function(void* handle, const uint8_t* data, uint32_t length) {
     return sonar_link_layer_set_response(handle, data, length);
 }
@@ -57,22 +72,30 @@ static bool application_layer_attribute_notify_handler(void* handle, uint16_t at
     return sonar_attribute_client_handle_notify_request(handle, attribute_id, data, length);
 }
 
-static void attribute_client_handle_read_response(void* handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length) {
-    sonar_attribute_client_handle_read_response(handle, attribute_id, success, data, length);
+static void attribute_client_handle_read_response(void* handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length, sonar_application_layer_request_complete_callback_t callback, void* context) {
+    sonar_attribute_client_handle_read_response(handle, attribute_id, success, data, length, (sonar_attribute_client_request_complete_callback_t)callback, context);
+}
+
+static uint8_t application_layer_attribute_priority_handler(void* handle, uint16_t attribute_id) {
+    return sonar_attribute_client_get_priority(handle, attribute_id);
+}
+
+static uint8_t* application_layer_attribute_buffer_handler(void* handle, uint16_t attribute_id, uint32_t length) {
+    return sonar_attribute_client_get_notify_buffer(handle, attribute_id, length);
 }
 
-static bool attribute_client_send_read_request_function(void* handle, uint16_t attribute_id) {
+static bool attribute_client_send_read_request_function(void* handle, uint16_t attribute_id, uint8_t* buffer, uint32_t buffer_size, sonar_attribute_client_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = handle;
-    return sonar_application_layer_read_request(inst->application_layer_handle, attribute_id);
+    return sonar_application_layer_read_request(inst->application_layer_handle, attribute_id, buffer, buffer_size, (sonar_application_layer_request_complete_callback_t)callback, context);
 }
 
-static void attribute_client_handle_write_response(void* handle, uint16_t attribute_id, bool success) {
-    sonar_attribute_client_handle_write_response(handle, attribute_id, success);
+static void attribute_client_handle_write_response(void* handle, uint16_t attribute_id, bool success, sonar_application_layer_request_complete_callback_t callback, void* context) {
+    sonar_attribute_client_handle_write_response(handle, attribute_id, success, (sonar_attribute_client_request_complete_callback_t)callback, context);
 }
 
-static bool attribute_client_send_write_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
+static bool attribute_client_send_write_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context) {
     instance_impl_t* inst = handle;
-    return sonar_application_layer_write_request(inst->application_layer_handle, attribute_id, data, length);
+    return sonar_application_layer_write_request(inst->application_layer_handle, attribute_id, data, length, (sonar_application_layer_request_complete_callback_t)callback, context);
 }
 
 static void attribute_client_connection_changed_callback(void* handle, bool connected) {
@@ -106,14 +129,32 @@ void sonar_client_init(sonar_client_handle_t handle, const sonar_client_init_t*
     const sonar_link_layer_init_t init_link_layer = {
         .config = {
             .is_server = false,
+            .window_size = init->window_size,
+            .enable_piggyback = init->enable_piggyback,
+            .min_retry_interval_ms = init->min_retry_interval_ms,
+            .max_retry_interval_ms = init->max_retry_interval_ms,
+            .enable_aggregation = init->enable_aggregation,
+            .aggregation_delay_ms = init->aggregation_delay_ms,
+            .enable_cobs = init->enable_cobs,
+            .enable_compression = init->enable_compression,
+            .enable_fragmentation = init->enable_fragmentation,
         },
         .buffers = {
             .receive = handle->receive_buffer,
             .receive_size = handle->receive_buffer_size,
+            .transmit = handle->transmit_buffer,
+            .transmit_size = handle->transmit_buffer_size,
+            .retransmit_request = handle->retransmit_cache,
+            .retransmit_response = handle->retransmit_cache ? &handle->retransmit_cache[handle->retransmit_cache_size] : NULL,
+            .retransmit_size = handle->retransmit_cache_size,
+            .transmit_ring = handle->transmit_ring,
+            .transmit_ring_size = handle->transmit_ring_size,
         },
         .functions = {
             .get_system_time_ms = init->get_system_time_ms,
             .write_byte = init->write_byte,
+            .write_bytes = init->write_bytes,
+            .start_tx = init->start_tx,
         },
         .handlers = {
             .connection_changed = link_layer_connection_changed_handler,
@@ -138,16 +179,24 @@ void sonar_client_init(sonar_client_handle_t handle, const sonar_client_init_t*
     const sonar_application_layer_init_t init_application_layer = {
         .is_server = false,
         .send_data_function = application_layer_send_data_function,
+        .can_send_data_function = application_layer_can_send_data_function,
+        .can_compress_data_function = application_layer_can_compress_data_function,
         .set_response_function = application_layer_set_response_function,
         .send_data_handle = inst->link_layer_handle,
         .attribute_read_handler = application_layer_attribute_read_handler,
         .attribute_write_handler = application_layer_attribute_write_handler,
         .attribute_notify_handler = application_layer_attribute_notify_handler,
+        .attribute_buffer_handler = application_layer_attribute_buffer_handler,
+        .attribute_priority_handler = application_layer_attribute_priority_handler,
         .attr_handler_handle = inst->attr_client_handle,
 
         .read_request_complete_handler = attribute_client_handle_read_response,
         .write_request_complete_handler = attribute_client_handle_write_response,
         .request_complete_handle = inst->attr_client_handle,
+        .get_max_packet_size_function = application_layer_get_max_packet_size_function,
+        .compression_buffer = handle->compression_buffer_size ? handle->compression_buffer : NULL,
+        .compression_buffer_size = handle->compression_buffer_size,
+        .max_priority_overtakes = init->max_priority_overtakes,
     };
     sonar_application_layer_init(inst->application_layer_handle, &init_application_layer);
 }
@@ -161,6 +210,35 @@ void sonar_client_process(sonar_client_handle_t handle, const uint8_t* received_
     instance_impl_t* inst = (instance_impl_t*)handle;
     sonar_link_layer_handle_receive_data(inst->link_layer_handle, received_data, received_data_length);
     sonar_link_layer_process(inst->link_layer_handle);
+    sonar_application_layer_process(inst->application_layer_handle);
+    sonar_link_layer_flush(inst->link_layer_handle);
+}
+
+void sonar_client_process_rx_ring(sonar_client_handle_t handle, sonar_rx_ring_handle_t ring) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    // the data may wrap around the end of the ring, in which case it's handled as two contiguous spans
+    for (uint32_t i = 0; i < 2; i++) {
+        const uint8_t* data;
+        const uint32_t length = sonar_rx_ring_peek(ring, &data);
+        if (!length) {
+            break;
+        }
+        sonar_link_layer_handle_receive_data(inst->link_layer_handle, data, length);
+        sonar_rx_ring_consume(ring, length);
+    }
+    sonar_link_layer_process(inst->link_layer_handle);
+    sonar_application_layer_process(inst->application_layer_handle);
+    sonar_link_layer_flush(inst->link_layer_handle);
+}
+
+uint64_t sonar_client_get_next_deadline_ms(sonar_client_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return sonar_link_layer_get_next_deadline_ms(inst->link_layer_handle);
+}
+
+void sonar_client_tx_complete(sonar_client_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_link_layer_tx_complete(inst->link_layer_handle);
 }
 
 void sonar_client_register(sonar_client_handle_t handle, sonar_attribute_t attr) {
@@ -170,12 +248,30 @@ void sonar_client_register(sonar_client_handle_t handle, sonar_attribute_t attr)
 
 bool sonar_client_read(sonar_client_handle_t handle, sonar_attribute_t attr) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    return sonar_attribute_client_read(inst->attr_client_handle, attr);
+    return sonar_attribute_client_read(inst->attr_client_handle, attr, NULL, NULL);
 }
 
 bool sonar_client_write(sonar_client_handle_t handle, sonar_attribute_t attr, const void* data, uint32_t length) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    return sonar_attribute_client_write(inst->attr_client_handle, attr, data, length);
+    return sonar_attribute_client_write(inst->attr_client_handle, attr, data, length, NULL, NULL);
+}
+
+bool sonar_client_read_with_callback(sonar_client_handle_t handle, sonar_attribute_t attr, sonar_client_request_complete_callback_t callback, void* context) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!callback) {
+        LOG_ERROR("Invalid callback");
+        return false;
+    }
+    return sonar_attribute_client_read(inst->attr_client_handle, attr, callback, context);
+}
+
+bool sonar_client_write_with_callback(sonar_client_handle_t handle, sonar_attribute_t attr, const void* data, uint32_t length, sonar_client_request_complete_callback_t callback, void* context) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!callback) {
+        LOG_ERROR("Invalid callback");
+        return false;
+    }
+    return sonar_attribute_client_write(inst->attr_client_handle, attr, data, length, callback, context);
 }
 
 void sonar_client_get_and_clear_errors(sonar_client_handle_t handle, sonar_errors_t* errors) {
@@ -198,3 +294,14 @@ void sonar_client_get_and_clear_errors(sonar_client_handle_t handle, sonar_error
         },
     };
 }
+
+void sonar_client_get_rtt(sonar_client_handle_t handle, sonar_rtt_t* rtt) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_link_layer_rtt_t link_layer_rtt;
+    sonar_link_layer_get_rtt(inst->link_layer_handle, &link_layer_rtt);
+    *rtt = (sonar_rtt_t){
+        .srtt_ms = link_layer_rtt.srtt_ms,
+        .rttvar_ms = link_layer_rtt.rttvar_ms,
+        .retry_interval_ms = link_layer_rtt.retry_interval_ms,
+    };
+}
@@ -1,7 +1,19 @@
 #pragma once
 
+#include "anchor/sonar/sonar_config.h"
+
 #include <inttypes.h>
 
 #define CRC16_INITIAL_VALUE UINT16_C(0xffff)
 
+// Computes the CRC16 (CCITT-FALSE) of the data using the backend selected by SONAR_CRC16_BACKEND
 uint16_t crc16(const uint8_t* data, uint32_t length, uint16_t crc);
+
+// The individual backends are also exposed for testing and benchmarking. Unless SONAR_CRC16_ALL_BACKENDS is
+// defined, only the selected backend (and any it depends on) is compiled in. All backends produce identical output.
+uint16_t crc16_bitwise(const uint8_t* data, uint32_t length, uint16_t crc);
+uint16_t crc16_table(const uint8_t* data, uint32_t length, uint16_t crc);
+uint16_t crc16_slicing_by_4(const uint8_t* data, uint32_t length, uint16_t crc);
+uint16_t crc16_slicing_by_8(const uint8_t* data, uint32_t length, uint16_t crc);
+// Uses carry-less multiplication (PCLMULQDQ) if supported by the CPU at runtime, otherwise falls back to slicing-by-8
+uint16_t crc16_clmul(const uint8_t* data, uint32_t length, uint16_t crc);
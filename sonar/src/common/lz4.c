@@ -0,0 +1,162 @@
+#include "lz4.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// The hash table holds 16-bit positions, so this uses 2 << LZ4_HASH_BITS bytes of stack
+#ifndef LZ4_HASH_BITS
+#define LZ4_HASH_BITS 8
+#endif
+
+#define MIN_MATCH       4
+// The LZ4 block format requires the last 5 bytes to be literals and the last match to start at least 12 bytes before
+// the end, which lets decoders copy in chunks
+#define LAST_LITERALS   5
+#define MF_LIMIT        12
+#define MAX_OFFSET      UINT16_MAX
+#define RUN_MASK        0x0f
+
+static uint32_t read32(const uint8_t* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint32_t get_hash(uint32_t value) {
+    return (value * UINT32_C(2654435761)) >> (32 - LZ4_HASH_BITS);
+}
+
+static bool write_length(uint8_t* buffer, uint32_t buffer_size, uint32_t* offset, uint32_t length) {
+    // writes the extra bytes of a literal / match length which didn't fit in the token
+    for (; length >= 0xff; length -= 0xff) {
+        if (*offset == buffer_size) {
+            return false;
+        }
+        buffer[(*offset)++] = 0xff;
+    }
+    if (*offset == buffer_size) {
+        return false;
+    }
+    buffer[(*offset)++] = length;
+    return true;
+}
+
+static bool write_sequence(uint8_t* buffer, uint32_t buffer_size, uint32_t* offset, const uint8_t* literals, uint32_t num_literals, uint32_t match_offset, uint32_t match_length) {
+    // a match_length of 0 means this is the last sequence, which only has literals
+    if (*offset == buffer_size) {
+        return false;
+    }
+    uint8_t* token = &buffer[(*offset)++];
+    *token = (num_literals < RUN_MASK ? num_literals : RUN_MASK) << 4;
+    if (num_literals >= RUN_MASK && !write_length(buffer, buffer_size, offset, num_literals - RUN_MASK)) {
+        return false;
+    } else if (num_literals > buffer_size - *offset) {
+        return false;
+    }
+    memcpy(&buffer[*offset], literals, num_literals);
+    *offset += num_literals;
+    if (!match_length) {
+        return true;
+    }
+    if (buffer_size - *offset < 2) {
+        return false;
+    }
+    buffer[(*offset)++] = match_offset & 0xff;
+    buffer[(*offset)++] = match_offset >> 8;
+    match_length -= MIN_MATCH;
+    *token |= match_length < RUN_MASK ? match_length : RUN_MASK;
+    return match_length < RUN_MASK || write_length(buffer, buffer_size, offset, match_length - RUN_MASK);
+}
+
+static bool read_length(const uint8_t* data, uint32_t length, uint32_t* offset, uint32_t max_value, uint32_t* value) {
+    // reads the extra bytes of a literal / match length (failing if it's larger than max_value)
+    uint8_t byte;
+    do {
+        if (*offset == length) {
+            return false;
+        }
+        byte = data[(*offset)++];
+        *value += byte;
+        if (*value > max_value) {
+            return false;
+        }
+    } while (byte == 0xff);
+    return true;
+}
+
+uint32_t lz4_compress(const uint8_t* data, uint32_t length, uint8_t* buffer, uint32_t buffer_size) {
+    if (!length || length > UINT16_MAX) {
+        return 0;
+    }
+    // positions are stored plus 1, so that 0 means the entry is empty
+    uint16_t hash_table[1 << LZ4_HASH_BITS] = {0};
+    uint32_t offset = 0;
+    uint32_t anchor = 0;
+    uint32_t pos = 0;
+    while (length >= MF_LIMIT && pos <= length - MF_LIMIT) {
+        const uint32_t value = read32(&data[pos]);
+        const uint32_t hash = get_hash(value);
+        const uint32_t candidate = hash_table[hash];
+        hash_table[hash] = pos + 1;
+        if (!candidate || read32(&data[candidate - 1]) != value) {
+            pos++;
+            continue;
+        }
+        // extend the match as far as possible
+        const uint32_t match_pos = candidate - 1;
+        uint32_t match_length = MIN_MATCH;
+        while (pos + match_length < length - LAST_LITERALS && data[match_pos + match_length] == data[pos + match_length]) {
+            match_length++;
+        }
+        if (!write_sequence(buffer, buffer_size, &offset, &data[anchor], pos - anchor, pos - match_pos, match_length)) {
+            return 0;
+        }
+        pos += match_length;
+        anchor = pos;
+    }
+    if (!write_sequence(buffer, buffer_size, &offset, &data[anchor], length - anchor, 0, 0)) {
+        return 0;
+    }
+    return offset;
+}
+
+uint32_t lz4_decompress(const uint8_t* data, uint32_t length, uint8_t* buffer, uint32_t buffer_size) {
+    uint32_t offset = 0;
+    uint32_t buffer_offset = 0;
+    while (offset < length) {
+        const uint8_t token = data[offset++];
+        uint32_t num_literals = token >> 4;
+        if (num_literals == RUN_MASK && !read_length(data, length, &offset, buffer_size, &num_literals)) {
+            return 0;
+        } else if (num_literals > length - offset || num_literals > buffer_size - buffer_offset) {
+            return 0;
+        }
+        memcpy(&buffer[buffer_offset], &data[offset], num_literals);
+        offset += num_literals;
+        buffer_offset += num_literals;
+        if (offset == length) {
+            // the last sequence only has literals
+            break;
+        } else if (length - offset < 2) {
+            return 0;
+        }
+        const uint32_t match_offset = data[offset] | (data[offset + 1] << 8);
+        offset += 2;
+        if (!match_offset || match_offset > buffer_offset) {
+            return 0;
+        }
+        uint32_t match_length = token & RUN_MASK;
+        if (match_length == RUN_MASK && !read_length(data, length, &offset, buffer_size, &match_length)) {
+            return 0;
+        }
+        match_length += MIN_MATCH;
+        if (match_length > buffer_size - buffer_offset) {
+            return 0;
+        }
+        // the match can overlap the data being written, so copy it one byte at a time
+        for (uint32_t i = 0; i < match_length; i++, buffer_offset++) {
+            buffer[buffer_offset] = buffer[buffer_offset - match_offset];
+        }
+    }
+    return buffer_offset;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <inttypes.h>
+
+// Compresses the data into an LZ4 block, returning the compressed length, or 0 if it doesn't fit in the buffer or the
+// data is empty or longer than UINT16_MAX bytes
+// NOTE: this uses a (1 << LZ4_HASH_BITS) entry hash table on the stack to find matches
+uint32_t lz4_compress(const uint8_t* data, uint32_t length, uint8_t* buffer, uint32_t buffer_size);
+
+// Decompresses an LZ4 block into the buffer, returning the decompressed length, or 0 if the block is invalid or doesn't
+// fit in the buffer
+uint32_t lz4_decompress(const uint8_t* data, uint32_t length, uint8_t* buffer, uint32_t buffer_size);
@@ -0,0 +1,111 @@
+#include "anchor/sonar/rx_ring.h"
+
+#define LOGGING_MODULE_NAME "SONAR"
+#include "anchor/logging/logging.h"
+
+#include <string.h>
+
+// The ring indexes are shared between the producer and consumer, so need to be accessed with acquire / release
+// semantics. C11 atomics are used where available. Otherwise, we fall back to volatile accesses with compiler barriers,
+// which is only sufficient for a producer and consumer running on the same core (i.e. an ISR and the main loop).
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef _Atomic uint32_t ring_index_t;
+#define LOAD_ACQUIRE(PTR) atomic_load_explicit(PTR, memory_order_acquire)
+#define LOAD_RELAXED(PTR) atomic_load_explicit(PTR, memory_order_relaxed)
+#define STORE_RELEASE(PTR, VALUE) atomic_store_explicit(PTR, VALUE, memory_order_release)
+#define STORE_RELAXED(PTR, VALUE) atomic_store_explicit(PTR, VALUE, memory_order_relaxed)
+#else
+#if defined(__GNUC__)
+#define COMPILER_BARRIER() __asm__ volatile("" ::: "memory")
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define COMPILER_BARRIER() _ReadWriteBarrier()
+#else
+#error "Unsupported compiler"
+#endif
+typedef volatile uint32_t ring_index_t;
+static inline uint32_t load_acquire(const ring_index_t* ptr) {
+    const uint32_t value = *ptr;
+    COMPILER_BARRIER();
+    return value;
+}
+static inline void store_release(ring_index_t* ptr, uint32_t value) {
+    COMPILER_BARRIER();
+    *ptr = value;
+}
+#define LOAD_ACQUIRE(PTR) load_acquire(PTR)
+#define LOAD_RELAXED(PTR) (*(PTR))
+#define STORE_RELEASE(PTR, VALUE) store_release(PTR, VALUE)
+#define STORE_RELAXED(PTR, VALUE) (*(PTR) = (VALUE))
+#endif
+
+typedef struct {
+    uint8_t* buffer;
+    uint32_t size;
+    // The index which the producer writes the next byte to (only written by the producer)
+    ring_index_t head;
+    // The index which the consumer reads the next byte from (only written by the consumer)
+    ring_index_t tail;
+} instance_impl_t;
+_Static_assert(sizeof(instance_impl_t) == sizeof(sonar_rx_ring_t), "Invalid context size");
+
+void sonar_rx_ring_init(sonar_rx_ring_handle_t handle, uint8_t* buffer, uint32_t size) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (size < 2) {
+        LOG_ERROR("Ring must be at least 2 bytes");
+        size = 0;
+    }
+    inst->buffer = buffer;
+    inst->size = size;
+    STORE_RELAXED(&inst->head, 0);
+    STORE_RELAXED(&inst->tail, 0);
+}
+
+uint32_t sonar_rx_ring_push(sonar_rx_ring_handle_t handle, const uint8_t* data, uint32_t length) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!inst->size) {
+        return 0;
+    }
+    const uint32_t head = LOAD_RELAXED(&inst->head);
+    const uint32_t tail = LOAD_ACQUIRE(&inst->tail);
+    // leave one byte free so that a full ring can be told apart from an empty one
+    const uint32_t free_length = (tail > head ? tail - head : inst->size - head + tail) - 1;
+    if (length > free_length) {
+        length = free_length;
+    }
+    // copy the data in (wrapping around the end of the buffer as necessary)
+    const uint32_t first_length = length < inst->size - head ? length : inst->size - head;
+    memcpy(&inst->buffer[head], data, first_length);
+    memcpy(inst->buffer, &data[first_length], length - first_length);
+    uint32_t new_head = head + length;
+    if (new_head >= inst->size) {
+        new_head -= inst->size;
+    }
+    // publish the data to the consumer
+    STORE_RELEASE(&inst->head, new_head);
+    return length;
+}
+
+bool sonar_rx_ring_push_byte(sonar_rx_ring_handle_t handle, uint8_t byte) {
+    return sonar_rx_ring_push(handle, &byte, sizeof(byte)) == sizeof(byte);
+}
+
+uint32_t sonar_rx_ring_peek(sonar_rx_ring_handle_t handle, const uint8_t** data) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    const uint32_t head = LOAD_ACQUIRE(&inst->head);
+    const uint32_t tail = LOAD_RELAXED(&inst->tail);
+    *data = &inst->buffer[tail];
+    // the span ends at the head or the end of the buffer, whichever comes first
+    return head >= tail ? head - tail : inst->size - tail;
+}
+
+void sonar_rx_ring_consume(sonar_rx_ring_handle_t handle, uint32_t length) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    uint32_t tail = LOAD_RELAXED(&inst->tail) + length;
+    if (tail >= inst->size) {
+        tail -= inst->size;
+    }
+    // release the space back to the producer
+    STORE_RELEASE(&inst->tail, tail);
+}
@@ -0,0 +1,332 @@
+#include "anchor/sonar/host/event_loop.h"
+
+#define LOGGING_MODULE_NAME "SONAR"
+#include "anchor/logging/logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+#define RECEIVE_CHUNK_SIZE 512
+
+typedef struct {
+    int epoll_fd;
+    uint32_t num_links;
+} loop_impl_t;
+_Static_assert(sizeof(loop_impl_t) == sizeof(sonar_host_loop_context_t), "Invalid loop context size");
+
+typedef struct link_impl link_impl_t;
+
+typedef struct {
+    // The link which the event is for (the source is the link's fd or timer fd based on which field this is)
+    link_impl_t* link;
+} event_source_t;
+
+struct link_impl {
+    sonar_host_link_init_t init;
+    loop_impl_t* loop;
+    event_source_t fd_source;
+    event_source_t timer_source;
+    // The deadline which the timer fd is currently armed with (UINT64_MAX if disarmed)
+    uint64_t armed_deadline_ms;
+    int timer_fd;
+    bool is_open;
+    // Sockets are written with send() so that a closed peer doesn't raise SIGPIPE
+    bool is_socket;
+    // The fd was full the last time it was written, so frames are dropped until epoll reports that it's writable again
+    bool is_write_blocked;
+};
+_Static_assert(sizeof(link_impl_t) == sizeof(sonar_host_link_context_t), "Invalid link context size");
+
+// The SONAR write_bytes() function and client callbacks don't take a handle, so the loop tracks the link which it's
+// currently calling into (per thread so that multiple loops can be run on separate threads)
+static _Thread_local link_impl_t* m_current_link;
+
+static link_impl_t* enter_link(link_impl_t* link) {
+    link_impl_t* prev_link = m_current_link;
+    m_current_link = link;
+    return prev_link;
+}
+
+static void update_timer(link_impl_t* link) {
+    const uint64_t deadline_ms = link->init.server ?
+        sonar_server_get_next_deadline_ms(link->init.server) :
+        sonar_client_get_next_deadline_ms(link->init.client);
+    if (deadline_ms == link->armed_deadline_ms) {
+        return;
+    }
+    // an absolute deadline which has already passed fires right away, and a zero value disarms the timer
+    struct itimerspec spec = {0};
+    if (deadline_ms != UINT64_MAX) {
+        const uint64_t value_ms = deadline_ms ? deadline_ms : 1;
+        spec.it_value.tv_sec = value_ms / 1000;
+        spec.it_value.tv_nsec = (value_ms % 1000) * 1000000;
+    }
+    if (timerfd_settime(link->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        LOG_ERROR("Failed to set timer (%d)", errno);
+        return;
+    }
+    link->armed_deadline_ms = deadline_ms;
+}
+
+static void process_link(link_impl_t* link, const uint8_t* data, uint32_t length) {
+    if (link->init.server) {
+        sonar_server_process(link->init.server, data, length);
+    } else {
+        sonar_client_process(link->init.client, data, length);
+    }
+}
+
+static void close_link(link_impl_t* link) {
+    link->is_open = false;
+    epoll_ctl(link->loop->epoll_fd, EPOLL_CTL_DEL, link->init.fd, NULL);
+}
+
+static void set_write_blocked(link_impl_t* link, bool is_write_blocked) {
+    // only wait for the fd to be writable while there's something which couldn't be written
+    struct epoll_event fd_event = {
+        .events = is_write_blocked ? (EPOLLIN | EPOLLOUT) : EPOLLIN,
+        .data.ptr = &link->fd_source,
+    };
+    if (epoll_ctl(link->loop->epoll_fd, EPOLL_CTL_MOD, link->init.fd, &fd_event) < 0) {
+        LOG_ERROR("Failed to update link in epoll (%d)", errno);
+    }
+    link->is_write_blocked = is_write_blocked;
+}
+
+static void receive_data(link_impl_t* link) {
+    uint8_t buffer[RECEIVE_CHUNK_SIZE];
+    bool did_process = false;
+    while (link->is_open) {
+        const ssize_t result = read(link->init.fd, buffer, sizeof(buffer));
+        if (result > 0) {
+            process_link(link, buffer, result);
+            did_process = true;
+        } else if (result == 0) {
+            LOG_ERROR("Link was closed");
+            close_link(link);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            LOG_ERROR("Failed to read from the link (%d)", errno);
+            close_link(link);
+        }
+    }
+    if (!did_process) {
+        process_link(link, NULL, 0);
+    }
+}
+
+static void handle_event(const struct epoll_event* event) {
+    event_source_t* source = event->data.ptr;
+    link_impl_t* link = source->link;
+    link_impl_t* prev_link = enter_link(link);
+    if (source == &link->timer_source) {
+        // clear the timer and process the link for its deadline
+        uint64_t num_expirations;
+        (void)!read(link->timer_fd, &num_expirations, sizeof(num_expirations));
+        link->armed_deadline_ms = UINT64_MAX;
+        process_link(link, NULL, 0);
+    } else {
+        if ((event->events & EPOLLOUT) && link->is_write_blocked && link->is_open) {
+            // the link layer retries whatever was dropped, so just start writing frames again
+            set_write_blocked(link, false);
+        }
+        if (event->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            receive_data(link);
+        }
+    }
+    update_timer(link);
+    enter_link(prev_link);
+}
+
+bool sonar_host_loop_init(sonar_host_loop_handle_t handle) {
+    loop_impl_t* inst = (loop_impl_t*)handle;
+    *inst = (loop_impl_t){0};
+    inst->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (inst->epoll_fd < 0) {
+        LOG_ERROR("Failed to create epoll instance (%d)", errno);
+        return false;
+    }
+    return true;
+}
+
+void sonar_host_loop_deinit(sonar_host_loop_handle_t handle) {
+    loop_impl_t* inst = (loop_impl_t*)handle;
+    if (inst->num_links) {
+        LOG_ERROR("Links must be removed first");
+    }
+    close(inst->epoll_fd);
+    inst->epoll_fd = -1;
+}
+
+bool sonar_host_loop_add_link(sonar_host_loop_handle_t handle, sonar_host_link_handle_t link, const sonar_host_link_init_t* init) {
+    loop_impl_t* inst = (loop_impl_t*)handle;
+    link_impl_t* link_inst = (link_impl_t*)link;
+    if (!init->client == !init->server) {
+        LOG_ERROR("Exactly one of client / server must be set");
+        return false;
+    }
+    *link_inst = (link_impl_t){
+        .init = *init,
+        .loop = inst,
+        .fd_source = { .link = link_inst },
+        .timer_source = { .link = link_inst },
+        .armed_deadline_ms = UINT64_MAX,
+        .is_open = true,
+    };
+
+    const int flags = fcntl(init->fd, F_GETFL);
+    if (flags < 0 || fcntl(init->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOG_ERROR("Failed to make the link non-blocking (%d)", errno);
+        return false;
+    }
+    struct stat fd_stat;
+    link_inst->is_socket = fstat(init->fd, &fd_stat) == 0 && S_ISSOCK(fd_stat.st_mode);
+    link_inst->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (link_inst->timer_fd < 0) {
+        LOG_ERROR("Failed to create timer (%d)", errno);
+        return false;
+    }
+    struct epoll_event fd_event = { .events = EPOLLIN, .data.ptr = &link_inst->fd_source };
+    struct epoll_event timer_event = { .events = EPOLLIN, .data.ptr = &link_inst->timer_source };
+    if (epoll_ctl(inst->epoll_fd, EPOLL_CTL_ADD, init->fd, &fd_event) < 0 ||
+        epoll_ctl(inst->epoll_fd, EPOLL_CTL_ADD, link_inst->timer_fd, &timer_event) < 0) {
+        LOG_ERROR("Failed to add link to epoll (%d)", errno);
+        epoll_ctl(inst->epoll_fd, EPOLL_CTL_DEL, init->fd, NULL);
+        close(link_inst->timer_fd);
+        return false;
+    }
+    inst->num_links++;
+
+    // process the link right away so that it gets going (i.e. a client starts connecting)
+    link_impl_t* prev_link = enter_link(link_inst);
+    process_link(link_inst, NULL, 0);
+    update_timer(link_inst);
+    enter_link(prev_link);
+    return true;
+}
+
+void sonar_host_loop_remove_link(sonar_host_loop_handle_t handle, sonar_host_link_handle_t link) {
+    loop_impl_t* inst = (loop_impl_t*)handle;
+    link_impl_t* link_inst = (link_impl_t*)link;
+    if (link_inst->is_open) {
+        close_link(link_inst);
+    }
+    close(link_inst->timer_fd);
+    link_inst->timer_fd = -1;
+    inst->num_links--;
+}
+
+bool sonar_host_loop_run(sonar_host_loop_handle_t handle, int timeout_ms) {
+    loop_impl_t* inst = (loop_impl_t*)handle;
+    struct epoll_event events[MAX_EVENTS];
+    const int num_events = epoll_wait(inst->epoll_fd, events, MAX_EVENTS, timeout_ms < 0 ? -1 : timeout_ms);
+    if (num_events < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        LOG_ERROR("Failed to wait for events (%d)", errno);
+        return false;
+    }
+    for (int i = 0; i < num_events; i++) {
+        handle_event(&events[i]);
+    }
+    return true;
+}
+
+sonar_host_link_handle_t sonar_host_loop_get_current_link(void) {
+    return (sonar_host_link_handle_t)m_current_link;
+}
+
+void sonar_host_loop_write_bytes(const uint8_t* data, uint32_t length) {
+    link_impl_t* link = m_current_link;
+    if (!link) {
+        LOG_ERROR("Write outside of the event loop");
+        return;
+    }
+    if (link->is_write_blocked) {
+        // still waiting for the fd to be writable
+        return;
+    }
+    while (length && link->is_open) {
+        const ssize_t result = link->is_socket ?
+            send(link->init.fd, data, length, MSG_NOSIGNAL) :
+            write(link->init.fd, data, length);
+        if (result > 0) {
+            data += result;
+            length -= result;
+        } else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the peer isn't keeping up, and blocking here would stall every other link in the loop, so drop the rest
+            // of the frame (which the receiver discards as it fails its CRC) and let the link layer retry it
+            LOG_WARN("Dropping %"PRIu32" bytes which couldn't be written to the link", length);
+            set_write_blocked(link, true);
+            return;
+        } else if (result < 0 && errno != EINTR) {
+            LOG_ERROR("Failed to write to the link (%d)", errno);
+            close_link(link);
+        }
+    }
+}
+
+uint64_t sonar_host_loop_get_system_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void* sonar_host_link_get_handle(sonar_host_link_handle_t link) {
+    link_impl_t* link_inst = (link_impl_t*)link;
+    return link_inst->init.handle;
+}
+
+bool sonar_host_link_is_open(sonar_host_link_handle_t link) {
+    link_impl_t* link_inst = (link_impl_t*)link;
+    return link_inst->is_open;
+}
+
+bool sonar_host_link_client_read(sonar_host_link_handle_t link, sonar_attribute_t attr) {
+    link_impl_t* link_inst = (link_impl_t*)link;
+    if (!link_inst->init.client) {
+        LOG_ERROR("Not a client link");
+        return false;
+    }
+    link_impl_t* prev_link = enter_link(link_inst);
+    const bool result = sonar_client_read(link_inst->init.client, attr);
+    update_timer(link_inst);
+    enter_link(prev_link);
+    return result;
+}
+
+bool sonar_host_link_client_write(sonar_host_link_handle_t link, sonar_attribute_t attr, const void* data, uint32_t length) {
+    link_impl_t* link_inst = (link_impl_t*)link;
+    if (!link_inst->init.client) {
+        LOG_ERROR("Not a client link");
+        return false;
+    }
+    link_impl_t* prev_link = enter_link(link_inst);
+    const bool result = sonar_client_write(link_inst->init.client, attr, data, length);
+    update_timer(link_inst);
+    enter_link(prev_link);
+    return result;
+}
+
+bool sonar_host_link_server_notify(sonar_host_link_handle_t link, sonar_server_attribute_t attr, const void* data, uint32_t length) {
+    link_impl_t* link_inst = (link_impl_t*)link;
+    if (!link_inst->init.server) {
+        LOG_ERROR("Not a server link");
+        return false;
+    }
+    link_impl_t* prev_link = enter_link(link_inst);
+    const bool result = sonar_server_notify(link_inst->init.server, attr, data, length);
+    update_timer(link_inst);
+    enter_link(prev_link);
+    return result;
+}
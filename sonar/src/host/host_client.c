@@ -0,0 +1,512 @@
+#include "anchor/sonar/host/client.h"
+
+#define LOGGING_MODULE_NAME "SONAR"
+#include "anchor/logging/logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GET_REQUEST_NEXT(REQUEST) ((_Atomic(sonar_host_client_request_t*)*)&(REQUEST)->_private[0])
+#define GET_REQUEST_IS_WRITE(REQUEST) ((bool)(uintptr_t)(REQUEST)->_private[1])
+#define SET_REQUEST_IS_WRITE(REQUEST, IS_WRITE) ((REQUEST)->_private[1] = (void*)(uintptr_t)(IS_WRITE))
+
+#define RECEIVE_CHUNK_SIZE 512
+// How long to wait for the link to accept more data before dropping the rest of the frame (which the link layer then
+// retries)
+#define WRITE_TIMEOUT_MS 100
+
+typedef struct {
+    sonar_host_client_init_t init;
+    pthread_t thread;
+    // Protects starting / stopping against requests being queued from other threads
+    pthread_mutex_t mutex;
+    // Requests are pushed onto the tail of the queue by any thread and popped from the head by the I/O thread, with the
+    // stub keeping the queue non-empty (an intrusive MPSC queue)
+    sonar_host_client_request_t queue_stub;
+    _Atomic(sonar_host_client_request_t*) queue_tail;
+    sonar_host_client_request_t* queue_head;
+    // Requests which have been popped from the queue but not yet passed to the client (I/O thread only)
+    sonar_host_client_request_t* waiting_head;
+    sonar_host_client_request_t* waiting_tail;
+    // Requests which have been passed to the client, which may complete them out of order if they have different
+    // priorities (I/O thread only)
+    sonar_host_client_request_t* in_flight_head;
+    sonar_host_client_request_t* in_flight_tail;
+    uint32_t num_in_flight;
+    int event_fd;
+    bool is_started;
+    bool is_fd_open;
+    atomic_bool is_stopping;
+    atomic_bool is_connected;
+} instance_impl_t;
+_Static_assert(sizeof(instance_impl_t) == sizeof(sonar_host_client_context_t), "Invalid context size");
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool is_complete;
+    bool success;
+} sync_request_t;
+
+// The SONAR client callbacks don't take a handle, so each I/O thread tracks the instance which it's running
+static _Thread_local instance_impl_t* m_current_inst;
+
+static sonar_host_client_request_t* get_next(sonar_host_client_request_t* request) {
+    return atomic_load_explicit(GET_REQUEST_NEXT(request), memory_order_relaxed);
+}
+
+static void set_next(sonar_host_client_request_t* request, sonar_host_client_request_t* next) {
+    atomic_store_explicit(GET_REQUEST_NEXT(request), next, memory_order_relaxed);
+}
+
+static void queue_push(instance_impl_t* inst, sonar_host_client_request_t* request) {
+    set_next(request, NULL);
+    sonar_host_client_request_t* prev = atomic_exchange_explicit(&inst->queue_tail, request, memory_order_acq_rel);
+    // the request isn't visible to the I/O thread until it's linked in
+    atomic_store_explicit(GET_REQUEST_NEXT(prev), request, memory_order_release);
+}
+
+static sonar_host_client_request_t* queue_pop(instance_impl_t* inst) {
+    sonar_host_client_request_t* head = inst->queue_head;
+    sonar_host_client_request_t* next = atomic_load_explicit(GET_REQUEST_NEXT(head), memory_order_acquire);
+    if (head == &inst->queue_stub) {
+        if (!next) {
+            return NULL;
+        }
+        // skip over the stub
+        inst->queue_head = next;
+        head = next;
+        next = atomic_load_explicit(GET_REQUEST_NEXT(head), memory_order_acquire);
+    }
+    if (next) {
+        inst->queue_head = next;
+        return head;
+    } else if (head != atomic_load_explicit(&inst->queue_tail, memory_order_acquire)) {
+        // a push is in progress, which will wake us up again once it's linked in
+        return NULL;
+    }
+    // this is the last request, so push the stub back on behind it before popping it
+    queue_push(inst, &inst->queue_stub);
+    next = atomic_load_explicit(GET_REQUEST_NEXT(head), memory_order_acquire);
+    if (next) {
+        inst->queue_head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static void list_push(sonar_host_client_request_t** head, sonar_host_client_request_t** tail, sonar_host_client_request_t* request) {
+    set_next(request, NULL);
+    if (*tail) {
+        set_next(*tail, request);
+    } else {
+        *head = request;
+    }
+    *tail = request;
+}
+
+static sonar_host_client_request_t* list_pop(sonar_host_client_request_t** head, sonar_host_client_request_t** tail) {
+    sonar_host_client_request_t* request = *head;
+    if (request) {
+        *head = get_next(request);
+        if (!*head) {
+            *tail = NULL;
+        }
+    }
+    return request;
+}
+
+static void list_remove(sonar_host_client_request_t** head, sonar_host_client_request_t** tail, sonar_host_client_request_t* request) {
+    sonar_host_client_request_t* prev = NULL;
+    for (sonar_host_client_request_t* entry = *head; entry; prev = entry, entry = get_next(entry)) {
+        if (entry != request) {
+            continue;
+        }
+        if (prev) {
+            set_next(prev, get_next(request));
+        } else {
+            *head = get_next(request);
+        }
+        if (*tail == request) {
+            *tail = prev;
+        }
+        return;
+    }
+}
+
+static void fail_in_flight_requests(instance_impl_t* inst) {
+    sonar_host_client_request_t* request;
+    while ((request = list_pop(&inst->in_flight_head, &inst->in_flight_tail))) {
+        inst->num_in_flight--;
+        request->complete_handler(request, false);
+    }
+}
+
+static bool has_in_flight_write(instance_impl_t* inst, sonar_attribute_t attr) {
+    for (sonar_host_client_request_t* request = inst->in_flight_head; request; request = get_next(request)) {
+        if (GET_REQUEST_IS_WRITE(request) && request->attr == attr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void request_complete_callback(void* context, bool success, const void* data, uint32_t length) {
+    instance_impl_t* inst = m_current_inst;
+    sonar_host_client_request_t* request = context;
+    list_remove(&inst->in_flight_head, &inst->in_flight_tail, request);
+    inst->num_in_flight--;
+    if (!GET_REQUEST_IS_WRITE(request)) {
+        if (success && length > request->length) {
+            LOG_ERROR("Read response is too big (%"PRIu32")", length);
+            success = false;
+        } else if (success) {
+            memcpy(request->data, data, length);
+            request->length = length;
+        }
+    }
+    request->complete_handler(request, success);
+}
+
+static void send_waiting_requests(instance_impl_t* inst) {
+    sonar_host_client_request_t* request;
+    while ((request = inst->waiting_head)) {
+        if (atomic_load_explicit(&inst->is_connected, memory_order_relaxed)) {
+            // the client's queue can only hold so many requests, and only one write per attribute can be pending, so
+            // hold the request (and all the ones after it to keep them in order) until there's space
+            if (inst->num_in_flight == SONAR_REQUEST_QUEUE_SIZE ||
+                (GET_REQUEST_IS_WRITE(request) && has_in_flight_write(inst, request->attr))) {
+                return;
+            }
+        }
+        list_pop(&inst->waiting_head, &inst->waiting_tail);
+        // the request is tracked as in flight before it's passed to the client in case its callback is called right away
+        list_push(&inst->in_flight_head, &inst->in_flight_tail, request);
+        inst->num_in_flight++;
+        bool success = false;
+        if (!atomic_load_explicit(&inst->is_connected, memory_order_relaxed)) {
+            LOG_ERROR("Not connected");
+        } else if (GET_REQUEST_IS_WRITE(request)) {
+            success = sonar_client_write_with_callback(inst->init.client, request->attr, request->data, request->length, request_complete_callback, request);
+        } else {
+            success = sonar_client_read_with_callback(inst->init.client, request->attr, request_complete_callback, request);
+        }
+        if (!success) {
+            list_remove(&inst->in_flight_head, &inst->in_flight_tail, request);
+            inst->num_in_flight--;
+            request->complete_handler(request, false);
+        }
+    }
+}
+
+static uint64_t get_system_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void wake_thread(instance_impl_t* inst) {
+    const uint64_t value = 1;
+    (void)!write(inst->event_fd, &value, sizeof(value));
+}
+
+static void write_bytes(const uint8_t* data, uint32_t length) {
+    instance_impl_t* inst = m_current_inst;
+    const uint64_t deadline_ms = get_system_time_ms() + WRITE_TIMEOUT_MS;
+    bool was_woken = false;
+    while (length && inst->is_fd_open) {
+        const ssize_t result = write(inst->init.fd, data, length);
+        if (result > 0) {
+            data += result;
+            length -= result;
+        } else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // wait for there to be space to write the rest, but not forever and not once we're being stopped
+            const uint64_t time_ms = get_system_time_ms();
+            if (time_ms >= deadline_ms || atomic_load_explicit(&inst->is_stopping, memory_order_acquire)) {
+                LOG_WARN("Dropping %"PRIu32" bytes which couldn't be written to the link", length);
+                break;
+            }
+            struct pollfd pfds[2] = {
+                { .fd = inst->init.fd, .events = POLLOUT },
+                { .fd = inst->event_fd, .events = POLLIN },
+            };
+            if (poll(pfds, 2, (int)(deadline_ms - time_ms)) > 0 && (pfds[1].revents & POLLIN)) {
+                uint64_t value;
+                (void)!read(inst->event_fd, &value, sizeof(value));
+                was_woken = true;
+            }
+        } else if (result < 0 && errno != EINTR) {
+            LOG_ERROR("Failed to write to the link (%d)", errno);
+            inst->is_fd_open = false;
+        }
+    }
+    if (was_woken) {
+        // the wakeup was consumed above, so re-arm it for the I/O loop to pick up any queued requests
+        wake_thread(inst);
+    }
+}
+
+static void connection_changed_callback(bool connected) {
+    instance_impl_t* inst = m_current_inst;
+    atomic_store_explicit(&inst->is_connected, connected, memory_order_relaxed);
+    if (!connected) {
+        // any requests which were in flight won't be completed by the client
+        fail_in_flight_requests(inst);
+    }
+    if (inst->init.connection_changed_callback) {
+        inst->init.connection_changed_callback(inst->init.handle, connected);
+    }
+}
+
+static void attribute_read_complete_handler(bool success, const void* data, uint32_t length) {
+    // should never happen as all of our requests have their own callback
+    LOG_ERROR("Unexpected read complete");
+}
+
+static void attribute_write_complete_handler(bool success) {
+    // should never happen as all of our requests have their own callback
+    LOG_ERROR("Unexpected write complete");
+}
+
+static bool attribute_notify_handler(sonar_attribute_t attr, const void* data, uint32_t length) {
+    instance_impl_t* inst = m_current_inst;
+    if (!inst->init.attribute_notify_handler) {
+        return false;
+    }
+    return inst->init.attribute_notify_handler(inst->init.handle, attr, data, length);
+}
+
+static void receive_data(instance_impl_t* inst) {
+    uint8_t buffer[RECEIVE_CHUNK_SIZE];
+    while (inst->is_fd_open) {
+        const ssize_t result = read(inst->init.fd, buffer, sizeof(buffer));
+        if (result > 0) {
+            sonar_client_process(inst->init.client, buffer, result);
+        } else if (result == 0) {
+            LOG_ERROR("Link was closed");
+            inst->is_fd_open = false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else if (errno != EINTR) {
+            LOG_ERROR("Failed to read from the link (%d)", errno);
+            inst->is_fd_open = false;
+        }
+    }
+}
+
+static void* thread_function(void* arg) {
+    instance_impl_t* inst = arg;
+    m_current_inst = inst;
+    while (!atomic_load_explicit(&inst->is_stopping, memory_order_acquire)) {
+        // wait for data to be received, a request to be queued, or the client's next deadline
+        const uint64_t deadline_ms = sonar_client_get_next_deadline_ms(inst->init.client);
+        const uint64_t time_ms = get_system_time_ms();
+        int timeout_ms = -1;
+        if (deadline_ms != UINT64_MAX) {
+            timeout_ms = deadline_ms > time_ms ? (int)(deadline_ms - time_ms) : 0;
+        }
+        struct pollfd pfds[2] = {
+            { .fd = inst->event_fd, .events = POLLIN },
+            { .fd = inst->is_fd_open ? inst->init.fd : -1, .events = POLLIN },
+        };
+        if (poll(pfds, 2, timeout_ms) < 0 && errno != EINTR) {
+            LOG_ERROR("Failed to poll (%d)", errno);
+            break;
+        }
+        if (pfds[0].revents & POLLIN) {
+            uint64_t value;
+            (void)!read(inst->event_fd, &value, sizeof(value));
+        }
+        if (pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            receive_data(inst);
+        }
+        // pass any newly-queued requests to the client before processing so they're sent right away
+        sonar_host_client_request_t* request;
+        while ((request = queue_pop(inst))) {
+            list_push(&inst->waiting_head, &inst->waiting_tail, request);
+        }
+        send_waiting_requests(inst);
+        sonar_client_process(inst->init.client, NULL, 0);
+        send_waiting_requests(inst);
+    }
+    return NULL;
+}
+
+static bool queue_request(sonar_host_client_handle_t handle, sonar_host_client_request_t* request, bool is_write) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!request->complete_handler) {
+        LOG_ERROR("Request has no complete handler");
+        return false;
+    }
+    SET_REQUEST_IS_WRITE(request, is_write);
+    // push the request while holding the lock so that sonar_host_client_stop() either rejects it here or drains it
+    pthread_mutex_lock(&inst->mutex);
+    const bool is_running = inst->is_started && !atomic_load_explicit(&inst->is_stopping, memory_order_relaxed);
+    if (is_running) {
+        queue_push(inst, request);
+        wake_thread(inst);
+    }
+    pthread_mutex_unlock(&inst->mutex);
+    if (!is_running) {
+        LOG_ERROR("Not running");
+        return false;
+    }
+    return true;
+}
+
+static void sync_complete_handler(sonar_host_client_request_t* request, bool success) {
+    sync_request_t* sync_request = request->handle;
+    pthread_mutex_lock(&sync_request->mutex);
+    sync_request->is_complete = true;
+    sync_request->success = success;
+    pthread_cond_signal(&sync_request->cond);
+    pthread_mutex_unlock(&sync_request->mutex);
+}
+
+static bool run_sync_request(sonar_host_client_handle_t handle, sonar_host_client_request_t* request, bool is_write) {
+    sync_request_t sync_request = {
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+    request->complete_handler = sync_complete_handler;
+    request->handle = &sync_request;
+    if (!queue_request(handle, request, is_write)) {
+        return false;
+    }
+    pthread_mutex_lock(&sync_request.mutex);
+    while (!sync_request.is_complete) {
+        pthread_cond_wait(&sync_request.cond, &sync_request.mutex);
+    }
+    pthread_mutex_unlock(&sync_request.mutex);
+    pthread_cond_destroy(&sync_request.cond);
+    pthread_mutex_destroy(&sync_request.mutex);
+    return sync_request.success;
+}
+
+bool sonar_host_client_init(sonar_host_client_handle_t handle, const sonar_host_client_init_t* init) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    *inst = (instance_impl_t){
+        .init = *init,
+        .queue_head = &inst->queue_stub,
+        .is_fd_open = true,
+    };
+    pthread_mutex_init(&inst->mutex, NULL);
+    atomic_init(&inst->queue_tail, &inst->queue_stub);
+    atomic_init(&inst->is_stopping, false);
+    atomic_init(&inst->is_connected, false);
+
+    const int flags = fcntl(init->fd, F_GETFL);
+    if (flags < 0 || fcntl(init->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOG_ERROR("Failed to make the link non-blocking (%d)", errno);
+        return false;
+    }
+    inst->event_fd = eventfd(0, EFD_NONBLOCK);
+    if (inst->event_fd < 0) {
+        LOG_ERROR("Failed to create eventfd (%d)", errno);
+        return false;
+    }
+
+    sonar_client_init_t init_client = init->client_init;
+    init_client.write_byte = NULL;
+    init_client.write_bytes = write_bytes;
+    init_client.start_tx = NULL;
+    init_client.get_system_time_ms = get_system_time_ms;
+    init_client.connection_changed_callback = connection_changed_callback;
+    init_client.attribute_read_complete_handler = attribute_read_complete_handler;
+    init_client.attribute_write_complete_handler = attribute_write_complete_handler;
+    init_client.attribute_notify_handler = attribute_notify_handler;
+    sonar_client_init(inst->init.client, &init_client);
+    return true;
+}
+
+void sonar_host_client_register(sonar_host_client_handle_t handle, sonar_attribute_t attr) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_client_register(inst->init.client, attr);
+}
+
+bool sonar_host_client_start(sonar_host_client_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    pthread_mutex_lock(&inst->mutex);
+    if (inst->is_started) {
+        pthread_mutex_unlock(&inst->mutex);
+        LOG_ERROR("Already started");
+        return false;
+    }
+    const int result = pthread_create(&inst->thread, NULL, thread_function, inst);
+    inst->is_started = !result;
+    pthread_mutex_unlock(&inst->mutex);
+    if (result) {
+        LOG_ERROR("Failed to create thread (%d)", result);
+        return false;
+    }
+    return true;
+}
+
+void sonar_host_client_stop(sonar_host_client_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    pthread_mutex_lock(&inst->mutex);
+    if (!inst->is_started) {
+        pthread_mutex_unlock(&inst->mutex);
+        return;
+    }
+    // no more requests can be queued once this is set
+    atomic_store_explicit(&inst->is_stopping, true, memory_order_release);
+    pthread_mutex_unlock(&inst->mutex);
+    wake_thread(inst);
+    pthread_join(inst->thread, NULL);
+    pthread_mutex_lock(&inst->mutex);
+    inst->is_started = false;
+    pthread_mutex_unlock(&inst->mutex);
+    close(inst->event_fd);
+
+    // fail any requests which didn't complete
+    fail_in_flight_requests(inst);
+    sonar_host_client_request_t* request;
+    while ((request = queue_pop(inst))) {
+        list_push(&inst->waiting_head, &inst->waiting_tail, request);
+    }
+    while ((request = list_pop(&inst->waiting_head, &inst->waiting_tail))) {
+        request->complete_handler(request, false);
+    }
+}
+
+bool sonar_host_client_is_connected(sonar_host_client_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return atomic_load_explicit(&inst->is_connected, memory_order_relaxed);
+}
+
+bool sonar_host_client_read(sonar_host_client_handle_t handle, sonar_host_client_request_t* request) {
+    return queue_request(handle, request, false);
+}
+
+bool sonar_host_client_write(sonar_host_client_handle_t handle, sonar_host_client_request_t* request) {
+    return queue_request(handle, request, true);
+}
+
+bool sonar_host_client_read_sync(sonar_host_client_handle_t handle, sonar_attribute_t attr, void* data, uint32_t* length) {
+    sonar_host_client_request_t request = {
+        .attr = attr,
+        .data = data,
+        .length = *length,
+    };
+    if (!run_sync_request(handle, &request, false)) {
+        return false;
+    }
+    *length = request.length;
+    return true;
+}
+
+bool sonar_host_client_write_sync(sonar_host_client_handle_t handle, sonar_attribute_t attr, const void* data, uint32_t length) {
+    sonar_host_client_request_t request = {
+        .attr = attr,
+        .data = (void*)data,
+        .length = length,
+    };
+    return run_sync_request(handle, &request, true);
+}
@@ -0,0 +1,113 @@
+#include "encoding.h"
+
+#include "types.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FIND_SPECIAL_IMPL find_special_avx2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FIND_SPECIAL_IMPL find_special_sse2
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+#define FIND_SPECIAL_IMPL find_special_neon
+#else
+#define FIND_SPECIAL_IMPL sonar_link_layer_encoding_find_special_portable
+#endif
+
+// SWAR helpers which operate on a native word at a time
+#if UINTPTR_MAX > UINT32_MAX
+typedef uint64_t word_t;
+#else
+typedef uint32_t word_t;
+#endif
+#define WORD_REPEAT_BYTE(BYTE) ((word_t)-1 / 0xff * (BYTE))
+
+static inline bool is_special(uint8_t byte) {
+    return byte == SONAR_ENCODING_FLAG_BYTE || byte == SONAR_ENCODING_ESCAPE_BYTE;
+}
+
+static inline bool word_has_zero_byte(word_t word) {
+    // this can only have false positives for bytes after a real zero byte, so is exact for checking the whole word
+    return (word - WORD_REPEAT_BYTE(0x01)) & ~word & WORD_REPEAT_BYTE(0x80);
+}
+
+static uint32_t find_special_scalar(const uint8_t* data, uint32_t start, uint32_t length) {
+    for (uint32_t i = start; i < length; i++) {
+        if (is_special(data[i])) {
+            return i;
+        }
+    }
+    return length;
+}
+
+uint32_t sonar_link_layer_encoding_find_special_portable(const uint8_t* data, uint32_t length) {
+    uint32_t i = 0;
+    for (; i + sizeof(word_t) <= length; i += sizeof(word_t)) {
+        word_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        if (word_has_zero_byte(word ^ WORD_REPEAT_BYTE(SONAR_ENCODING_FLAG_BYTE)) ||
+            word_has_zero_byte(word ^ WORD_REPEAT_BYTE(SONAR_ENCODING_ESCAPE_BYTE))) {
+            // the special byte is within this word
+            return find_special_scalar(data, i, i + sizeof(word_t));
+        }
+    }
+    return find_special_scalar(data, i, length);
+}
+
+#if defined(__AVX2__)
+static uint32_t find_special_avx2(const uint8_t* data, uint32_t length) {
+    const __m256i flag = _mm256_set1_epi8(SONAR_ENCODING_FLAG_BYTE);
+    const __m256i escape = _mm256_set1_epi8(SONAR_ENCODING_ESCAPE_BYTE);
+    uint32_t i = 0;
+    for (; i + sizeof(__m256i) <= length; i += sizeof(__m256i)) {
+        const __m256i block = _mm256_loadu_si256((const __m256i*)&data[i]);
+        const __m256i matches = _mm256_or_si256(_mm256_cmpeq_epi8(block, flag), _mm256_cmpeq_epi8(block, escape));
+        const uint32_t mask = (uint32_t)_mm256_movemask_epi8(matches);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + sonar_link_layer_encoding_find_special_portable(&data[i], length - i);
+}
+#elif defined(__SSE2__)
+static uint32_t find_special_sse2(const uint8_t* data, uint32_t length) {
+    const __m128i flag = _mm_set1_epi8(SONAR_ENCODING_FLAG_BYTE);
+    const __m128i escape = _mm_set1_epi8(SONAR_ENCODING_ESCAPE_BYTE);
+    uint32_t i = 0;
+    for (; i + sizeof(__m128i) <= length; i += sizeof(__m128i)) {
+        const __m128i block = _mm_loadu_si128((const __m128i*)&data[i]);
+        const __m128i matches = _mm_or_si128(_mm_cmpeq_epi8(block, flag), _mm_cmpeq_epi8(block, escape));
+        const uint32_t mask = (uint32_t)_mm_movemask_epi8(matches);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + sonar_link_layer_encoding_find_special_portable(&data[i], length - i);
+}
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+static uint32_t find_special_neon(const uint8_t* data, uint32_t length) {
+    const uint8x16_t flag = vdupq_n_u8(SONAR_ENCODING_FLAG_BYTE);
+    const uint8x16_t escape = vdupq_n_u8(SONAR_ENCODING_ESCAPE_BYTE);
+    uint32_t i = 0;
+    for (; i + sizeof(uint8x16_t) <= length; i += sizeof(uint8x16_t)) {
+        const uint8x16_t block = vld1q_u8(&data[i]);
+        const uint8x16_t matches = vorrq_u8(vceqq_u8(block, flag), vceqq_u8(block, escape));
+        // narrow the matches down to a 64-bit mask with 4 bits per byte
+        const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+        const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+        if (mask) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+    return i + sonar_link_layer_encoding_find_special_portable(&data[i], length - i);
+}
+#endif
+
+uint32_t sonar_link_layer_encoding_find_special(const uint8_t* data, uint32_t length) {
+    return FIND_SPECIAL_IMPL(data, length);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <inttypes.h>
+
+// Returns the index of the first flag or escape byte in the data (i.e. the first byte which needs to be escaped when
+// transmitting or which needs special handling when receiving), or `length` if there are none
+uint32_t sonar_link_layer_encoding_find_special(const uint8_t* data, uint32_t length);
+
+// Portable (SWAR) implementation of sonar_link_layer_encoding_find_special() which is used when no SIMD instructions
+// are available for the target (exposed for testing)
+uint32_t sonar_link_layer_encoding_find_special_portable(const uint8_t* data, uint32_t length);
@@ -3,36 +3,89 @@
 #include "receive.h"
 #include "transmit.h"
 #include "timeouts.h"
+#include "types.h"
 
 #define LOGGING_MODULE_NAME "SONAR"
 #include "anchor/logging/logging.h"
 
+#include <stddef.h>
 #include <string.h>
 
+// The lengths of extended connection requests / responses from before version 5, which don't contain the features
+#define CONNECTION_REQUEST_V2_LENGTH offsetof(sonar_link_layer_connection_request_t, features)
+#define CONNECTION_RESPONSE_V2_LENGTH offsetof(sonar_link_layer_connection_response_t, features)
+// The lengths of extended connection requests / responses from version 5, which don't contain the receive size
+#define CONNECTION_REQUEST_V5_LENGTH offsetof(sonar_link_layer_connection_request_t, receive_size)
+#define CONNECTION_RESPONSE_V5_LENGTH offsetof(sonar_link_layer_connection_response_t, receive_size)
+
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+#define MAX(A, B) ((A) > (B) ? (A) : (B))
+
 typedef struct {
     bool is_active;
+    // Whether or not the client's next connection attempt should use a legacy (version 1) connection request
+    bool use_legacy_connect;
     uint8_t prev_sequence_num;
+    // The negotiated number of requests which can be outstanding at once (always 1 for version 1 peers)
+    uint8_t window_size;
+    // The negotiated protocol version (SONAR_LINK_LAYER_PROTOCOL_VERSION_*)
+    uint8_t protocol_version;
+    // Whether or not a request can be piggybacked onto a response (negotiated via version 3 connection requests)
+    bool use_piggyback;
+    // Whether or not packets are combined into aggregate frames (negotiated via version 4 connection requests)
+    bool use_aggregation;
+    // The negotiated features which both sides use (SONAR_LINK_LAYER_FEATURE_*)
+    uint8_t features;
+    // The size of the peer's receive buffer, which is assumed to be the same as ours unless it was exchanged as part of
+    // connecting (version 6)
+    uint16_t peer_receive_size;
     uint64_t last_packet_time_ms;
 } connection_info_t;
 
 typedef struct {
-    bool is_active;
-    bool is_link_control;
-    uint8_t sequence_num;
-    uint64_t first_request_time_ms;
+    // Whether or not a round-trip time has been measured on this connection yet
+    bool has_sample;
+    // The smoothed round-trip time (scaled by 8) and round-trip time variation (scaled by 4) in ms
+    int32_t srtt_x8;
+    int32_t rttvar_x4;
+    // The current request retry interval in ms (derived from the above)
+    uint32_t retry_interval_ms;
+} rtt_info_t;
+
+typedef struct {
+    // aligned so that the context size doesn't depend on the platform's uint64_t struct alignment
+    _Alignas(uint64_t) uint64_t first_request_time_ms;
     uint64_t last_request_time_ms;
     const buffer_chain_entry_t* data;
+} pending_request_t;
+
+typedef struct {
+    // The outstanding requests are stored in order (oldest first) starting at `head` within `requests`
+    uint8_t num_active;
+    uint8_t head;
+    bool is_link_control;
+    // The sequence number of the most recent request
+    uint8_t sequence_num;
+    pending_request_t requests[SONAR_MAX_WINDOW_SIZE];
 } pending_request_info_t;
 
 typedef struct {
     bool is_pending;
     bool is_active;
+    // Whether or not the response is being held back so that the next request can be piggybacked onto it
+    bool is_deferred;
     bool is_link_control;
     uint8_t sequence_num;
     uint32_t length;
     const uint8_t* data;
 } pending_response_info_t;
 
+typedef struct {
+    // Whether or not there's an aggregate frame waiting for its delay to expire
+    bool is_pending;
+    uint64_t start_time_ms;
+} aggregate_info_t;
+
 typedef struct {
     sonar_link_layer_init_t init;
     sonar_link_layer_errors_t errors;
@@ -41,45 +94,257 @@ typedef struct {
     sonar_link_layer_receive_handle_t receive_handle;
     sonar_link_layer_transmit_handle_t transmit_handle;
     connection_info_t connection;
+    rtt_info_t rtt;
+    aggregate_info_t aggregate;
     buffer_chain_entry_t connection_data_buffer_chain;
-    uint8_t connection_data;
+    sonar_link_layer_connection_request_t connection_request;
+    sonar_link_layer_connection_response_t connection_response;
     pending_request_info_t pending_request;
     pending_response_info_t pending_response;
+    sonar_link_layer_transmit_cache_t request_cache;
+    sonar_link_layer_transmit_cache_t response_cache;
 } instance_impl_t;
+_Static_assert(SONAR_LINK_LAYER_PACKET_OVERHEAD == sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_footer_t), "Invalid packet overhead");
 _Static_assert(sizeof(sonar_link_layer_context_t) >= sizeof(instance_impl_t), "Invalid context size");
 
-static void set_pending_request(instance_impl_t* inst, bool is_link_control, const buffer_chain_entry_t* data) {
-    inst->pending_request.is_active = true;
-    inst->pending_request.first_request_time_ms = inst->init.functions.get_system_time_ms();
+static uint8_t get_max_window_size(const instance_impl_t* inst) {
+    if (inst->init.config.window_size < 1) {
+        return 1;
+    }
+    return MIN(inst->init.config.window_size, SONAR_MAX_WINDOW_SIZE);
+}
+
+static uint32_t get_max_retry_interval_ms(const instance_impl_t* inst) {
+    return inst->init.config.max_retry_interval_ms ? inst->init.config.max_retry_interval_ms : DEFAULT_MAX_REQUEST_RETRY_INTERVAL_MS;
+}
+
+static uint32_t get_min_retry_interval_ms(const instance_impl_t* inst) {
+    const uint32_t min_retry_interval_ms = inst->init.config.min_retry_interval_ms ? inst->init.config.min_retry_interval_ms : DEFAULT_MIN_REQUEST_RETRY_INTERVAL_MS;
+    return MIN(min_retry_interval_ms, get_max_retry_interval_ms(inst));
+}
+
+static uint8_t get_features(const instance_impl_t* inst) {
+    uint8_t features = 0;
+    // COBS frames are built up in the transmit buffer, so it needs to be able to hold the largest one
+    if (inst->init.config.enable_cobs && (inst->init.functions.write_bytes || inst->init.functions.start_tx) &&
+        inst->init.buffers.transmit_size >= SONAR_ENCODING_COBS_MAX_FRAME_SIZE(inst->init.buffers.receive_size)) {
+        features |= SONAR_LINK_LAYER_FEATURE_COBS;
+    }
+    if (inst->init.config.enable_compression) {
+        features |= SONAR_LINK_LAYER_FEATURE_COMPRESSION;
+    }
+    if (inst->init.config.enable_fragmentation) {
+        features |= SONAR_LINK_LAYER_FEATURE_FRAGMENTATION;
+    }
+    return features;
+}
+
+static uint16_t get_receive_size(const instance_impl_t* inst) {
+    return MIN(inst->init.buffers.receive_size, UINT16_MAX);
+}
+
+static uint8_t get_protocol_version(const instance_impl_t* inst) {
+    // the highest protocol version we can use (newer versions only add optional features)
+    if (get_features(inst) & SONAR_LINK_LAYER_FEATURE_FRAGMENTATION) {
+        return SONAR_LINK_LAYER_PROTOCOL_VERSION_6;
+    } else if (get_features(inst)) {
+        return SONAR_LINK_LAYER_PROTOCOL_VERSION_5;
+    } else if (inst->init.config.enable_aggregation) {
+        return SONAR_LINK_LAYER_PROTOCOL_VERSION_4;
+    } else if (inst->init.config.enable_piggyback) {
+        return SONAR_LINK_LAYER_PROTOCOL_VERSION_3;
+    }
+    return SONAR_LINK_LAYER_PROTOCOL_VERSION_2;
+}
+
+static uint32_t clamp_retry_interval_ms(const instance_impl_t* inst, uint32_t retry_interval_ms) {
+    if (retry_interval_ms < get_min_retry_interval_ms(inst)) {
+        return get_min_retry_interval_ms(inst);
+    }
+    return MIN(retry_interval_ms, get_max_retry_interval_ms(inst));
+}
+
+static uint32_t get_connection_timeout_ms(const instance_impl_t* inst) {
+    // a connection maintenance request must be able to time out (plus one more retry interval as a buffer) before the
+    // connection does, and as the server can't measure the client's retry interval, it allows for the largest one
+    const uint32_t retry_interval_ms = inst->init.config.is_server ? get_max_retry_interval_ms(inst) : inst->rtt.retry_interval_ms;
+    return MAX(CONNECTION_TIMEOUT_MS, CONNECTION_MAINTENANCE_INTERVAL_MS + retry_interval_ms * (REQUEST_TIMEOUT_INTERVALS + 1));
+}
+
+static uint32_t get_aggregation_delay_ms(const instance_impl_t* inst) {
+    // keep the delay well below the retry interval so that it doesn't trigger retries
+    return MIN(inst->init.config.aggregation_delay_ms, get_min_retry_interval_ms(inst) / 4);
+}
+
+static void reset_rtt(instance_impl_t* inst) {
+    inst->rtt = (rtt_info_t){
+        .retry_interval_ms = clamp_retry_interval_ms(inst, REQUEST_RETRY_INTERVAL_MS),
+    };
+}
+
+static void update_rtt(instance_impl_t* inst, uint32_t rtt_ms) {
+    // Jacobson / Karels estimator using fixed-point arithmetic (gains of 1/8 and 1/4)
+    rtt_ms = MIN(rtt_ms, (uint32_t)INT32_MAX >> 3);
+    if (!inst->rtt.has_sample) {
+        inst->rtt.has_sample = true;
+        inst->rtt.srtt_x8 = (int32_t)rtt_ms << 3;
+        inst->rtt.rttvar_x4 = (int32_t)rtt_ms << 1;
+    } else {
+        int32_t delta = (int32_t)rtt_ms - (inst->rtt.srtt_x8 >> 3);
+        inst->rtt.srtt_x8 += delta;
+        if (delta < 0) {
+            delta = -delta;
+        }
+        delta -= inst->rtt.rttvar_x4 >> 2;
+        inst->rtt.rttvar_x4 += delta;
+    }
+    inst->rtt.retry_interval_ms = clamp_retry_interval_ms(inst, (inst->rtt.srtt_x8 >> 3) + inst->rtt.rttvar_x4);
+}
+
+static pending_request_t* get_pending_request(instance_impl_t* inst, uint8_t index) {
+    // an index of 0 is the oldest outstanding request
+    return &inst->pending_request.requests[(inst->pending_request.head + index) % SONAR_MAX_WINDOW_SIZE];
+}
+
+static uint8_t get_pending_request_sequence_num(const instance_impl_t* inst, uint8_t index) {
+    return inst->pending_request.sequence_num - (inst->pending_request.num_active - 1) + index;
+}
+
+static bool get_pending_request_index(const instance_impl_t* inst, uint8_t sequence_num, uint8_t* index) {
+    const uint8_t offset = sequence_num - get_pending_request_sequence_num(inst, 0);
+    if (offset >= inst->pending_request.num_active) {
+        return false;
+    }
+    *index = offset;
+    return true;
+}
+
+static void pop_pending_request(instance_impl_t* inst) {
+    inst->pending_request.head = (inst->pending_request.head + 1) % SONAR_MAX_WINDOW_SIZE;
+    inst->pending_request.num_active--;
+}
+
+static void set_pending_request(instance_impl_t* inst, bool is_link_control, const buffer_chain_entry_t* data, uint64_t time_ms) {
+    pending_request_t* request = get_pending_request(inst, inst->pending_request.num_active);
+    request->first_request_time_ms = time_ms;
+    request->last_request_time_ms = time_ms;
+    request->data = data;
+    inst->pending_request.num_active++;
     inst->pending_request.sequence_num++;
     inst->pending_request.is_link_control = is_link_control;
-    inst->pending_request.data = data;
+    inst->request_cache.is_valid = false;
+}
+
+static bool can_piggyback(const instance_impl_t* inst, const buffer_chain_entry_t* request_data) {
+    // the combined packet needs to fit in the peer's receive buffer
+    uint32_t length = sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_piggyback_header_t) + inst->pending_response.length + sizeof(sonar_link_layer_footer_t);
+    FOREACH_BUFFER_CHAIN_ENTRY(request_data, entry) {
+        length += entry->length;
+    }
+    return inst->pending_response.length <= UINT16_MAX && length <= inst->connection.peer_receive_size;
 }
 
-static void send_pending_request(instance_impl_t* inst) {
-    inst->pending_request.last_request_time_ms = inst->init.functions.get_system_time_ms();
-    sonar_link_layer_transmit_send_packet(inst->transmit_handle, false, inst->pending_request.is_link_control, inst->pending_request.sequence_num, inst->pending_request.data);
+static void send_pending_request(instance_impl_t* inst, uint8_t index, uint64_t time_ms) {
+    pending_request_t* request = get_pending_request(inst, index);
+    const uint8_t sequence_num = get_pending_request_sequence_num(inst, index);
+    request->last_request_time_ms = time_ms;
+    if (inst->pending_response.is_deferred && !inst->pending_request.is_link_control && can_piggyback(inst, request->data)) {
+        // send the response which is being held back along with this request
+        inst->pending_response.is_deferred = false;
+        buffer_chain_entry_t response_data = {0};
+        buffer_chain_set_data(&response_data, inst->pending_response.data, inst->pending_response.length);
+        sonar_link_layer_transmit_send_piggyback_packet(inst->transmit_handle, inst->pending_response.sequence_num, &response_data, sequence_num, request->data);
+        return;
+    }
+    if (index != inst->pending_request.num_active - 1) {
+        // only the most recent request is cached
+        sonar_link_layer_transmit_send_packet(inst->transmit_handle, false, inst->pending_request.is_link_control, sequence_num, request->data);
+        return;
+    }
+    if (sonar_link_layer_transmit_resend_cached(inst->transmit_handle, &inst->request_cache)) {
+        return;
+    }
+    sonar_link_layer_transmit_send_packet_cached(inst->transmit_handle, &inst->request_cache, false, inst->pending_request.is_link_control, sequence_num, request->data);
+}
+
+static void sample_pending_request_rtt(instance_impl_t* inst, uint8_t index) {
+    const pending_request_t* request = get_pending_request(inst, index);
+    if (request->last_request_time_ms != request->first_request_time_ms) {
+        // the request was retried, so we can't tell which transmission this is the response to (Karn's algorithm)
+        return;
+    }
+    update_rtt(inst, inst->init.functions.get_system_time_ms() - request->first_request_time_ms);
+}
+
+static void fail_pending_requests(instance_impl_t* inst) {
+    // clear the pending requests before running the callbacks so that the user can issue new requests
+    const uint8_t num_failed = inst->pending_request.num_active;
+    inst->pending_request.num_active = 0;
+    for (uint8_t i = 0; i < num_failed; i++) {
+        inst->init.handlers.request_complete(inst->init.handlers.handler_handle, false, NULL, 0);
+    }
 }
 
 static void send_pending_response(instance_impl_t* inst) {
+    inst->pending_response.is_deferred = false;
+    if (sonar_link_layer_transmit_resend_cached(inst->transmit_handle, &inst->response_cache)) {
+        return;
+    }
     buffer_chain_entry_t data = {0};
     buffer_chain_set_data(&data, inst->pending_response.data, inst->pending_response.length);
-    sonar_link_layer_transmit_send_packet(inst->transmit_handle, true, inst->pending_response.is_link_control, inst->pending_response.sequence_num, &data);
+    sonar_link_layer_transmit_send_packet_cached(inst->transmit_handle, &inst->response_cache, true, inst->pending_response.is_link_control, inst->pending_response.sequence_num, &data);
+}
+
+static bool refresh_pending_response(instance_impl_t* inst) {
+    if (inst->response_cache.is_valid || inst->pending_response.is_link_control || !inst->init.handlers.response_retry) {
+        return true;
+    }
+    // the response data isn't cached, so let the upper layer set it again in case it's been overwritten since
+    inst->pending_response.is_pending = true;
+    const bool success = inst->init.handlers.response_retry(inst->init.handlers.handler_handle);
+    inst->pending_response.is_pending = false;
+    return success;
+}
+
+static void send_deferred_response(instance_impl_t* inst) {
+    if (inst->pending_response.is_deferred) {
+        send_pending_response(inst);
+    }
+}
+
+static void set_connection_features(instance_impl_t* inst, uint8_t protocol_version, uint8_t features, uint16_t peer_receive_size) {
+    const bool use_cobs = features & SONAR_LINK_LAYER_FEATURE_COBS;
+    if (use_cobs != (bool)(inst->connection.features & SONAR_LINK_LAYER_FEATURE_COBS)) {
+        sonar_link_layer_transmit_set_cobs(inst->transmit_handle, use_cobs);
+        sonar_link_layer_receive_set_cobs(inst->receive_handle, use_cobs);
+    }
+    inst->connection.features = features;
+    inst->connection.peer_receive_size = peer_receive_size;
+    inst->connection.protocol_version = protocol_version;
+    inst->connection.use_piggyback = inst->init.config.enable_piggyback && protocol_version >= SONAR_LINK_LAYER_PROTOCOL_VERSION_3;
+    inst->connection.use_aggregation = inst->init.config.enable_aggregation && protocol_version >= SONAR_LINK_LAYER_PROTOCOL_VERSION_4;
+    sonar_link_layer_transmit_set_aggregation(inst->transmit_handle, inst->connection.use_aggregation);
+    inst->aggregate.is_pending = false;
 }
 
 static void disconnect(instance_impl_t* inst) {
-    const bool had_pending_request = inst->pending_request.is_active;
-    inst->pending_request.is_active = false;
+    const uint8_t num_pending_requests = inst->pending_request.num_active;
+    inst->pending_request.num_active = 0;
     inst->connection.is_active = false;
+    inst->connection.window_size = 1;
+    set_connection_features(inst, SONAR_LINK_LAYER_PROTOCOL_VERSION_1, 0, get_receive_size(inst));
+    inst->pending_response.is_deferred = false;
+    reset_rtt(inst);
     // need to clear the pending request and connected state before running the callbacks so that
     // the user doesn't try to issue a new request
     LOG_INFO("Disconnected");
     inst->init.handlers.connection_changed(inst->init.handlers.handler_handle, false);
-    if (had_pending_request) {
+    if (num_pending_requests) {
         if (inst->pending_request.is_link_control) {
             LOG_INFO("Disconnected with link control request pending");
         } else {
-            inst->init.handlers.request_complete(inst->init.handlers.handler_handle, false, NULL, 0);
+            inst->pending_request.num_active = num_pending_requests;
+            fail_pending_requests(inst);
         }
     }
 }
@@ -93,25 +358,59 @@ static bool handle_link_control_packet(instance_impl_t* inst, bool is_response,
     }
 
     if (is_response) {
-        if (length != 0) {
-            // all responses should have 0 data bytes
+        uint32_t request_length = 0;
+        FOREACH_BUFFER_CHAIN_ENTRY(get_pending_request(inst, 0)->data, entry) {
+            request_length += entry->length;
+        }
+        const bool is_connection_request = inst->pending_request.is_link_control && request_length != 0;
+        uint8_t window_size = 1;
+        uint8_t protocol_version = SONAR_LINK_LAYER_PROTOCOL_VERSION_1;
+        uint8_t features = 0;
+        uint16_t peer_receive_size = get_receive_size(inst);
+        if (is_connection_request && request_length >= CONNECTION_REQUEST_V2_LENGTH && (length == CONNECTION_RESPONSE_V2_LENGTH ||
+            (request_length >= CONNECTION_REQUEST_V5_LENGTH && length == CONNECTION_RESPONSE_V5_LENGTH) ||
+            (request_length == sizeof(sonar_link_layer_connection_request_t) && length == sizeof(sonar_link_layer_connection_response_t)))) {
+            // response to an extended connection request
+            sonar_link_layer_connection_response_t response = {0};
+            memcpy(&response, data, length);
+            if (response.protocol_version >= SONAR_LINK_LAYER_PROTOCOL_VERSION_2 && response.window_size > 1) {
+                window_size = MIN(response.window_size, get_max_window_size(inst));
+            }
+            // the server responds with the version it's using, which is no higher than the one we requested
+            protocol_version = MIN(response.protocol_version, get_protocol_version(inst));
+            if (length >= CONNECTION_RESPONSE_V5_LENGTH) {
+                features = response.features & get_features(inst);
+            }
+            if (length == sizeof(response)) {
+                peer_receive_size = response.receive_size;
+            } else {
+                // fragments can't be sized without knowing the server's receive size
+                features &= ~SONAR_LINK_LAYER_FEATURE_FRAGMENTATION;
+            }
+        } else if (length != 0) {
+            // all other responses should have 0 data bytes
             LOG_ERROR("Invalid packet: Link control packet with data");
             inst->errors.invalid_packet++;
             return false;
         }
-        uint32_t request_length = 0;
-        FOREACH_BUFFER_CHAIN_ENTRY(inst->pending_request.data, entry) {
-            request_length += entry->length;
-        }
-        const bool did_connect = !inst->connection.is_active && inst->pending_request.is_link_control && request_length == 1;
-        inst->pending_request.is_active = false;
+        const bool did_connect = !inst->connection.is_active && is_connection_request;
+        sample_pending_request_rtt(inst, 0);
+        inst->pending_request.num_active = 0;
         inst->connection.is_active = true;
         if (did_connect) {
-            LOG_INFO("Connected");
+            inst->connection.window_size = window_size;
+            set_connection_features(inst, protocol_version, features, peer_receive_size);
+            LOG_INFO("Connected (window_size=%u, use_piggyback=%d, use_aggregation=%d, features=0x%x)", window_size,
+                inst->connection.use_piggyback, inst->connection.use_aggregation, features);
             inst->init.handlers.connection_changed(inst->init.handlers.handler_handle, true);
         }
         return true;
     } else {
+        const uint8_t* response_data = NULL;
+        uint32_t response_length = 0;
+        uint8_t protocol_version = SONAR_LINK_LAYER_PROTOCOL_VERSION_1;
+        uint8_t features = 0;
+        uint16_t peer_receive_size = get_receive_size(inst);
         // use the data length to figure out what type of request this is
         if (length == 0) {
             // connection maintenance request
@@ -120,16 +419,51 @@ static bool handle_link_control_packet(instance_impl_t* inst, bool is_response,
                 inst->errors.unexpected_packet++;
                 return false;
             }
-        } else if (length == 1) {
-            // connection request
+        } else if (length == sizeof(uint8_t) || length == CONNECTION_REQUEST_V2_LENGTH || length == CONNECTION_REQUEST_V5_LENGTH ||
+            length == sizeof(sonar_link_layer_connection_request_t)) {
+            // connection request (either legacy or extended)
+            sonar_link_layer_connection_request_t request = {0};
+            memcpy(&request, data, length);
             if (inst->connection.is_active) {
                 // disconnect first since this is a new connection
                 disconnect(inst);
             }
-            LOG_INFO("Connected");
+            uint8_t window_size = 1;
+            if (length != sizeof(uint8_t)) {
+                // negotiate the window size, protocol version, and features, and respond with what we're using
+                if (request.protocol_version >= SONAR_LINK_LAYER_PROTOCOL_VERSION_2 && request.window_size > 1) {
+                    window_size = MIN(request.window_size, get_max_window_size(inst));
+                }
+                protocol_version = MAX(MIN(request.protocol_version, get_protocol_version(inst)), SONAR_LINK_LAYER_PROTOCOL_VERSION_2);
+                if (length >= CONNECTION_REQUEST_V5_LENGTH) {
+                    features = request.features & get_features(inst);
+                }
+                if (length == sizeof(request)) {
+                    peer_receive_size = request.receive_size;
+                } else {
+                    // fragments can't be sized without knowing the client's receive size
+                    features &= ~SONAR_LINK_LAYER_FEATURE_FRAGMENTATION;
+                }
+                inst->connection_response = (sonar_link_layer_connection_response_t){
+                    .protocol_version = protocol_version,
+                    .window_size = window_size,
+                    .features = features,
+                    .receive_size = get_receive_size(inst),
+                };
+                response_data = (const uint8_t*)&inst->connection_response;
+                // only include the features and receive size if the request did
+                if (length == sizeof(request)) {
+                    response_length = sizeof(inst->connection_response);
+                } else if (length == CONNECTION_REQUEST_V5_LENGTH) {
+                    response_length = CONNECTION_RESPONSE_V5_LENGTH;
+                } else {
+                    response_length = CONNECTION_RESPONSE_V2_LENGTH;
+                }
+            }
             // grab the data as our sequence number
-            inst->pending_request.sequence_num = data[0] - 1;
+            inst->pending_request.sequence_num = request.sequence_num - 1;
             inst->connection.is_active = true;
+            inst->connection.window_size = window_size;
             inst->init.handlers.connection_changed(inst->init.handlers.handler_handle, true);
         } else {
             LOG_ERROR("Invalid packet: Invalid link control data length (%"PRIu32")", length);
@@ -137,34 +471,66 @@ static bool handle_link_control_packet(instance_impl_t* inst, bool is_response,
             return false;
         }
 
-        // valid request, so send the response (always no data)
+        // valid request, so send the response (no data unless this is an extended connection request)
         inst->pending_response.is_active = true;
         inst->pending_response.sequence_num = sequence_num;
         inst->pending_response.is_link_control = true;
-        inst->pending_response.data = NULL;
-        inst->pending_response.length = 0;
+        inst->pending_response.data = response_data;
+        inst->pending_response.length = response_length;
+        inst->response_cache.is_valid = false;
         send_pending_response(inst);
+        if (length != 0) {
+            // the connection response is always sent in its own frame, so the negotiated features only apply after it
+            set_connection_features(inst, protocol_version, features, peer_receive_size);
+            LOG_INFO("Connected (window_size=%u, use_piggyback=%d, use_aggregation=%d, features=0x%x)", inst->connection.window_size,
+                inst->connection.use_piggyback, inst->connection.use_aggregation, features);
+        }
         return true;
     }
 }
 
-static void receive_handler(void* handle, bool is_response, bool is_link_control, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
+static void receive_handler(void* handle, bool is_response, bool is_link_control, bool is_piggyback, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
     instance_impl_t* inst = handle;
+    if (is_piggyback) {
+        // split the packet back into the response and the request which was piggybacked onto it
+        const sonar_link_layer_piggyback_header_t* piggyback_header = (const sonar_link_layer_piggyback_header_t*)data;
+        if (inst->connection.protocol_version < SONAR_LINK_LAYER_PROTOCOL_VERSION_3) {
+            // the peer may piggyback whenever the negotiated version supports it, even if we don't
+            LOG_ERROR("Invalid packet: Piggyback packet on a connection which doesn't support it");
+            inst->errors.unexpected_packet++;
+            return;
+        } else if (length < sizeof(*piggyback_header) || piggyback_header->response_length > length - sizeof(*piggyback_header)) {
+            LOG_ERROR("Invalid packet: Invalid piggyback response length");
+            inst->errors.invalid_packet++;
+            return;
+        }
+        const uint8_t request_sequence_num = piggyback_header->request_sequence_num;
+        const uint32_t response_length = piggyback_header->response_length;
+        data += sizeof(*piggyback_header);
+        length -= sizeof(*piggyback_header);
+        receive_handler(inst, true, false, false, sequence_num, data, response_length);
+        receive_handler(inst, false, false, false, request_sequence_num, data + response_length, length - response_length);
+        return;
+    }
+    // how many requests ago this request's sequence number was (0 for the previous request)
+    const uint8_t request_age = inst->connection.prev_sequence_num - sequence_num;
+    uint8_t response_index = 0;
     if (!is_link_control && !inst->connection.is_active) {
         LOG_ERROR("Invalid packet: Not connected");
             inst->errors.unexpected_packet++;
         return;
-    } else if (is_response && !inst->pending_request.is_active) {
+    } else if (is_response && !inst->pending_request.num_active) {
         LOG_ERROR("Invalid packet: Got response without any pending request");
         inst->errors.unexpected_packet++;
         return;
-    } else if (is_response && sequence_num != inst->pending_request.sequence_num) {
+    } else if (is_response && !get_pending_request_index(inst, sequence_num, &response_index)) {
         LOG_ERROR("Invalid packet: Response sequence number does not match request");
         inst->errors.invalid_sequence_number++;
         return;
-    } else if (!is_link_control && !is_response && sequence_num == inst->connection.prev_sequence_num) {
-        // this is a retry of the previous request (and not a link control request), so send the last response
-        if (inst->pending_response.is_active) {
+    } else if (!is_link_control && !is_response && request_age < inst->connection.window_size) {
+        // this is a retry of a previous request (and not a link control request), so send the last response, which
+        // also acknowledges any earlier requests within the window
+        if (inst->pending_response.is_active && refresh_pending_response(inst)) {
             send_pending_response(inst);
         } // else there was no response (request handler returned an error) so just drop this request
         return;
@@ -175,6 +541,10 @@ static void receive_handler(void* handle, bool is_response, bool is_link_control
     }
 
     if (is_link_control) {
+        if (!is_response) {
+            // the response to the previous request can't be held back any longer
+            send_deferred_response(inst);
+        }
         // handle_link_control_packet() is idempotent, so we can just call it every time and it'll also send the response
         if (!handle_link_control_packet(inst, is_response, sequence_num, data, length)) {
             return;
@@ -184,14 +554,25 @@ static void receive_handler(void* handle, bool is_response, bool is_link_control
         }
     } else {
         if (is_response) {
+            // the peer handles requests in order, so this response also acknowledges any earlier requests whose
+            // responses were lost (which are completed without any data, and reads are sent again by the application
+            // layer)
+            for (uint8_t i = 0; i < response_index; i++) {
+                pop_pending_request(inst);
+                inst->init.handlers.request_complete(inst->init.handlers.handler_handle, true, NULL, 0);
+            }
+            sample_pending_request_rtt(inst, 0);
             // mark the request as inactive first so the response handler can trigger another request
-            inst->pending_request.is_active = false;
+            pop_pending_request(inst);
             inst->init.handlers.request_complete(inst->init.handlers.handler_handle, true, data, length);
         } else {
+            // the response to the previous request can't be held back any longer
+            send_deferred_response(inst);
             // this was a valid packet as far as the link layer is concerned, so update our previous sequence number
             inst->connection.prev_sequence_num = sequence_num;
             inst->pending_response.is_active = false;
             inst->pending_response.is_pending = true;
+            inst->response_cache.is_valid = false;
             inst->pending_response.is_link_control = false;
             inst->pending_response.sequence_num = sequence_num;
             const bool success = inst->init.handlers.request(inst->init.handlers.handler_handle, data, length);
@@ -205,8 +586,13 @@ static void receive_handler(void* handle, bool is_response, bool is_link_control
                 return;
             }
 
-            // got a new request, so send the response
-            send_pending_response(inst);
+            if (inst->connection.use_piggyback && !inst->connection.use_aggregation) {
+                // hold back the response until sonar_link_layer_flush() in case a request can be piggybacked onto it
+                inst->pending_response.is_deferred = true;
+            } else {
+                // got a new request, so send the response
+                send_pending_response(inst);
+            }
         }
     }
 
@@ -220,8 +606,22 @@ void sonar_link_layer_init(sonar_link_layer_handle_t handle, const sonar_link_la
         .init = *init,
         .receive_handle = &inst->receive_context,
         .transmit_handle = &inst->transmit_context,
+        .connection = {
+            .window_size = 1,
+            .peer_receive_size = MIN(init->buffers.receive_size, UINT16_MAX),
+        },
+        .request_cache = {
+            .buffer = init->buffers.retransmit_request,
+            .size = init->buffers.retransmit_request ? init->buffers.retransmit_size : 0,
+        },
+        .response_cache = {
+            .buffer = init->buffers.retransmit_response,
+            .size = init->buffers.retransmit_response ? init->buffers.retransmit_size : 0,
+        },
     };
-    buffer_chain_set_data(&inst->connection_data_buffer_chain, (const uint8_t*)&inst->connection_data, sizeof(inst->connection_data));
+    if (init->config.min_retry_interval_ms > get_max_retry_interval_ms(inst)) {
+        LOG_ERROR("Min retry interval (%u ms) is larger than the max retry interval, using the max", init->config.min_retry_interval_ms);
+    }
 
     const sonar_link_layer_receive_init_t link_layer_receive_init = {
         .is_server = inst->init.config.is_server,
@@ -231,10 +631,18 @@ void sonar_link_layer_init(sonar_link_layer_handle_t handle, const sonar_link_la
         .handler_handle = inst,
     };
     sonar_link_layer_receive_init(inst->receive_handle, &link_layer_receive_init);
+    reset_rtt(inst);
 
     const sonar_link_layer_transmit_init_t link_layer_transmit_init = {
         .is_server = inst->init.config.is_server,
         .write_byte_function = inst->init.functions.write_byte,
+        .write_bytes_function = inst->init.functions.write_bytes,
+        .buffer = inst->init.buffers.transmit,
+        .buffer_size = inst->init.buffers.transmit_size,
+        .start_tx_function = inst->init.functions.start_tx,
+        .ring = inst->init.buffers.transmit_ring,
+        .ring_size = inst->init.buffers.transmit_ring_size,
+        .max_frame_size = inst->init.buffers.receive_size,
     };
     sonar_link_layer_transmit_init(inst->transmit_handle, &link_layer_transmit_init);
 }
@@ -244,23 +652,48 @@ bool sonar_link_layer_is_connected(sonar_link_layer_handle_t handle) {
     return inst->connection.is_active;
 }
 
+bool sonar_link_layer_is_compression_enabled(sonar_link_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return inst->connection.is_active && (inst->connection.features & SONAR_LINK_LAYER_FEATURE_COMPRESSION);
+}
+
+uint32_t sonar_link_layer_get_max_packet_size(sonar_link_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!inst->connection.is_active || !(inst->connection.features & SONAR_LINK_LAYER_FEATURE_FRAGMENTATION) ||
+        inst->connection.peer_receive_size <= SONAR_LINK_LAYER_PACKET_OVERHEAD) {
+        return 0;
+    }
+    return inst->connection.peer_receive_size - SONAR_LINK_LAYER_PACKET_OVERHEAD;
+}
+
 void sonar_link_layer_handle_receive_data(sonar_link_layer_handle_t handle, const uint8_t* data, uint32_t length) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     sonar_link_layer_receive_process_data(inst->receive_handle, data, length);
 }
 
+bool sonar_link_layer_can_send_request(sonar_link_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!inst->connection.is_active) {
+        return false;
+    } else if (!inst->pending_request.num_active) {
+        return true;
+    }
+    return !inst->pending_request.is_link_control && inst->pending_request.num_active < inst->connection.window_size;
+}
+
 bool sonar_link_layer_send_request(sonar_link_layer_handle_t handle, const buffer_chain_entry_t* data) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     if (!inst->connection.is_active) {
         LOG_ERROR("Not connected");
         return false;
     }
-    if (inst->pending_request.is_active) {
+    if (!sonar_link_layer_can_send_request(handle)) {
         LOG_ERROR("ERROR: Request already pending");
         return false;
     }
-    set_pending_request(inst, false, data);
-    send_pending_request(inst);
+    const uint64_t time_ms = inst->init.functions.get_system_time_ms();
+    set_pending_request(inst, false, data, time_ms);
+    send_pending_request(inst, inst->pending_request.num_active - 1, time_ms);
     return true;
 }
 
@@ -270,43 +703,125 @@ void sonar_link_layer_process(sonar_link_layer_handle_t handle) {
     const uint32_t ms_since_last_packet = time_ms - inst->connection.last_packet_time_ms;
 
     // check if the connection has timed out
-    if (inst->connection.is_active && ms_since_last_packet >= CONNECTION_TIMEOUT_MS) {
+    if (inst->connection.is_active && ms_since_last_packet >= get_connection_timeout_ms(inst)) {
         LOG_INFO("Connection timed out");
         disconnect(inst);
     }
 
-    if (inst->pending_request.is_active) {
-        // check if the pending request should be timed out or retried
-        if (time_ms - inst->pending_request.first_request_time_ms >= REQUEST_TIMEOUT_MS) {
+    if (inst->pending_request.num_active) {
+        // check if the oldest pending request should be timed out or retried
+        const pending_request_t* oldest_request = get_pending_request(inst, 0);
+        if (time_ms - oldest_request->first_request_time_ms >= inst->rtt.retry_interval_ms * REQUEST_TIMEOUT_INTERVALS) {
             // pending request has timed out
-            inst->pending_request.is_active = false;
             if (inst->pending_request.is_link_control) {
                 LOG_WARN("Link control request timed out");
+                inst->pending_request.num_active = 0;
+                if (!inst->connection.is_active) {
+                    // alternate between extended and legacy connection requests in case the server doesn't support the former
+                    inst->connection.use_legacy_connect = !inst->connection.use_legacy_connect;
+                }
             } else {
+                // the peer handles requests in order, so any later requests will also fail
                 LOG_WARN("Sonar request timed out");
-                inst->init.handlers.request_complete(inst->init.handlers.handler_handle, false, NULL, 0);
+                fail_pending_requests(inst);
             }
-        } else if (time_ms - inst->pending_request.last_request_time_ms >= REQUEST_RETRY_INTERVAL_MS) {
-            // send the request again
-            send_pending_request(inst);
-            inst->errors.retries++;
+        } else if (time_ms - oldest_request->last_request_time_ms >= inst->rtt.retry_interval_ms) {
+            // send the pending requests again
+            for (uint8_t i = 0; i < inst->pending_request.num_active; i++) {
+                send_pending_request(inst, i, time_ms);
+                inst->errors.retries++;
+            }
+            // retried requests aren't sampled, so back off until one isn't retried in case the round-trip time is longer
+            // than the retry interval (Karn's algorithm)
+            inst->rtt.retry_interval_ms = clamp_retry_interval_ms(inst, inst->rtt.retry_interval_ms * 2);
         }
     } else if (!inst->init.config.is_server) {
         // the bus is free so check if the client should send a link control request
         if (!inst->connection.is_active) {
-            // try to connect (use a somewhat-random initial sequence number based on the time)
-            inst->connection_data = time_ms & 0xff;
-            inst->connection.prev_sequence_num = inst->connection_data - 1;
-            set_pending_request(inst, true, &inst->connection_data_buffer_chain);
-            send_pending_request(inst);
+            // try to connect (use a somewhat-random initial sequence number based on the time), using an extended
+            // connection request if we support multiple outstanding requests
+            const uint8_t protocol_version = get_protocol_version(inst);
+            const bool is_extended = (get_max_window_size(inst) > 1 || protocol_version > SONAR_LINK_LAYER_PROTOCOL_VERSION_2) && !inst->connection.use_legacy_connect;
+            inst->connection_request = (sonar_link_layer_connection_request_t){
+                .sequence_num = time_ms & 0xff,
+                .protocol_version = protocol_version,
+                .window_size = get_max_window_size(inst),
+                .features = get_features(inst),
+                .receive_size = get_receive_size(inst),
+            };
+            uint32_t request_length = sizeof(inst->connection_request.sequence_num);
+            if (is_extended && protocol_version >= SONAR_LINK_LAYER_PROTOCOL_VERSION_6) {
+                request_length = sizeof(inst->connection_request);
+            } else if (is_extended) {
+                // the features are only included from version 5 (and the receive size from version 6)
+                request_length = protocol_version >= SONAR_LINK_LAYER_PROTOCOL_VERSION_5 ? CONNECTION_REQUEST_V5_LENGTH : CONNECTION_REQUEST_V2_LENGTH;
+            }
+            buffer_chain_set_data(&inst->connection_data_buffer_chain, (const uint8_t*)&inst->connection_request, request_length);
+            inst->connection.prev_sequence_num = inst->connection_request.sequence_num - 1;
+            set_pending_request(inst, true, &inst->connection_data_buffer_chain, time_ms);
+            send_pending_request(inst, 0, time_ms);
         } else if (ms_since_last_packet >= CONNECTION_MAINTENANCE_INTERVAL_MS) {
             // send a connection maintenance request
-            set_pending_request(inst, true, NULL);
-            send_pending_request(inst);
+            set_pending_request(inst, true, NULL, time_ms);
+            send_pending_request(inst, 0, time_ms);
         }
     }
 }
 
+void sonar_link_layer_flush(sonar_link_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    send_deferred_response(inst);
+    if (!sonar_link_layer_transmit_has_aggregate(inst->transmit_handle)) {
+        inst->aggregate.is_pending = false;
+        return;
+    }
+    const uint64_t time_ms = inst->init.functions.get_system_time_ms();
+    if (!inst->aggregate.is_pending) {
+        inst->aggregate.is_pending = true;
+        inst->aggregate.start_time_ms = time_ms;
+    }
+    if (time_ms - inst->aggregate.start_time_ms >= get_aggregation_delay_ms(inst)) {
+        sonar_link_layer_transmit_flush(inst->transmit_handle);
+        inst->aggregate.is_pending = false;
+    }
+}
+
+uint64_t sonar_link_layer_get_next_deadline_ms(sonar_link_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    const uint64_t time_ms = inst->init.functions.get_system_time_ms();
+    const bool has_aggregate = sonar_link_layer_transmit_has_aggregate(inst->transmit_handle);
+    if (inst->pending_response.is_deferred || (has_aggregate && !inst->aggregate.is_pending)) {
+        // something was queued outside of processing which needs to be flushed
+        return time_ms;
+    }
+
+    uint64_t deadline_ms = UINT64_MAX;
+    if (has_aggregate) {
+        deadline_ms = MIN(deadline_ms, inst->aggregate.start_time_ms + get_aggregation_delay_ms(inst));
+    }
+    if (inst->connection.is_active) {
+        deadline_ms = MIN(deadline_ms, inst->connection.last_packet_time_ms + get_connection_timeout_ms(inst));
+    }
+    if (inst->pending_request.num_active) {
+        // the oldest pending request is the next to be timed out or retried
+        const pending_request_t* oldest_request = get_pending_request(inst, 0);
+        deadline_ms = MIN(deadline_ms, oldest_request->first_request_time_ms + inst->rtt.retry_interval_ms * REQUEST_TIMEOUT_INTERVALS);
+        deadline_ms = MIN(deadline_ms, oldest_request->last_request_time_ms + inst->rtt.retry_interval_ms);
+    } else if (!inst->init.config.is_server) {
+        if (!inst->connection.is_active) {
+            // the client should try to connect right away
+            return time_ms;
+        }
+        deadline_ms = MIN(deadline_ms, inst->connection.last_packet_time_ms + CONNECTION_MAINTENANCE_INTERVAL_MS);
+    }
+    return deadline_ms;
+}
+
+void sonar_link_layer_tx_complete(sonar_link_layer_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    sonar_link_layer_transmit_complete(inst->transmit_handle);
+}
+
 void sonar_link_layer_set_response(sonar_link_layer_handle_t handle, const uint8_t* data, uint32_t length) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     if (!inst->pending_response.is_pending) {
@@ -325,3 +840,12 @@ void sonar_link_layer_get_and_clear_errors(sonar_link_layer_handle_t handle, son
     inst->errors = (sonar_link_layer_errors_t){0};
     sonar_link_layer_receive_get_and_clear_errors(inst->receive_handle, receive_errors);
 }
+
+void sonar_link_layer_get_rtt(sonar_link_layer_handle_t handle, sonar_link_layer_rtt_t* rtt) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    *rtt = (sonar_link_layer_rtt_t){
+        .srtt_ms = inst->rtt.srtt_x8 >> 3,
+        .rttvar_ms = inst->rtt.rttvar_x4 >> 2,
+        .retry_interval_ms = inst->rtt.retry_interval_ms,
+    };
+}
@@ -3,10 +3,14 @@
 #include "receive.h"
 #include "transmit.h"
 #include "../common/buffer_chain.h"
+#include "anchor/sonar/sonar_config.h"
 
 #include <inttypes.h>
 #include <stdbool.h>
 
+// The number of bytes of each (non-piggyback) packet which are used by the link layer header and footer
+#define SONAR_LINK_LAYER_PACKET_OVERHEAD 4
+
 #define _SONAR_LINK_LAYER_CONTEXT_SIZE ( \
     sizeof(sonar_link_layer_init_t) + \
     sizeof(sonar_link_layer_errors_t) + \
@@ -14,17 +18,47 @@
     sizeof(sonar_link_layer_transmit_context_t) + \
     sizeof(sonar_link_layer_receive_handle_t) + \
     sizeof(sonar_link_layer_transmit_handle_t) + \
+    sizeof(sonar_link_layer_transmit_cache_t) * 2 + \
     sizeof(buffer_chain_entry_t) + \
     sizeof(uint64_t) * 2 + \
-    sizeof(uint64_t) * 4 + \
+    sizeof(uint64_t) + sizeof(uint64_t) * 3 * SONAR_MAX_WINDOW_SIZE + \
     sizeof(uintptr_t) + sizeof(uint64_t) * 2 + sizeof(void*) + \
     sizeof(uint32_t) * 2 + sizeof(void*) + \
-    sizeof(uintptr_t))
+    sizeof(uint64_t) + \
+    sizeof(uint32_t) * 4 + \
+    sizeof(uint64_t) * 2)
 
 typedef struct {
     struct {
         // Whether or not this is the server (vs. client)
         bool is_server;
+        // The maximum number of requests which may be outstanding at once (up to SONAR_MAX_WINDOW_SIZE)
+        // A value greater than 1 requires the peer to also support it, otherwise 1 is used
+        uint8_t window_size;
+        // Whether or not to hold back responses until sonar_link_layer_flush() so that a new request can be sent in the
+        // same packet, if the peer also supports it (optional)
+        bool enable_piggyback;
+        // The bounds on the request retry interval, which is otherwise derived from the measured round-trip time
+        // (optional - they default to DEFAULT_MIN_REQUEST_RETRY_INTERVAL_MS and DEFAULT_MAX_REQUEST_RETRY_INTERVAL_MS, and
+        // a larger max extends the connection timeout so that a connection maintenance request can still time out first)
+        // The retry interval doubles with each retry until the next sample, and requests time out after
+        // REQUEST_TIMEOUT_INTERVALS retry intervals
+        uint16_t min_retry_interval_ms;
+        uint16_t max_retry_interval_ms;
+        // Whether or not to combine the packets which are sent within each round of processing into a single aggregate
+        // frame, if the peer also supports it (optional)
+        bool enable_aggregation;
+        // How long to hold an aggregate frame open for more packets before it's flushed (optional - defaults to 0, which
+        // flushes it at the end of each round of processing, and is limited to a quarter of the minimum retry interval)
+        uint16_t aggregation_delay_ms;
+        // Whether or not to encode frames with COBS rather than HDLC byte stuffing once connected, if the peer also
+        // supports it (optional - requires write_bytes and a transmit buffer which can hold the largest COBS frame)
+        bool enable_cobs;
+        // Whether or not the upper layer accepts compressed requests, which it can send if the peer also does (optional)
+        bool enable_compression;
+        // Whether or not the upper layer accepts fragmented requests, which it can send (sized to fit the peer's receive
+        // buffer) if the peer also does (optional)
+        bool enable_fragmentation;
     } config;
     struct {
         // Buffer used to receive data into by the link layer receive code
@@ -32,12 +66,31 @@ typedef struct {
         uint8_t* receive;
         // Size of the `receive` buffer in bytes
         uint32_t receive_size;
+        // Buffer used to stage encoded packets before they are passed to `functions.write_bytes` (optional)
+        uint8_t* transmit;
+        // Size of the `transmit` buffer in bytes
+        uint32_t transmit_size;
+        // Buffers used to cache the last encoded request and response for retransmission (optional)
+        // Should each be large enough to hold a fully-encoded packet in order for it to be cached
+        uint8_t* retransmit_request;
+        uint8_t* retransmit_response;
+        // Size of each of the `retransmit_*` buffers in bytes
+        uint32_t retransmit_size;
+        // Ring which encoded frames are queued in for `functions.start_tx` (required by `functions.start_tx`)
+        uint8_t* transmit_ring;
+        // Size of the `transmit_ring` buffer in bytes
+        uint32_t transmit_ring_size;
     } buffers;
     struct {
         // Function which returns the current system time in ms
         uint64_t (*get_system_time_ms)(void);
         // Function which is called to write data over the physical link
         void (*write_byte)(uint8_t byte);
+        // Function which is called to write multiple bytes of data over the physical link (optional - takes precedence over `write_byte`)
+        void (*write_bytes)(const uint8_t* data, uint32_t length);
+        // Function which is called to start writing data from the transmit ring over the physical link, after which
+        // sonar_link_layer_tx_complete() must be called (optional - takes precedence over `write_byte` and `write_bytes`)
+        void (*start_tx)(const uint8_t* data, uint32_t length);
     } functions;
     struct {
         // Function which is called when the connection state changes
@@ -48,6 +101,10 @@ typedef struct {
         bool (*request)(void* handle, const uint8_t* data, uint32_t length);
         // Function which is called when a request (issued via sonar_link_layer_send_request()) completes
         void (*request_complete)(void* handle, bool success, const uint8_t* data, uint32_t length);
+        // Function which is called before the response to a retried request is sent again without a cached copy, which
+        // may call sonar_link_layer_set_response() to replace it if the data it points to has since changed, or return
+        // false to drop the retry (optional)
+        bool (*response_retry)(void* handle);
         // Handle which is passed to the handlers
         void* handler_handle;
     } handlers;
@@ -64,6 +121,15 @@ typedef struct {
     uint32_t retries;
 } sonar_link_layer_errors_t;
 
+typedef struct {
+    // The smoothed round-trip time in ms (0 if no round-trip time has been measured yet)
+    uint32_t srtt_ms;
+    // The round-trip time variation in ms
+    uint32_t rttvar_ms;
+    // The current request retry interval in ms
+    uint32_t retry_interval_ms;
+} sonar_link_layer_rtt_t;
+
 // The handle is a pointer to a pre-allocated context type (to be accessed by the SONAR implementation only)
 typedef uint8_t sonar_link_layer_context_t[_SONAR_LINK_LAYER_CONTEXT_SIZE];
 typedef sonar_link_layer_context_t* sonar_link_layer_handle_t;
@@ -74,17 +140,42 @@ void sonar_link_layer_init(sonar_link_layer_handle_t handle, const sonar_link_la
 // Returns whether or not we're currently connected
 bool sonar_link_layer_is_connected(sonar_link_layer_handle_t handle);
 
+// Returns whether or not compressed requests can be sent on the current connection
+bool sonar_link_layer_is_compression_enabled(sonar_link_layer_handle_t handle);
+
+// Returns the largest packet (excluding the link layer header / footer) which the peer can receive, or 0 if fragmented
+// requests can't be sent on the current connection
+uint32_t sonar_link_layer_get_max_packet_size(sonar_link_layer_handle_t handle);
+
 // Processes received data
 void sonar_link_layer_handle_receive_data(sonar_link_layer_handle_t handle, const uint8_t* data, uint32_t length);
 
+// Returns whether or not another request can currently be sent (we're connected and the request window isn't full)
+bool sonar_link_layer_can_send_request(sonar_link_layer_handle_t handle);
+
 // NOTE: If this returns true, `data` must remain valid and stable until the request_complete() callback is called
 bool sonar_link_layer_send_request(sonar_link_layer_handle_t handle, const buffer_chain_entry_t* data);
 
-// Run link layer processing (should be called regularly - ideally at least every 1ms)
+// Run link layer processing (should be called whenever data is received and by the deadline returned by
+// sonar_link_layer_get_next_deadline_ms(), or otherwise regularly - ideally at least every 1ms)
 void sonar_link_layer_process(sonar_link_layer_handle_t handle);
 
+// Returns the system time (in ms) by which processing next needs to run if no data is received, which is the next
+// request retry / timeout, connection maintenance / timeout or aggregate frame flush (UINT64_MAX if there isn't one)
+uint64_t sonar_link_layer_get_next_deadline_ms(sonar_link_layer_handle_t handle);
+
+// Sends any response which is being held back to have a request piggybacked onto it, and any aggregate frame whose
+// delay has expired (should be called at the end of each round of processing)
+void sonar_link_layer_flush(sonar_link_layer_handle_t handle);
+
+// Called once the data passed to `functions.start_tx` has been written
+void sonar_link_layer_tx_complete(sonar_link_layer_handle_t handle);
+
 // Sets the SONAR link layer response - should only (and must) be called from handlers.request()
 void sonar_link_layer_set_response(sonar_link_layer_handle_t handle, const uint8_t* data, uint32_t length);
 
 // Get and then clear the current error counters
 void sonar_link_layer_get_and_clear_errors(sonar_link_layer_handle_t handle, sonar_link_layer_errors_t* errors, sonar_link_layer_receive_errors_t* receive_errors);
+
+// Get the current round-trip time estimates
+void sonar_link_layer_get_rtt(sonar_link_layer_handle_t handle, sonar_link_layer_rtt_t* rtt);
@@ -1,6 +1,7 @@
 #include "receive.h"
 
 #include "../common/crc16.h"
+#include "encoding.h"
 #include "types.h"
 
 #define LOGGING_MODULE_NAME "SONAR"
@@ -9,63 +10,177 @@
 #include <stdbool.h>
 #include <string.h>
 
+// The largest HDLC frame which is still accepted after switching to COBS (a connection request)
+#define HDLC_FALLBACK_BUFFER_SIZE \
+    (sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_connection_request_t) + sizeof(sonar_link_layer_footer_t))
+
+typedef struct {
+    uint8_t buffer[HDLC_FALLBACK_BUFFER_SIZE];
+    uint8_t received_len;
+    bool packet_started;
+    bool escaping;
+} hdlc_fallback_t;
+
 typedef struct {
     sonar_link_layer_receive_init_t init;
     sonar_link_layer_receive_errors_t errors;
     uint32_t received_len;
+    uint32_t crc_len;
+    uint16_t crc;
     bool packet_started;
     bool escaping;
+    bool use_cobs;
+    // The number of data bytes left in the current COBS block (0 if the next byte is a code byte)
+    uint8_t cobs_remaining;
+    // Whether or not a zero byte is implied at the end of the current COBS block (unless it's the last one)
+    bool cobs_implied_zero;
+    // Decodes HDLC connection requests while using COBS, which a peer that hasn't switched over yet (or has been reset)
+    // sends
+    hdlc_fallback_t hdlc_fallback;
 } instance_impl_t;
 _Static_assert(sizeof(sonar_link_layer_receive_context_t) == sizeof(instance_impl_t), "Invalid context size");
 
-static void process_packet(instance_impl_t* inst) {
-    if (inst->received_len < (sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_footer_t))) {
-        return;
+static void update_crc(instance_impl_t* inst) {
+    // the CRC lags behind the received data by the size of the footer so that it covers exactly the header and data
+    // once the end of the packet is received
+    if (inst->received_len > inst->crc_len + sizeof(sonar_link_layer_footer_t)) {
+        const uint32_t length = inst->received_len - sizeof(sonar_link_layer_footer_t) - inst->crc_len;
+        inst->crc = crc16(&inst->init.buffer[inst->crc_len], length, inst->crc);
+        inst->crc_len += length;
     }
+}
 
-    const uint32_t data_length = inst->received_len - sizeof(sonar_link_layer_header_t) - sizeof(sonar_link_layer_footer_t);
-    const sonar_link_layer_header_t* header = (const sonar_link_layer_header_t*)inst->init.buffer;
-    const sonar_link_layer_footer_t* footer = (const sonar_link_layer_footer_t*)&inst->init.buffer[sizeof(*header) + data_length];
-
+static bool is_valid_flags(instance_impl_t* inst, const sonar_link_layer_header_t* header) {
     const uint8_t version = (header->flags & SONAR_LINK_LAYER_FLAGS_VERSION_MASK) >> SONAR_LINK_LAYER_FLAGS_VERSION_OFFSET;
-    const uint16_t calculated_crc = crc16(inst->init.buffer, sizeof(sonar_link_layer_header_t) + data_length, CRC16_INITIAL_VALUE);
-    const bool is_server_to_client = header->flags & SONAR_LINK_LAYER_FLAGS_DIRECTION_MASK;
-
-    if (header->flags & SONAR_LINK_LAYER_FLAGS_RESERVED_MASK) {
-        LOG_ERROR("Invalid packet: bad reserved bits");
+    const bool is_response = header->flags & SONAR_LINK_LAYER_FLAGS_RESPONSE_MASK;
+    const bool is_link_control = header->flags & SONAR_LINK_LAYER_FLAGS_LINK_CONTROL_MASK;
+    const bool is_piggyback = header->flags & SONAR_LINK_LAYER_FLAGS_PIGGYBACK_MASK;
+    if (is_piggyback && (!is_response || is_link_control)) {
+        // only (non-link control) responses can have a request piggybacked onto them
+        LOG_ERROR("Invalid packet: bad piggyback bit");
         inst->errors.invalid_header++;
-        return;
+        return false;
     } else if (version != SONAR_VERSION) {
         LOG_ERROR("Invalid packet: bad version");
         inst->errors.invalid_header++;
+        return false;
+    }
+    return true;
+}
+
+static bool is_valid_direction(instance_impl_t* inst, const sonar_link_layer_header_t* header) {
+    const bool is_server_to_client = header->flags & SONAR_LINK_LAYER_FLAGS_DIRECTION_MASK;
+    if (is_server_to_client == inst->init.is_server) {
+        LOG_ERROR("Invalid packet: wrong direction");
+        inst->errors.invalid_header++;
+        return false;
+    }
+    return true;
+}
+
+static void handle_packet(instance_impl_t* inst, const sonar_link_layer_header_t* header, const uint8_t* data, uint32_t data_length) {
+    const bool is_response = header->flags & SONAR_LINK_LAYER_FLAGS_RESPONSE_MASK;
+    const bool is_link_control = header->flags & SONAR_LINK_LAYER_FLAGS_LINK_CONTROL_MASK;
+    const bool is_piggyback = header->flags & SONAR_LINK_LAYER_FLAGS_PIGGYBACK_MASK;
+    inst->init.packet_handler(inst->init.handler_handle, is_response, is_link_control, is_piggyback, header->sequence_num, data, data_length);
+}
+
+static void handle_aggregate_packet(instance_impl_t* inst, const uint8_t* data, uint32_t data_length) {
+    // split the frame back into the packets it contains
+    while (data_length) {
+        const sonar_link_layer_aggregate_header_t* aggregate_header = (const sonar_link_layer_aggregate_header_t*)data;
+        if (data_length < sizeof(*aggregate_header) || aggregate_header->length < sizeof(sonar_link_layer_header_t) ||
+            aggregate_header->length > data_length - sizeof(*aggregate_header)) {
+            LOG_ERROR("Invalid packet: bad aggregate packet length");
+            inst->errors.invalid_header++;
+            return;
+        }
+        const uint32_t packet_length = aggregate_header->length;
+        const sonar_link_layer_header_t* header = (const sonar_link_layer_header_t*)(data + sizeof(*aggregate_header));
+        if (is_valid_flags(inst, header) && is_valid_direction(inst, header)) {
+            handle_packet(inst, header, (const uint8_t*)header + sizeof(*header), packet_length - sizeof(*header));
+        }
+        data += sizeof(*aggregate_header) + packet_length;
+        data_length -= sizeof(*aggregate_header) + packet_length;
+    }
+}
+
+static void process_packet(instance_impl_t* inst, const uint8_t* packet, uint32_t packet_length, uint16_t calculated_crc) {
+    const uint32_t data_length = packet_length - sizeof(sonar_link_layer_header_t) - sizeof(sonar_link_layer_footer_t);
+    const sonar_link_layer_header_t* header = (const sonar_link_layer_header_t*)packet;
+    const sonar_link_layer_footer_t* footer = (const sonar_link_layer_footer_t*)&packet[sizeof(*header) + data_length];
+    const uint8_t version = (header->flags & SONAR_LINK_LAYER_FLAGS_VERSION_MASK) >> SONAR_LINK_LAYER_FLAGS_VERSION_OFFSET;
+    const bool is_aggregate = version == SONAR_AGGREGATE_VERSION;
+
+    if (!is_aggregate && !is_valid_flags(inst, header)) {
         return;
     } else if (footer->crc != calculated_crc) {
         LOG_ERROR("Invalid packet: bad CRC");
         inst->errors.invalid_crc++;
         return;
-    } else if (is_server_to_client == inst->init.is_server) {
-        LOG_ERROR("Invalid packet: wrong direction");
-        inst->errors.invalid_header++;
+    } else if (!is_valid_direction(inst, header)) {
         return;
     }
 
-    const bool is_response = header->flags & SONAR_LINK_LAYER_FLAGS_RESPONSE_MASK;
-    const bool is_link_control = header->flags & SONAR_LINK_LAYER_FLAGS_LINK_CONTROL_MASK;
-    inst->init.packet_handler(inst->init.handler_handle, is_response, is_link_control, header->sequence_num, &inst->init.buffer[sizeof(*header)], data_length);
+    if (is_aggregate) {
+        handle_aggregate_packet(inst, &packet[sizeof(*header)], data_length);
+    } else {
+        handle_packet(inst, header, &packet[sizeof(*header)], data_length);
+    }
+}
+
+static void process_buffered_packet(instance_impl_t* inst) {
+    if (inst->received_len < (sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_footer_t))) {
+        return;
+    }
+    // the CRC of the header and data has already been (mostly) calculated as the data was received
+    update_crc(inst);
+    process_packet(inst, inst->init.buffer, inst->received_len, inst->crc);
+}
+
+static void process_packet_in_place(instance_impl_t* inst, const uint8_t* packet, uint32_t packet_length) {
+    if (packet_length < (sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_footer_t))) {
+        return;
+    }
+    const uint16_t calculated_crc = crc16(packet, packet_length - sizeof(sonar_link_layer_footer_t), CRC16_INITIAL_VALUE);
+    process_packet(inst, packet, packet_length, calculated_crc);
+}
+
+static void handle_buffer_overflow(instance_impl_t* inst) {
+    // buffer overflowed, so drop this packet and wait for the next flag byte
+    LOG_ERROR("Invalid packet: overflowed buffer");
+    inst->errors.buffer_overflow++;
+    inst->packet_started = false;
+    inst->received_len = 0;
 }
 
 static void store_byte(instance_impl_t* inst, uint8_t byte) {
     if (inst->received_len < inst->init.buffer_size) {
         inst->init.buffer[inst->received_len++] = byte;
     } else {
-        // buffer overflowed, so drop this packet and wait for the next flag byte
-        LOG_ERROR("Invalid packet: overflowed buffer");
-        inst->errors.buffer_overflow++;
-        inst->packet_started = false;
-        inst->received_len = 0;
+        handle_buffer_overflow(inst);
+    }
+}
+
+static void store_bytes(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    if (length <= inst->init.buffer_size - inst->received_len) {
+        memcpy(&inst->init.buffer[inst->received_len], data, length);
+        inst->received_len += length;
+    } else {
+        // the rest of the data (which doesn't contain any flag bytes) will be dropped
+        handle_buffer_overflow(inst);
     }
 }
 
+static void start_packet(instance_impl_t* inst) {
+    inst->packet_started = true;
+    inst->received_len = 0;
+    inst->crc_len = 0;
+    inst->crc = CRC16_INITIAL_VALUE;
+    inst->cobs_remaining = 0;
+    inst->cobs_implied_zero = false;
+}
+
 static void receive_byte(instance_impl_t* inst, uint8_t byte) {
     if (inst->packet_started) {
         if (inst->escaping) {
@@ -93,26 +208,176 @@ static void receive_byte(instance_impl_t* inst, uint8_t byte) {
 
     if (byte == SONAR_ENCODING_FLAG_BYTE) {
         // a flag byte is always the end of the current packet and the start of a new packet
-        process_packet(inst);
-        inst->packet_started = true;
-        inst->received_len = 0;
+        process_buffered_packet(inst);
+        start_packet(inst);
     }
 }
 
+static uint32_t receive_cobs_data(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    // handles the received data up until the end of the current frame (if any), returning the number of bytes consumed
+    if (!inst->packet_started) {
+        // skip until the next delimiter (which starts a new packet)
+        const uint8_t* delimiter = memchr(data, SONAR_ENCODING_COBS_DELIMITER, length);
+        if (!delimiter) {
+            return length;
+        }
+        start_packet(inst);
+        return (uint32_t)(delimiter - data) + 1;
+    }
+
+    uint32_t offset = 0;
+    while (offset < length) {
+        if (inst->cobs_remaining) {
+            // store the run of data up until the end of the block (or a delimiter, which ends the frame early)
+            const uint32_t max_run_length = inst->cobs_remaining < length - offset ? inst->cobs_remaining : length - offset;
+            const uint8_t* delimiter = memchr(&data[offset], SONAR_ENCODING_COBS_DELIMITER, max_run_length);
+            const uint32_t run_length = delimiter ? (uint32_t)(delimiter - &data[offset]) : max_run_length;
+            if (inst->packet_started) {
+                store_bytes(inst, &data[offset], run_length);
+            }
+            inst->cobs_remaining -= run_length;
+            offset += run_length;
+            if (!delimiter) {
+                continue;
+            }
+        }
+
+        const uint8_t byte = data[offset++];
+        if (byte == SONAR_ENCODING_COBS_DELIMITER) {
+            // a delimiter is always the end of the current packet and the start of a new packet
+            if (inst->cobs_remaining) {
+                LOG_ERROR("Truncated COBS block");
+                inst->errors.invalid_escape_sequence++;
+            } else if (inst->packet_started) {
+                process_buffered_packet(inst);
+            }
+            start_packet(inst);
+            return offset;
+        }
+        // this is the code byte for the next block
+        if (inst->cobs_implied_zero && inst->packet_started) {
+            store_byte(inst, 0);
+        }
+        inst->cobs_remaining = byte - 1;
+        inst->cobs_implied_zero = byte != SONAR_ENCODING_COBS_MAX_CODE;
+    }
+    return offset;
+}
+
+static void receive_hdlc_fallback_data(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    // decodes small HDLC frames alongside the COBS data, without counting any errors since the COBS data isn't expected
+    // to decode as HDLC
+    hdlc_fallback_t* fallback = &inst->hdlc_fallback;
+    for (uint32_t i = 0; i < length && inst->use_cobs; i++) {
+        uint8_t byte = data[i];
+        if (byte == SONAR_ENCODING_FLAG_BYTE) {
+            const uint32_t packet_length = fallback->received_len;
+            fallback->packet_started = true;
+            fallback->escaping = false;
+            fallback->received_len = 0;
+            if (packet_length < sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_footer_t)) {
+                continue;
+            }
+            const uint32_t data_length = packet_length - sizeof(sonar_link_layer_header_t) - sizeof(sonar_link_layer_footer_t);
+            const sonar_link_layer_header_t* header = (const sonar_link_layer_header_t*)fallback->buffer;
+            const sonar_link_layer_footer_t* footer = (const sonar_link_layer_footer_t*)&fallback->buffer[sizeof(*header) + data_length];
+            // only link control requests are accepted, which makes it even less likely that COBS data is mistaken for one
+            const bool is_link_control_request = (header->flags & SONAR_LINK_LAYER_FLAGS_LINK_CONTROL_MASK) &&
+                !(header->flags & SONAR_LINK_LAYER_FLAGS_RESPONSE_MASK);
+            if (is_link_control_request && footer->crc == crc16(fallback->buffer, packet_length - sizeof(*footer), CRC16_INITIAL_VALUE) &&
+                is_valid_flags(inst, header) && is_valid_direction(inst, header)) {
+                handle_packet(inst, header, &fallback->buffer[sizeof(*header)], data_length);
+            }
+            continue;
+        } else if (!fallback->packet_started) {
+            continue;
+        } else if (fallback->escaping) {
+            fallback->escaping = false;
+            byte ^= SONAR_ENCODING_ESCAPE_XOR;
+        } else if (byte == SONAR_ENCODING_ESCAPE_BYTE) {
+            fallback->escaping = true;
+            continue;
+        }
+        if (fallback->received_len < sizeof(fallback->buffer)) {
+            fallback->buffer[fallback->received_len++] = byte;
+        } else {
+            // too big to be a connection request
+            fallback->packet_started = false;
+        }
+    }
+}
+
+void sonar_link_layer_receive_set_cobs(sonar_link_layer_receive_handle_t handle, bool enabled) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    inst->use_cobs = enabled;
+    inst->hdlc_fallback.packet_started = false;
+    inst->hdlc_fallback.escaping = false;
+    inst->hdlc_fallback.received_len = 0;
+    inst->packet_started = false;
+    inst->escaping = false;
+    inst->received_len = 0;
+}
+
 void sonar_link_layer_receive_init(sonar_link_layer_receive_handle_t handle, const sonar_link_layer_receive_init_t* init) {
     instance_impl_t* inst = (instance_impl_t*)handle;
     *inst = (instance_impl_t){
         .init = *init,
         .packet_started = false,
         .escaping = false,
+        .use_cobs = false,
         .received_len = 0,
+        .crc_len = 0,
+        .crc = CRC16_INITIAL_VALUE,
     };
 }
 
 void sonar_link_layer_receive_process_data(sonar_link_layer_receive_handle_t handle, const uint8_t* data, uint32_t length) {
     instance_impl_t* inst = (instance_impl_t*)handle;
-    while (length--) {
-        receive_byte(inst, *data++);
+    while (length) {
+        uint32_t run_length;
+        if (inst->use_cobs) {
+            // handle the data a frame at a time, since the framing can change after each packet
+            const uint32_t consumed = receive_cobs_data(inst, data, length);
+            if (inst->use_cobs) {
+                receive_hdlc_fallback_data(inst, data, consumed);
+            }
+            data += consumed;
+            length -= consumed;
+            continue;
+        } else if (!inst->packet_started) {
+            // skip until the next flag byte (which starts a new packet)
+            const uint8_t* flag = memchr(data, SONAR_ENCODING_FLAG_BYTE, length);
+            run_length = flag ? (uint32_t)(flag - data) : length;
+            inst->escaping = false;
+        } else if (!inst->escaping) {
+            run_length = sonar_link_layer_encoding_find_special(data, length);
+            if (!inst->received_len && run_length < length && data[run_length] == SONAR_ENCODING_FLAG_BYTE &&
+                run_length <= inst->init.buffer_size) {
+                // the whole packet is within the received data and has no escaped bytes, so handle it in place rather
+                // than copying it into the buffer (the flag byte which ends it is then handled normally below)
+                process_packet_in_place(inst, data, run_length);
+            } else {
+                // store the run of data up until the next byte which needs special handling
+                store_bytes(inst, data, run_length);
+            }
+        } else {
+            run_length = 0;
+        }
+        data += run_length;
+        length -= run_length;
+        if (inst->use_cobs) {
+            // the packet which was just handled switched the framing, so the flag byte which ends it is handled as COBS
+            continue;
+        } else if (length) {
+            // handle the next byte normally
+            receive_byte(inst, *data++);
+            length--;
+        }
+    }
+    if (inst->packet_started) {
+        // update the CRC while the data which was just stored is still in the cache, which also means there is less to
+        // do once the end of the packet is received
+        update_crc(inst);
     }
 }
 
@@ -4,7 +4,8 @@
 #include <stdbool.h>
 
 #define _SONAR_LINK_LAYER_RECEIVE_CONTEXT_SIZE \
-    (sizeof(uint32_t) * 2 + sizeof(sonar_link_layer_receive_init_t) + sizeof(sonar_link_layer_receive_errors_t))
+    ((sizeof(uint32_t) * 7 + sizeof(sonar_link_layer_receive_init_t) + sizeof(sonar_link_layer_receive_errors_t) + \
+        sizeof(uintptr_t) - 1) / sizeof(uintptr_t) * sizeof(uintptr_t))
 
 typedef struct {
     // Whether or not this is the server (vs. client)
@@ -15,7 +16,11 @@ typedef struct {
     // Size of `buffer` in bytes
     uint32_t buffer_size;
     // Function which is called with complete SONAR link layer packets upon receipt
-    void (*packet_handler)(void* handle, bool is_response, bool is_link_control, uint8_t sequence_num, const uint8_t* data, uint32_t length);
+    // Piggyback packets (see sonar_link_layer_piggyback_header_t) are passed through as-is with `is_piggyback` set, and
+    // aggregate frames are split back up, with this being called for each packet they contain
+    // NOTE: The data may point into either `buffer` or the data passed to sonar_link_layer_receive_process_data(), so is
+    // only valid until this function returns
+    void (*packet_handler)(void* handle, bool is_response, bool is_link_control, bool is_piggyback, uint8_t sequence_num, const uint8_t* data, uint32_t length);
     // Handle which is passed to packet_handler()
     void* handler_handle;
 } sonar_link_layer_receive_init_t;
@@ -27,7 +32,7 @@ typedef struct {
     uint32_t invalid_crc;
     // Receive buffer overflows
     uint32_t buffer_overflow;
-    // Invalid HDLC escape sequences
+    // Invalid HDLC escape sequences (or truncated COBS blocks)
     uint32_t invalid_escape_sequence;
 } sonar_link_layer_receive_errors_t;
 
@@ -38,6 +43,11 @@ typedef sonar_link_layer_receive_context_t* sonar_link_layer_receive_handle_t;
 // Initializes the SONAR link layer receive code
 void sonar_link_layer_receive_init(sonar_link_layer_receive_handle_t handle, const sonar_link_layer_receive_init_t* init);
 
+// Sets whether frames are encoded with COBS rather than HDLC byte stuffing (dropping any partially-received frame)
+// NOTE: While enabled, HDLC link control requests (i.e. connection requests) are still accepted, in case the peer hasn't
+// switched over yet or has been reset
+void sonar_link_layer_receive_set_cobs(sonar_link_layer_receive_handle_t handle, bool enabled);
+
 // Processes received SONAR data
 void sonar_link_layer_receive_process_data(sonar_link_layer_receive_handle_t handle, const uint8_t* data, uint32_t length);
 
@@ -1,14 +1,30 @@
 #pragma once
 
-// How long before we disconnect if we haven't received a response. A connection maintenance
-// message is sent by the client at half this interval.
+// How long before we disconnect if we haven't received a response, which is extended on links whose
+// retry interval is too long for a connection maintenance request to time out first. A connection
+// maintenance message is sent by the client at half this interval.
 #define CONNECTION_TIMEOUT_MS               1000
 #define CONNECTION_MAINTENANCE_INTERVAL_MS  500
 #define REQUEST_RETRY_INTERVAL_MS           100
 #define REQUEST_TIMEOUT_MS                  300
 
+// Requests are retried at an interval derived from the measured round-trip time, and time out after
+// this many retry intervals.
+#define REQUEST_TIMEOUT_INTERVALS           (REQUEST_TIMEOUT_MS / REQUEST_RETRY_INTERVAL_MS)
+// The default upper bound on the retry interval, which is the largest one that still lets a connection
+// maintenance request time out (plus one more retry interval as a buffer) within CONNECTION_TIMEOUT_MS,
+// so that the connection timeout is only extended if a larger bound is configured.
+#define DEFAULT_MAX_REQUEST_RETRY_INTERVAL_MS  ((CONNECTION_TIMEOUT_MS - CONNECTION_MAINTENANCE_INTERVAL_MS) / (REQUEST_TIMEOUT_INTERVALS + 1))
+// The default lower bound on the retry interval, which keeps a link with a very short round-trip
+// time from retrying requests on every small delay.
+#define DEFAULT_MIN_REQUEST_RETRY_INTERVAL_MS  20
+
 // Make sure that we have enough time to send a connection maintenance request and get the
 // response before disconnecting, using the retry interval as an extra buffer.
 #if CONNECTION_TIMEOUT_MS < CONNECTION_MAINTENANCE_INTERVAL_MS + REQUEST_TIMEOUT_MS + REQUEST_RETRY_INTERVAL_MS
 #error "The connection timeout must be at least double the request timeout"
 #endif
+
+#if DEFAULT_MAX_REQUEST_RETRY_INTERVAL_MS < REQUEST_RETRY_INTERVAL_MS || DEFAULT_MIN_REQUEST_RETRY_INTERVAL_MS > REQUEST_RETRY_INTERVAL_MS
+#error "The default retry interval must be within the default retry interval range"
+#endif
@@ -1,21 +1,228 @@
 #include "transmit.h"
 
 #include "../common/crc16.h"
+#include "encoding.h"
 #include "types.h"
 
+#define LOGGING_MODULE_NAME "SONAR"
+#include "anchor/logging/logging.h"
+
+#include <string.h>
+
 typedef struct {
     sonar_link_layer_transmit_init_t init;
+    sonar_link_layer_transmit_cache_t* cache;
+    uint32_t buffer_len;
+    // The index within the staging buffer of the code byte of the current COBS block
+    uint32_t cobs_code_index;
+    // The (decoded) length of the current aggregate frame so far, excluding the footer
+    uint32_t aggregate_len;
+    // The CRC of the current aggregate frame so far
+    uint16_t aggregate_crc;
+    bool use_aggregation;
+    bool is_aggregate_open;
+    bool use_cobs;
+    // Whether or not the current COBS frame didn't fit in the staging buffer (and is being dropped)
+    bool cobs_overflow;
+    // Whether or not the current frame didn't fit in the transmit ring (and is being dropped)
+    bool ring_overflow;
+    // The transmit ring holds `ring_length` bytes starting at `ring_tail`, of which the first `ring_committed_length`
+    // are complete frames which can be transmitted, and the first `ring_tx_length` are currently being transmitted
+    uint32_t ring_tail;
+    uint32_t ring_length;
+    uint32_t ring_committed_length;
+    uint32_t ring_tx_length;
 } instance_impl_t;
 _Static_assert(sizeof(instance_impl_t) == sizeof(sonar_link_layer_transmit_context_t), "Invalid context size");
 
+static void ring_start_tx(instance_impl_t* inst) {
+    if (inst->ring_tx_length || !inst->ring_committed_length) {
+        // already transmitting or nothing to transmit
+        return;
+    }
+    // transmit up to the end of the committed data or the end of the ring, whichever comes first
+    const uint32_t contiguous_length = inst->init.ring_size - inst->ring_tail;
+    inst->ring_tx_length = inst->ring_committed_length < contiguous_length ? inst->ring_committed_length : contiguous_length;
+    inst->init.start_tx_function(&inst->init.ring[inst->ring_tail], inst->ring_tx_length);
+}
+
+static void ring_write(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    if (inst->ring_overflow) {
+        return;
+    } else if (length > inst->init.ring_size - inst->ring_length) {
+        inst->ring_overflow = true;
+        return;
+    }
+    // copy the data in (wrapping around the end of the ring as necessary)
+    uint32_t head = inst->ring_tail + inst->ring_length;
+    if (head >= inst->init.ring_size) {
+        head -= inst->init.ring_size;
+    }
+    const uint32_t first_length = length < inst->init.ring_size - head ? length : inst->init.ring_size - head;
+    memcpy(&inst->init.ring[head], data, first_length);
+    memcpy(inst->init.ring, &data[first_length], length - first_length);
+    inst->ring_length += length;
+}
+
+static void ring_commit(instance_impl_t* inst) {
+    // the frame is complete, so it can be transmitted (or dropped if it didn't fit)
+    if (inst->ring_overflow) {
+        LOG_ERROR("Frame does not fit in the transmit ring");
+        inst->ring_length = inst->ring_committed_length;
+        inst->ring_overflow = false;
+    }
+    inst->ring_committed_length = inst->ring_length;
+    ring_start_tx(inst);
+}
+
+static void write_out(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    if (inst->init.start_tx_function) {
+        ring_write(inst, data, length);
+    } else {
+        inst->init.write_bytes_function(data, length);
+    }
+}
+
+static void flush_buffer(instance_impl_t* inst) {
+    if (inst->buffer_len) {
+        write_out(inst, inst->init.buffer, inst->buffer_len);
+        inst->buffer_len = 0;
+    }
+}
+
+static void end_frame(instance_impl_t* inst) {
+    // writes out the rest of the frame
+    flush_buffer(inst);
+    if (inst->init.start_tx_function) {
+        ring_commit(inst);
+    }
+}
+
+static void write_to_cache(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    sonar_link_layer_transmit_cache_t* cache = inst->cache;
+    if (cache && cache->is_valid) {
+        if (length <= cache->size - cache->length) {
+            memcpy(&cache->buffer[cache->length], data, length);
+            cache->length += length;
+        } else {
+            // the packet doesn't fit in the cache
+            cache->is_valid = false;
+        }
+    }
+}
+
+static void write_raw_bytes(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    write_to_cache(inst, data, length);
+
+    if (inst->init.start_tx_function) {
+        // the ring serves as the staging buffer
+        ring_write(inst, data, length);
+        return;
+    } else if (!inst->init.write_bytes_function) {
+        while (length--) {
+            inst->init.write_byte_function(*data++);
+        }
+        return;
+    } else if (!inst->init.buffer_size) {
+        // no staging buffer, so write the data directly
+        inst->init.write_bytes_function(data, length);
+        return;
+    }
+
+    while (length) {
+        if (inst->buffer_len == inst->init.buffer_size) {
+            // the packet doesn't fit in the staging buffer, so write out what we have so far
+            flush_buffer(inst);
+        }
+        uint32_t chunk_length = inst->init.buffer_size - inst->buffer_len;
+        if (chunk_length > length) {
+            chunk_length = length;
+        }
+        memcpy(&inst->init.buffer[inst->buffer_len], data, chunk_length);
+        inst->buffer_len += chunk_length;
+        data += chunk_length;
+        length -= chunk_length;
+    }
+}
+
+static void write_raw_byte(instance_impl_t* inst, uint8_t byte) {
+    write_raw_bytes(inst, &byte, sizeof(byte));
+}
+
+static void write_cobs_staged(instance_impl_t* inst, uint32_t length) {
+    // writes out the first `length` bytes of the staging buffer, which must all be final
+    write_to_cache(inst, inst->init.buffer, length);
+    write_out(inst, inst->init.buffer, length);
+    memmove(inst->init.buffer, &inst->init.buffer[length], inst->buffer_len - length);
+    inst->buffer_len -= length;
+    inst->cobs_code_index -= length;
+}
+
+static bool reserve_cobs(instance_impl_t* inst, uint32_t length) {
+    // makes space for `length` more bytes in the staging buffer, writing out everything before the current block (whose
+    // code byte isn't known yet) if necessary
+    if (!inst->cobs_overflow && length > inst->init.buffer_size - inst->buffer_len) {
+        write_cobs_staged(inst, inst->cobs_code_index);
+        inst->cobs_overflow = length > inst->init.buffer_size - inst->buffer_len;
+    }
+    return !inst->cobs_overflow;
+}
+
+static void start_cobs_block(instance_impl_t* inst) {
+    // the code byte is filled in once the block ends
+    inst->cobs_code_index = inst->buffer_len;
+    inst->init.buffer[inst->buffer_len++] = 0;
+}
+
+static void end_cobs_block(instance_impl_t* inst) {
+    inst->init.buffer[inst->cobs_code_index] = inst->buffer_len - inst->cobs_code_index;
+}
+
+static void write_cobs_bytes(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
+    while (length && !inst->cobs_overflow) {
+        // copy the run of non-zero bytes which fit in the current block
+        const uint32_t block_space = SONAR_ENCODING_COBS_MAX_CODE - (inst->buffer_len - inst->cobs_code_index);
+        const uint32_t max_run_length = length < block_space ? length : block_space;
+        const uint8_t* zero = memchr(data, 0, max_run_length);
+        const uint32_t run_length = zero ? (uint32_t)(zero - data) : max_run_length;
+        // reserve space for the run and the code byte of the next block
+        if (!reserve_cobs(inst, run_length + 1)) {
+            return;
+        }
+        memcpy(&inst->init.buffer[inst->buffer_len], data, run_length);
+        inst->buffer_len += run_length;
+        data += run_length;
+        length -= run_length;
+        if (zero || run_length == block_space) {
+            // a zero byte is implied by ending the block (unless it's full)
+            end_cobs_block(inst);
+            start_cobs_block(inst);
+            if (zero) {
+                data++;
+                length--;
+            }
+        }
+    }
+}
+
 static void write_encoded_bytes(instance_impl_t* inst, const uint8_t* data, uint32_t length) {
-    for (uint32_t i = 0; i < length; i++) {
-        uint8_t byte = data[i];
-        if (byte == SONAR_ENCODING_FLAG_BYTE || byte == SONAR_ENCODING_ESCAPE_BYTE) {
-            inst->init.write_byte_function(SONAR_ENCODING_ESCAPE_BYTE);
-            byte ^= SONAR_ENCODING_ESCAPE_XOR;
+    if (inst->use_cobs) {
+        write_cobs_bytes(inst, data, length);
+        return;
+    }
+    while (length) {
+        // write out the run of bytes which don't need to be escaped
+        const uint32_t run_length = sonar_link_layer_encoding_find_special(data, length);
+        write_raw_bytes(inst, data, run_length);
+        data += run_length;
+        length -= run_length;
+        if (length) {
+            // escape the next byte
+            const uint8_t escaped[] = {SONAR_ENCODING_ESCAPE_BYTE, *data ^ SONAR_ENCODING_ESCAPE_XOR};
+            write_raw_bytes(inst, escaped, sizeof(escaped));
+            data++;
+            length--;
         }
-        inst->init.write_byte_function(byte);
     }
 }
 
@@ -23,39 +230,230 @@ void sonar_link_layer_transmit_init(sonar_link_layer_transmit_handle_t handle, c
     instance_impl_t* inst = (instance_impl_t*)handle;
     *inst = (instance_impl_t){
         .init = *init,
+        .cache = NULL,
+        .buffer_len = 0,
+        .use_aggregation = false,
+        .is_aggregate_open = false,
+        .use_cobs = false,
     };
+    if (init->start_tx_function && !init->ring_size) {
+        LOG_ERROR("start_tx_function requires a ring");
+        inst->init.start_tx_function = NULL;
+    }
 }
 
-void sonar_link_layer_transmit_send_packet(sonar_link_layer_transmit_handle_t handle, bool is_response, bool is_link_control, uint8_t sequence_num, const buffer_chain_entry_t* data) {
-    instance_impl_t* inst = (instance_impl_t*)handle;
-    uint16_t crc = CRC16_INITIAL_VALUE;
+static uint8_t get_header_flags(const instance_impl_t* inst, bool is_response, bool is_link_control) {
+    return (SONAR_VERSION << SONAR_LINK_LAYER_FLAGS_VERSION_OFFSET) |
+        (is_link_control ? SONAR_LINK_LAYER_FLAGS_LINK_CONTROL_MASK : 0) |
+        (inst->init.is_server ? SONAR_LINK_LAYER_FLAGS_DIRECTION_MASK : 0) |
+        (is_response ? SONAR_LINK_LAYER_FLAGS_RESPONSE_MASK : 0);
+}
 
-    // write the starting flag byte
-    inst->init.write_byte_function(SONAR_ENCODING_FLAG_BYTE);
+static uint16_t write_packet_start(instance_impl_t* inst, uint8_t flags, uint8_t sequence_num) {
+    if (inst->use_cobs) {
+        // write the starting delimiter and start the first block
+        inst->cobs_code_index = 0;
+        inst->cobs_overflow = false;
+        if (reserve_cobs(inst, 2)) {
+            inst->init.buffer[inst->buffer_len++] = SONAR_ENCODING_COBS_DELIMITER;
+            start_cobs_block(inst);
+        }
+    } else {
+        // write the starting flag byte
+        write_raw_byte(inst, SONAR_ENCODING_FLAG_BYTE);
+    }
 
     // write the header
     const sonar_link_layer_header_t header = {
-        .flags = (SONAR_VERSION << SONAR_LINK_LAYER_FLAGS_VERSION_OFFSET) |
-            (is_link_control ? SONAR_LINK_LAYER_FLAGS_LINK_CONTROL_MASK : 0) |
-            (inst->init.is_server ? SONAR_LINK_LAYER_FLAGS_DIRECTION_MASK : 0) |
-            (is_response ? SONAR_LINK_LAYER_FLAGS_RESPONSE_MASK : 0),
+        .flags = flags,
         .sequence_num = sequence_num,
     };
     write_encoded_bytes(inst, (const uint8_t*)&header, sizeof(header));
-    crc = crc16((const uint8_t*)&header, sizeof(header), crc);
+    return crc16((const uint8_t*)&header, sizeof(header), CRC16_INITIAL_VALUE);
+}
 
-    // write the data
+static uint16_t write_packet_data(instance_impl_t* inst, const buffer_chain_entry_t* data, uint16_t crc) {
     FOREACH_BUFFER_CHAIN_ENTRY(data, entry) {
         write_encoded_bytes(inst, entry->data, entry->length);
         crc = crc16(entry->data, entry->length, crc);
     }
+    return crc;
+}
 
+static void write_packet_end(instance_impl_t* inst, uint16_t crc) {
     // write the footer
     const sonar_link_layer_footer_t footer = {
         .crc = crc,
     };
     write_encoded_bytes(inst, (const uint8_t*)&footer, sizeof(footer));
 
+    if (inst->use_cobs) {
+        // end the last block and write the ending delimiter along with the rest of the frame
+        if (reserve_cobs(inst, 1)) {
+            end_cobs_block(inst);
+            inst->init.buffer[inst->buffer_len++] = SONAR_ENCODING_COBS_DELIMITER;
+            write_cobs_staged(inst, inst->buffer_len);
+        } else {
+            LOG_ERROR("Frame does not fit in the transmit buffer");
+            inst->buffer_len = 0;
+            // drop anything which was already queued in the ring
+            inst->ring_overflow = inst->init.start_tx_function != NULL;
+            if (inst->cache) {
+                inst->cache->is_valid = false;
+            }
+        }
+        end_frame(inst);
+        return;
+    }
+
     // write the ending flag byte
-    inst->init.write_byte_function(SONAR_ENCODING_FLAG_BYTE);
+    write_raw_byte(inst, SONAR_ENCODING_FLAG_BYTE);
+
+    // write out the staged packet
+    end_frame(inst);
+}
+
+static void close_aggregate(instance_impl_t* inst) {
+    if (inst->is_aggregate_open) {
+        inst->is_aggregate_open = false;
+        write_packet_end(inst, inst->aggregate_crc);
+    }
+}
+
+static bool append_to_aggregate(instance_impl_t* inst, uint8_t flags, uint8_t sequence_num, const buffer_chain_entry_t* data) {
+    // adds the packet to the current aggregate frame (starting a new one as necessary), returning false if it's too big
+    const uint32_t overhead = sizeof(sonar_link_layer_header_t) + sizeof(sonar_link_layer_footer_t);
+    uint32_t packet_len = sizeof(sonar_link_layer_header_t);
+    FOREACH_BUFFER_CHAIN_ENTRY(data, entry) {
+        packet_len += entry->length;
+    }
+    const uint32_t entry_len = sizeof(sonar_link_layer_aggregate_header_t) + packet_len;
+    if (packet_len > UINT16_MAX || overhead > inst->init.max_frame_size || entry_len > inst->init.max_frame_size - overhead) {
+        return false;
+    }
+    if (inst->is_aggregate_open && entry_len > inst->init.max_frame_size - overhead - inst->aggregate_len) {
+        // doesn't fit in the current aggregate frame, so send it and start a new one
+        close_aggregate(inst);
+    }
+    if (!inst->is_aggregate_open) {
+        const uint8_t aggregate_flags = (SONAR_AGGREGATE_VERSION << SONAR_LINK_LAYER_FLAGS_VERSION_OFFSET) |
+            (inst->init.is_server ? SONAR_LINK_LAYER_FLAGS_DIRECTION_MASK : 0);
+        inst->aggregate_crc = write_packet_start(inst, aggregate_flags, 0);
+        inst->aggregate_len = 0;
+        inst->is_aggregate_open = true;
+    }
+    const sonar_link_layer_aggregate_header_t aggregate_header = {
+        .length = packet_len,
+    };
+    const sonar_link_layer_header_t header = {
+        .flags = flags,
+        .sequence_num = sequence_num,
+    };
+    buffer_chain_entry_t headers[2] = {0};
+    buffer_chain_set_data(&headers[0], (const uint8_t*)&aggregate_header, sizeof(aggregate_header));
+    buffer_chain_set_data(&headers[1], (const uint8_t*)&header, sizeof(header));
+    buffer_chain_push_back(&headers[0], &headers[1]);
+    inst->aggregate_crc = write_packet_data(inst, headers, inst->aggregate_crc);
+    inst->aggregate_crc = write_packet_data(inst, data, inst->aggregate_crc);
+    inst->aggregate_len += entry_len;
+    return true;
+}
+
+void sonar_link_layer_transmit_send_packet(sonar_link_layer_transmit_handle_t handle, bool is_response, bool is_link_control, uint8_t sequence_num, const buffer_chain_entry_t* data) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (inst->use_aggregation) {
+        if (append_to_aggregate(inst, get_header_flags(inst, is_response, is_link_control), sequence_num, data)) {
+            return;
+        }
+        // too big to aggregate, so send it on its own after the current aggregate frame
+        close_aggregate(inst);
+    }
+    uint16_t crc = write_packet_start(inst, get_header_flags(inst, is_response, is_link_control), sequence_num);
+    crc = write_packet_data(inst, data, crc);
+    write_packet_end(inst, crc);
+}
+
+void sonar_link_layer_transmit_send_piggyback_packet(sonar_link_layer_transmit_handle_t handle, uint8_t response_sequence_num, const buffer_chain_entry_t* response_data, uint8_t request_sequence_num, const buffer_chain_entry_t* request_data) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    uint32_t response_length = 0;
+    FOREACH_BUFFER_CHAIN_ENTRY(response_data, entry) {
+        response_length += entry->length;
+    }
+    const sonar_link_layer_piggyback_header_t piggyback_header = {
+        .response_length = response_length,
+        .request_sequence_num = request_sequence_num,
+    };
+    buffer_chain_entry_t piggyback_header_entry = {0};
+    buffer_chain_set_data(&piggyback_header_entry, (const uint8_t*)&piggyback_header, sizeof(piggyback_header));
+
+    const uint8_t flags = get_header_flags(inst, true, false) | SONAR_LINK_LAYER_FLAGS_PIGGYBACK_MASK;
+    close_aggregate(inst);
+    uint16_t crc = write_packet_start(inst, flags, response_sequence_num);
+    crc = write_packet_data(inst, &piggyback_header_entry, crc);
+    crc = write_packet_data(inst, response_data, crc);
+    crc = write_packet_data(inst, request_data, crc);
+    write_packet_end(inst, crc);
+}
+
+void sonar_link_layer_transmit_send_packet_cached(sonar_link_layer_transmit_handle_t handle, sonar_link_layer_transmit_cache_t* cache, bool is_response, bool is_link_control, uint8_t sequence_num, const buffer_chain_entry_t* data) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    cache->length = 0;
+    // packets within an aggregate frame can't be retransmitted on their own
+    cache->is_valid = !inst->use_aggregation;
+    inst->cache = cache;
+    sonar_link_layer_transmit_send_packet(handle, is_response, is_link_control, sequence_num, data);
+    inst->cache = NULL;
+}
+
+bool sonar_link_layer_transmit_resend_cached(sonar_link_layer_transmit_handle_t handle, const sonar_link_layer_transmit_cache_t* cache) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!cache->is_valid) {
+        return false;
+    }
+    close_aggregate(inst);
+    write_raw_bytes(inst, cache->buffer, cache->length);
+    end_frame(inst);
+    return true;
+}
+
+void sonar_link_layer_transmit_set_aggregation(sonar_link_layer_transmit_handle_t handle, bool enabled) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    close_aggregate(inst);
+    inst->use_aggregation = enabled;
+}
+
+bool sonar_link_layer_transmit_has_aggregate(sonar_link_layer_transmit_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    return inst->is_aggregate_open;
+}
+
+void sonar_link_layer_transmit_flush(sonar_link_layer_transmit_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    close_aggregate(inst);
+}
+
+void sonar_link_layer_transmit_set_cobs(sonar_link_layer_transmit_handle_t handle, bool enabled) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    close_aggregate(inst);
+    if (enabled && ((!inst->init.write_bytes_function && !inst->init.start_tx_function) || !inst->init.buffer_size)) {
+        LOG_ERROR("COBS requires write_bytes_function (or start_tx_function) and a staging buffer");
+        return;
+    }
+    inst->use_cobs = enabled;
+}
+
+void sonar_link_layer_transmit_complete(sonar_link_layer_transmit_handle_t handle) {
+    instance_impl_t* inst = (instance_impl_t*)handle;
+    if (!inst->ring_tx_length) {
+        LOG_ERROR("No transmit in progress");
+        return;
+    }
+    inst->ring_tail += inst->ring_tx_length;
+    if (inst->ring_tail == inst->init.ring_size) {
+        inst->ring_tail = 0;
+    }
+    inst->ring_length -= inst->ring_tx_length;
+    inst->ring_committed_length -= inst->ring_tx_length;
+    inst->ring_tx_length = 0;
+    ring_start_tx(inst);
 }
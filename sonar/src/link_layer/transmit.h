@@ -6,15 +6,45 @@
 #include <stdbool.h>
 
 #define _SONAR_LINK_LAYER_TRANSMIT_CONTEXT_SIZE \
-    (sizeof(sonar_link_layer_transmit_init_t))
+    ((sizeof(sonar_link_layer_transmit_init_t) + sizeof(void*) + sizeof(uint32_t) * 9 + \
+        sizeof(uintptr_t) - 1) / sizeof(uintptr_t) * sizeof(uintptr_t))
 
 typedef struct {
     // Whether or not this is the server (vs. client)
     bool is_server;
     // Function which is called to write a byte of data over the physical link
     void (*write_byte_function)(uint8_t byte);
+    // Function which is called to write multiple bytes of data over the physical link (optional - takes precedence over write_byte_function)
+    void (*write_bytes_function)(const uint8_t* data, uint32_t length);
+    // Buffer which is used to stage encoded data before passing it to write_bytes_function (optional)
+    // Should be large enough to hold a fully-encoded packet in order for each packet to be written with a single call
+    uint8_t* buffer;
+    // Size of `buffer` in bytes
+    uint32_t buffer_size;
+    // Function which is called to start writing a contiguous region of `ring` over the physical link, after which
+    // sonar_link_layer_transmit_complete() must be called (optional - takes precedence over the other write functions)
+    void (*start_tx_function)(const uint8_t* data, uint32_t length);
+    // Ring which encoded frames are queued in while earlier ones are being written by start_tx_function
+    // Should be large enough to hold at least one fully-encoded packet (frames which don't fit are dropped)
+    uint8_t* ring;
+    // Size of `ring` in bytes
+    uint32_t ring_size;
+    // The largest (decoded) frame which the peer can receive, which limits how many packets are combined into a single
+    // aggregate frame
+    uint32_t max_frame_size;
 } sonar_link_layer_transmit_init_t;
 
+typedef struct {
+    // Buffer which is used to store the encoded packet
+    // Should be large enough to hold a fully-encoded packet, otherwise packets which don't fit won't be cached
+    uint8_t* buffer;
+    // Size of `buffer` in bytes
+    uint32_t size;
+    // Length of the cached packet in bytes (only valid if `is_valid` is set)
+    uint32_t length;
+    // Whether or not the buffer contains a complete encoded packet
+    bool is_valid;
+} sonar_link_layer_transmit_cache_t;
 
 // The handle is a pointer to a pre-allocated context type (to be accessed by the SONAR implementation only)
 typedef uint8_t sonar_link_layer_transmit_context_t[_SONAR_LINK_LAYER_TRANSMIT_CONTEXT_SIZE];
@@ -25,3 +55,30 @@ void sonar_link_layer_transmit_init(sonar_link_layer_transmit_handle_t handle, c
 
 // Transmits a SONAR link layer packet
 void sonar_link_layer_transmit_send_packet(sonar_link_layer_transmit_handle_t handle, bool is_response, bool is_link_control, uint8_t sequence_num, const buffer_chain_entry_t* data);
+
+// Transmits a SONAR link layer packet which contains both a response and the next (non-link control) request
+void sonar_link_layer_transmit_send_piggyback_packet(sonar_link_layer_transmit_handle_t handle, uint8_t response_sequence_num, const buffer_chain_entry_t* response_data, uint8_t request_sequence_num, const buffer_chain_entry_t* request_data);
+
+// Transmits a SONAR link layer packet and stores the encoded packet in the cache so it can be efficiently retransmitted
+void sonar_link_layer_transmit_send_packet_cached(sonar_link_layer_transmit_handle_t handle, sonar_link_layer_transmit_cache_t* cache, bool is_response, bool is_link_control, uint8_t sequence_num, const buffer_chain_entry_t* data);
+
+// Retransmits the packet which is stored in the cache, returning false if the cache doesn't contain a valid packet
+bool sonar_link_layer_transmit_resend_cached(sonar_link_layer_transmit_handle_t handle, const sonar_link_layer_transmit_cache_t* cache);
+
+// Sets whether or not packets are combined into aggregate frames, which are held open until
+// sonar_link_layer_transmit_flush() is called (and aren't cached)
+void sonar_link_layer_transmit_set_aggregation(sonar_link_layer_transmit_handle_t handle, bool enabled);
+
+// Returns whether or not there is an aggregate frame which is waiting to be flushed
+bool sonar_link_layer_transmit_has_aggregate(sonar_link_layer_transmit_handle_t handle);
+
+// Ends the current aggregate frame (if any) and writes it out
+void sonar_link_layer_transmit_flush(sonar_link_layer_transmit_handle_t handle);
+
+// Sets whether frames are encoded with COBS rather than HDLC byte stuffing (closing any open aggregate frame)
+// NOTE: COBS frames are built up in `buffer` and written with a single call to write_bytes_function (or queued in the
+// ring), so this requires both, and frames whose encoding doesn't fit in `buffer` are dropped
+void sonar_link_layer_transmit_set_cobs(sonar_link_layer_transmit_handle_t handle, bool enabled);
+
+// Called once the region passed to start_tx_function has been written, which starts writing the next one (if any)
+void sonar_link_layer_transmit_complete(sonar_link_layer_transmit_handle_t handle);
@@ -4,18 +4,53 @@
 #include <stdbool.h>
 
 #define SONAR_VERSION                                   1
+// Frames with this version contain multiple packets (each prefixed by a sonar_link_layer_aggregate_header_t) which share
+// a single CRC, with the sequence number of the outer header being unused
+#define SONAR_AGGREGATE_VERSION                         2
 
 #define SONAR_ENCODING_FLAG_BYTE                        0x7E
 #define SONAR_ENCODING_ESCAPE_BYTE                      0x7D
 #define SONAR_ENCODING_ESCAPE_XOR                       0x20
+// COBS-encoded frames are delimited by zero bytes, and are made up of blocks which each start with a code byte of
+// one more than the number of (non-zero) data bytes in the block, with a zero being implied after every block which
+// isn't full
+#define SONAR_ENCODING_COBS_DELIMITER                   0x00
+#define SONAR_ENCODING_COBS_MAX_CODE                    0xFF
+// The maximum encoded size of a COBS frame containing LENGTH bytes (including the delimiters)
+#define SONAR_ENCODING_COBS_MAX_FRAME_SIZE(LENGTH)      ((LENGTH) + (LENGTH) / (SONAR_ENCODING_COBS_MAX_CODE - 1) + 3)
 
 #define SONAR_LINK_LAYER_FLAGS_RESPONSE_MASK            (1 << 0)
 #define SONAR_LINK_LAYER_FLAGS_DIRECTION_MASK           (1 << 1)
 #define SONAR_LINK_LAYER_FLAGS_LINK_CONTROL_MASK        (1 << 2)
-#define SONAR_LINK_LAYER_FLAGS_RESERVED_MASK            (1 << 3)
+// Only valid for (non-link control) responses on connections which negotiated version 3 - see
+// sonar_link_layer_piggyback_header_t
+#define SONAR_LINK_LAYER_FLAGS_PIGGYBACK_MASK           (1 << 3)
 #define SONAR_LINK_LAYER_FLAGS_VERSION_MASK             0xf0
 #define SONAR_LINK_LAYER_FLAGS_VERSION_OFFSET           4
 
+// Link layer protocol version which is negotiated via the connection request (version 1 is implied by a legacy
+// connection request which only contains the initial sequence number)
+#define SONAR_LINK_LAYER_PROTOCOL_VERSION_1             1
+#define SONAR_LINK_LAYER_PROTOCOL_VERSION_2             2
+// Version 3 adds support for piggybacking a request onto a response
+#define SONAR_LINK_LAYER_PROTOCOL_VERSION_3             3
+// Version 4 adds support for aggregate frames (see SONAR_AGGREGATE_VERSION)
+#define SONAR_LINK_LAYER_PROTOCOL_VERSION_4             4
+// Version 5 adds a features byte to the connection request / response for features which both sides have to use
+// together (see SONAR_LINK_LAYER_FEATURE_*), with the response containing the ones which are enabled on both sides
+#define SONAR_LINK_LAYER_PROTOCOL_VERSION_5             5
+// Version 6 adds the size of the sender's receive buffer to the connection request / response, which fragmented
+// requests are sized to fit (see SONAR_LINK_LAYER_FEATURE_FRAGMENTATION)
+#define SONAR_LINK_LAYER_PROTOCOL_VERSION_6             6
+
+// Frames after the connection response are encoded with COBS rather than HDLC byte stuffing
+#define SONAR_LINK_LAYER_FEATURE_COBS                   (1 << 0)
+// Write / notify requests may be compressed (see SONAR_APPLICATION_ATTRIBUTE_ID_COMPRESSED_FLAG)
+#define SONAR_LINK_LAYER_FEATURE_COMPRESSION            (1 << 1)
+// Requests which don't fit in the peer's receive buffer may be split into fragments (see
+// SONAR_APPLICATION_ATTRIBUTE_ID_FRAGMENT_FLAG), which is only negotiated along with the receive buffer sizes (version 6)
+#define SONAR_LINK_LAYER_FEATURE_FRAGMENTATION          (1 << 2)
+
 #pragma pack(push, 1)
 
 typedef struct {
@@ -27,4 +62,37 @@ typedef struct {
     uint16_t crc;
 } sonar_link_layer_footer_t;
 
+// Link control connection request data (legacy requests only contain the sequence number, the features are only
+// present for version 5 and later, and the receive size for version 6 and later)
+typedef struct {
+    uint8_t sequence_num;
+    uint8_t protocol_version;
+    uint8_t window_size;
+    uint8_t features;
+    // The size of the sender's receive buffer (including the link layer header / footer)
+    uint16_t receive_size;
+} sonar_link_layer_connection_request_t;
+
+// Link control connection response data (legacy responses are empty, and the features and receive size are only
+// present if the request contained them)
+typedef struct {
+    uint8_t protocol_version;
+    uint8_t window_size;
+    uint8_t features;
+    uint16_t receive_size;
+} sonar_link_layer_connection_response_t;
+
+// Header at the start of the data of a piggyback packet, which is followed by the response data and then the request data
+// (the sequence number in the link layer header is the response's)
+typedef struct {
+    uint16_t response_length;
+    uint8_t request_sequence_num;
+} sonar_link_layer_piggyback_header_t;
+
+// Header before each packet within an aggregate frame
+typedef struct {
+    // The length of the packet (header and data)
+    uint16_t length;
+} sonar_link_layer_aggregate_header_t;
+
 #pragma pack(pop)
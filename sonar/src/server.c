@@ -12,16 +12,19 @@
 #define GET_SERVER_IMPL(SERVER) ((instance_impl_t*)((SERVER)->_private))
 #define GET_SERVER_ATTR_IMPL(SERVER) ((attr_instance_impl_t*)((SERVER)->_private))
 
-typedef struct {
+typedef struct instance_impl instance_impl_t;
+struct instance_impl {
     sonar_server_init_t init;
     sonar_server_attribute_t attr_list;
+    // The server which this one is a link of (and shares the attributes of), or NULL
+    instance_impl_t* primary;
     sonar_link_layer_context_t link_layer_context;
     sonar_application_layer_context_t application_layer_context;
     sonar_attribute_server_context_t attr_server_context;
     sonar_link_layer_handle_t link_layer_handle;
     sonar_application_layer_handle_t application_layer_handle;
     sonar_attribute_server_handle_t attr_server_handle;
-} instance_impl_t;
+};
 _Static_assert(sizeof(instance_impl_t) == sizeof(((sonar_server_handle_t)0)->_private), "Invalid context size");
 
 typedef struct {
@@ -31,7 +34,7 @@ _Static_assert(sizeof(attr_instance_impl_t) == sizeof(((sonar_server_attribute_t
 
 static sonar_server_attribute_t get_server_attr(sonar_server_handle_t handle, sonar_attribute_t attr) {
     instance_impl_t* inst = GET_SERVER_IMPL(handle);
-    sonar_server_attribute_t server_attr = inst->attr_list;
+    sonar_server_attribute_t server_attr = inst->primary ? inst->primary->attr_list : inst->attr_list;
     while (server_attr) {
         if (server_attr->attr == attr) {
             return server_attr;
@@ -43,6 +46,8 @@ static sonar_server_attribute_t get_server_attr(sonar_server_handle_t handle, so
 
 static void link_layer_connection_changed_callback(void* handle, bool connected) {
     instance_impl_t* inst = handle;
+    sonar_application_layer_connection_changed(inst->application_layer_handle, connected);
+    sonar_attribute_server_connection_changed(inst->attr_server_handle, connected);
     inst->init.connection_changed_callback(handle, connected);
 }
 
@@ -51,6 +56,11 @@ static bool link_layer_request_handler(void* handle, const uint8_t* data, uint32
     return sonar_application_layer_handle_request(inst->application_layer_handle, data, length);
 }
 
+static bool link_layer_response_retry_handler(void* handle) {
+    instance_impl_t* inst = handle;
+    return sonar_application_layer_handle_response_retry(inst->application_layer_handle);
+}
+
 static void link_layer_response_handler(void* handle, bool success, const uint8_t* data, uint32_t length) {
     instance_impl_t* inst = handle;
     sonar_application_layer_handle_response(inst->application_layer_handle, success, data, length);
@@ -60,6 +70,18 @@ static bool application_layer_send_data_function(void* handle, const buffer_chai
     return sonar_link_layer_send_request(handle, data);
 }
 
+static bool application_layer_can_send_data_function(void* handle) {
+    return sonar_link_layer_can_send_request(handle);
+}
+
+static bool application_layer_can_compress_data_function(void* handle) {
+    return sonar_link_layer_is_compression_enabled(handle);
+}
+
+static uint32_t application_layer_get_max_packet_size_function(void* handle) {
+    return sonar_link_layer_get_max_packet_size(handle);
+}
+
 static void application_layer_set_response_function(void* handle, const uint8_t* data, uint32_t length) {
     return sonar_link_layer_set_response(handle, data, length);
 }
@@ -72,19 +94,41 @@ static bool application_layer_attribute_write_handler(void* handle, uint16_t att
     return sonar_attribute_server_handle_write_request(handle, attribute_id, data, length);
 }
 
+static uint8_t application_layer_attribute_priority_handler(void* handle, uint16_t attribute_id) {
+    return sonar_attribute_server_get_priority(handle, attribute_id);
+}
+
+static bool application_layer_attribute_read_stale_handler(void* handle, uint16_t attribute_id) {
+    return sonar_attribute_server_is_read_response_stale(handle, attribute_id);
+}
+
+static uint8_t* application_layer_attribute_buffer_handler(void* handle, uint16_t attribute_id, uint32_t length) {
+    return sonar_attribute_server_get_write_buffer(handle, attribute_id, length);
+}
+
 static bool application_layer_attribute_notify_handler(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
     // the server should never got notify requests
     LOG_ERROR("Got unexpected attribute notify request (0x%x)", attribute_id);
     return false;
 }
 
-static void attribute_server_handle_notify_response(void* handle, uint16_t attribute_id, bool success) {
-    sonar_attribute_server_handle_notify_response(handle, attribute_id, success);
+static void attribute_server_handle_notify_response(void* handle, uint16_t attribute_id, bool success, sonar_application_layer_request_complete_callback_t callback, void* context) {
+    sonar_attribute_server_handle_notify_response(handle, attribute_id, success, (sonar_attribute_server_notify_complete_callback_t)callback, context);
 }
 
-static bool attribute_server_send_notify_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
+static bool attribute_server_send_notify_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_attribute_server_notify_complete_callback_t callback, void* context) {
     instance_impl_t* inst = handle;
-    return sonar_application_layer_notify_request(inst->application_layer_handle, attribute_id, data, length);
+    return sonar_application_layer_notify_request(inst->application_layer_handle, attribute_id, data, length, (sonar_application_layer_request_complete_callback_t)callback, context);
+}
+
+static bool attribute_server_can_send_notify_request_function(void* handle) {
+    instance_impl_t* inst = handle;
+    return sonar_application_layer_can_send_request(inst->application_layer_handle);
+}
+
+static bool attribute_server_is_fragment_in_progress_function(void* handle, uint16_t attribute_id) {
+    instance_impl_t* inst = handle;
+    return sonar_application_layer_is_fragment_in_progress(inst->application_layer_handle, attribute_id);
 }
 
 static void attribute_server_read_response_handler(void* handle, const uint8_t* data, uint32_t length) {
@@ -115,10 +159,11 @@ static void attribute_server_notify_complete_handler(void* handle, bool success)
     inst->init.attribute_notify_complete_handler(handle, success);
 }
 
-void sonar_server_init(sonar_server_handle_t handle, const sonar_server_init_t* init) {
+static void init_server(sonar_server_handle_t handle, const sonar_server_init_t* init, instance_impl_t* primary) {
     instance_impl_t* inst = GET_SERVER_IMPL(handle);
     *inst = (instance_impl_t){
         .init = *init,
+        .primary = primary,
         .link_layer_handle = &inst->link_layer_context,
         .application_layer_handle = &inst->application_layer_context,
         .attr_server_handle = &inst->attr_server_context,
@@ -126,19 +171,38 @@ void sonar_server_init(sonar_server_handle_t handle, const sonar_server_init_t*
     const sonar_link_layer_init_t init_link_layer = {
         .config = {
             .is_server = true,
+            .window_size = init->window_size,
+            .enable_piggyback = init->enable_piggyback,
+            .min_retry_interval_ms = init->min_retry_interval_ms,
+            .max_retry_interval_ms = init->max_retry_interval_ms,
+            .enable_aggregation = init->enable_aggregation,
+            .aggregation_delay_ms = init->aggregation_delay_ms,
+            .enable_cobs = init->enable_cobs,
+            .enable_compression = init->enable_compression,
+            .enable_fragmentation = init->enable_fragmentation,
         },
         .buffers = {
             .receive = handle->receive_buffer,
             .receive_size = handle->receive_buffer_size,
+            .transmit = handle->transmit_buffer,
+            .transmit_size = handle->transmit_buffer_size,
+            .retransmit_request = handle->retransmit_cache,
+            .retransmit_response = handle->retransmit_cache ? &handle->retransmit_cache[handle->retransmit_cache_size] : NULL,
+            .retransmit_size = handle->retransmit_cache_size,
+            .transmit_ring = handle->transmit_ring,
+            .transmit_ring_size = handle->transmit_ring_size,
         },
         .functions = {
             .get_system_time_ms = init->get_system_time_ms,
             .write_byte = init->write_byte,
+            .write_bytes = init->write_bytes,
+            .start_tx = init->start_tx,
         },
         .handlers = {
             .connection_changed = link_layer_connection_changed_callback,
             .request = link_layer_request_handler,
             .request_complete = link_layer_response_handler,
+            .response_retry = link_layer_response_retry_handler,
             .handler_handle = inst,
         },
     };
@@ -147,29 +211,54 @@ void sonar_server_init(sonar_server_handle_t handle, const sonar_server_init_t*
     const sonar_application_layer_init_t init_application_layer = {
         .is_server = true,
         .send_data_function = application_layer_send_data_function,
+        .can_send_data_function = application_layer_can_send_data_function,
+        .can_compress_data_function = application_layer_can_compress_data_function,
         .set_response_function = application_layer_set_response_function,
         .send_data_handle = inst->link_layer_handle,
         .attribute_read_handler = application_layer_attribute_read_handler,
         .attribute_write_handler = application_layer_attribute_write_handler,
         .attribute_notify_handler = application_layer_attribute_notify_handler,
+        .attribute_buffer_handler = application_layer_attribute_buffer_handler,
+        .attribute_priority_handler = application_layer_attribute_priority_handler,
+        .attribute_read_stale_handler = application_layer_attribute_read_stale_handler,
         .attr_handler_handle = inst->attr_server_handle,
 
         .notify_request_complete_handler = attribute_server_handle_notify_response,
         .request_complete_handle = inst->attr_server_handle,
+        .get_max_packet_size_function = application_layer_get_max_packet_size_function,
+        .compression_buffer = handle->compression_buffer_size ? handle->compression_buffer : NULL,
+        .compression_buffer_size = handle->compression_buffer_size,
+        .max_priority_overtakes = init->max_priority_overtakes,
     };
     sonar_application_layer_init(inst->application_layer_handle, &init_application_layer);
 
     const sonar_attribute_server_init_t init_attr_server = {
         .send_notify_request_function = attribute_server_send_notify_request_function,
+        .can_send_notify_request_function = attribute_server_can_send_notify_request_function,
         .read_response_handler = attribute_server_read_response_handler,
         .read_handler = attribute_server_read_handler,
         .write_handler = attribute_server_write_handler,
         .notify_complete_handler = attribute_server_notify_complete_handler,
+        .is_fragment_in_progress_function = attribute_server_is_fragment_in_progress_function,
         .handle = inst,
+        .parent = primary ? primary->attr_server_handle : NULL,
     };
     sonar_attribute_server_init(inst->attr_server_handle, &init_attr_server);
 }
 
+void sonar_server_init(sonar_server_handle_t handle, const sonar_server_init_t* init) {
+    init_server(handle, init, NULL);
+}
+
+void sonar_server_init_link(sonar_server_handle_t handle, sonar_server_handle_t primary, const sonar_server_init_t* init) {
+    instance_impl_t* primary_inst = GET_SERVER_IMPL(primary);
+    if (primary_inst->primary) {
+        LOG_ERROR("The primary server can't itself be a link");
+        primary_inst = primary_inst->primary;
+    }
+    init_server(handle, init, primary_inst);
+}
+
 bool sonar_server_is_connected(sonar_server_handle_t handle) {
     instance_impl_t* inst = GET_SERVER_IMPL(handle);
     return sonar_link_layer_is_connected(inst->link_layer_handle);
@@ -179,10 +268,45 @@ void sonar_server_process(sonar_server_handle_t handle, const uint8_t* received_
     instance_impl_t* inst = GET_SERVER_IMPL(handle);
     sonar_link_layer_handle_receive_data(inst->link_layer_handle, received_data, received_data_length);
     sonar_link_layer_process(inst->link_layer_handle);
+    sonar_application_layer_process(inst->application_layer_handle);
+    sonar_attribute_server_process(inst->attr_server_handle);
+    sonar_link_layer_flush(inst->link_layer_handle);
+}
+
+void sonar_server_process_rx_ring(sonar_server_handle_t handle, sonar_rx_ring_handle_t ring) {
+    instance_impl_t* inst = GET_SERVER_IMPL(handle);
+    // the data may wrap around the end of the ring, in which case it's handled as two contiguous spans
+    for (uint32_t i = 0; i < 2; i++) {
+        const uint8_t* data;
+        const uint32_t length = sonar_rx_ring_peek(ring, &data);
+        if (!length) {
+            break;
+        }
+        sonar_link_layer_handle_receive_data(inst->link_layer_handle, data, length);
+        sonar_rx_ring_consume(ring, length);
+    }
+    sonar_link_layer_process(inst->link_layer_handle);
+    sonar_application_layer_process(inst->application_layer_handle);
+    sonar_attribute_server_process(inst->attr_server_handle);
+    sonar_link_layer_flush(inst->link_layer_handle);
+}
+
+uint64_t sonar_server_get_next_deadline_ms(sonar_server_handle_t handle) {
+    instance_impl_t* inst = GET_SERVER_IMPL(handle);
+    return sonar_link_layer_get_next_deadline_ms(inst->link_layer_handle);
+}
+
+void sonar_server_tx_complete(sonar_server_handle_t handle) {
+    instance_impl_t* inst = GET_SERVER_IMPL(handle);
+    sonar_link_layer_tx_complete(inst->link_layer_handle);
 }
 
 void sonar_server_register(sonar_server_handle_t handle, sonar_server_attribute_t attr) {
     instance_impl_t* inst = GET_SERVER_IMPL(handle);
+    if (inst->primary) {
+        LOG_ERROR("Attributes must be registered with the primary server");
+        return;
+    }
     if (inst->attr_list) {
         GET_SERVER_ATTR_IMPL(attr)->next = inst->attr_list;
     }
@@ -192,7 +316,16 @@ void sonar_server_register(sonar_server_handle_t handle, sonar_server_attribute_
 
 bool sonar_server_notify(sonar_server_handle_t handle, sonar_server_attribute_t attr, const void* data, uint32_t length) {
     instance_impl_t* inst = GET_SERVER_IMPL(handle);
-    return sonar_attribute_server_notify(inst->attr_server_handle, attr->attr, data, length);
+    return sonar_attribute_server_notify(inst->attr_server_handle, attr->attr, data, length, NULL, NULL);
+}
+
+bool sonar_server_notify_with_callback(sonar_server_handle_t handle, sonar_server_attribute_t attr, const void* data, uint32_t length, sonar_server_notify_complete_callback_t callback, void* context) {
+    instance_impl_t* inst = GET_SERVER_IMPL(handle);
+    if (!callback) {
+        LOG_ERROR("Invalid callback");
+        return false;
+    }
+    return sonar_attribute_server_notify(inst->attr_server_handle, attr->attr, data, length, callback, context);
 }
 
 bool sonar_server_notify_read_data(sonar_server_handle_t handle, sonar_server_attribute_t attr) {
@@ -200,6 +333,11 @@ bool sonar_server_notify_read_data(sonar_server_handle_t handle, sonar_server_at
     return sonar_attribute_server_notify_read_data(inst->attr_server_handle, attr->attr);
 }
 
+bool sonar_server_notify_schedule(sonar_server_handle_t handle, sonar_server_attribute_t attr) {
+    instance_impl_t* inst = GET_SERVER_IMPL(handle);
+    return sonar_attribute_server_notify_schedule(inst->attr_server_handle, attr->attr);
+}
+
 void sonar_server_get_and_clear_errors(sonar_server_handle_t handle, sonar_errors_t* errors) {
     instance_impl_t* inst = GET_SERVER_IMPL(handle);
     sonar_link_layer_errors_t link_layer_errors;
@@ -220,3 +358,14 @@ void sonar_server_get_and_clear_errors(sonar_server_handle_t handle, sonar_error
         },
     };
 }
+
+void sonar_server_get_rtt(sonar_server_handle_t handle, sonar_rtt_t* rtt) {
+    instance_impl_t* inst = GET_SERVER_IMPL(handle);
+    sonar_link_layer_rtt_t link_layer_rtt;
+    sonar_link_layer_get_rtt(inst->link_layer_handle, &link_layer_rtt);
+    *rtt = (sonar_rtt_t){
+        .srtt_ms = link_layer_rtt.srtt_ms,
+        .rttvar_ms = link_layer_rtt.rttvar_ms,
+        .retry_interval_ms = link_layer_rtt.retry_interval_ms,
+    };
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef void(*benchmark_function_t)(void);
+
+// Registers a benchmark to be run by benchmark_main.cpp (used via the BENCHMARK() macro)
+bool benchmark_register(const char* name, benchmark_function_t func);
+
+// Repeatedly calls FUNC for a fixed amount of time and prints its throughput, where each call processes BYTES bytes
+void benchmark_report_throughput(const char* name, size_t bytes, void(*func)(void* arg), void* arg);
+
+#define BENCHMARK(NAME) \
+  static void benchmark_##NAME(void); \
+  static const bool _benchmark_##NAME##_registered = benchmark_register(#NAME, benchmark_##NAME); \
+  static void benchmark_##NAME(void)
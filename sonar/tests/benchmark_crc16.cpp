@@ -0,0 +1,52 @@
+#include "benchmark.h"
+
+extern "C" {
+
+#include "src/common/crc16.h"
+
+};
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint16_t(*crc16_function_t)(const uint8_t* data, uint32_t length, uint16_t crc);
+
+typedef struct {
+  crc16_function_t func;
+  const uint8_t* data;
+  uint32_t length;
+  volatile uint16_t result;
+} crc16_benchmark_arg_t;
+
+static void run_crc16(void* arg) {
+  crc16_benchmark_arg_t* crc_arg = (crc16_benchmark_arg_t*)arg;
+  crc_arg->result = crc_arg->func(crc_arg->data, crc_arg->length, CRC16_INITIAL_VALUE);
+}
+
+static void benchmark_backend(const char* name, crc16_function_t func) {
+  static uint8_t data[4096];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = rand();
+  }
+  // typical SONAR frame sizes up to large host-side buffers
+  const uint32_t lengths[] = {16, 64, 256, 4096};
+  for (uint32_t length : lengths) {
+    char label[64];
+    snprintf(label, sizeof(label), "%s (%u bytes)", name, length);
+    crc16_benchmark_arg_t arg = {
+      .func = func,
+      .data = data,
+      .length = length,
+      .result = 0,
+    };
+    benchmark_report_throughput(label, length, run_crc16, &arg);
+  }
+}
+
+BENCHMARK(CRC16) {
+  benchmark_backend("bitwise", crc16_bitwise);
+  benchmark_backend("table", crc16_table);
+  benchmark_backend("slicing_by_4", crc16_slicing_by_4);
+  benchmark_backend("slicing_by_8", crc16_slicing_by_8);
+  benchmark_backend("clmul", crc16_clmul);
+}
@@ -0,0 +1,138 @@
+#include "benchmark.h"
+
+extern "C" {
+
+#include "src/link_layer/receive.h"
+#include "src/link_layer/transmit.h"
+#include "src/link_layer/types.h"
+
+};
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define MAX_PAYLOAD_SIZE 1024
+
+typedef struct {
+  const char* name;
+  std::vector<uint8_t> data;
+} payload_t;
+
+typedef struct {
+  buffer_chain_entry_t entry;
+  std::vector<uint8_t> frame;
+} framing_arg_t;
+
+static uint8_t m_transmit_buffer[(MAX_PAYLOAD_SIZE + 6) * 2 + 2];
+static uint8_t m_receive_buffer[MAX_PAYLOAD_SIZE + 4];
+static sonar_link_layer_transmit_context_t m_transmit_context;
+static sonar_link_layer_receive_context_t m_receive_context;
+static std::vector<uint8_t>* m_sent_data;
+static volatile uint32_t m_num_received_packets;
+
+static void write_bytes_function(const uint8_t* data, uint32_t length) {
+  if (m_sent_data) {
+    m_sent_data->insert(m_sent_data->end(), data, data + length);
+  }
+}
+
+static void packet_handler(void* handle, bool is_response, bool is_link_control, bool is_piggyback, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
+  m_num_received_packets++;
+}
+
+static void run_transmit(void* arg) {
+  const framing_arg_t* framing_arg = (const framing_arg_t*)arg;
+  sonar_link_layer_transmit_send_packet(&m_transmit_context, false, false, 0, &framing_arg->entry);
+}
+
+static void run_receive(void* arg) {
+  const framing_arg_t* framing_arg = (const framing_arg_t*)arg;
+  sonar_link_layer_receive_process_data(&m_receive_context, framing_arg->frame.data(), framing_arg->frame.size());
+}
+
+static std::vector<payload_t> build_payloads(void) {
+  std::vector<payload_t> payloads;
+
+  // a protobuf-encoded device info attribute (tags, short strings, and varints)
+  std::vector<uint8_t> device_info;
+  const char* strings[] = {"anchor-sonar-device", "v1.4.2-rc1", "SN0012345678"};
+  for (uint32_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+    device_info.push_back((uint8_t)(((i + 1) << 3) | 2));
+    device_info.push_back((uint8_t)strlen(strings[i]));
+    device_info.insert(device_info.end(), strings[i], strings[i] + strlen(strings[i]));
+  }
+  const uint8_t varints[] = {0x20, 0x96, 0x01, 0x28, 0x00, 0x30, 0xac, 0x02};
+  device_info.insert(device_info.end(), varints, varints + sizeof(varints));
+  payloads.push_back({"device info", device_info});
+
+  // little-endian int16 sensor samples close to zero (lots of 0x00 / 0xff bytes)
+  std::vector<uint8_t> samples;
+  for (uint32_t i = 0; i < 256; i++) {
+    const int16_t sample = (int16_t)(rand() % 64 - 32);
+    samples.push_back(sample & 0xff);
+    samples.push_back((uint16_t)sample >> 8);
+  }
+  payloads.push_back({"int16 samples", samples});
+
+  // a chunk of a firmware image (uniformly random bytes)
+  std::vector<uint8_t> firmware;
+  for (uint32_t i = 0; i < MAX_PAYLOAD_SIZE; i++) {
+    firmware.push_back(rand());
+  }
+  payloads.push_back({"firmware chunk", firmware});
+
+  // the worst cases for each encoding
+  payloads.push_back({"all 0x7e", std::vector<uint8_t>(MAX_PAYLOAD_SIZE, 0x7e)});
+  payloads.push_back({"all 0x00", std::vector<uint8_t>(MAX_PAYLOAD_SIZE, 0x00)});
+  return payloads;
+}
+
+BENCHMARK(LinkLayerFraming) {
+  const sonar_link_layer_transmit_init_t transmit_init = {
+    .is_server = false,
+    .write_byte_function = NULL,
+    .write_bytes_function = write_bytes_function,
+    .buffer = m_transmit_buffer,
+    .buffer_size = sizeof(m_transmit_buffer),
+  };
+  const sonar_link_layer_receive_init_t receive_init = {
+    .is_server = true,
+    .buffer = m_receive_buffer,
+    .buffer_size = sizeof(m_receive_buffer),
+    .packet_handler = packet_handler,
+    .handler_handle = NULL,
+  };
+  for (const payload_t& payload : build_payloads()) {
+    for (int use_cobs = 0; use_cobs < 2; use_cobs++) {
+      const char* framing = use_cobs ? "COBS" : "HDLC";
+      sonar_link_layer_transmit_init(&m_transmit_context, &transmit_init);
+      sonar_link_layer_transmit_set_cobs(&m_transmit_context, use_cobs);
+      sonar_link_layer_receive_init(&m_receive_context, &receive_init);
+      sonar_link_layer_receive_set_cobs(&m_receive_context, use_cobs);
+
+      // encode the frame once to get the number of bytes on the wire
+      framing_arg_t arg = {};
+      buffer_chain_set_data(&arg.entry, payload.data.data(), payload.data.size());
+      m_sent_data = &arg.frame;
+      run_transmit(&arg);
+      m_sent_data = NULL;
+      const uint32_t num_received_packets = m_num_received_packets;
+      run_receive(&arg);
+      if (m_num_received_packets != num_received_packets + 1) {
+        printf("  %s, %s: failed to decode frame\n", payload.name, framing);
+        continue;
+      }
+      const uint32_t overhead = arg.frame.size() - payload.data.size();
+      printf("  %s, %s: %u byte payload, %u bytes on the wire (%.1f%% overhead)\n", payload.name, framing,
+        (uint32_t)payload.data.size(), (uint32_t)arg.frame.size(), 100.0 * overhead / payload.data.size());
+
+      char label[64];
+      snprintf(label, sizeof(label), "%s, %s, transmit", payload.name, framing);
+      benchmark_report_throughput(label, payload.data.size(), run_transmit, &arg);
+      snprintf(label, sizeof(label), "%s, %s, receive", payload.name, framing);
+      benchmark_report_throughput(label, payload.data.size(), run_receive, &arg);
+    }
+  }
+}
@@ -0,0 +1,79 @@
+#include "benchmark.h"
+
+extern "C" {
+
+#include "src/common/crc16.h"
+#include "src/link_layer/receive.h"
+
+};
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define MAX_PAYLOAD_SIZE 4096
+
+typedef struct {
+  const uint8_t* data;
+  uint32_t length;
+} receive_arg_t;
+
+static sonar_link_layer_receive_context_t m_receive_context;
+static uint8_t m_receive_buffer[MAX_PAYLOAD_SIZE + 4];
+static volatile uint32_t m_num_received_packets;
+
+static void packet_handler(void* handle, bool is_response, bool is_link_control, bool is_piggyback, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
+  m_num_received_packets++;
+}
+
+static void run_receive(void* arg) {
+  const receive_arg_t* receive_arg = (const receive_arg_t*)arg;
+  sonar_link_layer_receive_process_data(&m_receive_context, receive_arg->data, receive_arg->length);
+}
+
+static std::vector<uint8_t> build_frame(uint32_t length, uint32_t special_interval) {
+  // random data which doesn't need escaping, other than every `special_interval` bytes
+  std::vector<uint8_t> packet = {0x10, 0x00};
+  for (uint32_t i = 0; i < length; i++) {
+    packet.push_back((special_interval && (i % special_interval) == special_interval - 1) ? 0x7e : rand() % 0x7d);
+  }
+  const uint16_t crc = crc16(packet.data(), packet.size(), CRC16_INITIAL_VALUE);
+  packet.push_back(crc & 0xff);
+  packet.push_back(crc >> 8);
+  std::vector<uint8_t> frame = {0x7e};
+  for (uint8_t byte : packet) {
+    if (byte == 0x7e || byte == 0x7d) {
+      frame.push_back(0x7d);
+      frame.push_back(byte ^ 0x20);
+    } else {
+      frame.push_back(byte);
+    }
+  }
+  frame.push_back(0x7e);
+  return frame;
+}
+
+BENCHMARK(LinkLayerReceive) {
+  const sonar_link_layer_receive_init_t init = {
+    .is_server = true,
+    .buffer = m_receive_buffer,
+    .buffer_size = sizeof(m_receive_buffer),
+    .packet_handler = packet_handler,
+    .handler_handle = NULL,
+  };
+  const uint32_t lengths[] = {32, 256, MAX_PAYLOAD_SIZE};
+  const uint32_t special_intervals[] = {0, 256, 16};
+  for (uint32_t special_interval : special_intervals) {
+    for (uint32_t length : lengths) {
+      sonar_link_layer_receive_init(&m_receive_context, &init);
+      const std::vector<uint8_t> frame = build_frame(length, special_interval);
+      receive_arg_t arg = {
+        .data = frame.data(),
+        .length = (uint32_t)frame.size(),
+      };
+      char label[64];
+      snprintf(label, sizeof(label), "%u bytes, escape every %u", length, special_interval);
+      benchmark_report_throughput(label, length, run_receive, &arg);
+    }
+  }
+}
@@ -0,0 +1,111 @@
+#include "benchmark.h"
+
+extern "C" {
+
+#include "src/link_layer/encoding.h"
+#include "src/link_layer/transmit.h"
+
+};
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_PAYLOAD_SIZE 4096
+
+typedef struct {
+  const uint8_t* data;
+  uint32_t length;
+  volatile uint32_t result;
+} find_special_arg_t;
+
+static uint8_t m_transmit_buffer[(MAX_PAYLOAD_SIZE + 6) * 2 + 2];
+static sonar_link_layer_transmit_context_t m_transmit_context;
+
+static void write_bytes_function(const uint8_t* data, uint32_t length) {
+  (void)data;
+  (void)length;
+}
+
+static void write_byte_function(uint8_t byte) {
+  (void)byte;
+}
+
+static uint32_t find_special_bytewise(const uint8_t* data, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    if (data[i] == 0x7e || data[i] == 0x7d) {
+      return i;
+    }
+  }
+  return length;
+}
+
+static void run_find_special_bytewise(void* arg) {
+  find_special_arg_t* find_arg = (find_special_arg_t*)arg;
+  find_arg->result = find_special_bytewise(find_arg->data, find_arg->length);
+}
+
+static void run_find_special_portable(void* arg) {
+  find_special_arg_t* find_arg = (find_special_arg_t*)arg;
+  find_arg->result = sonar_link_layer_encoding_find_special_portable(find_arg->data, find_arg->length);
+}
+
+static void run_find_special(void* arg) {
+  find_special_arg_t* find_arg = (find_special_arg_t*)arg;
+  find_arg->result = sonar_link_layer_encoding_find_special(find_arg->data, find_arg->length);
+}
+
+static void run_send_packet(void* arg) {
+  sonar_link_layer_transmit_send_packet(&m_transmit_context, false, false, 0, (const buffer_chain_entry_t*)arg);
+}
+
+static void fill_payload(uint8_t* data, uint32_t length, uint32_t special_interval) {
+  // random data which doesn't need escaping, other than every `special_interval` bytes
+  for (uint32_t i = 0; i < length; i++) {
+    data[i] = rand() % 0x7d;
+    if (special_interval && (i % special_interval) == special_interval - 1) {
+      data[i] = 0x7e;
+    }
+  }
+}
+
+BENCHMARK(LinkLayerFindSpecial) {
+  static uint8_t data[MAX_PAYLOAD_SIZE];
+  fill_payload(data, sizeof(data), 0);
+  find_special_arg_t arg = {
+    .data = data,
+    .length = sizeof(data),
+    .result = 0,
+  };
+  benchmark_report_throughput("bytewise", sizeof(data), run_find_special_bytewise, &arg);
+  benchmark_report_throughput("portable", sizeof(data), run_find_special_portable, &arg);
+  benchmark_report_throughput("native", sizeof(data), run_find_special, &arg);
+}
+
+BENCHMARK(LinkLayerTransmit) {
+  static uint8_t data[MAX_PAYLOAD_SIZE];
+  const uint32_t lengths[] = {32, 256, MAX_PAYLOAD_SIZE};
+  const uint32_t special_intervals[] = {0, 256, 16};
+  for (uint32_t special_interval : special_intervals) {
+    fill_payload(data, sizeof(data), special_interval);
+    for (uint32_t length : lengths) {
+      buffer_chain_entry_t entry = {};
+      buffer_chain_set_data(&entry, data, length);
+      char label[64];
+
+      sonar_link_layer_transmit_init_t init = {
+        .is_server = false,
+        .write_byte_function = write_byte_function,
+      };
+      sonar_link_layer_transmit_init(&m_transmit_context, &init);
+      snprintf(label, sizeof(label), "write_byte, %u bytes, escape every %u", length, special_interval);
+      benchmark_report_throughput(label, length, run_send_packet, &entry);
+
+      init.write_bytes_function = write_bytes_function;
+      init.buffer = m_transmit_buffer;
+      init.buffer_size = sizeof(m_transmit_buffer);
+      sonar_link_layer_transmit_init(&m_transmit_context, &init);
+      snprintf(label, sizeof(label), "write_bytes, %u bytes, escape every %u", length, special_interval);
+      benchmark_report_throughput(label, length, run_send_packet, &entry);
+    }
+  }
+}
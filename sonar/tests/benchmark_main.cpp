@@ -0,0 +1,57 @@
+#include "benchmark.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define MIN_DURATION_S 0.25
+
+typedef struct {
+  const char* name;
+  benchmark_function_t func;
+} benchmark_t;
+
+static std::vector<benchmark_t>& get_benchmarks() {
+  static std::vector<benchmark_t> benchmarks;
+  return benchmarks;
+}
+
+bool benchmark_register(const char* name, benchmark_function_t func) {
+  get_benchmarks().push_back({ .name = name, .func = func });
+  return true;
+}
+
+void benchmark_report_throughput(const char* name, size_t bytes, void(*func)(void* arg), void* arg) {
+  // warm up, then double the number of iterations until we've run for long enough to get a stable result
+  func(arg);
+  double elapsed_s = 0;
+  uint64_t iterations = 1;
+  while (true) {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+      func(arg);
+    }
+    elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (elapsed_s >= MIN_DURATION_S) {
+      break;
+    }
+    iterations *= 2;
+  }
+  const double gb_per_s = (double)bytes * iterations / elapsed_s / 1e9;
+  printf("  %-40s %8.3f GB/s\n", name, gb_per_s);
+}
+
+int main(int argc, char **argv) {
+  // optionally only run the benchmarks whose name contains the first argument
+  const char* filter = argc > 1 ? argv[1] : "";
+  for (const benchmark_t& benchmark : get_benchmarks()) {
+    if (!strstr(benchmark.name, filter)) {
+      continue;
+    }
+    printf("%s\n", benchmark.name);
+    benchmark.func();
+  }
+  return 0;
+}
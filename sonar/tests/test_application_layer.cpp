@@ -17,17 +17,22 @@ extern "C" {
   } while (0)
 
 #define SEND_READ_REQUEST(ATTR_ID) do { \
-    EXPECT_TRUE(sonar_application_layer_read_request(handle_, ATTR_ID)); \
+    EXPECT_TRUE(sonar_application_layer_read_request(handle_, ATTR_ID, NULL, 0, NULL, NULL)); \
   } while (0)
 
 #define SEND_WRITE_REQUEST(ATTR_ID, ...) do { \
     const uint8_t _buffer[] = {__VA_ARGS__}; \
-    EXPECT_TRUE(sonar_application_layer_write_request(handle_, ATTR_ID, _buffer, sizeof(_buffer))); \
+    EXPECT_TRUE(sonar_application_layer_write_request(handle_, ATTR_ID, _buffer, sizeof(_buffer), NULL, NULL)); \
   } while (0)
 
 #define SEND_NOTIFY_REQUEST(ATTR_ID, ...) do { \
     const uint8_t _buffer[] = {__VA_ARGS__}; \
-    EXPECT_TRUE(sonar_application_layer_notify_request(handle_, ATTR_ID, _buffer, sizeof(_buffer))); \
+    EXPECT_TRUE(sonar_application_layer_notify_request(handle_, ATTR_ID, _buffer, sizeof(_buffer), NULL, NULL)); \
+  } while (0)
+
+#define SEND_WRITE_REQUEST_WITH_CALLBACK(ATTR_ID, CONTEXT, ...) do { \
+    const uint8_t _buffer[] = {__VA_ARGS__}; \
+    EXPECT_TRUE(sonar_application_layer_write_request(handle_, ATTR_ID, _buffer, sizeof(_buffer), (sonar_application_layer_request_complete_callback_t)request_complete_callback, (void*)(CONTEXT))); \
   } while (0)
 
 #define HANDLE_REQUEST_DATA_NO_RESPONSE(...) do { \
@@ -128,6 +133,15 @@ extern "C" {
     m_complete_data.clear(); \
   } while (0)
 
+#define EXPECT_CALLBACK_COMPLETE(CONTEXT, ATTR_ID, SUCCESS) do { \
+    ASSERT_EQ(m_callback_contexts.size(), 1); \
+    EXPECT_EQ(m_callback_contexts[0], CONTEXT); \
+    EXPECT_EQ(m_complete_attribute_id, ATTR_ID); \
+    EXPECT_EQ(m_complete_success, SUCCESS); \
+    m_callback_contexts.clear(); \
+    m_complete_data.clear(); \
+  } while (0)
+
 static int m_num_sent_packets;
 static std::vector<uint8_t> m_sent_data;
 static int m_num_read_requests;
@@ -143,14 +157,44 @@ static uint16_t m_complete_attribute_id;;
 static std::vector<uint8_t> m_complete_data;
 static std::vector<uint8_t> m_response_data;
 static uint32_t m_response_length;
+// number of additional requests the lower layer can currently accept (or -1 for unlimited)
+static int m_send_budget;
+static std::vector<uintptr_t> m_callback_contexts;
+static bool m_can_compress;
+static uint32_t m_max_packet_size;
 
 static bool send_data_function(void* handle, const buffer_chain_entry_t* data) {
+  if (m_send_budget > 0) {
+    m_send_budget--;
+  }
   m_num_sent_packets++;
   std::vector<uint8_t> new_data = buffer_chain_to_vector(data);
   m_sent_data.insert(m_sent_data.end(), new_data.begin(), new_data.end());
   return true;
 }
 
+static bool can_send_data_function(void* handle) {
+  return m_send_budget != 0;
+}
+
+static bool can_compress_data_function(void* handle) {
+  return m_can_compress;
+}
+
+static uint32_t get_max_packet_size_function(void* handle) {
+  return m_max_packet_size;
+}
+
+// the callbacks are opaque to the application layer, so the complete handlers cast them back to this type
+typedef void (*test_callback_t)(void* context, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length);
+
+static void request_complete_callback(void* context, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length) {
+  m_callback_contexts.push_back((uintptr_t)context);
+  m_complete_attribute_id = attribute_id;
+  m_complete_success = success;
+  m_complete_data.insert(m_complete_data.end(), data, data + length);
+}
+
 static void set_response_function(void* handle, const uint8_t* data, uint32_t length) {
   m_response_data.insert(m_response_data.end(), data, data + length);
 }
@@ -183,20 +227,42 @@ static bool attribute_notify_handler(void* handle, uint16_t attribute_id, const
   return true;
 }
 
-static void read_request_complete_handler(void* handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length) {
+static uint8_t attribute_priority_handler(void* handle, uint16_t attribute_id) {
+  // attributes from 0xc00 up are high priority
+  return attribute_id >= 0xc00 ? 1 : 0;
+}
+
+static uint8_t* attribute_buffer_handler(void* handle, uint16_t attribute_id, uint32_t length) {
+  static uint8_t buffer[16];
+  return length <= sizeof(buffer) ? buffer : NULL;
+}
+
+static void read_request_complete_handler(void* handle, uint16_t attribute_id, bool success, const uint8_t* data, uint32_t length, sonar_application_layer_request_complete_callback_t callback, void* context) {
+  if (callback) {
+    ((test_callback_t)callback)(context, attribute_id, success, data, length);
+    return;
+  }
   m_num_read_complete++;
   m_complete_attribute_id = attribute_id;
   m_complete_success = success;
   m_complete_data.insert(m_complete_data.end(), data, data + length);
 }
 
-static void write_request_complete_handler(void* handle, uint16_t attribute_id, bool success) {
+static void write_request_complete_handler(void* handle, uint16_t attribute_id, bool success, sonar_application_layer_request_complete_callback_t callback, void* context) {
+  if (callback) {
+    ((test_callback_t)callback)(context, attribute_id, success, NULL, 0);
+    return;
+  }
   m_num_write_complete++;
   m_complete_attribute_id = attribute_id;
   m_complete_success = success;
 }
 
-static void notify_request_complete_handler(void* handle, uint16_t attribute_id, bool success) {
+static void notify_request_complete_handler(void* handle, uint16_t attribute_id, bool success, sonar_application_layer_request_complete_callback_t callback, void* context) {
+  if (callback) {
+    ((test_callback_t)callback)(context, attribute_id, success, NULL, 0);
+    return;
+  }
   m_num_notify_complete++;
   m_complete_attribute_id = attribute_id;
   m_complete_success = success;
@@ -204,25 +270,36 @@ static void notify_request_complete_handler(void* handle, uint16_t attribute_id,
 
 class ApplicationLayerTest : public ::testing::Test {
  protected:
-  void DoApplicationLayerInit(bool is_server) {
+  void DoApplicationLayerInit(bool is_server, uint32_t max_packet_size = 0, bool use_compression_buffer = false, bool use_priority = false, uint8_t max_priority_overtakes = 0) {
     static sonar_application_layer_context_t context;
+    static uint8_t compression_buffer[16];
     handle_ = &context;
     const sonar_application_layer_init_t init_application_layer = {
       .is_server = is_server,
       .send_data_function = send_data_function,
+      .can_send_data_function = can_send_data_function,
+      .can_compress_data_function = can_compress_data_function,
       .set_response_function = set_response_function,
       .send_data_handle = NULL,
       .attribute_read_handler = attribute_read_handler,
       .attribute_write_handler = attribute_write_handler,
       .attribute_notify_handler = attribute_notify_handler,
+      .attribute_buffer_handler = attribute_buffer_handler,
+      .attribute_priority_handler = use_priority ? attribute_priority_handler : NULL,
       .attr_handler_handle = handle_,
 
       .read_request_complete_handler = read_request_complete_handler,
       .write_request_complete_handler = write_request_complete_handler,
       .notify_request_complete_handler = notify_request_complete_handler,
       .request_complete_handle = NULL,
+      .get_max_packet_size_function = get_max_packet_size_function,
+      .compression_buffer = use_compression_buffer ? compression_buffer : NULL,
+      .compression_buffer_size = use_compression_buffer ? (uint32_t)sizeof(compression_buffer) : 0,
+      .max_priority_overtakes = max_priority_overtakes,
     };
+    m_max_packet_size = max_packet_size;
     sonar_application_layer_init(handle_, &init_application_layer);
+    sonar_application_layer_connection_changed(handle_, true);
   }
 
   void SetUp() override {
@@ -238,6 +315,9 @@ class ApplicationLayerTest : public ::testing::Test {
     m_complete_success = false;
     m_complete_attribute_id = 0;
     m_complete_data.clear();
+    m_send_budget = -1;
+    m_callback_contexts.clear();
+    m_can_compress = true;
   }
 
   void TearDown() override {
@@ -250,6 +330,7 @@ class ApplicationLayerTest : public ::testing::Test {
     EXPECT_EQ(m_num_write_complete, 0);
     EXPECT_EQ(m_num_notify_complete, 0);
     EXPECT_TRUE(m_complete_data.empty());
+    EXPECT_TRUE(m_callback_contexts.empty());
   }
 
   sonar_application_layer_handle_t handle_;
@@ -271,6 +352,41 @@ class ApplicationLayerClientTest : public ApplicationLayerTest {
   }
 };
 
+// 4 bytes of data per fragment after the 2 byte header and 8 byte fragment header
+#define TEST_MAX_PACKET_SIZE 14
+
+class ApplicationLayerFragmentServerTest : public ApplicationLayerTest {
+ protected:
+  void SetUp() override {
+    ApplicationLayerTest::SetUp();
+    DoApplicationLayerInit(true, TEST_MAX_PACKET_SIZE);
+  }
+};
+
+class ApplicationLayerFragmentClientTest : public ApplicationLayerTest {
+ protected:
+  void SetUp() override {
+    ApplicationLayerTest::SetUp();
+    DoApplicationLayerInit(false, TEST_MAX_PACKET_SIZE);
+  }
+};
+
+class ApplicationLayerCompressionServerTest : public ApplicationLayerTest {
+ protected:
+  void SetUp() override {
+    ApplicationLayerTest::SetUp();
+    DoApplicationLayerInit(true, 0, true);
+  }
+};
+
+class ApplicationLayerCompressionClientTest : public ApplicationLayerTest {
+ protected:
+  void SetUp() override {
+    ApplicationLayerTest::SetUp();
+    DoApplicationLayerInit(false, 0, true);
+  }
+};
+
 TEST_F(ApplicationLayerClientTest, SendReadRequest) {
   // request
   SEND_READ_REQUEST(0xabc);
@@ -346,3 +462,437 @@ TEST_F(ApplicationLayerServerTest, HandleWriteRequest) {
   HANDLE_REQUEST_DATA_NO_RESPONSE(0xbc, 0x2a, 0x11, 0x22);
   EXPECT_WRITE_REQUEST(0xabc, 0x11, 0x22);
 }
+
+class ApplicationLayerPriorityClientTest : public ApplicationLayerTest {
+ protected:
+  void SetUp() override {
+    ApplicationLayerTest::SetUp();
+    DoApplicationLayerInit(false, 0, false, true);
+  }
+};
+
+class ApplicationLayerWeightedPriorityClientTest : public ApplicationLayerTest {
+ protected:
+  void SetUp() override {
+    ApplicationLayerTest::SetUp();
+    DoApplicationLayerInit(false, 0, false, true, 1);
+  }
+};
+
+TEST_F(ApplicationLayerClientTest, RequestQueue) {
+  // the first request is sent right away and the rest are queued while the lower layer is busy
+  m_send_budget = 1;
+  SEND_READ_REQUEST(0xabc);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x1abc);
+  SEND_WRITE_REQUEST(0xabd, 0x11);
+  SEND_READ_REQUEST(0xabe);
+  EXPECT_TRUE(sonar_application_layer_read_request(handle_, 0xabf, NULL, 0, (sonar_application_layer_request_complete_callback_t)request_complete_callback, (void*)0x1234));
+  EXPECT_EQ(m_num_sent_packets, 0);
+
+  // the queue is full
+  EXPECT_FALSE(sonar_application_layer_read_request(handle_, 0xac0, NULL, 0, NULL, NULL));
+
+  // the next request is sent as soon as the previous one completes
+  m_send_budget = 1;
+  HANDLE_RESPONSE(true, 0xf1);
+  EXPECT_READ_COMPLETE(0xabc, true, 0xf1);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abd, 0x11);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabd, true);
+  EXPECT_EQ(m_num_sent_packets, 0);
+
+  // the rest are sent by the process function once the lower layer can accept them
+  m_send_budget = -1;
+  sonar_application_layer_process(handle_);
+  EXPECT_EQ(m_num_sent_packets, 2);
+  m_num_sent_packets = 0;
+  const uint8_t expected_sent_data[] = {0xbe, 0x1a, 0xbf, 0x1a};
+  EXPECT_TRUE(DataMatches(m_sent_data, expected_sent_data, sizeof(expected_sent_data)));
+  m_sent_data.clear();
+
+  // the responses complete the requests in order, with the per-request callback used for the last one
+  HANDLE_RESPONSE(true, 0xf2);
+  EXPECT_READ_COMPLETE(0xabe, true, 0xf2);
+  HANDLE_RESPONSE(true, 0xf3);
+  ASSERT_EQ(m_callback_contexts.size(), 1);
+  EXPECT_EQ(m_callback_contexts[0], 0x1234);
+  m_callback_contexts.clear();
+  EXPECT_EQ(m_complete_attribute_id, 0xabf);
+  EXPECT_TRUE(m_complete_success);
+  const uint8_t expected_complete_data[] = {0xf3};
+  EXPECT_TRUE(DataMatches(m_complete_data, expected_complete_data, sizeof(expected_complete_data)));
+  m_complete_data.clear();
+}
+
+TEST_F(ApplicationLayerClientTest, RequestQueueDisconnect) {
+  m_send_budget = 1;
+  SEND_READ_REQUEST(0xabc);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x1abc);
+  EXPECT_TRUE(sonar_application_layer_read_request(handle_, 0xabd, NULL, 0, (sonar_application_layer_request_complete_callback_t)request_complete_callback, (void*)1));
+  EXPECT_TRUE(sonar_application_layer_read_request(handle_, 0xabe, NULL, 0, (sonar_application_layer_request_complete_callback_t)request_complete_callback, (void*)2));
+
+  // the queued requests fail (in order) on disconnect, and the sent request is failed by the lower layer
+  sonar_application_layer_connection_changed(handle_, false);
+  ASSERT_EQ(m_callback_contexts.size(), 2);
+  EXPECT_EQ(m_callback_contexts[0], 1);
+  EXPECT_EQ(m_callback_contexts[1], 2);
+  m_callback_contexts.clear();
+  EXPECT_FALSE(m_complete_success);
+  sonar_application_layer_handle_response(handle_, false, NULL, 0);
+  EXPECT_READ_COMPLETE(0xabc, false);
+
+  // new requests are rejected while disconnected
+  m_send_budget = -1;
+  EXPECT_FALSE(sonar_application_layer_read_request(handle_, 0xabc, NULL, 0, NULL, NULL));
+  EXPECT_EQ(m_num_sent_packets, 0);
+}
+
+TEST_F(ApplicationLayerClientTest, LostReadResponse) {
+  // send a read, a write, and another read all at once
+  uint8_t read_buffer1[4];
+  uint8_t read_buffer2[4];
+  EXPECT_TRUE(sonar_application_layer_read_request(handle_, 0xabc, read_buffer1, sizeof(read_buffer1), (sonar_application_layer_request_complete_callback_t)request_complete_callback, (void*)1));
+  EXPECT_TRUE(sonar_application_layer_write_request(handle_, 0xabd, NULL, 0, (sonar_application_layer_request_complete_callback_t)request_complete_callback, (void*)2));
+  EXPECT_TRUE(sonar_application_layer_read_request(handle_, 0xabe, read_buffer2, sizeof(read_buffer2), (sonar_application_layer_request_complete_callback_t)request_complete_callback, (void*)3));
+  EXPECT_EQ(m_num_sent_packets, 3);
+  m_num_sent_packets = 0;
+  m_sent_data.clear();
+
+  // the lower layer acknowledges the first read without its data, so it's held until the others have completed
+  sonar_application_layer_handle_response(handle_, true, NULL, 0);
+  sonar_application_layer_handle_response(handle_, true, NULL, 0);
+  EXPECT_EQ(m_num_sent_packets, 0);
+  HANDLE_RESPONSE(true, 0xf2);
+  EXPECT_TRUE(m_callback_contexts.empty());
+
+  // the read is then sent again, and the requests complete in order once it has a response
+  EXPECT_AND_CLEAR_SENT_PACKET(0x1abc);
+  HANDLE_RESPONSE(true, 0xf1);
+  ASSERT_EQ(m_callback_contexts.size(), 3);
+  EXPECT_EQ(m_callback_contexts[0], 1);
+  EXPECT_EQ(m_callback_contexts[1], 2);
+  EXPECT_EQ(m_callback_contexts[2], 3);
+  m_callback_contexts.clear();
+  const uint8_t expected_complete_data[] = {0xf1, 0xf2};
+  EXPECT_TRUE(DataMatches(m_complete_data, expected_complete_data, sizeof(expected_complete_data)));
+  m_complete_data.clear();
+  EXPECT_TRUE(m_complete_success);
+
+  // a read without a buffer to hold a later response in fails rather than completing out of order
+  SEND_READ_REQUEST(0xabc);
+  SEND_READ_REQUEST(0xabe);
+  EXPECT_EQ(m_num_sent_packets, 2);
+  m_num_sent_packets = 0;
+  m_sent_data.clear();
+  sonar_application_layer_handle_response(handle_, true, NULL, 0);
+  EXPECT_EQ(m_num_read_complete, 0);
+  HANDLE_RESPONSE(true, 0xf2);
+  EXPECT_EQ(m_num_read_complete, 2);
+  m_num_read_complete = 1;
+  EXPECT_READ_COMPLETE(0xabe, true, 0xf2);
+  EXPECT_EQ(m_num_sent_packets, 0);
+}
+
+TEST_F(ApplicationLayerPriorityClientTest, RequestQueue) {
+  // queue a low priority write behind one which has been sent
+  m_send_budget = 1;
+  SEND_WRITE_REQUEST(0xabc, 0x11);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abc, 0x11);
+  SEND_WRITE_REQUEST(0xabd, 0x22);
+
+  // a high priority write with a callback goes ahead of the queued one, but not the one which was already sent
+  SEND_WRITE_REQUEST_WITH_CALLBACK(0xc01, 1, 0x33);
+
+  // one without a callback can't overtake other requests without one, since their completion handlers can't tell
+  // them apart
+  SEND_WRITE_REQUEST(0xc02, 0x44);
+  EXPECT_EQ(m_num_sent_packets, 0);
+  m_send_budget = 1;
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c01, 0x33);
+
+  // the rest are sent in order
+  m_send_budget = 1;
+  HANDLE_RESPONSE(true);
+  EXPECT_CALLBACK_COMPLETE(1, 0xc01, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abd, 0x22);
+  m_send_budget = 1;
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabd, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c02, 0x44);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xc02, true);
+  EXPECT_EQ(m_num_sent_packets, 0);
+}
+
+TEST_F(ApplicationLayerWeightedPriorityClientTest, RequestQueue) {
+  m_send_budget = 1;
+  SEND_WRITE_REQUEST(0xabc, 0x11);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abc, 0x11);
+  SEND_WRITE_REQUEST(0xabd, 0x22);
+
+  // the low priority write can only be overtaken once, so the second high priority write goes after it
+  SEND_WRITE_REQUEST_WITH_CALLBACK(0xc01, 1, 0x33);
+  SEND_WRITE_REQUEST_WITH_CALLBACK(0xc02, 2, 0x44);
+  m_send_budget = 1;
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c01, 0x33);
+  m_send_budget = 1;
+  HANDLE_RESPONSE(true);
+  EXPECT_CALLBACK_COMPLETE(1, 0xc01, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abd, 0x22);
+  m_send_budget = 1;
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabd, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c02, 0x44);
+  HANDLE_RESPONSE(true);
+  EXPECT_CALLBACK_COMPLETE(2, 0xc02, true);
+  EXPECT_EQ(m_num_sent_packets, 0);
+}
+
+TEST_F(ApplicationLayerFragmentClientTest, SendFragmentedWriteRequest) {
+  // requests which fit in a single packet aren't fragmented
+  SEND_WRITE_REQUEST(0xabc, 0x00, 0x01, 0x02, 0x03);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abc, 0x00, 0x01, 0x02, 0x03);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+
+  // larger requests are sent one fragment at a time, with each carrying its offset and the total length
+  SEND_WRITE_REQUEST(0xabc, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabc, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  HANDLE_RESPONSE(true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabc, 0x04, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x04, 0x05, 0x06, 0x07);
+  HANDLE_RESPONSE(true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabc, 0x08, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x08, 0x09);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+
+  // a failed fragment fails the whole request
+  SEND_WRITE_REQUEST(0xabc, 0x00, 0x01, 0x02, 0x03, 0x04);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabc, 0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  HANDLE_RESPONSE(false);
+  EXPECT_WRITE_COMPLETE(0xabc, false);
+}
+
+TEST_F(ApplicationLayerFragmentClientTest, SendFragmentedReadRequest) {
+  // the response is read in fragments until one comes back short
+  uint8_t buffer[10];
+  EXPECT_TRUE(sonar_application_layer_read_request(handle_, 0xabc, buffer, sizeof(buffer), NULL, NULL));
+  EXPECT_AND_CLEAR_SENT_PACKET(0x9abc, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00);
+  HANDLE_RESPONSE(true, 0xf0, 0xf1, 0xf2, 0xf3);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x9abc, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00);
+  HANDLE_RESPONSE(true, 0xf4, 0xf5, 0xf6, 0xf7);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x9abc, 0x08, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00);
+  HANDLE_RESPONSE(true, 0xf8);
+  EXPECT_READ_COMPLETE(0xabc, true, 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8);
+
+  // a response which doesn't fit in the buffer fails the request
+  EXPECT_TRUE(sonar_application_layer_read_request(handle_, 0xabc, buffer, 6, NULL, NULL));
+  EXPECT_AND_CLEAR_SENT_PACKET(0x9abc, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00);
+  HANDLE_RESPONSE(true, 0xf0, 0xf1, 0xf2, 0xf3);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x9abc, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00);
+  HANDLE_RESPONSE(true, 0xf4, 0xf5, 0xf6);
+  EXPECT_READ_COMPLETE(0xabc, false);
+}
+
+TEST_F(ApplicationLayerFragmentClientTest, FragmentedRequestQueue) {
+  // a fragmented request waits for the requests ahead of it and holds back the ones behind it
+  SEND_READ_REQUEST(0xabc);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x1abc);
+  SEND_WRITE_REQUEST(0xabd, 0x00, 0x01, 0x02, 0x03, 0x04);
+  SEND_WRITE_REQUEST(0xabe, 0x11);
+  EXPECT_EQ(m_num_sent_packets, 0);
+  HANDLE_RESPONSE(true, 0xf1);
+  EXPECT_READ_COMPLETE(0xabc, true, 0xf1);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  HANDLE_RESPONSE(true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x04);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabd, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abe, 0x11);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabe, true);
+}
+
+class ApplicationLayerFragmentPriorityClientTest : public ApplicationLayerTest {
+ protected:
+  void SetUp() override {
+    ApplicationLayerTest::SetUp();
+    DoApplicationLayerInit(false, TEST_MAX_PACKET_SIZE, false, true);
+  }
+};
+
+TEST_F(ApplicationLayerFragmentPriorityClientTest, InterleavedRequest) {
+  // one higher priority request is sent between each pair of fragments
+  SEND_WRITE_REQUEST(0xabd, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  SEND_WRITE_REQUEST_WITH_CALLBACK(0xc01, 1, 0x11);
+  SEND_WRITE_REQUEST_WITH_CALLBACK(0xc02, 2, 0x22);
+  EXPECT_EQ(m_num_sent_packets, 0);
+  HANDLE_RESPONSE(true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c01, 0x11);
+  HANDLE_RESPONSE(true);
+  EXPECT_CALLBACK_COMPLETE(1, 0xc01, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x04, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x04, 0x05, 0x06, 0x07);
+  HANDLE_RESPONSE(true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c02, 0x22);
+  HANDLE_RESPONSE(true);
+  EXPECT_CALLBACK_COMPLETE(2, 0xc02, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x08, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x08, 0x09);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabd, true);
+
+  // requests without a callback aren't sent ahead of a fragmented request without one
+  SEND_WRITE_REQUEST(0xabd, 0x00, 0x01, 0x02, 0x03, 0x04);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  SEND_WRITE_REQUEST(0xc01, 0x11);
+  HANDLE_RESPONSE(true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x04);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabd, true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c01, 0x11);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xc01, true);
+
+  // if the connection is lost while the interleaved request is in flight, the fragmented one fails right away and the
+  // lower layer fails the interleaved one
+  SEND_WRITE_REQUEST(0xabd, 0x00, 0x01, 0x02, 0x03, 0x04);
+  EXPECT_AND_CLEAR_SENT_PACKET(0xaabd, 0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  SEND_WRITE_REQUEST_WITH_CALLBACK(0xc01, 3, 0x11);
+  HANDLE_RESPONSE(true);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2c01, 0x11);
+  sonar_application_layer_connection_changed(handle_, false);
+  EXPECT_WRITE_COMPLETE(0xabd, false);
+  EXPECT_TRUE(m_callback_contexts.empty());
+  sonar_application_layer_handle_response(handle_, false, NULL, 0);
+  EXPECT_CALLBACK_COMPLETE(3, 0xc01, false);
+}
+
+TEST_F(ApplicationLayerFragmentServerTest, HandleFragmentedWriteRequest) {
+  // the fragments are reassembled and passed to the write handler once they've all been received
+  HANDLE_REQUEST_DATA_NO_RESPONSE(0xbc, 0xaa, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  HANDLE_REQUEST_DATA_NO_RESPONSE(0xbc, 0xaa, 0x04, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x04, 0x05, 0x06, 0x07);
+  EXPECT_EQ(m_num_write_requests, 0);
+  HANDLE_REQUEST_DATA_NO_RESPONSE(0xbc, 0xaa, 0x08, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x08, 0x09);
+  EXPECT_WRITE_REQUEST(0xabc, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09);
+
+  // out of order fragments are rejected
+  HANDLE_REQUEST_DATA_NO_RESPONSE(0xbc, 0xaa, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03);
+  static const uint8_t skipped_fragment[] = {0xbc, 0xaa, 0x08, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x08, 0x09};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, skipped_fragment, sizeof(skipped_fragment)));
+
+  // as are requests which don't fit in the buffer or extend past the total length
+  static const uint8_t too_big[] = {0xbc, 0xaa, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, too_big, sizeof(too_big)));
+  static const uint8_t too_long[] = {0xbc, 0xaa, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, too_long, sizeof(too_long)));
+  EXPECT_EQ(m_num_write_requests, 0);
+  EXPECT_TRUE(m_response_data.empty());
+}
+
+TEST_F(ApplicationLayerFragmentServerTest, HandleFragmentedReadRequest) {
+  // the read handler is called for the first fragment and the rest of its data is returned by the later ones
+  m_response_length = 10;
+  static const uint8_t first_fragment[] = {0xbc, 0x9a, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00};
+  EXPECT_TRUE(sonar_application_layer_handle_request(handle_, first_fragment, sizeof(first_fragment)));
+  EXPECT_READ_REQUEST(0xabc);
+  const uint8_t expected_first[] = {0x00, 0x01, 0x02, 0x03};
+  EXPECT_TRUE(DataMatches(m_response_data, expected_first, sizeof(expected_first)));
+  m_response_data.clear();
+  static const uint8_t second_fragment[] = {0xbc, 0x9a, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00};
+  EXPECT_TRUE(sonar_application_layer_handle_request(handle_, second_fragment, sizeof(second_fragment)));
+  const uint8_t expected_second[] = {0x04, 0x05, 0x06, 0x07};
+  EXPECT_TRUE(DataMatches(m_response_data, expected_second, sizeof(expected_second)));
+  m_response_data.clear();
+  static const uint8_t third_fragment[] = {0xbc, 0x9a, 0x08, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00};
+  EXPECT_TRUE(sonar_application_layer_handle_request(handle_, third_fragment, sizeof(third_fragment)));
+  const uint8_t expected_third[] = {0x08, 0x09};
+  EXPECT_TRUE(DataMatches(m_response_data, expected_third, sizeof(expected_third)));
+  m_response_data.clear();
+  EXPECT_EQ(m_num_read_requests, 0);
+
+  // a later fragment for a different attribute is rejected
+  static const uint8_t other_fragment[] = {0xbd, 0x9a, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, other_fragment, sizeof(other_fragment)));
+  EXPECT_TRUE(m_response_data.empty());
+}
+
+TEST_F(ApplicationLayerCompressionClientTest, SendCompressedWriteRequest) {
+  // compressible data is sent as the uncompressed length followed by an LZ4 block
+  SEND_WRITE_REQUEST(0xabc, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x6abc, 0x10, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x01, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+
+  // data which doesn't get any smaller is sent uncompressed
+  SEND_WRITE_REQUEST(0xabc, 0x00, 0x01, 0x02, 0x03);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abc, 0x00, 0x01, 0x02, 0x03);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+
+  // as is data which doesn't fit in the compression buffer
+  SEND_WRITE_REQUEST(0xabc, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abc, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+    0x0e, 0x0f, 0x10, 0x11);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+
+  // and everything if the peer doesn't accept compressed requests
+  m_can_compress = false;
+  SEND_WRITE_REQUEST(0xabc, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x2abc, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xaa, 0xaa);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+}
+
+TEST_F(ApplicationLayerCompressionClientTest, CompressionBufferInUse) {
+  // only one request at a time can be compressed, with the others being sent uncompressed
+  SEND_WRITE_REQUEST(0xabc, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  SEND_WRITE_REQUEST(0xabd, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  EXPECT_EQ(m_num_sent_packets, 2);
+  m_num_sent_packets = 1;
+  EXPECT_AND_CLEAR_SENT_PACKET(0x6abc, 0x10, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x01, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xbd, 0x2a, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabc, true);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabd, true);
+
+  // the buffer is free again once the compressed request completes
+  SEND_WRITE_REQUEST(0xabe, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  EXPECT_AND_CLEAR_SENT_PACKET(0x6abe, 0x10, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x01, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  HANDLE_RESPONSE(true);
+  EXPECT_WRITE_COMPLETE(0xabe, true);
+}
+
+TEST_F(ApplicationLayerCompressionServerTest, HandleCompressedWriteRequest) {
+  // the data is decompressed into the attribute's buffer and passed to the write handler
+  HANDLE_REQUEST_DATA_NO_RESPONSE(0xbc, 0x6a, 0x10, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x01, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+  EXPECT_WRITE_REQUEST(0xabc, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa);
+
+  // data which doesn't decompress to the specified length is rejected
+  static const uint8_t wrong_length[] = {0xbc, 0x6a, 0x0f, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x01, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, wrong_length, sizeof(wrong_length)));
+  static const uint8_t invalid_offset[] = {0xbc, 0x6a, 0x10, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x02, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, invalid_offset, sizeof(invalid_offset)));
+
+  // as is data which doesn't fit in the attribute's buffer
+  static const uint8_t too_big[] = {0xbc, 0x6a, 0x20, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x01, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, too_big, sizeof(too_big)));
+
+  // and compressed read requests
+  static const uint8_t read_request[] = {0xbc, 0x5a, 0x10, 0x00, 0x00, 0x00};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, read_request, sizeof(read_request)));
+
+  // and compressed requests if compression wasn't negotiated
+  m_can_compress = false;
+  static const uint8_t not_negotiated[] = {0xbc, 0x6a, 0x10, 0x00, 0x00, 0x00, 0x16, 0xaa, 0x01, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa};
+  EXPECT_FALSE(sonar_application_layer_handle_request(handle_, not_negotiated, sizeof(not_negotiated)));
+  EXPECT_EQ(m_num_write_requests, 0);
+  EXPECT_EQ(m_num_read_requests, 0);
+  EXPECT_TRUE(m_response_data.empty());
+}
@@ -10,6 +10,7 @@ extern "C" {
 
 SONAR_ATTR_DEF(TEST_ATTR, 0xff1, sizeof(uint32_t), RW);
 SONAR_ATTR_DEF(TEST_ATTR2, 0xff2, sizeof(uint32_t), N);
+SONAR_ATTR_DEF_DELTA(TEST_ATTR3, 0xff3, 16, N);
 
 static uint32_t m_test_attr_num_read_complete;
 static bool m_test_attr_read_complete_success;
@@ -18,6 +19,7 @@ static uint32_t m_test_attr_num_write_complete;
 static bool m_test_attr_write_complete_success;
 static uint32_t m_test_attr_num_notifies;
 static uint32_t m_test_notify_data;
+static std::vector<uint8_t> m_test_notify_value;
 static uint32_t m_read_request_num;
 static uint32_t m_read_request_attribute_id;
 static uint32_t m_write_request_num;
@@ -26,13 +28,13 @@ static std::vector<uint8_t> m_write_request_data;
 static int m_num_connections;
 static int m_num_disconnections;
 
-static bool send_read_request_function(void* handle, uint16_t attribute_id) {
+static bool send_read_request_function(void* handle, uint16_t attribute_id, uint8_t* buffer, uint32_t buffer_size, sonar_attribute_client_request_complete_callback_t callback, void* context) {
   m_read_request_num++;
   m_read_request_attribute_id = attribute_id;
   return true;
 }
 
-static bool send_write_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
+static bool send_write_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_attribute_client_request_complete_callback_t callback, void* context) {
   m_write_request_num++;
   m_write_request_attribute_id = attribute_id;
   m_write_request_data.insert(m_write_request_data.end(), data, data + length);
@@ -54,6 +56,7 @@ static void write_complete_handler(void* handle, bool success) {
 
 static bool notify_handler(void* handle, sonar_attribute_t attr, const uint8_t* data, uint32_t length) {
   m_test_attr_num_notifies++;
+  m_test_notify_value.assign(data, data + length);
   if (length == sizeof(uint32_t)) {
     m_test_notify_data = *(uint32_t*)data;
   }
@@ -78,6 +81,7 @@ class AttributeClientTest : public ::testing::Test {
     m_test_attr_write_complete_success = false;
     m_test_attr_num_notifies = 0;
     m_test_notify_data = 0;
+    m_test_notify_value.clear();
     m_read_request_num = 0;
     m_read_request_attribute_id = 0;
     m_write_request_num = 0;
@@ -100,6 +104,7 @@ class AttributeClientTest : public ::testing::Test {
     sonar_attribute_client_init(handle_, &init_attribute_client);
     sonar_attribute_client_register(handle_, TEST_ATTR);
     sonar_attribute_client_register(handle_, TEST_ATTR2);
+    sonar_attribute_client_register(handle_, TEST_ATTR3);
 
     // Run (and test) the connection process as it's required before any of the other tests can run
 
@@ -110,8 +115,8 @@ class AttributeClientTest : public ::testing::Test {
     EXPECT_EQ(m_read_request_attribute_id, 0x101);
 
     // Respond to the CTRL_NUM_ATTRS read request and expect a CTRL_ATTR_OFFSET write request
-    const uint16_t num = 5;
-    sonar_attribute_client_handle_read_response(handle_, 0x101, true, (const uint8_t*)&num, sizeof(num));
+    const uint16_t num = 6;
+    sonar_attribute_client_handle_read_response(handle_, 0x101, true, (const uint8_t*)&num, sizeof(num), NULL, NULL);
     EXPECT_EQ(m_write_request_num, 1);
     m_write_request_num = 0;
     EXPECT_EQ(m_write_request_attribute_id, 0x102);
@@ -120,14 +125,14 @@ class AttributeClientTest : public ::testing::Test {
     m_write_request_data.clear();
 
     // Respond to the CTRL_ATTR_OFFSET write request and expect a CTRL_ATTR_LIST read request
-    sonar_attribute_client_handle_write_response(handle_, 0x102, true);
+    sonar_attribute_client_handle_write_response(handle_, 0x102, true, NULL, NULL);
     EXPECT_EQ(m_read_request_num, 1);
     m_read_request_num = 0;
     EXPECT_EQ(m_read_request_attribute_id, 0x103);
 
     // Respond to the CTRL_ATTR_LIST read request
-    const uint16_t attr_list[8] = { 0x4ff2, 0x3ff1, 0x1103, 0x3102, 0x1101 };
-    sonar_attribute_client_handle_read_response(handle_, 0x103, true, (const uint8_t*)&attr_list, sizeof(attr_list));
+    const uint16_t attr_list[8] = { 0xcff3, 0x4ff2, 0x3ff1, 0x1103, 0x3102, 0x1101 };
+    sonar_attribute_client_handle_read_response(handle_, 0x103, true, (const uint8_t*)&attr_list, sizeof(attr_list), NULL, NULL);
     EXPECT_EQ(m_num_connections, 1);
     m_num_connections = 0;
   }
@@ -149,7 +154,7 @@ class AttributeClientTest : public ::testing::Test {
 };
 
 TEST_F(AttributeClientTest, ValidReadRequest) {
-  EXPECT_TRUE(sonar_attribute_client_read(handle_, TEST_ATTR));
+  EXPECT_TRUE(sonar_attribute_client_read(handle_, TEST_ATTR, NULL, NULL));
   EXPECT_EQ(m_read_request_num, 1);
   m_read_request_num = 0;
   EXPECT_EQ(m_read_request_attribute_id, 0xff1);
@@ -157,21 +162,21 @@ TEST_F(AttributeClientTest, ValidReadRequest) {
 
 TEST_F(AttributeClientTest, InvalidReadRequest) {
   // attribute which doesn't support read requests
-  EXPECT_FALSE(sonar_attribute_client_read(handle_, TEST_ATTR2));
+  EXPECT_FALSE(sonar_attribute_client_read(handle_, TEST_ATTR2, NULL, NULL));
 }
 
 TEST_F(AttributeClientTest, ReadResponse) {
   const uint32_t data = 0x44556677;
 
   // success response
-  sonar_attribute_client_handle_read_response(handle_, 0xff1, true, (const uint8_t*)&data, sizeof(data));
+  sonar_attribute_client_handle_read_response(handle_, 0xff1, true, (const uint8_t*)&data, sizeof(data), NULL, NULL);
   EXPECT_EQ(m_test_attr_num_read_complete, 1);
   m_test_attr_num_read_complete = 0;
   EXPECT_EQ(m_test_attr_read_complete_success, true);
   EXPECT_EQ(m_test_attr_read_complete_data, data);
 
   // failed response
-  sonar_attribute_client_handle_read_response(handle_, 0xff1, false, NULL, 0);
+  sonar_attribute_client_handle_read_response(handle_, 0xff1, false, NULL, 0, NULL, NULL);
   EXPECT_EQ(m_test_attr_num_read_complete, 1);
   m_test_attr_num_read_complete = 0;
   EXPECT_EQ(m_test_attr_read_complete_success, false);
@@ -179,7 +184,7 @@ TEST_F(AttributeClientTest, ReadResponse) {
 
 TEST_F(AttributeClientTest, ValidWriteRequest) {
   const uint32_t value = 0xabcdabcd;
-  EXPECT_TRUE(sonar_attribute_client_write(handle_, TEST_ATTR, (const uint8_t*)&value, sizeof(value)));
+  EXPECT_TRUE(sonar_attribute_client_write(handle_, TEST_ATTR, (const uint8_t*)&value, sizeof(value), NULL, NULL));
   EXPECT_EQ(m_write_request_num, 1);
   m_write_request_num = 0;
   EXPECT_EQ(m_write_request_attribute_id, 0xff1);
@@ -191,18 +196,18 @@ TEST_F(AttributeClientTest, ValidWriteRequest) {
 TEST_F(AttributeClientTest, InvalidWriteRequest) {
   // attribute which doesn't support write requests
   const uint32_t value = 0;
-  EXPECT_FALSE(sonar_attribute_client_write(handle_, TEST_ATTR2, (const uint8_t*)&value, sizeof(value)));
+  EXPECT_FALSE(sonar_attribute_client_write(handle_, TEST_ATTR2, (const uint8_t*)&value, sizeof(value), NULL, NULL));
 }
 
 TEST_F(AttributeClientTest, WriteResponse) {
   // success response
-  sonar_attribute_client_handle_write_response(handle_, 0xff1, true);
+  sonar_attribute_client_handle_write_response(handle_, 0xff1, true, NULL, NULL);
   EXPECT_EQ(m_test_attr_num_write_complete, 1);
   m_test_attr_num_write_complete = 0;
   EXPECT_EQ(m_test_attr_write_complete_success, true);
 
   // failed response
-  sonar_attribute_client_handle_write_response(handle_, 0xff1, false);
+  sonar_attribute_client_handle_write_response(handle_, 0xff1, false, NULL, NULL);
   EXPECT_EQ(m_test_attr_num_write_complete, 1);
   m_test_attr_num_write_complete = 0;
   EXPECT_EQ(m_test_attr_write_complete_success, false);
@@ -226,6 +231,46 @@ TEST_F(AttributeClientTest, HandleInvalidNotify) {
   EXPECT_FALSE(sonar_attribute_client_handle_notify_request(handle_, 0xff1, (const uint8_t*)&data, sizeof(data)));
 }
 
+TEST_F(AttributeClientTest, HandleDeltaNotify) {
+  // a delta can't be applied before a full value is received
+  const uint8_t delta[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x02, 0x10};
+  EXPECT_FALSE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, delta, sizeof(delta)));
+
+  // full value
+  const uint8_t full[] = {0x00, 0x01, 0x02, 0x03, 0x04};
+  EXPECT_TRUE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, full, sizeof(full)));
+  EXPECT_EQ(m_test_attr_num_notifies, 1);
+  m_test_attr_num_notifies = 0;
+  const uint8_t expected_full[] = {0x01, 0x02, 0x03, 0x04};
+  EXPECT_TRUE(DataMatches(m_test_notify_value, expected_full, sizeof(expected_full)));
+
+  // the delta is applied to the last value
+  EXPECT_TRUE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, delta, sizeof(delta)));
+  EXPECT_EQ(m_test_attr_num_notifies, 1);
+  m_test_attr_num_notifies = 0;
+  const uint8_t expected_delta[] = {0x01, 0x12, 0x03, 0x04};
+  EXPECT_TRUE(DataMatches(m_test_notify_value, expected_delta, sizeof(expected_delta)));
+
+  // a longer value treats the missing bytes of the last value as zero
+  const uint8_t delta_longer[] = {0x01, 0x09, 0x00, 0x00, 0x00, 0x20, 0x05, 0x01, 0x09};
+  EXPECT_TRUE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, delta_longer, sizeof(delta_longer)));
+  EXPECT_EQ(m_test_attr_num_notifies, 1);
+  m_test_attr_num_notifies = 0;
+  const uint8_t expected_longer[] = {0x01, 0x12, 0x03, 0x04, 0x00, 0x05, 0x00, 0x00, 0x09};
+  EXPECT_TRUE(DataMatches(m_test_notify_value, expected_longer, sizeof(expected_longer)));
+
+  // an invalid delta is rejected and invalidates the last value
+  const uint8_t delta_truncated[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x02};
+  EXPECT_FALSE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, delta_truncated, sizeof(delta_truncated)));
+  EXPECT_FALSE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, delta, sizeof(delta)));
+
+  // too big for the attribute
+  const uint8_t delta_too_big[] = {0x01, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  EXPECT_TRUE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, full, sizeof(full)));
+  m_test_attr_num_notifies = 0;
+  EXPECT_FALSE(sonar_attribute_client_handle_notify_request(handle_, 0xff3, delta_too_big, sizeof(delta_too_big)));
+}
+
 TEST_F(AttributeClientTest, TestDisconnect) {
   sonar_attribute_client_low_level_connection_changed(handle_, false);
   EXPECT_EQ(m_num_disconnections, 1);
@@ -233,8 +278,8 @@ TEST_F(AttributeClientTest, TestDisconnect) {
 
   // responses should fail / be ignored
   const uint32_t data = 0x44556677;
-  sonar_attribute_client_handle_read_response(handle_, 0xff1, true, (const uint8_t*)&data, sizeof(data));
-  sonar_attribute_client_handle_write_response(handle_, 0xff1, true);
+  sonar_attribute_client_handle_read_response(handle_, 0xff1, true, (const uint8_t*)&data, sizeof(data), NULL, NULL);
+  sonar_attribute_client_handle_write_response(handle_, 0xff1, true, NULL, NULL);
 
   // requests should fail
   EXPECT_FALSE(sonar_attribute_client_handle_notify_request(handle_, 0xff2, (const uint8_t*)&data, sizeof(data)));
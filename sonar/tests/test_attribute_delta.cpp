@@ -0,0 +1,110 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+
+#include "src/attribute/delta.h"
+#include "anchor/sonar/attribute.h"
+
+};
+
+#include <vector>
+
+// Encodes the value against the base and checks that decoding it against the previous base gives back the value
+static uint32_t EncodeAndDecode(const std::vector<uint8_t>& value, std::vector<uint8_t>& base, uint32_t& base_length, bool is_base_valid) {
+  const uint32_t max_size = base.size();
+  std::vector<uint8_t> buffer(SONAR_ATTR_DELTA_BUFFER_SIZE(max_size));
+  memcpy(buffer.data(), value.data(), value.size());
+  std::vector<uint8_t> decoded = base;
+  uint32_t decoded_length = base_length;
+  const uint32_t encoded_length = attribute_delta_encode(buffer.data(), buffer.size(), value.size(), base.data(), base_length, is_base_valid);
+  base_length = value.size();
+  EXPECT_TRUE(memcmp(base.data(), value.data(), value.size()) == 0);
+  EXPECT_LE(encoded_length, value.size() + 1);
+  EXPECT_TRUE(attribute_delta_decode(buffer.data(), encoded_length, decoded.data(), max_size, &decoded_length, is_base_valid));
+  EXPECT_EQ(decoded_length, value.size());
+  EXPECT_TRUE(memcmp(decoded.data(), value.data(), value.size()) == 0);
+  return encoded_length;
+}
+
+TEST(AttributeDelta, Full) {
+  std::vector<uint8_t> base(16);
+  uint32_t base_length = 0;
+  const std::vector<uint8_t> value = {0x01, 0x02, 0x03};
+  uint8_t buffer[SONAR_ATTR_DELTA_BUFFER_SIZE(16)] = {0x01, 0x02, 0x03};
+  ASSERT_EQ(attribute_delta_encode(buffer, sizeof(buffer), value.size(), base.data(), base_length, false), 4u);
+  const uint8_t expected[] = {0x00, 0x01, 0x02, 0x03};
+  EXPECT_EQ(memcmp(buffer, expected, sizeof(expected)), 0);
+  EXPECT_EQ(memcmp(base.data(), value.data(), value.size()), 0);
+}
+
+TEST(AttributeDelta, Xor) {
+  std::vector<uint8_t> base(32);
+  uint32_t base_length = 0;
+  std::vector<uint8_t> value(20, 0x55);
+  EXPECT_EQ(EncodeAndDecode(value, base, base_length, false), 21u);
+
+  // change one byte in the 2nd block
+  value[10] = 0x54;
+  uint8_t buffer[SONAR_ATTR_DELTA_BUFFER_SIZE(32)];
+  memcpy(buffer, value.data(), value.size());
+  ASSERT_EQ(attribute_delta_encode(buffer, sizeof(buffer), value.size(), base.data(), base_length, true), 9u);
+  const uint8_t expected[] = {0x01, 0x14, 0x00, 0x00, 0x00, 0x00, 0x04, 0x01, 0x00};
+  EXPECT_EQ(memcmp(buffer, expected, sizeof(expected)), 0);
+  EXPECT_EQ(memcmp(base.data(), value.data(), value.size()), 0);
+}
+
+TEST(AttributeDelta, FallbackToFull) {
+  std::vector<uint8_t> base(32);
+  uint32_t base_length = 0;
+  std::vector<uint8_t> value(20, 0x55);
+  EncodeAndDecode(value, base, base_length, false);
+
+  // changing every byte is sent as the full value
+  std::fill(value.begin(), value.end(), 0xaa);
+  EXPECT_EQ(EncodeAndDecode(value, base, base_length, true), 21u);
+}
+
+TEST(AttributeDelta, RoundTrip) {
+  std::vector<uint8_t> base(256);
+  uint32_t base_length = 0;
+  std::vector<uint8_t> value;
+  bool is_base_valid = false;
+  for (int i = 0; i < 200; i++) {
+    // randomly change the length and some of the bytes
+    value.resize(rand() % 2 ? value.size() : rand() % (base.size() + 1));
+    for (int j = rand() % 16; j > 0 && !value.empty(); j--) {
+      value[rand() % value.size()] = rand();
+    }
+    EncodeAndDecode(value, base, base_length, is_base_valid);
+    is_base_valid = true;
+  }
+}
+
+TEST(AttributeDelta, DecodeInvalid) {
+  uint8_t base[8] = {0};
+  uint32_t base_length = 4;
+
+  // empty
+  EXPECT_FALSE(attribute_delta_decode(NULL, 0, base, sizeof(base), &base_length, true));
+
+  // unknown type
+  const uint8_t unknown_type[] = {0x02, 0x00};
+  EXPECT_FALSE(attribute_delta_decode(unknown_type, sizeof(unknown_type), base, sizeof(base), &base_length, true));
+
+  // full value which is too big
+  const uint8_t full_too_big[10] = {0x00};
+  EXPECT_FALSE(attribute_delta_decode(full_too_big, sizeof(full_too_big), base, sizeof(base), &base_length, true));
+
+  // delta without a valid base
+  const uint8_t delta[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x01, 0xff};
+  EXPECT_FALSE(attribute_delta_decode(delta, sizeof(delta), base, sizeof(base), &base_length, false));
+
+  // delta which changes a byte beyond the new length
+  const uint8_t delta_past_end[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x10, 0xff};
+  EXPECT_FALSE(attribute_delta_decode(delta_past_end, sizeof(delta_past_end), base, sizeof(base), &base_length, true));
+
+  // delta with extra data
+  const uint8_t delta_extra[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x01, 0xff, 0xff};
+  EXPECT_FALSE(attribute_delta_decode(delta_extra, sizeof(delta_extra), base, sizeof(base), &base_length, true));
+  EXPECT_EQ(base_length, 4u);
+}
@@ -17,6 +17,7 @@ extern "C" {
 
 SONAR_ATTR_DEF(TEST_ATTR, 0xff1, sizeof(uint32_t), RW);
 SONAR_ATTR_DEF(TEST_ATTR2, 0xff2, sizeof(uint32_t), N);
+SONAR_ATTR_DEF_DELTA(TEST_ATTR3, 0xff3, 16, N);
 
 static uint32_t m_test_attr_num_reads;
 static uint32_t m_test_attr_num_writes;
@@ -28,7 +29,7 @@ static uint16_t m_notify_request_attribute_id;
 static std::vector<uint8_t> m_notify_request_data;
 static std::vector<uint8_t> m_response_data;
 
-static bool send_notify_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length) {
+static bool send_notify_request_function(void* handle, uint16_t attribute_id, const uint8_t* data, uint32_t length, sonar_attribute_server_notify_complete_callback_t callback, void* context) {
   m_notify_request_num++;
   m_notify_request_attribute_id = attribute_id;
   m_notify_request_data.insert(m_notify_request_data.end(), data, data + length);
@@ -91,6 +92,7 @@ class AttributeServerTest : public ::testing::Test {
     sonar_attribute_server_init(handle_, &init_attribute_server);
     sonar_attribute_server_register(handle_, TEST_ATTR);
     sonar_attribute_server_register(handle_, TEST_ATTR2);
+    sonar_attribute_server_register(handle_, TEST_ATTR3);
   }
 
   void TearDown() override {
@@ -144,7 +146,7 @@ TEST_F(AttributeServerTest, HandleInvalidWrite) {
 
 TEST_F(AttributeServerTest, ValidNotifyRequest) {
   const uint32_t data = 0xabcdabcd;
-  EXPECT_TRUE(sonar_attribute_server_notify(handle_, TEST_ATTR2, (const uint8_t*)&data, sizeof(data)));
+  EXPECT_TRUE(sonar_attribute_server_notify(handle_, TEST_ATTR2, (const uint8_t*)&data, sizeof(data), NULL, NULL));
   EXPECT_EQ(m_notify_request_num, 1);
   m_notify_request_num = 0;
   EXPECT_EQ(m_notify_request_attribute_id, 0xff2);
@@ -156,35 +158,94 @@ TEST_F(AttributeServerTest, ValidNotifyRequest) {
 TEST_F(AttributeServerTest, InvalidNotifyRequest) {
   // attribute which doesn't support notify requests
   const uint32_t data = 0xabcdabcd;
-  EXPECT_FALSE(sonar_attribute_server_notify(handle_, TEST_ATTR, (const uint8_t*)&data, sizeof(data)));
+  EXPECT_FALSE(sonar_attribute_server_notify(handle_, TEST_ATTR, (const uint8_t*)&data, sizeof(data), NULL, NULL));
 }
 
 TEST_F(AttributeServerTest, NotifyResponse) {
   // success response
-  sonar_attribute_server_handle_notify_response(handle_, 0xff2, true);
+  sonar_attribute_server_handle_notify_response(handle_, 0xff2, true, NULL, NULL);
   EXPECT_EQ(m_test_attr_num_notify_complete, 1);
   m_test_attr_num_notify_complete = 0;
   EXPECT_EQ(m_test_attr_notify_complete_success, true);
 
   // failed response
-  sonar_attribute_server_handle_notify_response(handle_, 0xff2, false);
+  sonar_attribute_server_handle_notify_response(handle_, 0xff2, false, NULL, NULL);
   EXPECT_EQ(m_test_attr_num_notify_complete, 1);
   m_test_attr_num_notify_complete = 0;
   EXPECT_EQ(m_test_attr_notify_complete_success, false);
 }
 
+TEST_F(AttributeServerTest, DeltaNotifyRequest) {
+  uint8_t data[16] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10};
+
+  // the first notify contains the full value
+  EXPECT_TRUE(sonar_attribute_server_notify(handle_, TEST_ATTR3, data, sizeof(data), NULL, NULL));
+  EXPECT_EQ(m_notify_request_num, 1);
+  m_notify_request_num = 0;
+  EXPECT_EQ(m_notify_request_attribute_id, 0xff3);
+  const uint8_t expected_full[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10};
+  EXPECT_TRUE(DataMatches(m_notify_request_data, expected_full, sizeof(expected_full)));
+  m_notify_request_data.clear();
+  sonar_attribute_server_handle_notify_response(handle_, 0xff3, true, NULL, NULL);
+  EXPECT_EQ(m_test_attr_num_notify_complete, 1);
+  m_test_attr_num_notify_complete = 0;
+
+  // once acknowledged, the next notify only contains the changed byte
+  data[9] = 0x1a;
+  EXPECT_TRUE(sonar_attribute_server_notify(handle_, TEST_ATTR3, data, sizeof(data), NULL, NULL));
+  EXPECT_EQ(m_notify_request_num, 1);
+  m_notify_request_num = 0;
+  const uint8_t expected_delta[] = {0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x02, 0x10};
+  EXPECT_TRUE(DataMatches(m_notify_request_data, expected_delta, sizeof(expected_delta)));
+  m_notify_request_data.clear();
+
+  // fail the notify, so the next one should contain the full value again
+  sonar_attribute_server_handle_notify_response(handle_, 0xff3, false, NULL, NULL);
+  EXPECT_EQ(m_test_attr_num_notify_complete, 1);
+  m_test_attr_num_notify_complete = 0;
+  EXPECT_TRUE(sonar_attribute_server_notify(handle_, TEST_ATTR3, data, sizeof(data), NULL, NULL));
+  EXPECT_EQ(m_notify_request_num, 1);
+  m_notify_request_num = 0;
+  EXPECT_EQ(m_notify_request_data.size(), sizeof(data) + 1);
+  EXPECT_EQ(m_notify_request_data[0], 0x00);
+  m_notify_request_data.clear();
+  sonar_attribute_server_handle_notify_response(handle_, 0xff3, true, NULL, NULL);
+  m_test_attr_num_notify_complete = 0;
+
+  // a shorter value is still sent as a delta
+  EXPECT_TRUE(sonar_attribute_server_notify(handle_, TEST_ATTR3, data, 12, NULL, NULL));
+  EXPECT_EQ(m_notify_request_num, 1);
+  m_notify_request_num = 0;
+  const uint8_t expected_shorter[] = {0x01, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00};
+  EXPECT_TRUE(DataMatches(m_notify_request_data, expected_shorter, sizeof(expected_shorter)));
+  m_notify_request_data.clear();
+  sonar_attribute_server_handle_notify_response(handle_, 0xff3, true, NULL, NULL);
+  m_test_attr_num_notify_complete = 0;
+
+  // after the connection changes, the next notify should contain the full value again
+  sonar_attribute_server_connection_changed(handle_, false);
+  EXPECT_TRUE(sonar_attribute_server_notify(handle_, TEST_ATTR3, data, 12, NULL, NULL));
+  EXPECT_EQ(m_notify_request_num, 1);
+  m_notify_request_num = 0;
+  EXPECT_EQ(m_notify_request_data.size(), 13);
+  EXPECT_EQ(m_notify_request_data[0], 0x00);
+  m_notify_request_data.clear();
+  sonar_attribute_server_handle_notify_response(handle_, 0xff3, true, NULL, NULL);
+  m_test_attr_num_notify_complete = 0;
+}
+
 TEST_F(AttributeServerTest, ControlAttrs) {
   uint32_t data_len;
 
-  // Read CTRL_NUM_ATTRS (should be 2)
-  READ_EXPECT_RESPONSE(0x101, 0x02, 0x00);
+  // Read CTRL_NUM_ATTRS (should be 3)
+  READ_EXPECT_RESPONSE(0x101, 0x03, 0x00);
 
   // Write to CTRL_ATTR_OFFSET to 0
   const uint16_t initial_attr_offset = 0;
   EXPECT_TRUE(sonar_attribute_server_handle_write_request(handle_, 0x102, (const uint8_t*)&initial_attr_offset, sizeof(initial_attr_offset)));
 
-  // Read CTRL_ATTR_LIST
-  READ_EXPECT_RESPONSE(0x103, 0xf2, 0x4f, 0xf1, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+  // Read CTRL_ATTR_LIST (the delta attribute has bit15 set)
+  READ_EXPECT_RESPONSE(0x103, 0xf3, 0xcf, 0xf2, 0x4f, 0xf1, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
 
   // Read back CTRL_ATTR_OFFSET (should still be 0)
   READ_EXPECT_RESPONSE(0x102, 0x00, 0x00);
@@ -194,5 +255,5 @@ TEST_F(AttributeServerTest, ControlAttrs) {
   EXPECT_TRUE(sonar_attribute_server_handle_write_request(handle_, 0x102, (const uint8_t*)&attr_offset2, sizeof(attr_offset2)));
 
   // Read CTRL_ATTR_LIST again (with an offset of 1)
-  READ_EXPECT_RESPONSE(0x103, 0xf1, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+  READ_EXPECT_RESPONSE(0x103, 0xf2, 0x4f, 0xf1, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
 }
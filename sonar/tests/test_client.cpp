@@ -28,6 +28,9 @@ static int m_num_disconnections;
 static int m_attr_num_read_complete;
 static int m_attr_num_write_complete;
 static int m_attr_num_notify;
+static std::vector<uintptr_t> m_request_callback_contexts;
+static bool m_request_callback_success;
+static uint32_t m_request_callback_data;
 
 static void write_byte(uint8_t byte) {
   m_write_data.push_back(byte);
@@ -53,6 +56,12 @@ static void attribute_write_complete_handler(bool success) {
   m_attr_num_write_complete++;
 }
 
+static void request_complete_callback(void* context, bool success, const void* data, uint32_t length) {
+  m_request_callback_contexts.push_back((uintptr_t)context);
+  m_request_callback_success = success;
+  m_request_callback_data = length == sizeof(uint32_t) ? *(const uint32_t*)data : 0;
+}
+
 static bool attribute_notify_handler(sonar_attribute_t attr, const void* data, uint32_t length) {
   m_attr_num_notify++;
   return true;
@@ -67,6 +76,7 @@ class ClientTest : public ::testing::Test {
     m_attr_num_read_complete = 0;
     m_attr_num_write_complete = 0;
     m_attr_num_notify = 0;
+    m_request_callback_contexts.clear();
 
     SONAR_CLIENT_DEF(handle, 1024);
     handle_ = handle;
@@ -88,6 +98,7 @@ class ClientTest : public ::testing::Test {
     EXPECT_EQ(m_attr_num_read_complete, 0);
     EXPECT_EQ(m_attr_num_write_complete, 0);
     EXPECT_EQ(m_attr_num_notify, 0);
+    EXPECT_TRUE(m_request_callback_contexts.empty());
   }
 
   sonar_client_handle_t handle_;
@@ -96,10 +107,11 @@ class ClientTest : public ::testing::Test {
 TEST_F(ClientTest, Full) {
   sonar_client_register(handle_, TEST_ATTR);
 
-  // run the process function
+  // should need to process right away, and then send a connection request
+  EXPECT_EQ(sonar_client_get_next_deadline_ms(handle_), 0);
   sonar_client_process(handle_, NULL, 0);
-  // should send a connection request
   EXPECT_WRITE_PACKET(0x14, 0x01, 0x00);
+  EXPECT_EQ(sonar_client_get_next_deadline_ms(handle_), REQUEST_RETRY_INTERVAL_MS);
 
   // process the connection response
   PROCESS_RECEIVE_PACKET(0x17, 0x01);
@@ -147,4 +159,21 @@ TEST_F(ClientTest, Full) {
   m_attr_num_notify = 0;
   // expect a response
   EXPECT_WRITE_PACKET(0x11, 0x00);
+
+  // read TEST_ATTR with a callback, which is called instead of the read complete handler
+  EXPECT_TRUE(sonar_client_read_with_callback(handle_, TEST_ATTR, request_complete_callback, (void*)1));
+  EXPECT_WRITE_PACKET(0x10, 0x07, 0xff, 0x1f);
+  PROCESS_RECEIVE_PACKET(0x13, 0x07, 0x44, 0x33, 0x22, 0x11);
+  EXPECT_EQ(m_request_callback_contexts, std::vector<uintptr_t>({1}));
+  EXPECT_TRUE(m_request_callback_success);
+  EXPECT_EQ(m_request_callback_data, 0x11223344);
+  m_request_callback_contexts.clear();
+
+  // write TEST_ATTR with a callback, which is called instead of the write complete handler
+  EXPECT_TRUE(sonar_client_write_with_callback(handle_, TEST_ATTR, &test_attr_data, sizeof(test_attr_data), request_complete_callback, (void*)2));
+  EXPECT_WRITE_PACKET(0x10, 0x08, 0xff, 0x2f, 0x22, 0xbb, 0x11, 0xaa);
+  PROCESS_RECEIVE_PACKET(0x13, 0x08);
+  EXPECT_EQ(m_request_callback_contexts, std::vector<uintptr_t>({2}));
+  EXPECT_TRUE(m_request_callback_success);
+  m_request_callback_contexts.clear();
 }
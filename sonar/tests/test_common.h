@@ -19,6 +19,28 @@ extern "C" {
   NAME[sizeof(NAME) - 2] = _crc >> 8; \
   NAME[sizeof(NAME) - 1] = 0x7e;
 
+static std::vector<uint8_t> build_cobs_frame(std::vector<uint8_t> packet) {
+  // appends the CRC and then COBS-encodes the packet, with a zero byte at either end
+  const uint16_t crc = crc16(packet.data(), packet.size(), CRC16_INITIAL_VALUE);
+  packet.push_back(crc & 0xff);
+  packet.push_back(crc >> 8);
+  std::vector<uint8_t> frame = {0x00, 0x00};
+  size_t code_index = 1;
+  for (uint8_t byte : packet) {
+    if (byte) {
+      frame.push_back(byte);
+    }
+    if (!byte || frame.size() - code_index == 0xff) {
+      frame[code_index] = frame.size() - code_index;
+      code_index = frame.size();
+      frame.push_back(0x00);
+    }
+  }
+  frame[code_index] = frame.size() - code_index;
+  frame.push_back(0x00);
+  return frame;
+}
+
 static ::testing::AssertionResult DataMatches(const std::vector<uint8_t>& actual, const uint8_t* expected, size_t expected_length) {
   if (actual.size() != expected_length) {
     return ::testing::AssertionFailure()
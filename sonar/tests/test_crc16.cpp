@@ -18,3 +18,40 @@ TEST(CRC16, TestData) {
   const char* test_data2 = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
   EXPECT_EQ(crc16((const uint8_t*)test_data2, strlen(test_data2), CRC16_INITIAL_VALUE), 0xD8E1);
 }
+
+TEST(CRC16, TestBackendsEquivalent) {
+  // all the backends should produce identical results for all lengths, alignments, and initial values
+  static uint8_t data[1024 + 8];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = rand();
+  }
+  const uint16_t initial_values[] = {0, CRC16_INITIAL_VALUE, 0x1234};
+  for (uint16_t initial_value : initial_values) {
+    for (uint32_t offset = 0; offset < 8; offset++) {
+      for (uint32_t length = 0; length <= 1024; length++) {
+        const uint8_t* test_data = &data[offset];
+        const uint16_t expected = crc16_bitwise(test_data, length, initial_value);
+        EXPECT_EQ(crc16_table(test_data, length, initial_value), expected);
+        EXPECT_EQ(crc16_slicing_by_4(test_data, length, initial_value), expected);
+        EXPECT_EQ(crc16_slicing_by_8(test_data, length, initial_value), expected);
+        EXPECT_EQ(crc16_clmul(test_data, length, initial_value), expected);
+        EXPECT_EQ(crc16(test_data, length, initial_value), expected);
+      }
+    }
+  }
+}
+
+TEST(CRC16, TestBackendsIncremental) {
+  // computing the CRC in pieces should match computing it in one go
+  static uint8_t data[512];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = rand();
+  }
+  const uint16_t expected = crc16_bitwise(data, sizeof(data), CRC16_INITIAL_VALUE);
+  for (uint32_t split = 0; split <= sizeof(data); split += 37) {
+    uint16_t crc = crc16_clmul(data, split, CRC16_INITIAL_VALUE);
+    EXPECT_EQ(crc16_clmul(&data[split], sizeof(data) - split, crc), expected);
+    crc = crc16_slicing_by_8(data, split, CRC16_INITIAL_VALUE);
+    EXPECT_EQ(crc16_slicing_by_4(&data[split], sizeof(data) - split, crc), expected);
+  }
+}
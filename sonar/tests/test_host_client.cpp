@@ -0,0 +1,284 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+
+#include "anchor/sonar/host/client.h"
+#include "anchor/sonar/server.h"
+
+};
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_ATTRS 4
+
+// each worker thread gets its own attribute on the server so that it can read back what it wrote
+#define DEFINE_SERVER_ATTR(INDEX) \
+  SONAR_SERVER_ATTR_DEF(ServerAttr##INDEX, SERVER_ATTR_##INDEX, 0x200 + INDEX, sizeof(uint32_t), RW); \
+  static uint32_t ServerAttr##INDEX##_read_handler(void* response_data, uint32_t response_max_size) { \
+    memcpy(response_data, &m_server_values[INDEX], sizeof(uint32_t)); \
+    return sizeof(uint32_t); \
+  } \
+  static bool ServerAttr##INDEX##_write_handler(const void* data, uint32_t length) { \
+    if (length != sizeof(uint32_t)) { \
+      return false; \
+    } \
+    memcpy(&m_server_values[INDEX], data, sizeof(uint32_t)); \
+    return true; \
+  }
+
+static uint32_t m_server_values[NUM_ATTRS];
+static int m_server_fd;
+
+DEFINE_SERVER_ATTR(0)
+DEFINE_SERVER_ATTR(1)
+DEFINE_SERVER_ATTR(2)
+DEFINE_SERVER_ATTR(3)
+
+SONAR_ATTR_DEF(CLIENT_ATTR_0, 0x200, sizeof(uint32_t), RW);
+SONAR_ATTR_DEF(CLIENT_ATTR_1, 0x201, sizeof(uint32_t), RW);
+SONAR_ATTR_DEF(CLIENT_ATTR_2, 0x202, sizeof(uint32_t), RW);
+SONAR_ATTR_DEF(CLIENT_ATTR_3, 0x203, sizeof(uint32_t), RW);
+
+static void server_write_bytes(const uint8_t* data, uint32_t length) {
+  while (length) {
+    const ssize_t result = write(m_server_fd, data, length);
+    if (result > 0) {
+      data += result;
+      length -= result;
+    }
+  }
+}
+
+static uint64_t server_get_system_time_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void server_connection_changed_callback(sonar_server_handle_t handle, bool connected) {
+}
+
+static void server_attribute_notify_complete_handler(sonar_server_handle_t handle, bool success) {
+}
+
+class HostClientTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    m_server_fd = fds[0];
+    client_fd_ = fds[1];
+    memset(m_server_values, 0, sizeof(m_server_values));
+
+    SONAR_CLIENT_DEF(client, 64);
+    SONAR_HOST_CLIENT_DEF(host_client);
+    handle_ = host_client;
+    const sonar_host_client_init_t init_host_client = {
+      .client = client,
+      .fd = client_fd_,
+      .client_init = {
+        .window_size = 4,
+      },
+    };
+    ASSERT_TRUE(sonar_host_client_init(handle_, &init_host_client));
+    sonar_host_client_register(handle_, CLIENT_ATTR_0);
+    sonar_host_client_register(handle_, CLIENT_ATTR_1);
+    sonar_host_client_register(handle_, CLIENT_ATTR_2);
+    sonar_host_client_register(handle_, CLIENT_ATTR_3);
+  }
+
+  void TearDown() override {
+    sonar_host_client_stop(handle_);
+    server_stop_ = true;
+    if (server_thread_.joinable()) {
+      server_thread_.join();
+    }
+    close(m_server_fd);
+    close(client_fd_);
+  }
+
+  void StartServer() {
+    server_thread_ = std::thread([this] {
+      SONAR_SERVER_DEF(server, 64);
+      const sonar_server_init_t init_server = {
+        .write_bytes = server_write_bytes,
+        .get_system_time_ms = server_get_system_time_ms,
+        .connection_changed_callback = server_connection_changed_callback,
+        .attribute_notify_complete_handler = server_attribute_notify_complete_handler,
+        .window_size = 4,
+      };
+      sonar_server_init(server, &init_server);
+      sonar_server_register(server, SERVER_ATTR_0);
+      sonar_server_register(server, SERVER_ATTR_1);
+      sonar_server_register(server, SERVER_ATTR_2);
+      sonar_server_register(server, SERVER_ATTR_3);
+      while (!server_stop_) {
+        struct pollfd pfd = { .fd = m_server_fd, .events = POLLIN };
+        uint8_t buffer[256];
+        ssize_t length = 0;
+        if (poll(&pfd, 1, 1) > 0) {
+          length = read(m_server_fd, buffer, sizeof(buffer));
+        }
+        sonar_server_process(server, buffer, length > 0 ? length : 0);
+      }
+    });
+  }
+
+  bool WaitForConnection() {
+    for (int i = 0; i < 2000; i++) {
+      if (sonar_host_client_is_connected(handle_)) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+  }
+
+  sonar_host_client_handle_t handle_;
+  int client_fd_;
+  std::thread server_thread_;
+  std::atomic<bool> server_stop_{false};
+};
+
+TEST_F(HostClientTest, NotStarted) {
+  const uint32_t value = 1;
+  EXPECT_FALSE(sonar_host_client_write_sync(handle_, CLIENT_ATTR_0, &value, sizeof(value)));
+}
+
+TEST_F(HostClientTest, NotConnected) {
+  // requests fail while the client isn't connected
+  ASSERT_TRUE(sonar_host_client_start(handle_));
+  EXPECT_FALSE(sonar_host_client_is_connected(handle_));
+  uint32_t value;
+  uint32_t length = sizeof(value);
+  EXPECT_FALSE(sonar_host_client_read_sync(handle_, CLIENT_ATTR_0, &value, &length));
+}
+
+TEST_F(HostClientTest, ConcurrentSync) {
+  StartServer();
+  ASSERT_TRUE(sonar_host_client_start(handle_));
+  ASSERT_TRUE(WaitForConnection());
+
+  // issue reads and writes from several threads at once without any locking
+  const sonar_attribute_t attrs[NUM_ATTRS] = {CLIENT_ATTR_0, CLIENT_ATTR_1, CLIENT_ATTR_2, CLIENT_ATTR_3};
+  std::atomic<int> num_failures{0};
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < NUM_ATTRS; i++) {
+    workers.emplace_back([&, i] {
+      for (uint32_t j = 0; j < 50; j++) {
+        const uint32_t value = (i << 16) | j;
+        if (!sonar_host_client_write_sync(handle_, attrs[i], &value, sizeof(value))) {
+          num_failures++;
+          continue;
+        }
+        uint32_t read_value = 0;
+        uint32_t length = sizeof(read_value);
+        if (!sonar_host_client_read_sync(handle_, attrs[i], &read_value, &length) || length != sizeof(read_value) ||
+            read_value != value) {
+          num_failures++;
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(num_failures, 0);
+}
+
+TEST_F(HostClientTest, Async) {
+  StartServer();
+  ASSERT_TRUE(sonar_host_client_start(handle_));
+  ASSERT_TRUE(WaitForConnection());
+
+  // queue more writes to the same attribute than the client can hold at once and make sure they complete in order
+  static std::atomic<int> num_complete;
+  static std::atomic<int> num_out_of_order;
+  num_complete = 0;
+  num_out_of_order = 0;
+  const int num_requests = 16;
+  uint32_t values[num_requests];
+  sonar_host_client_request_t requests[num_requests];
+  for (int i = 0; i < num_requests; i++) {
+    values[i] = i;
+    requests[i] = {};
+    requests[i].attr = CLIENT_ATTR_0;
+    requests[i].data = &values[i];
+    requests[i].length = sizeof(values[i]);
+    requests[i].complete_handler = [](sonar_host_client_request_t* request, bool success) {
+      if (!success || *(uint32_t*)request->data != (uint32_t)num_complete) {
+        num_out_of_order++;
+      }
+      num_complete++;
+    };
+    ASSERT_TRUE(sonar_host_client_write(handle_, &requests[i]));
+  }
+  for (int i = 0; i < 2000 && num_complete != num_requests; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(num_complete, num_requests);
+  EXPECT_EQ(num_out_of_order, 0);
+
+  // the last write should have stuck
+  uint32_t read_value = 0;
+  uint32_t length = sizeof(read_value);
+  EXPECT_TRUE(sonar_host_client_read_sync(handle_, CLIENT_ATTR_0, &read_value, &length));
+  EXPECT_EQ(read_value, (uint32_t)(num_requests - 1));
+}
+
+TEST_F(HostClientTest, Priority) {
+  StartServer();
+  ASSERT_TRUE(sonar_host_client_start(handle_));
+  ASSERT_TRUE(WaitForConnection());
+
+  // high priority reads may overtake the low priority writes, but each request still gets its own result
+  CLIENT_ATTR_3->priority = 1;
+  m_server_values[3] = 0x1234;
+  static std::atomic<int> num_complete;
+  static std::atomic<int> num_failures;
+  num_complete = 0;
+  num_failures = 0;
+  const int num_requests = 16;
+  const sonar_attribute_t write_attrs[] = {CLIENT_ATTR_0, CLIENT_ATTR_1, CLIENT_ATTR_2};
+  uint32_t values[num_requests];
+  sonar_host_client_request_t requests[num_requests];
+  for (int i = 0; i < num_requests; i++) {
+    values[i] = i;
+    requests[i] = {};
+    requests[i].data = &values[i];
+    requests[i].length = sizeof(values[i]);
+    if (i % 2) {
+      requests[i].attr = CLIENT_ATTR_3;
+      requests[i].complete_handler = [](sonar_host_client_request_t* request, bool success) {
+        if (!success || request->length != sizeof(uint32_t) || *(uint32_t*)request->data != 0x1234) {
+          num_failures++;
+        }
+        num_complete++;
+      };
+      EXPECT_TRUE(sonar_host_client_read(handle_, &requests[i]));
+    } else {
+      requests[i].attr = write_attrs[(i / 2) % 3];
+      requests[i].complete_handler = [](sonar_host_client_request_t* request, bool success) {
+        if (!success) {
+          num_failures++;
+        }
+        num_complete++;
+      };
+      EXPECT_TRUE(sonar_host_client_write(handle_, &requests[i]));
+    }
+  }
+  for (int i = 0; i < 2000 && num_complete != num_requests; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CLIENT_ATTR_3->priority = 0;
+  EXPECT_EQ(num_complete, num_requests);
+  EXPECT_EQ(num_failures, 0);
+}
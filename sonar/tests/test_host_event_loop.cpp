@@ -0,0 +1,264 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+
+#include "anchor/sonar/host/event_loop.h"
+
+};
+
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define MAX_ATTR_SIZE 16
+#define TEST_ATTR_ID 0x200
+
+// everything needed for a client / server pair, with the SONAR objects which the DEF macros would normally allocate
+struct Pair {
+  explicit Pair(uint32_t index) :
+      index(index),
+      server_attr_def{{0}, TEST_ATTR_ID, sizeof(uint32_t), SONAR_ATTRIBUTE_OPS_RW, server_request_buffer, server_response_buffer, nullptr},
+      client_attr_def{{0}, TEST_ATTR_ID, sizeof(uint32_t), SONAR_ATTRIBUTE_OPS_RW, client_request_buffer, client_response_buffer, nullptr} {
+    server_context.receive_buffer = server_receive_buffer;
+    server_context.receive_buffer_size = sizeof(server_receive_buffer);
+    server_context.transmit_buffer = server_transmit_buffer;
+    server_context.transmit_buffer_size = sizeof(server_transmit_buffer);
+    client_context.receive_buffer = client_receive_buffer;
+    client_context.receive_buffer_size = sizeof(client_receive_buffer);
+    client_context.transmit_buffer = client_transmit_buffer;
+    client_context.transmit_buffer_size = sizeof(client_transmit_buffer);
+    server_attr.attr = &server_attr_def;
+  }
+
+  uint32_t index;
+  uint32_t server_value = 0;
+  bool is_connected = false;
+  int num_write_complete = 0;
+  int num_read_complete = 0;
+  uint32_t read_value = 0;
+
+  uint8_t server_request_buffer[sizeof(uint32_t)];
+  uint8_t server_response_buffer[sizeof(uint32_t)];
+  uint8_t client_request_buffer[sizeof(uint32_t)];
+  uint8_t client_response_buffer[sizeof(uint32_t)];
+  sonar_attribute_def_t server_attr_def;
+  sonar_attribute_def_t client_attr_def;
+  struct sonar_server_attribute server_attr = {};
+
+  uint8_t server_receive_buffer[MAX_ATTR_SIZE + 6];
+  uint8_t server_transmit_buffer[SONAR_MAX_FRAME_SIZE(MAX_ATTR_SIZE)];
+  uint8_t client_receive_buffer[MAX_ATTR_SIZE + 6];
+  uint8_t client_transmit_buffer[SONAR_MAX_FRAME_SIZE(MAX_ATTR_SIZE)];
+  struct sonar_server_context server_context = {};
+  sonar_client_context_t client_context = {};
+
+  sonar_host_link_context_t server_link = {};
+  sonar_host_link_context_t client_link = {};
+  int server_fd = -1;
+  int client_fd = -1;
+};
+
+static Pair* GetCurrentPair() {
+  return (Pair*)sonar_host_link_get_handle(sonar_host_loop_get_current_link());
+}
+
+static uint32_t server_attr_read_handler(void* response_data, uint32_t response_max_size) {
+  memcpy(response_data, &GetCurrentPair()->server_value, sizeof(uint32_t));
+  return sizeof(uint32_t);
+}
+
+static bool server_attr_write_handler(const void* data, uint32_t length) {
+  if (length != sizeof(uint32_t)) {
+    return false;
+  }
+  memcpy(&GetCurrentPair()->server_value, data, sizeof(uint32_t));
+  return true;
+}
+
+static void server_connection_changed_callback(sonar_server_handle_t handle, bool connected) {
+}
+
+static void server_attribute_notify_complete_handler(sonar_server_handle_t handle, bool success) {
+}
+
+static void client_connection_changed_callback(bool connected) {
+  GetCurrentPair()->is_connected = connected;
+}
+
+static void client_attribute_read_complete_handler(bool success, const void* data, uint32_t length) {
+  Pair* pair = GetCurrentPair();
+  pair->num_read_complete++;
+  if (success && length == sizeof(uint32_t)) {
+    memcpy(&pair->read_value, data, sizeof(uint32_t));
+  }
+}
+
+static void client_attribute_write_complete_handler(bool success) {
+  GetCurrentPair()->num_write_complete += success ? 1 : 0;
+}
+
+static bool client_attribute_notify_handler(sonar_attribute_t attr, const void* data, uint32_t length) {
+  return false;
+}
+
+class HostEventLoopTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    SONAR_HOST_LOOP_DEF(loop);
+    loop_ = loop;
+    ASSERT_TRUE(sonar_host_loop_init(loop_));
+  }
+
+  void TearDown() override {
+    for (auto& pair : pairs_) {
+      sonar_host_loop_remove_link(loop_, &pair->server_link);
+      sonar_host_loop_remove_link(loop_, &pair->client_link);
+      close(pair->server_fd);
+      close(pair->client_fd);
+    }
+    sonar_host_loop_deinit(loop_);
+  }
+
+  void AddPair(int server_fd, int client_fd) {
+    pairs_.emplace_back(new Pair(pairs_.size()));
+    Pair* pair = pairs_.back().get();
+    pair->server_fd = server_fd;
+    pair->client_fd = client_fd;
+
+    const sonar_server_init_t init_server = {
+      .write_bytes = sonar_host_loop_write_bytes,
+      .get_system_time_ms = sonar_host_loop_get_system_time_ms,
+      .connection_changed_callback = server_connection_changed_callback,
+      .attribute_notify_complete_handler = server_attribute_notify_complete_handler,
+    };
+    sonar_server_init(&pair->server_context, &init_server);
+    pair->server_attr.read_handler = server_attr_read_handler;
+    pair->server_attr.write_handler = server_attr_write_handler;
+    sonar_server_register(&pair->server_context, &pair->server_attr);
+
+    const sonar_client_init_t init_client = {
+      .write_bytes = sonar_host_loop_write_bytes,
+      .get_system_time_ms = sonar_host_loop_get_system_time_ms,
+      .connection_changed_callback = client_connection_changed_callback,
+      .attribute_read_complete_handler = client_attribute_read_complete_handler,
+      .attribute_write_complete_handler = client_attribute_write_complete_handler,
+      .attribute_notify_handler = client_attribute_notify_handler,
+    };
+    sonar_client_init(&pair->client_context, &init_client);
+    sonar_client_register(&pair->client_context, &pair->client_attr_def);
+
+    const sonar_host_link_init_t init_server_link = {
+      .fd = server_fd,
+      .client = NULL,
+      .server = &pair->server_context,
+      .handle = pair,
+    };
+    ASSERT_TRUE(sonar_host_loop_add_link(loop_, &pair->server_link, &init_server_link));
+    const sonar_host_link_init_t init_client_link = {
+      .fd = client_fd,
+      .client = &pair->client_context,
+      .server = NULL,
+      .handle = pair,
+    };
+    ASSERT_TRUE(sonar_host_loop_add_link(loop_, &pair->client_link, &init_client_link));
+  }
+
+  template <typename Predicate>
+  bool RunUntil(Predicate predicate) {
+    const uint64_t end_time_ms = sonar_host_loop_get_system_time_ms() + 5000;
+    while (sonar_host_loop_get_system_time_ms() < end_time_ms) {
+      bool done = true;
+      for (auto& pair : pairs_) {
+        done &= predicate(*pair);
+      }
+      if (done) {
+        return true;
+      }
+      EXPECT_TRUE(sonar_host_loop_run(loop_, 10));
+    }
+    return false;
+  }
+
+  void RunWriteRead() {
+    // connect all the pairs
+    ASSERT_TRUE(RunUntil([](const Pair& pair) { return pair.is_connected; }));
+
+    // write a different value through each pair
+    for (auto& pair : pairs_) {
+      const uint32_t value = 0x1000 + pair->index;
+      ASSERT_TRUE(sonar_host_link_client_write(&pair->client_link, &pair->client_attr_def, &value, sizeof(value)));
+    }
+    ASSERT_TRUE(RunUntil([](const Pair& pair) { return pair.num_write_complete == 1; }));
+    for (auto& pair : pairs_) {
+      EXPECT_EQ(pair->server_value, 0x1000 + pair->index);
+    }
+
+    // read the values back
+    for (auto& pair : pairs_) {
+      ASSERT_TRUE(sonar_host_link_client_read(&pair->client_link, &pair->client_attr_def));
+    }
+    ASSERT_TRUE(RunUntil([](const Pair& pair) { return pair.num_read_complete == 1; }));
+    for (auto& pair : pairs_) {
+      EXPECT_EQ(pair->read_value, 0x1000 + pair->index);
+    }
+  }
+
+  sonar_host_loop_handle_t loop_;
+  std::vector<std::unique_ptr<Pair>> pairs_;
+};
+
+TEST_F(HostEventLoopTest, ManySocketPairs) {
+  for (int i = 0; i < 200; i++) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    AddPair(fds[0], fds[1]);
+  }
+  RunWriteRead();
+}
+
+TEST_F(HostEventLoopTest, Pty) {
+  const int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  ASSERT_GE(master_fd, 0);
+  ASSERT_EQ(grantpt(master_fd), 0);
+  ASSERT_EQ(unlockpt(master_fd), 0);
+  const int slave_fd = open(ptsname(master_fd), O_RDWR | O_NOCTTY);
+  ASSERT_GE(slave_fd, 0);
+  // the link carries binary data, so put the terminal into raw mode
+  struct termios tio;
+  ASSERT_EQ(tcgetattr(slave_fd, &tio), 0);
+  cfmakeraw(&tio);
+  ASSERT_EQ(tcsetattr(slave_fd, TCSANOW, &tio), 0);
+  AddPair(master_fd, slave_fd);
+  RunWriteRead();
+}
+
+TEST_F(HostEventLoopTest, Closed) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  AddPair(fds[0], fds[1]);
+  ASSERT_TRUE(RunUntil([](const Pair& pair) { return pair.is_connected; }));
+
+  // close the server's end and make sure the client's link gets closed
+  Pair* pair = pairs_.back().get();
+  shutdown(pair->server_fd, SHUT_RDWR);
+  ASSERT_TRUE(RunUntil([](Pair& pair) { return !sonar_host_link_is_open(&pair.client_link); }));
+}
+
+TEST_F(HostEventLoopTest, Backpressure) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  // fill up the client's end so that its first writes can't complete, which mustn't block the loop
+  ASSERT_EQ(fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK), 0);
+  const uint8_t junk[256] = {0};
+  while (write(fds[1], junk, sizeof(junk)) > 0) {
+  }
+  AddPair(fds[0], fds[1]);
+
+  // the server then drains the junk and the client's requests get through once they're retried
+  RunWriteRead();
+}
@@ -7,6 +7,7 @@ extern "C" {
 #include "src/common/crc16.h"
 #include "src/link_layer/link_layer.h"
 #include "src/link_layer/timeouts.h"
+#include "src/link_layer/types.h"
 
 };
 
@@ -21,6 +22,25 @@ extern "C" {
     m_sent_data.clear(); \
   } while (0)
 
+#define RECEIVE_HANDLE_COBS_DATA(...) do { \
+    const std::vector<uint8_t> _frame = build_cobs_frame({__VA_ARGS__}); \
+    sonar_link_layer_handle_receive_data(handle_, _frame.data(), _frame.size()); \
+  } while (0)
+
+#define EXPECT_AND_CLEAR_SENT_COBS_DATA(...) do { \
+    const std::vector<uint8_t> _frame = build_cobs_frame({__VA_ARGS__}); \
+    EXPECT_TRUE(DataMatches(m_sent_data, _frame.data(), _frame.size())); \
+    m_sent_data.clear(); \
+  } while (0)
+
+#define EXPECT_AND_POP_SENT_DATA(...) do { \
+    BUILD_PACKET_BUFFER(_buffer, __VA_ARGS__); \
+    ASSERT_GE(m_sent_data.size(), sizeof(_buffer)); \
+    const std::vector<uint8_t> _sent(m_sent_data.begin(), m_sent_data.begin() + sizeof(_buffer)); \
+    EXPECT_TRUE(DataMatches(_sent, _buffer, sizeof(_buffer))); \
+    m_sent_data.erase(m_sent_data.begin(), m_sent_data.begin() + sizeof(_buffer)); \
+  } while (0)
+
 #define EXPECT_NO_RESPONSE() do { \
     EXPECT_EQ(m_num_successful_responses, 0); \
     m_num_successful_responses = 0; \
@@ -45,6 +65,14 @@ extern "C" {
     EXPECT_TRUE(sonar_link_layer_send_request(handle_, &_buffer_chain)); \
   } while (0)
 
+#define EXPECT_RTT(SRTT, RTTVAR, RETRY_INTERVAL) do { \
+    sonar_link_layer_rtt_t _rtt = {}; \
+    sonar_link_layer_get_rtt(handle_, &_rtt); \
+    EXPECT_EQ(_rtt.srtt_ms, SRTT); \
+    EXPECT_EQ(_rtt.rttvar_ms, RTTVAR); \
+    EXPECT_EQ(_rtt.retry_interval_ms, RETRY_INTERVAL); \
+  } while (0)
+
 #define EXPECT_ERRORS(INVALID_PACKET, UNEXPECTED_PACKET, INVALID_SEQUENCE_NUMBER, RETRIES) do { \
     sonar_link_layer_errors_t _errors = {}; \
     sonar_link_layer_receive_errors_t _receive_errors = {}; \
@@ -72,6 +100,10 @@ static void write_byte_function(uint8_t byte) {
   m_sent_data.push_back(byte);
 }
 
+static void write_bytes_function(const uint8_t* data, uint32_t length) {
+  m_sent_data.insert(m_sent_data.end(), data, data + length);
+}
+
 static void connection_changed_handler(void* handle, bool connected) {
   if (connected) {
     m_num_connected_callbacks++;
@@ -103,21 +135,39 @@ static void request_complete_handler(void* handle, bool success, const uint8_t*
 
 class LinkLayerTest : public ::testing::Test {
  protected:
-  void DoLinkLayerInit(bool is_server) {
+  void DoLinkLayerInit(bool is_server, bool use_retransmit_cache = true, uint8_t window_size = 0, uint16_t min_retry_interval_ms = REQUEST_RETRY_INTERVAL_MS, uint16_t max_retry_interval_ms = REQUEST_RETRY_INTERVAL_MS, bool enable_piggyback = false, bool enable_aggregation = false, uint16_t aggregation_delay_ms = 0, bool enable_cobs = false, bool enable_compression = false, bool enable_fragmentation = false) {
     static uint8_t receive_buffer[1024];
+    static uint8_t retransmit_buffers[2][64];
+    static uint8_t transmit_buffer[SONAR_ENCODING_COBS_MAX_FRAME_SIZE(sizeof(receive_buffer))];
     static sonar_link_layer_context_t context;
     handle_ = &context;
     const sonar_link_layer_init_t init_link_layer = {
       .config = {
         .is_server = is_server,
+        .window_size = window_size,
+        .enable_piggyback = enable_piggyback,
+        .min_retry_interval_ms = min_retry_interval_ms,
+        .max_retry_interval_ms = max_retry_interval_ms,
+        .enable_aggregation = enable_aggregation,
+        .aggregation_delay_ms = aggregation_delay_ms,
+        .enable_cobs = enable_cobs,
+        .enable_compression = enable_compression,
+        .enable_fragmentation = enable_fragmentation,
       },
       .buffers = {
         .receive = receive_buffer,
         .receive_size = sizeof(receive_buffer),
+        // COBS requires a transmit buffer
+        .transmit = enable_cobs ? transmit_buffer : NULL,
+        .transmit_size = enable_cobs ? (uint32_t)sizeof(transmit_buffer) : 0,
+        .retransmit_request = use_retransmit_cache ? retransmit_buffers[0] : NULL,
+        .retransmit_response = use_retransmit_cache ? retransmit_buffers[1] : NULL,
+        .retransmit_size = sizeof(retransmit_buffers[0]),
       },
       .functions = {
         .get_system_time_ms = get_system_time_ms_function,
         .write_byte = write_byte_function,
+        .write_bytes = enable_cobs ? write_bytes_function : NULL,
       },
       .handlers = {
         .connection_changed = connection_changed_handler,
@@ -169,6 +219,36 @@ protected:
   }
 };
 
+TEST_F(LinkLayerServerTest, NextDeadline) {
+  // no deadline until a client connects
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), UINT64_MAX);
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // the next deadline is the connection timeout
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), CONNECTION_TIMEOUT_MS);
+
+  // send a request and the next deadline should be its retry
+  m_system_time_ms += 50;
+  SEND_REQUEST(0xaa);
+  EXPECT_AND_CLEAR_SENT_DATA(0x12, 0x42, 0xaa);
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), 50 + REQUEST_RETRY_INTERVAL_MS);
+
+  // disconnect at the connection timeout and there should be no deadline again
+  m_system_time_ms = CONNECTION_TIMEOUT_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_FALSE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  EXPECT_EQ(m_num_failed_responses, 1);
+  m_num_failed_responses = 0;
+  m_sent_data.clear();
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), UINT64_MAX);
+}
+
 TEST_F(LinkLayerServerTest, ResponseNormal) {
   ASSERT_FALSE(sonar_link_layer_is_connected(handle_));
 
@@ -409,6 +489,46 @@ TEST_F(LinkLayerClientTest, Connection) {
   m_num_disconnected_callbacks = 0;
 }
 
+TEST_F(LinkLayerClientTest, NextDeadline) {
+  // should need to process right away to send a connection request
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), m_system_time_ms);
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00);
+
+  // the next deadline is the retry of the connection request
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), REQUEST_RETRY_INTERVAL_MS);
+
+  // once connected, the next deadline is the connection maintenance request
+  m_system_time_ms += 10;
+  RECEIVE_HANDLE_DATA(0x17, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), 10 + CONNECTION_MAINTENANCE_INTERVAL_MS);
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+
+  // send a request and the next deadline should be its retry
+  m_system_time_ms += 200;
+  SEND_REQUEST(0xaa);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa);
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), 210 + REQUEST_RETRY_INTERVAL_MS);
+  m_system_time_ms = sonar_link_layer_get_next_deadline_ms(handle_) - 1;
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+  m_system_time_ms++;
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa);
+  EXPECT_ERRORS(0, 0, 0, 1);
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), 210 + REQUEST_RETRY_INTERVAL_MS * 2);
+
+  // after the response, the next deadline is the connection maintenance request again
+  m_system_time_ms += 5;
+  RECEIVE_HANDLE_DATA(0x13, 0x02);
+  EXPECT_AND_CLEAR_RESPONSE_DATA();
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), m_system_time_ms + CONNECTION_MAINTENANCE_INTERVAL_MS);
+}
+
 TEST_F(LinkLayerClientTest, ResponseNormal) {
   // need to connect first (also covered by ClientConnection test case)
   sonar_link_layer_process(handle_);
@@ -533,3 +653,688 @@ TEST_F(LinkLayerClientTest, RequestRetriesAndTimeout) {
   EXPECT_EQ(m_num_disconnected_callbacks, 1);
   m_num_disconnected_callbacks = 0;
 }
+
+TEST_F(LinkLayerClientTest, RequestRetriesCached) {
+  // need to connect first (also covered by ClientConnection test case)
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00);
+  RECEIVE_HANDLE_DATA(0x17, 0x01);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // send a request with data
+  static uint8_t buffer[] = {0xaa, 0xbb, 0xcc};
+  static buffer_chain_entry_t buffer_chain;
+  buffer_chain_set_data(&buffer_chain, buffer, sizeof(buffer));
+  EXPECT_TRUE(sonar_link_layer_send_request(handle_, &buffer_chain));
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa, 0xbb, 0xcc);
+
+  // modify the request data (not allowed by the API), and check that the retry is sent from the cache as-is
+  buffer[0] = 0x11;
+  m_system_time_ms += REQUEST_RETRY_INTERVAL_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa, 0xbb, 0xcc);
+  EXPECT_ERRORS(0, 0, 0, 1);
+
+  // process the response
+  RECEIVE_HANDLE_DATA(0x13, 0x02);
+  EXPECT_AND_CLEAR_RESPONSE_DATA();
+
+  // a request which is too big to fit in the cache should be re-encoded for each retry
+  static uint8_t large_buffer[100] = {0};
+  buffer_chain_set_data(&buffer_chain, large_buffer, sizeof(large_buffer));
+  EXPECT_TRUE(sonar_link_layer_send_request(handle_, &buffer_chain));
+  std::vector<uint8_t> sent_data = m_sent_data;
+  m_sent_data.clear();
+  m_system_time_ms += REQUEST_RETRY_INTERVAL_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(DataMatches(m_sent_data, sent_data.data(), sent_data.size()));
+  m_sent_data.clear();
+  EXPECT_ERRORS(0, 0, 0, 1);
+  RECEIVE_HANDLE_DATA(0x13, 0x03);
+  EXPECT_AND_CLEAR_RESPONSE_DATA();
+}
+
+TEST_F(LinkLayerServerTest, ResponseRetriesCached) {
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // should respond to a normal request (echo'ing data back)
+  RECEIVE_HANDLE_DATA(0x10, 0x0c, 0x77);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0c, 0x77);
+
+  // a failed request shouldn't leave the previous response in the cache
+  m_should_fail_request = true;
+  RECEIVE_HANDLE_DATA(0x10, 0x0d, 0x33);
+  m_should_fail_request = false;
+  EXPECT_TRUE(m_sent_data.empty());
+  RECEIVE_HANDLE_DATA(0x10, 0x0d, 0x33);
+  EXPECT_TRUE(m_sent_data.empty());
+
+  // the next request's response should be cached for retries
+  RECEIVE_HANDLE_DATA(0x10, 0x0e, 0xf0);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0e, 0xf0);
+  RECEIVE_HANDLE_DATA(0x10, 0x0e, 0xf0);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0e, 0xf0);
+  EXPECT_NO_RESPONSE();
+}
+
+TEST_F(LinkLayerClientTest, RequestRetriesNoCache) {
+  DoLinkLayerInit(false, false);
+
+  // need to connect first (also covered by ClientConnection test case)
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00);
+  RECEIVE_HANDLE_DATA(0x17, 0x01);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // without a cache, retries are re-encoded from the request data
+  SEND_REQUEST(0xaa, 0xbb, 0xcc);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa, 0xbb, 0xcc);
+  m_system_time_ms += REQUEST_RETRY_INTERVAL_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa, 0xbb, 0xcc);
+  EXPECT_ERRORS(0, 0, 0, 1);
+  RECEIVE_HANDLE_DATA(0x13, 0x02);
+  EXPECT_AND_CLEAR_RESPONSE_DATA();
+}
+
+TEST_F(LinkLayerClientTest, WindowNegotiation) {
+  DoLinkLayerInit(false, true, 4);
+
+  // should send an extended connection request with our window size
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00, 0x02, 0x04);
+
+  // the server only supports a window size of 3
+  RECEIVE_HANDLE_DATA(0x17, 0x01, 0x02, 0x03);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // should be able to send 3 requests at once
+  SEND_REQUEST(0xa1);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xa1);
+  SEND_REQUEST(0xa2);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x03, 0xa2);
+  SEND_REQUEST(0xa3);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x04, 0xa3);
+  EXPECT_FALSE(sonar_link_layer_send_request(handle_, NULL));
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_NO_RESPONSE();
+
+  // process the response to the first request
+  RECEIVE_HANDLE_DATA(0x13, 0x02, 0xa1);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xa1);
+
+  // the response to the third request also acknowledges the second one
+  RECEIVE_HANDLE_DATA(0x13, 0x04, 0xa3);
+  EXPECT_EQ(m_num_successful_responses, 2);
+  m_num_successful_responses = 0;
+  EXPECT_EQ(m_num_failed_responses, 0);
+  const uint8_t expected_response[] = {0xa3};
+  EXPECT_TRUE(DataMatches(m_response_data, expected_response, sizeof(expected_response)));
+  m_response_data.clear();
+
+  // a response to a request which is no longer pending should be dropped
+  SEND_REQUEST(0xa4);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x05, 0xa4);
+  RECEIVE_HANDLE_DATA(0x13, 0x04, 0xa3);
+  EXPECT_NO_RESPONSE();
+  EXPECT_ERRORS(0, 0, 1, 0);
+  RECEIVE_HANDLE_DATA(0x13, 0x05, 0xa4);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xa4);
+}
+
+TEST_F(LinkLayerClientTest, WindowRetriesAndTimeout) {
+  DoLinkLayerInit(false, true, 4);
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00, 0x02, 0x04);
+  RECEIVE_HANDLE_DATA(0x17, 0x01, 0x02, 0x04);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  SEND_REQUEST(0xa1);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xa1);
+  SEND_REQUEST(0xa2);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x03, 0xa2);
+
+  // all the outstanding requests should be retried in order
+  m_system_time_ms += REQUEST_RETRY_INTERVAL_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_POP_SENT_DATA(0x10, 0x02, 0xa1);
+  EXPECT_AND_POP_SENT_DATA(0x10, 0x03, 0xa2);
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_NO_RESPONSE();
+  EXPECT_ERRORS(0, 0, 0, 2);
+
+  // the response to the second request completes both
+  RECEIVE_HANDLE_DATA(0x13, 0x03, 0xa2);
+  EXPECT_EQ(m_num_successful_responses, 2);
+  m_num_successful_responses = 0;
+  m_response_data.clear();
+
+  // all the outstanding requests should fail once the oldest one times out
+  SEND_REQUEST(0xa3);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x04, 0xa3);
+  SEND_REQUEST(0xa4);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x05, 0xa4);
+  m_system_time_ms += REQUEST_TIMEOUT_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_EQ(m_num_successful_responses, 0);
+  EXPECT_EQ(m_num_failed_responses, 2);
+  m_num_failed_responses = 0;
+}
+
+TEST_F(LinkLayerClientTest, WindowLegacyFallback) {
+  DoLinkLayerInit(false, true, 4);
+
+  // a legacy server will drop the extended connection request
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00, 0x02, 0x04);
+  m_system_time_ms += REQUEST_TIMEOUT_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+
+  // the next attempt should use a legacy connection request
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x02, REQUEST_TIMEOUT_MS & 0xff);
+  RECEIVE_HANDLE_DATA(0x17, 0x02);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // only a single request can be outstanding
+  SEND_REQUEST(0xa1);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x03, 0xa1);
+  EXPECT_FALSE(sonar_link_layer_send_request(handle_, NULL));
+  RECEIVE_HANDLE_DATA(0x13, 0x03, 0xa1);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xa1);
+}
+
+TEST_F(LinkLayerClientTest, AdaptiveRetryInterval) {
+  // use the default retry interval range
+  DoLinkLayerInit(false, true, 0, 0, 0);
+  // should start with the default retry interval
+  EXPECT_RTT(0, 0, REQUEST_RETRY_INTERVAL_MS);
+
+  // the connection request is the first round-trip time sample
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00);
+  m_system_time_ms += 40;
+  RECEIVE_HANDLE_DATA(0x17, 0x01);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+  EXPECT_RTT(40, 20, 120);
+
+  // the variation should decay with a steady round-trip time
+  uint8_t sequence_num = 0x02;
+  for (int i = 0; i < 10; i++) {
+    SEND_REQUEST(0xaa);
+    EXPECT_AND_CLEAR_SENT_DATA(0x10, sequence_num, 0xaa);
+    m_system_time_ms += 40;
+    RECEIVE_HANDLE_DATA(0x13, sequence_num, 0xaa);
+    EXPECT_AND_CLEAR_RESPONSE_DATA(0xaa);
+    sequence_num++;
+  }
+  EXPECT_RTT(40, 1, 46);
+
+  // should retry after the new retry interval
+  SEND_REQUEST(0xbb);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, sequence_num, 0xbb);
+  m_system_time_ms += 45;
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+  m_system_time_ms += 1;
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, sequence_num, 0xbb);
+  EXPECT_ERRORS(0, 0, 0, 1);
+
+  // the response to a retried request shouldn't be used as a sample, and the retry should have backed off
+  m_system_time_ms += 10;
+  RECEIVE_HANDLE_DATA(0x13, sequence_num, 0xbb);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xbb);
+  EXPECT_RTT(40, 1, 92);
+  sequence_num++;
+
+  // the next sample should undo the back off
+  SEND_REQUEST(0xaa);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, sequence_num, 0xaa);
+  m_system_time_ms += 40;
+  RECEIVE_HANDLE_DATA(0x13, sequence_num, 0xaa);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xaa);
+  EXPECT_RTT(40, 1, 45);
+  sequence_num++;
+
+  // should back off with each retry (up to the max) and time out after a fixed number of the current retry intervals
+  SEND_REQUEST(0xcc);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, sequence_num, 0xcc);
+  const uint32_t retry_times_ms[] = {45, 45 + 90, 45 + 90 + DEFAULT_MAX_REQUEST_RETRY_INTERVAL_MS};
+  uint64_t start_time_ms = m_system_time_ms;
+  for (uint32_t retry_time_ms : retry_times_ms) {
+    m_system_time_ms = start_time_ms + retry_time_ms - 1;
+    sonar_link_layer_process(handle_);
+    EXPECT_TRUE(m_sent_data.empty());
+    m_system_time_ms++;
+    sonar_link_layer_process(handle_);
+    EXPECT_AND_CLEAR_SENT_DATA(0x10, sequence_num, 0xcc);
+    EXPECT_NO_RESPONSE();
+  }
+  EXPECT_ERRORS(0, 0, 0, 3);
+  m_system_time_ms = start_time_ms + DEFAULT_MAX_REQUEST_RETRY_INTERVAL_MS * REQUEST_TIMEOUT_INTERVALS;
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_EQ(m_num_failed_responses, 1);
+  m_num_failed_responses = 0;
+  sequence_num++;
+}
+
+TEST_F(LinkLayerClientTest, AdaptiveRetryIntervalBounds) {
+  // a max retry interval above the default is allowed for slow links
+  DoLinkLayerInit(false, true, 0, 20, 400);
+
+  // the retry interval should be limited to the configured minimum
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00);
+  RECEIVE_HANDLE_DATA(0x17, 0x01);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+  EXPECT_RTT(0, 0, 20);
+
+  // retries should back off until the retry interval exceeds the round-trip time
+  SEND_REQUEST(0xaa);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa);
+  for (uint32_t retry_interval_ms = 20; retry_interval_ms < 150; retry_interval_ms *= 2) {
+    m_system_time_ms += retry_interval_ms;
+    sonar_link_layer_process(handle_);
+    EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa);
+  }
+  EXPECT_RTT(0, 0, 160);
+  m_system_time_ms += 10;
+  RECEIVE_HANDLE_DATA(0x13, 0x02, 0xaa);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xaa);
+  EXPECT_ERRORS(0, 0, 0, 3);
+
+  // so that the next request isn't retried and can be sampled
+  SEND_REQUEST(0xbb);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x03, 0xbb);
+  m_system_time_ms += 150;
+  sonar_link_layer_process(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+  RECEIVE_HANDLE_DATA(0x13, 0x03, 0xbb);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xbb);
+  EXPECT_RTT(18, 37, 168);
+
+  // the retry interval should be limited to the configured maximum
+  SEND_REQUEST(0xcc);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x04, 0xcc);
+  m_system_time_ms += 1000;
+  RECEIVE_HANDLE_DATA(0x13, 0x04, 0xcc);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xcc);
+  EXPECT_RTT(141, 273, 400);
+
+  // the connection timeout should be extended so that a connection maintenance request can time out first
+  m_system_time_ms += CONNECTION_TIMEOUT_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x05);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+
+  // the estimates should be reset when the connection is lost
+  m_system_time_ms += CONNECTION_MAINTENANCE_INTERVAL_MS + 400 * (REQUEST_TIMEOUT_INTERVALS + 1) - CONNECTION_TIMEOUT_MS;
+  sonar_link_layer_process(handle_);
+  m_sent_data.clear();
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  EXPECT_RTT(0, 0, REQUEST_RETRY_INTERVAL_MS);
+}
+
+TEST_F(LinkLayerServerTest, ConnectionTimeoutMaxRetryInterval) {
+  // the server can't measure the client's retry interval, so should allow for the configured max
+  DoLinkLayerInit(true, true, 0, 0, 400);
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  const uint32_t connection_timeout_ms = CONNECTION_MAINTENANCE_INTERVAL_MS + 400 * (REQUEST_TIMEOUT_INTERVALS + 1);
+  m_system_time_ms += connection_timeout_ms - 1;
+  sonar_link_layer_process(handle_);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  m_system_time_ms++;
+  sonar_link_layer_process(handle_);
+  EXPECT_FALSE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+}
+
+TEST_F(LinkLayerServerTest, WindowNegotiation) {
+  DoLinkLayerInit(true, true, 2);
+
+  // should respond to an extended connection request with the negotiated window size
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42, 0x02, 0x04);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b, 0x02, 0x02);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  RECEIVE_HANDLE_DATA(0x10, 0x0c, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0c, 0x01);
+  RECEIVE_HANDLE_DATA(0x10, 0x0d, 0x02);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0d, 0x02);
+
+  // a retry of an earlier request within the window gets the latest response
+  RECEIVE_HANDLE_DATA(0x10, 0x0c, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0d, 0x02);
+
+  // a request from outside the window is invalid
+  RECEIVE_HANDLE_DATA(0x10, 0x0b, 0x00);
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_ERRORS(0, 0, 1, 0);
+
+  // should respond to a legacy connection request as before
+  RECEIVE_HANDLE_DATA(0x14, 0x20, 0x42);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x20);
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+  RECEIVE_HANDLE_DATA(0x10, 0x21, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x21, 0x01);
+  RECEIVE_HANDLE_DATA(0x10, 0x20, 0x00);
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_ERRORS(0, 0, 1, 0);
+  EXPECT_NO_RESPONSE();
+}
+
+TEST_F(LinkLayerClientTest, Piggyback) {
+  DoLinkLayerInit(false, true, 0, 0, 0, true);
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00, 0x03, 0x01);
+  RECEIVE_HANDLE_DATA(0x17, 0x01, 0x03, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // the response should be held back and then sent along with the next request
+  RECEIVE_HANDLE_DATA(0x12, 0x00, 0x77);
+  EXPECT_TRUE(m_sent_data.empty());
+  SEND_REQUEST(0xaa);
+  EXPECT_AND_CLEAR_SENT_DATA(0x19, 0x00, 0x01, 0x00, 0x02, 0x77, 0xaa);
+  sonar_link_layer_flush(handle_);
+  EXPECT_TRUE(m_sent_data.empty());
+  RECEIVE_HANDLE_DATA(0x13, 0x02, 0xaa);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xaa);
+
+  // the response should be sent on its own if there's no request to piggyback onto it
+  RECEIVE_HANDLE_DATA(0x12, 0x01, 0x78);
+  EXPECT_TRUE(m_sent_data.empty());
+  sonar_link_layer_flush(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x11, 0x01, 0x78);
+
+  // retries of the request should get the response on its own
+  RECEIVE_HANDLE_DATA(0x12, 0x01, 0x78);
+  EXPECT_AND_CLEAR_SENT_DATA(0x11, 0x01, 0x78);
+  EXPECT_NO_RESPONSE();
+}
+
+TEST_F(LinkLayerServerTest, Piggyback) {
+  DoLinkLayerInit(true, true, 0, 0, 0, true);
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42, 0x03, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b, 0x03, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // should handle both the response and the request within a piggyback packet
+  SEND_REQUEST(0xbb);
+  EXPECT_AND_CLEAR_SENT_DATA(0x12, 0x42, 0xbb);
+  RECEIVE_HANDLE_DATA(0x19, 0x42, 0x01, 0x00, 0x0c, 0xbb, 0xcc);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xbb);
+  EXPECT_TRUE(m_sent_data.empty());
+  sonar_link_layer_flush(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0c, 0xcc);
+
+  // should reject piggyback packets with an invalid response length
+  RECEIVE_HANDLE_DATA(0x19, 0x43, 0x05, 0x00, 0x0d, 0xbb);
+  EXPECT_NO_RESPONSE();
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_ERRORS(1, 0, 0, 0);
+}
+
+TEST_F(LinkLayerServerTest, PiggybackNotNegotiated) {
+  // should respond to a version 3 connection request with version 2 if piggybacking isn't enabled
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42, 0x03, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b, 0x02, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // should respond right away and reject piggyback packets
+  RECEIVE_HANDLE_DATA(0x10, 0x0c, 0xcc);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0c, 0xcc);
+  RECEIVE_HANDLE_DATA(0x19, 0x42, 0x00, 0x00, 0x0d, 0xdd);
+  EXPECT_NO_RESPONSE();
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_ERRORS(0, 1, 0, 0);
+}
+
+TEST_F(LinkLayerServerTest, Aggregation) {
+  DoLinkLayerInit(true, true, 2, REQUEST_RETRY_INTERVAL_MS, REQUEST_RETRY_INTERVAL_MS, false, true, 10);
+  // should respond to a version 4 connection request on its own
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42, 0x04, 0x02);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b, 0x04, 0x02);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // the response and the next request should be combined into a single frame which is held open for the delay
+  RECEIVE_HANDLE_DATA(0x10, 0x0c, 0x01);
+  SEND_REQUEST(0xbb);
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), m_system_time_ms);
+  sonar_link_layer_flush(handle_);
+  EXPECT_EQ(sonar_link_layer_get_next_deadline_ms(handle_), m_system_time_ms + 10);
+  m_system_time_ms += 5;
+  sonar_link_layer_flush(handle_);
+  EXPECT_NE(m_sent_data.back(), 0x7e);
+  m_system_time_ms += 5;
+  sonar_link_layer_flush(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x22, 0x00, 0x03, 0x00, 0x13, 0x0c, 0x01, 0x03, 0x00, 0x12, 0x42, 0xbb);
+
+  // the peer can aggregate its response and request in the same way
+  RECEIVE_HANDLE_DATA(0x20, 0x00, 0x03, 0x00, 0x11, 0x42, 0xbb, 0x03, 0x00, 0x10, 0x0d, 0x02);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xbb);
+  sonar_link_layer_flush(handle_);
+  m_system_time_ms += 10;
+  sonar_link_layer_flush(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x22, 0x00, 0x03, 0x00, 0x13, 0x0d, 0x02);
+  EXPECT_NO_RESPONSE();
+}
+
+TEST_F(LinkLayerClientTest, AggregationNotNegotiated) {
+  DoLinkLayerInit(false, true, 0, 0, 0, false, true);
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00, 0x04, 0x01);
+  // should fall back to sending packets on their own if the server responds with an older version
+  RECEIVE_HANDLE_DATA(0x17, 0x01, 0x03, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  RECEIVE_HANDLE_DATA(0x12, 0x00, 0x77);
+  EXPECT_AND_CLEAR_SENT_DATA(0x11, 0x00, 0x77);
+  SEND_REQUEST(0xaa);
+  EXPECT_AND_CLEAR_SENT_DATA(0x10, 0x02, 0xaa);
+  RECEIVE_HANDLE_DATA(0x13, 0x02, 0xaa);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xaa);
+  EXPECT_NO_RESPONSE();
+}
+
+TEST_F(LinkLayerClientTest, Cobs) {
+  DoLinkLayerInit(false, true, 0, 0, 0, false, false, 0, true);
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00, 0x05, 0x01, 0x01);
+  RECEIVE_HANDLE_DATA(0x17, 0x01, 0x05, 0x01, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // everything after the connection response should be COBS-encoded
+  SEND_REQUEST(0xaa, 0x00);
+  EXPECT_AND_CLEAR_SENT_COBS_DATA(0x10, 0x02, 0xaa, 0x00);
+  RECEIVE_HANDLE_COBS_DATA(0x13, 0x02, 0xaa, 0x00);
+  EXPECT_AND_CLEAR_RESPONSE_DATA(0xaa, 0x00);
+  RECEIVE_HANDLE_COBS_DATA(0x12, 0x00, 0x7e, 0x00);
+  EXPECT_AND_CLEAR_SENT_COBS_DATA(0x11, 0x00, 0x7e, 0x00);
+
+  // HDLC frames should no longer be understood
+  RECEIVE_HANDLE_DATA(0x12, 0x01, 0x77);
+  EXPECT_TRUE(m_sent_data.empty());
+  EXPECT_NO_RESPONSE();
+
+  // should go back to HDLC once disconnected
+  m_system_time_ms += CONNECTION_TIMEOUT_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x03, 0xe8, 0x05, 0x01, 0x01);
+  EXPECT_NO_RESPONSE();
+}
+
+TEST_F(LinkLayerServerTest, CobsLostConnectionResponse) {
+  DoLinkLayerInit(true, true, 0, 0, 0, false, false, 0, true);
+  RECEIVE_HANDLE_DATA(0x14, 0x0c, 0x42, 0x05, 0x01, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0c, 0x05, 0x01, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // if the connection response is lost, the client retries the connection request with HDLC, which should still be
+  // understood
+  RECEIVE_HANDLE_DATA(0x14, 0x0c, 0x42, 0x05, 0x01, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0c, 0x05, 0x01, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  m_num_connected_callbacks = 0;
+
+  // once the client sends COBS frames, other HDLC frames are no longer understood
+  RECEIVE_HANDLE_COBS_DATA(0x10, 0x0d, 0xaa);
+  EXPECT_AND_CLEAR_SENT_COBS_DATA(0x13, 0x0d, 0xaa);
+  RECEIVE_HANDLE_DATA(0x10, 0x0e, 0xbb);
+  EXPECT_TRUE(m_sent_data.empty());
+}
+
+TEST_F(LinkLayerServerTest, CobsClientReset) {
+  DoLinkLayerInit(true, true, 0, 0, 0, false, false, 0, true);
+  RECEIVE_HANDLE_DATA(0x14, 0x0c, 0x42, 0x05, 0x01, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0c, 0x05, 0x01, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+  RECEIVE_HANDLE_COBS_DATA(0x10, 0x0d, 0xaa);
+  EXPECT_AND_CLEAR_SENT_COBS_DATA(0x13, 0x0d, 0xaa);
+
+  // a client which is reset partway through the session starts over with an HDLC connection request, which should
+  // be understood right away rather than once the connection times out
+  RECEIVE_HANDLE_DATA(0x14, 0x03, 0xe8, 0x05, 0x01, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x03, 0x05, 0x01, 0x01);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  m_num_connected_callbacks = 0;
+
+  // and the new session switches to COBS again
+  RECEIVE_HANDLE_COBS_DATA(0x10, 0x04, 0xbb);
+  EXPECT_AND_CLEAR_SENT_COBS_DATA(0x13, 0x04, 0xbb);
+}
+
+TEST_F(LinkLayerServerTest, Compression) {
+  DoLinkLayerInit(true, true, 0, 0, 0, false, false, 0, false, true);
+  EXPECT_FALSE(sonar_link_layer_is_compression_enabled(handle_));
+
+  // compression isn't used if the client doesn't request it
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42, 0x05, 0x01, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b, 0x05, 0x01, 0x00);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_FALSE(sonar_link_layer_is_compression_enabled(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // but is once the client reconnects with it
+  RECEIVE_HANDLE_DATA(0x14, 0x0c, 0x20, 0x05, 0x01, 0x03);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0c, 0x05, 0x01, 0x02);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_TRUE(sonar_link_layer_is_compression_enabled(handle_));
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  m_num_connected_callbacks = 0;
+}
+
+TEST_F(LinkLayerServerTest, Fragmentation) {
+  DoLinkLayerInit(true, true, 0, 0, 0, false, false, 0, false, false, true);
+
+  // fragmentation isn't used if the client doesn't send its receive size
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42, 0x05, 0x01, 0x04);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b, 0x05, 0x01, 0x00);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(sonar_link_layer_get_max_packet_size(handle_), 0);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // but is once the client reconnects with it, with packets sized to fit the client's receive buffer
+  RECEIVE_HANDLE_DATA(0x14, 0x0c, 0x20, 0x06, 0x01, 0x04, 0x40, 0x00);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0c, 0x06, 0x01, 0x04, 0x00, 0x04);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(sonar_link_layer_get_max_packet_size(handle_), 0x40 - SONAR_LINK_LAYER_PACKET_OVERHEAD);
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  m_num_connected_callbacks = 0;
+}
+
+TEST_F(LinkLayerClientTest, Fragmentation) {
+  DoLinkLayerInit(false, true, 0, 0, 0, false, false, 0, false, false, true);
+  sonar_link_layer_process(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x01, 0x00, 0x06, 0x01, 0x04, 0x00, 0x04);
+
+  // a server which doesn't send its receive size doesn't get fragments
+  RECEIVE_HANDLE_DATA(0x17, 0x01, 0x05, 0x01, 0x04);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(sonar_link_layer_get_max_packet_size(handle_), 0);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // reconnect to one which does
+  m_system_time_ms += CONNECTION_TIMEOUT_MS;
+  sonar_link_layer_process(handle_);
+  EXPECT_EQ(m_num_disconnected_callbacks, 1);
+  m_num_disconnected_callbacks = 0;
+  EXPECT_AND_CLEAR_SENT_DATA(0x14, 0x02, 0xe8, 0x06, 0x01, 0x04, 0x00, 0x04);
+  RECEIVE_HANDLE_DATA(0x17, 0x02, 0x06, 0x01, 0x04, 0x40, 0x00);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(sonar_link_layer_get_max_packet_size(handle_), 0x40 - SONAR_LINK_LAYER_PACKET_OVERHEAD);
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+}
+
+TEST_F(LinkLayerServerTest, CobsNotNegotiated) {
+  // should respond to a version 5 connection request with the features which are enabled on both sides (none)
+  RECEIVE_HANDLE_DATA(0x14, 0x0b, 0x42, 0x05, 0x01, 0x01);
+  EXPECT_AND_CLEAR_SENT_DATA(0x17, 0x0b, 0x02, 0x01, 0x00);
+  ASSERT_TRUE(sonar_link_layer_is_connected(handle_));
+  EXPECT_EQ(m_num_connected_callbacks, 1);
+  m_num_connected_callbacks = 0;
+
+  // and then continue to use HDLC
+  RECEIVE_HANDLE_DATA(0x10, 0x0c, 0x00);
+  EXPECT_AND_CLEAR_SENT_DATA(0x13, 0x0c, 0x00);
+  EXPECT_NO_RESPONSE();
+}
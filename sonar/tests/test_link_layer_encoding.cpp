@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+
+#include "src/link_layer/encoding.h"
+#include "src/link_layer/receive.h"
+#include "src/link_layer/transmit.h"
+#include "src/link_layer/types.h"
+
+};
+
+#include <algorithm>
+
+static uint32_t find_special_reference(const uint8_t* data, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    if (data[i] == 0x7e || data[i] == 0x7d) {
+      return i;
+    }
+  }
+  return length;
+}
+
+TEST(LinkLayerEncodingTest, FindSpecialNone) {
+  EXPECT_EQ(sonar_link_layer_encoding_find_special(nullptr, 0), 0);
+  EXPECT_EQ(sonar_link_layer_encoding_find_special_portable(nullptr, 0), 0);
+  uint8_t data[100];
+  memset(data, 0x7c, sizeof(data));
+  EXPECT_EQ(sonar_link_layer_encoding_find_special(data, sizeof(data)), sizeof(data));
+  EXPECT_EQ(sonar_link_layer_encoding_find_special_portable(data, sizeof(data)), sizeof(data));
+}
+
+TEST(LinkLayerEncodingTest, FindSpecialPosition) {
+  // place a single special byte at every position of every length (and alignment)
+  static uint8_t buffer[128 + 8];
+  const uint8_t special_bytes[] = {0x7e, 0x7d};
+  for (uint8_t special_byte : special_bytes) {
+    for (uint32_t offset = 0; offset < 8; offset++) {
+      uint8_t* data = &buffer[offset];
+      for (uint32_t length = 1; length <= 128; length++) {
+        for (uint32_t pos = 0; pos < length; pos++) {
+          memset(buffer, 0xff, sizeof(buffer));
+          data[pos] = special_byte;
+          EXPECT_EQ(sonar_link_layer_encoding_find_special(data, length), pos);
+          EXPECT_EQ(sonar_link_layer_encoding_find_special_portable(data, length), pos);
+        }
+      }
+    }
+  }
+}
+
+TEST(LinkLayerEncodingTest, FindSpecialRandom) {
+  // random data which is biased towards values near the special bytes
+  static uint8_t data[256];
+  for (int iteration = 0; iteration < 1000; iteration++) {
+    for (size_t i = 0; i < sizeof(data); i++) {
+      data[i] = (rand() % 64) ? (0x7b + rand() % 2) | ((rand() % 2) << 7) : (0x7d + rand() % 2);
+    }
+    const uint32_t length = rand() % sizeof(data);
+    const uint32_t expected = find_special_reference(data, length);
+    EXPECT_EQ(sonar_link_layer_encoding_find_special(data, length), expected);
+    EXPECT_EQ(sonar_link_layer_encoding_find_special_portable(data, length), expected);
+  }
+}
+
+static std::vector<uint8_t> m_cobs_sent_data;
+static std::vector<std::vector<uint8_t>> m_cobs_received_packets;
+
+static void cobs_write_bytes_function(const uint8_t* data, uint32_t length) {
+  m_cobs_sent_data.insert(m_cobs_sent_data.end(), data, data + length);
+}
+
+static void cobs_packet_handler(void* handle, bool is_response, bool is_link_control, bool is_piggyback, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
+  m_cobs_received_packets.emplace_back(data, data + length);
+}
+
+TEST(LinkLayerEncodingTest, CobsRoundTrip) {
+  // packets of every length up to a few blocks with a varying density of zero bytes should survive encoding and
+  // decoding, with the encoding never being bigger than the worst case
+  static uint8_t transmit_buffer[1024];
+  static uint8_t receive_buffer[1024];
+  static sonar_link_layer_transmit_context_t transmit_context;
+  static sonar_link_layer_receive_context_t receive_context;
+  const sonar_link_layer_transmit_init_t transmit_init = {
+    .is_server = true,
+    .write_byte_function = NULL,
+    .write_bytes_function = cobs_write_bytes_function,
+    .buffer = transmit_buffer,
+    .buffer_size = sizeof(transmit_buffer),
+  };
+  sonar_link_layer_transmit_init(&transmit_context, &transmit_init);
+  sonar_link_layer_transmit_set_cobs(&transmit_context, true);
+  const sonar_link_layer_receive_init_t receive_init = {
+    .is_server = false,
+    .buffer = receive_buffer,
+    .buffer_size = sizeof(receive_buffer),
+    .packet_handler = cobs_packet_handler,
+    .handler_handle = NULL,
+  };
+  sonar_link_layer_receive_init(&receive_context, &receive_init);
+  sonar_link_layer_receive_set_cobs(&receive_context, true);
+
+  static uint8_t data[800];
+  for (uint32_t length = 0; length <= sizeof(data); length++) {
+    const int zero_interval = 1 + rand() % 300;
+    for (uint32_t i = 0; i < length; i++) {
+      data[i] = (rand() % zero_interval) ? 1 + rand() % 0xff : 0;
+    }
+    buffer_chain_entry_t entry = {};
+    buffer_chain_set_data(&entry, data, length);
+    m_cobs_sent_data.clear();
+    sonar_link_layer_transmit_send_packet(&transmit_context, false, false, 0, &entry);
+    EXPECT_LE(m_cobs_sent_data.size(), SONAR_ENCODING_COBS_MAX_FRAME_SIZE(length + 4));
+    EXPECT_EQ(std::count(m_cobs_sent_data.begin(), m_cobs_sent_data.end(), 0), 2);
+
+    m_cobs_received_packets.clear();
+    sonar_link_layer_receive_process_data(&receive_context, m_cobs_sent_data.data(), m_cobs_sent_data.size());
+    ASSERT_EQ(m_cobs_received_packets.size(), 1);
+    EXPECT_EQ(m_cobs_received_packets[0], std::vector<uint8_t>(data, data + length));
+  }
+  sonar_link_layer_receive_errors_t errors = {};
+  sonar_link_layer_receive_get_and_clear_errors(&receive_context, &errors);
+  EXPECT_EQ(errors.invalid_header, 0);
+  EXPECT_EQ(errors.invalid_crc, 0);
+}
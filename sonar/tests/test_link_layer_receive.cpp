@@ -4,6 +4,7 @@
 
 extern "C" {
 
+#include "src/common/crc16.h"
 #include "src/link_layer/receive.h"
 
 };
@@ -45,13 +46,17 @@ extern "C" {
 static std::vector<uint8_t> m_received_data;
 static bool m_received_is_response;
 static bool m_received_is_link_control;
+static bool m_received_is_piggyback;
 static uint8_t m_received_sequence_num;
+static const uint8_t* m_received_data_ptr;
 static int m_num_received_packets = 0;
 
-static void link_layer_receive_packet_handler(void* handle, bool is_response, bool is_link_control, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
+static void link_layer_receive_packet_handler(void* handle, bool is_response, bool is_link_control, bool is_piggyback, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
   m_received_is_response = is_response;
   m_received_is_link_control = is_link_control;
+  m_received_is_piggyback = is_piggyback;
   m_received_sequence_num = sequence_num;
+  m_received_data_ptr = data;
   m_received_data.insert(m_received_data.end(), data, data + length);
   m_num_received_packets++;
 }
@@ -189,6 +194,74 @@ TEST_F(LinkLayerReceiveClientTest, EncodingEscaped) {
   EXPECT_ERRORS(0, 0, 0, 0);
 }
 
+TEST_F(LinkLayerReceiveClientTest, SplitAcrossCalls) {
+  // the packet should be received regardless of where it's split (i.e. within the escaped data or CRC)
+  const uint8_t buffer[] = {0x7e, 0x17, 0x0b, 0x7d, 0x5e, 0x7d, 0x5d, 0x5e, 0x5d, 0xb4, 0xec, 0x7e};
+  for (uint32_t split = 1; split < sizeof(buffer); split++) {
+    sonar_link_layer_receive_process_data(handle_, buffer, split);
+    sonar_link_layer_receive_process_data(handle_, &buffer[split], sizeof(buffer) - split);
+    EXPECT_AND_CLEAR_RECEIVED_PACKET(true, true, 11, 0x7e, 0x7d, 0x5e, 0x5d);
+  }
+  EXPECT_ERRORS(0, 0, 0, 0);
+}
+
+TEST_F(LinkLayerReceiveClientTest, InPlace) {
+  // packets which are entirely within the received data and don't contain any escaped bytes are handled in place
+  const uint8_t buffer[] = {0x7e, 0x17, 0x0b, 0x11, 0x22, 0xd9, 0x0a, 0x7e, 0x17, 0x0b, 0x33, 0x44, 0x3d, 0x66, 0x7e};
+  sonar_link_layer_receive_process_data(handle_, buffer, sizeof(buffer));
+  EXPECT_EQ(m_received_data_ptr, &buffer[10]);
+  EXPECT_EQ(m_num_received_packets, 2);
+  const uint8_t expected_data[] = {0x11, 0x22, 0x33, 0x44};
+  EXPECT_TRUE(DataMatches(m_received_data, expected_data, sizeof(expected_data)));
+  m_received_data.clear();
+  m_num_received_packets = 0;
+
+  // packets which contain escaped bytes are copied into the receive buffer
+  const uint8_t escaped_buffer[] = {0x7e, 0x17, 0x0b, 0x7d, 0x5e, 0x7d, 0x5d, 0x5e, 0x5d, 0xb4, 0xec, 0x7e};
+  sonar_link_layer_receive_process_data(handle_, escaped_buffer, sizeof(escaped_buffer));
+  EXPECT_TRUE(m_received_data_ptr < escaped_buffer || m_received_data_ptr >= escaped_buffer + sizeof(escaped_buffer));
+  EXPECT_AND_CLEAR_RECEIVED_PACKET(true, true, 11, 0x7e, 0x7d, 0x5e, 0x5d);
+
+  // as are packets which are split across calls
+  sonar_link_layer_receive_process_data(handle_, buffer, 4);
+  sonar_link_layer_receive_process_data(handle_, &buffer[4], 4);
+  EXPECT_TRUE(m_received_data_ptr < buffer || m_received_data_ptr >= buffer + sizeof(buffer));
+  EXPECT_AND_CLEAR_RECEIVED_PACKET(true, true, 11, 0x11, 0x22);
+  EXPECT_ERRORS(0, 0, 0, 0);
+}
+
+TEST_F(LinkLayerReceiveServerTest, Cobs) {
+  sonar_link_layer_receive_set_cobs(handle_, true);
+  const uint8_t buffer[] = {0x00, 0x04, 0x10, 0x0b, 0x11, 0x04, 0x22, 0x3a, 0x7b, 0x00};
+  for (uint32_t split = 1; split < sizeof(buffer); split++) {
+    sonar_link_layer_receive_process_data(handle_, buffer, split);
+    sonar_link_layer_receive_process_data(handle_, &buffer[split], sizeof(buffer) - split);
+    EXPECT_AND_CLEAR_RECEIVED_PACKET(false, false, 11, 0x11, 0x00, 0x22);
+  }
+
+  // frames can share delimiters, and flag / escape bytes have no special meaning
+  RECEIVE_HANDLE_DATA_RAW(0x03, 0x10, 0x0b, 0x01, 0x03, 0x96, 0x6f, 0x00);
+  EXPECT_AND_CLEAR_RECEIVED_PACKET(false, false, 11, 0x00, 0x00);
+
+  // a frame which ends within a block should be dropped
+  RECEIVE_HANDLE_DATA_RAW(0x00, 0x05, 0x10, 0x0b, 0x00);
+  EXPECT_EQ(m_num_received_packets, 0);
+  EXPECT_ERRORS(0, 0, 0, 1);
+
+  // a frame which overflows the buffer should be dropped without affecting the next one
+  RECEIVE_HANDLE_DATA_RAW(0x00, 0x0e, 0x10, 0x0b, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x00);
+  EXPECT_EQ(m_num_received_packets, 0);
+  EXPECT_ERRORS(0, 0, 1, 0);
+  RECEIVE_HANDLE_DATA_RAW(0x00, 0x03, 0x10, 0x0b, 0x01, 0x03, 0x96, 0x6f, 0x00);
+  EXPECT_AND_CLEAR_RECEIVED_PACKET(false, false, 11, 0x00, 0x00);
+
+  // switching back should go back to HDLC decoding
+  sonar_link_layer_receive_set_cobs(handle_, false);
+  RECEIVE_HANDLE_DATA(0x10, 0x0b, 0x11, 0x22);
+  EXPECT_AND_CLEAR_RECEIVED_PACKET(false, false, 11, 0x11, 0x22);
+  EXPECT_ERRORS(0, 0, 0, 0);
+}
+
 TEST_F(LinkLayerReceiveServerTest, InvalidCRC) {
   // request, client->server, normal, no data
   RECEIVE_HANDLE_DATA_RAW(0x7e, 0x10, 0x0b, 0x00, 0x00, 0x7e);
@@ -209,10 +282,26 @@ TEST_F(LinkLayerReceiveServerTest, InvalidFlags) {
   EXPECT_EQ(m_num_received_packets, 0);
   EXPECT_ERRORS(1, 0, 0, 0);
 
-  // reserved bit
+  // piggyback bit on a request
   RECEIVE_HANDLE_DATA(0x18, 0x0b);
   EXPECT_EQ(m_num_received_packets, 0);
   EXPECT_ERRORS(1, 0, 0, 0);
+
+  // piggyback bit on a link control response
+  RECEIVE_HANDLE_DATA(0x1d, 0x0b);
+  EXPECT_EQ(m_num_received_packets, 0);
+  EXPECT_ERRORS(1, 0, 0, 0);
+
+  // piggyback bit on a response
+  RECEIVE_HANDLE_DATA(0x19, 0x0b, 0x01, 0x00, 0x0c, 0xaa, 0xbb);
+  EXPECT_EQ(m_num_received_packets, 1);
+  EXPECT_TRUE(m_received_is_response);
+  EXPECT_FALSE(m_received_is_link_control);
+  EXPECT_TRUE(m_received_is_piggyback);
+  EXPECT_EQ(m_received_sequence_num, 0x0b);
+  m_received_data.clear();
+  m_num_received_packets = 0;
+  EXPECT_ERRORS(0, 0, 0, 0);
 }
 
 TEST_F(LinkLayerReceiveServerTest, InvalidSize) {
@@ -301,3 +390,141 @@ TEST_F(LinkLayerReceiveServerTest, DecodingError) {
   EXPECT_AND_CLEAR_RECEIVED_PACKET(false, false, 11);
   EXPECT_ERRORS(0, 0, 0, 1);
 }
+
+typedef struct {
+  std::vector<std::vector<uint8_t>> packets;
+} received_packets_t;
+
+static void link_layer_receive_record_packet_handler(void* handle, bool is_response, bool is_link_control, bool is_piggyback, uint8_t sequence_num, const uint8_t* data, uint32_t length) {
+  received_packets_t* received = (received_packets_t*)handle;
+  std::vector<uint8_t> packet = {is_response, is_link_control, sequence_num};
+  packet.insert(packet.end(), data, data + length);
+  received->packets.push_back(packet);
+}
+
+TEST(LinkLayerReceiveBulkTest, MatchesBytewise) {
+  // a mix of valid packets, packets which overflow the buffer, invalid escapes, and random data should all be handled
+  // identically regardless of how the data is split up
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < 300; i++) {
+    const int type = rand() % 4;
+    if (type == 0 || type == 1) {
+      // valid packet with some escaped data
+      std::vector<uint8_t> packet = {0x10, (uint8_t)i};
+      const int data_length = rand() % (type == 0 ? 8 : 32);
+      for (int j = 0; j < data_length; j++) {
+        packet.push_back((rand() % 4) ? rand() : (0x7d + rand() % 2));
+      }
+      const uint16_t crc = crc16(packet.data(), packet.size(), CRC16_INITIAL_VALUE);
+      packet.push_back(crc & 0xff);
+      packet.push_back(crc >> 8);
+      stream.push_back(0x7e);
+      for (uint8_t byte : packet) {
+        if (byte == 0x7e || byte == 0x7d) {
+          stream.push_back(0x7d);
+          stream.push_back(byte ^ 0x20);
+        } else {
+          stream.push_back(byte);
+        }
+      }
+      stream.push_back(0x7e);
+    } else {
+      // random data biased towards special bytes
+      const int data_length = rand() % 32;
+      for (int j = 0; j < data_length; j++) {
+        stream.push_back((rand() % 8) ? rand() : (0x7d + rand() % 2));
+      }
+    }
+  }
+
+  received_packets_t received_bytewise;
+  received_packets_t received_bulk;
+  sonar_link_layer_receive_errors_t errors_bytewise = {};
+  sonar_link_layer_receive_errors_t errors_bulk = {};
+  static sonar_link_layer_receive_context_t context_bytewise;
+  static sonar_link_layer_receive_context_t context_bulk;
+  static uint8_t receive_buffer_bytewise[24];
+  static uint8_t receive_buffer_bulk[24];
+  sonar_link_layer_receive_init_t init_link_layer = {
+    .is_server = true,
+    .buffer = receive_buffer_bytewise,
+    .buffer_size = sizeof(receive_buffer_bytewise),
+    .packet_handler = link_layer_receive_record_packet_handler,
+    .handler_handle = &received_bytewise,
+  };
+  sonar_link_layer_receive_init(&context_bytewise, &init_link_layer);
+  init_link_layer.buffer = receive_buffer_bulk;
+  init_link_layer.handler_handle = &received_bulk;
+  sonar_link_layer_receive_init(&context_bulk, &init_link_layer);
+
+  for (uint8_t byte : stream) {
+    sonar_link_layer_receive_process_data(&context_bytewise, &byte, 1);
+  }
+  size_t offset = 0;
+  while (offset < stream.size()) {
+    const size_t chunk_length = std::min<size_t>(rand() % 200, stream.size() - offset);
+    sonar_link_layer_receive_process_data(&context_bulk, &stream[offset], chunk_length);
+    offset += chunk_length;
+  }
+
+  sonar_link_layer_receive_get_and_clear_errors(&context_bytewise, &errors_bytewise);
+  sonar_link_layer_receive_get_and_clear_errors(&context_bulk, &errors_bulk);
+  EXPECT_GT(received_bytewise.packets.size(), 0);
+  EXPECT_GT(errors_bytewise.buffer_overflow, 0);
+  EXPECT_GT(errors_bytewise.invalid_escape_sequence, 0);
+  EXPECT_EQ(received_bulk.packets, received_bytewise.packets);
+  EXPECT_EQ(errors_bulk.invalid_header, errors_bytewise.invalid_header);
+  EXPECT_EQ(errors_bulk.invalid_crc, errors_bytewise.invalid_crc);
+  EXPECT_EQ(errors_bulk.buffer_overflow, errors_bytewise.buffer_overflow);
+  EXPECT_EQ(errors_bulk.invalid_escape_sequence, errors_bytewise.invalid_escape_sequence);
+}
+
+TEST(LinkLayerReceiveAggregateTest, Split) {
+  received_packets_t received;
+  static sonar_link_layer_receive_context_t context;
+  static uint8_t receive_buffer[24];
+  const sonar_link_layer_receive_init_t init_link_layer = {
+    .is_server = true,
+    .buffer = receive_buffer,
+    .buffer_size = sizeof(receive_buffer),
+    .packet_handler = link_layer_receive_record_packet_handler,
+    .handler_handle = &received,
+  };
+  sonar_link_layer_receive_init(&context, &init_link_layer);
+  sonar_link_layer_receive_errors_t errors = {};
+
+  // an aggregate frame containing a request, a link control request, and another request
+  {
+    BUILD_PACKET_BUFFER(buffer, 0x20, 0x00, 0x04, 0x00, 0x10, 0x0b, 0x11, 0x22, 0x02, 0x00, 0x14, 0x0c, 0x03, 0x00, 0x10, 0x0d, 0x33);
+    sonar_link_layer_receive_process_data(&context, buffer, sizeof(buffer));
+  }
+  const std::vector<std::vector<uint8_t>> expected = {{0, 0, 11, 0x11, 0x22}, {0, 1, 12}, {0, 0, 13, 0x33}};
+  EXPECT_EQ(received.packets, expected);
+  received.packets.clear();
+  sonar_link_layer_receive_get_and_clear_errors(&context, &errors);
+  EXPECT_EQ(errors.invalid_header, 0);
+  EXPECT_EQ(errors.invalid_crc, 0);
+
+  // packets within the frame which are going in the wrong direction should be dropped
+  {
+    BUILD_PACKET_BUFFER(buffer, 0x20, 0x00, 0x02, 0x00, 0x13, 0x0e, 0x03, 0x00, 0x10, 0x0f, 0x44);
+    sonar_link_layer_receive_process_data(&context, buffer, sizeof(buffer));
+  }
+  const std::vector<std::vector<uint8_t>> expected_direction = {{0, 0, 15, 0x44}};
+  EXPECT_EQ(received.packets, expected_direction);
+  received.packets.clear();
+  sonar_link_layer_receive_get_and_clear_errors(&context, &errors);
+  EXPECT_EQ(errors.invalid_header, 1);
+
+  // a bad length should stop processing the rest of the frame
+  {
+    BUILD_PACKET_BUFFER(buffer, 0x20, 0x00, 0x03, 0x00, 0x10, 0x10, 0x55, 0x09, 0x00, 0x10, 0x11);
+    sonar_link_layer_receive_process_data(&context, buffer, sizeof(buffer));
+  }
+  const std::vector<std::vector<uint8_t>> expected_length = {{0, 0, 16, 0x55}};
+  EXPECT_EQ(received.packets, expected_length);
+  received.packets.clear();
+  sonar_link_layer_receive_get_and_clear_errors(&context, &errors);
+  EXPECT_EQ(errors.invalid_header, 1);
+  EXPECT_EQ(errors.invalid_crc, 0);
+}
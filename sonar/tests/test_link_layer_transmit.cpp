@@ -4,6 +4,7 @@
 
 extern "C" {
 
+#include "src/common/crc16.h"
 #include "src/link_layer/transmit.h"
 
 };
@@ -21,12 +22,28 @@ extern "C" {
     m_transmit_sent_data.clear(); \
   } while (0)
 
+#define EXPECT_AND_CLEAR_WRITE_CALLS(NUM_CALLS) do { \
+    EXPECT_EQ(m_transmit_num_write_calls, NUM_CALLS); \
+    m_transmit_num_write_calls = 0; \
+  } while (0)
+
 static std::vector<uint8_t> m_transmit_sent_data;
+static int m_transmit_num_write_calls;
 
 static void link_layer_transmit_write_byte_function(uint8_t byte) {
   m_transmit_sent_data.push_back(byte);
 }
 
+static void link_layer_transmit_write_bytes_function(const uint8_t* data, uint32_t length) {
+  m_transmit_sent_data.insert(m_transmit_sent_data.end(), data, data + length);
+  m_transmit_num_write_calls++;
+}
+
+static void link_layer_transmit_start_tx_function(const uint8_t* data, uint32_t length) {
+  m_transmit_sent_data.insert(m_transmit_sent_data.end(), data, data + length);
+  m_transmit_num_write_calls++;
+}
+
 class LinkLayerTransmitTest : public ::testing::Test {
  protected:
   void DoLinkLayerTransmitInit(bool is_server) {
@@ -39,12 +56,47 @@ class LinkLayerTransmitTest : public ::testing::Test {
     sonar_link_layer_transmit_init(handle_, &init_link_layer);
   }
 
+  void DoLinkLayerTransmitBulkInit(uint32_t buffer_size, uint32_t max_frame_size = 0) {
+    static sonar_link_layer_transmit_context_t context;
+    static uint8_t buffer[64];
+    const sonar_link_layer_transmit_init_t init_link_layer = {
+      .is_server = false,
+      .write_byte_function = NULL,
+      .write_bytes_function = link_layer_transmit_write_bytes_function,
+      .buffer = buffer,
+      .buffer_size = buffer_size,
+      .max_frame_size = max_frame_size,
+    };
+    handle_ = &context;
+    sonar_link_layer_transmit_init(handle_, &init_link_layer);
+  }
+
+  void DoLinkLayerTransmitRingInit(uint32_t ring_size, uint32_t buffer_size = 0) {
+    static sonar_link_layer_transmit_context_t context;
+    static uint8_t buffer[64];
+    static uint8_t ring[64];
+    const sonar_link_layer_transmit_init_t init_link_layer = {
+      .is_server = false,
+      .write_byte_function = NULL,
+      .write_bytes_function = NULL,
+      .buffer = buffer,
+      .buffer_size = buffer_size,
+      .start_tx_function = link_layer_transmit_start_tx_function,
+      .ring = ring,
+      .ring_size = ring_size,
+    };
+    handle_ = &context;
+    sonar_link_layer_transmit_init(handle_, &init_link_layer);
+  }
+
   void SetUp() override {
     m_transmit_sent_data.clear();
+    m_transmit_num_write_calls = 0;
   }
 
   void TearDown() override {
     EXPECT_TRUE(m_transmit_sent_data.empty());
+    EXPECT_EQ(m_transmit_num_write_calls, 0);
   }
 
   sonar_link_layer_transmit_handle_t handle_;
@@ -143,3 +195,246 @@ TEST_F(LinkLayerTransmitClientTest, EncodingEscape) {
   TRANSMIT_PACKET(false, false, 11, 0x11, 0x7e, 0x22, 0x7e, 0x33);
   EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x7d, 0x5e, 0x22, 0x7d, 0x5e, 0x33, 0xf3, 0x8e, 0x7e);
 }
+
+TEST_F(LinkLayerTransmitTest, BulkWrite) {
+  DoLinkLayerTransmitBulkInit(64);
+
+  // request, client->server, normal, 1 byte of data (written with a single call)
+  TRANSMIT_PACKET(false, false, 11, 0x42);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x42, 0x83, 0x3b, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // escaped data (written with a single call)
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x7e, 0x22, 0x7e, 0x33);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x7d, 0x5e, 0x22, 0x7d, 0x5e, 0x33, 0xf3, 0x8e, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+}
+
+TEST_F(LinkLayerTransmitTest, BulkWriteSmallBuffer) {
+  // the encoded packet is 13 bytes, so should be split across multiple calls
+  DoLinkLayerTransmitBulkInit(4);
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x7e, 0x22, 0x7e, 0x33);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x7d, 0x5e, 0x22, 0x7d, 0x5e, 0x33, 0xf3, 0x8e, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(4);
+}
+
+TEST_F(LinkLayerTransmitTest, BulkWriteNoBuffer) {
+  // without a staging buffer, the data should be written directly
+  DoLinkLayerTransmitBulkInit(0);
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x7e, 0x22, 0x7e, 0x33);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x7d, 0x5e, 0x22, 0x7d, 0x5e, 0x33, 0xf3, 0x8e, 0x7e);
+  EXPECT_GT(m_transmit_num_write_calls, 1);
+  m_transmit_num_write_calls = 0;
+}
+
+TEST_F(LinkLayerTransmitTest, LongRunsWithEscapes) {
+  // long runs of data with occasional bytes which need escaping (including back-to-back and at the ends)
+  DoLinkLayerTransmitBulkInit(64);
+  std::vector<uint8_t> payload;
+  for (int i = 0; i < 200; i++) {
+    payload.push_back((i % 37 == 0 || i == 38 || i == 199) ? (0x7d + (i % 2)) : (uint8_t)i);
+  }
+  buffer_chain_entry_t data = {};
+  buffer_chain_set_data(&data, payload.data(), payload.size());
+  sonar_link_layer_transmit_send_packet(handle_, false, false, 11, &data);
+
+  // build the expected output byte-by-byte
+  std::vector<uint8_t> unencoded = {0x10, 0x0b};
+  unencoded.insert(unencoded.end(), payload.begin(), payload.end());
+  const uint16_t crc = crc16(unencoded.data(), unencoded.size(), CRC16_INITIAL_VALUE);
+  unencoded.push_back(crc & 0xff);
+  unencoded.push_back(crc >> 8);
+  std::vector<uint8_t> expected = {0x7e};
+  for (uint8_t byte : unencoded) {
+    if (byte == 0x7e || byte == 0x7d) {
+      expected.push_back(0x7d);
+      expected.push_back(byte ^ 0x20);
+    } else {
+      expected.push_back(byte);
+    }
+  }
+  expected.push_back(0x7e);
+  EXPECT_TRUE(DataMatches(m_transmit_sent_data, expected.data(), expected.size()));
+  m_transmit_sent_data.clear();
+  m_transmit_num_write_calls = 0;
+}
+
+TEST_F(LinkLayerTransmitTest, Cached) {
+  DoLinkLayerTransmitBulkInit(64);
+  static uint8_t cache_buffer[16];
+  sonar_link_layer_transmit_cache_t cache = {
+    .buffer = cache_buffer,
+    .size = sizeof(cache_buffer),
+  };
+
+  // nothing cached yet
+  EXPECT_FALSE(sonar_link_layer_transmit_resend_cached(handle_, &cache));
+
+  // send a packet and then resend it from the cache
+  const uint8_t data_buffer[] = {0x11, 0x7e, 0x22, 0x7e, 0x33};
+  buffer_chain_entry_t data = {};
+  buffer_chain_set_data(&data, data_buffer, sizeof(data_buffer));
+  sonar_link_layer_transmit_send_packet_cached(handle_, &cache, false, false, 11, &data);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x7d, 0x5e, 0x22, 0x7d, 0x5e, 0x33, 0xf3, 0x8e, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  EXPECT_TRUE(sonar_link_layer_transmit_resend_cached(handle_, &cache));
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x7d, 0x5e, 0x22, 0x7d, 0x5e, 0x33, 0xf3, 0x8e, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // a packet which doesn't fit in the cache shouldn't be cached
+  const uint8_t large_data_buffer[16] = {0};
+  buffer_chain_set_data(&data, large_data_buffer, sizeof(large_data_buffer));
+  sonar_link_layer_transmit_send_packet_cached(handle_, &cache, false, false, 12, &data);
+  EXPECT_EQ(m_transmit_sent_data.size(), 22);
+  m_transmit_sent_data.clear();
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  EXPECT_FALSE(sonar_link_layer_transmit_resend_cached(handle_, &cache));
+}
+
+TEST_F(LinkLayerTransmitTest, Aggregate) {
+  DoLinkLayerTransmitBulkInit(64, 16);
+  sonar_link_layer_transmit_set_aggregation(handle_, true);
+  EXPECT_FALSE(sonar_link_layer_transmit_has_aggregate(handle_));
+
+  // the packets should be combined into a single frame which isn't written until it's flushed
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x22);
+  TRANSMIT_PACKET(false, false, 12, 0x33, 0x44);
+  EXPECT_TRUE(sonar_link_layer_transmit_has_aggregate(handle_));
+  EXPECT_TRUE(m_transmit_sent_data.empty());
+
+  // the next packet doesn't fit, so the current frame should be sent and a new one started
+  TRANSMIT_PACKET(false, false, 13, 0x55);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x20, 0x00, 0x04, 0x00, 0x10, 0x0b, 0x11, 0x22, 0x04, 0x00, 0x10, 0x0c, 0x33, 0x44, 0xcf, 0xed, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  EXPECT_TRUE(sonar_link_layer_transmit_has_aggregate(handle_));
+  sonar_link_layer_transmit_flush(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x20, 0x00, 0x03, 0x00, 0x10, 0x0d, 0x55, 0x85, 0x4e, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  EXPECT_FALSE(sonar_link_layer_transmit_has_aggregate(handle_));
+
+  // packets which are too big to ever fit in an aggregate frame should be sent on their own
+  TRANSMIT_PACKET(false, false, 14, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09);
+  EXPECT_FALSE(sonar_link_layer_transmit_has_aggregate(handle_));
+  EXPECT_EQ(m_transmit_sent_data.size(), 15);
+  m_transmit_sent_data.clear();
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // disabling aggregation should flush any open frame
+  TRANSMIT_PACKET(false, false, 15, 0x55);
+  sonar_link_layer_transmit_set_aggregation(handle_, false);
+  EXPECT_FALSE(sonar_link_layer_transmit_has_aggregate(handle_));
+  EXPECT_EQ(m_transmit_sent_data.size(), 11);
+  m_transmit_sent_data.clear();
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+}
+
+TEST_F(LinkLayerTransmitTest, Cobs) {
+  DoLinkLayerTransmitBulkInit(64);
+  sonar_link_layer_transmit_set_cobs(handle_, true);
+
+  // zero bytes should end each block, and each frame should be written with a single call
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x00, 0x22);
+  EXPECT_AND_CLEAR_SENT_DATA(0x00, 0x04, 0x10, 0x0b, 0x11, 0x04, 0x22, 0x3a, 0x7b, 0x00);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  TRANSMIT_PACKET(false, false, 11, 0x00, 0x00);
+  EXPECT_AND_CLEAR_SENT_DATA(0x00, 0x03, 0x10, 0x0b, 0x01, 0x03, 0x96, 0x6f, 0x00);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // flag and escape bytes don't need escaping
+  static uint8_t cache_buffer[16];
+  sonar_link_layer_transmit_cache_t cache = {
+    .buffer = cache_buffer,
+    .size = sizeof(cache_buffer),
+  };
+  const uint8_t data_buffer[] = {0x7e, 0x7d};
+  buffer_chain_entry_t data = {};
+  buffer_chain_set_data(&data, data_buffer, sizeof(data_buffer));
+  sonar_link_layer_transmit_send_packet_cached(handle_, &cache, false, false, 11, &data);
+  EXPECT_EQ(m_transmit_sent_data.size(), 9);
+  const std::vector<uint8_t> sent = m_transmit_sent_data;
+  m_transmit_sent_data.clear();
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  EXPECT_TRUE(sonar_link_layer_transmit_resend_cached(handle_, &cache));
+  EXPECT_TRUE(DataMatches(m_transmit_sent_data, sent.data(), sent.size()));
+  m_transmit_sent_data.clear();
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // switching back should go back to HDLC encoding
+  sonar_link_layer_transmit_set_cobs(handle_, false);
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x22);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x22, 0xf4, 0x5b, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+}
+
+TEST_F(LinkLayerTransmitTest, CobsOverflow) {
+  DoLinkLayerTransmitBulkInit(9);
+  sonar_link_layer_transmit_set_cobs(handle_, true);
+
+  // a block which doesn't fit in the buffer can't be written, so the frame should be dropped (after the part of it
+  // which is already final)
+  TRANSMIT_PACKET(false, false, 11, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08);
+  EXPECT_AND_CLEAR_SENT_DATA(0x00);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // later frames which fit should be unaffected
+  TRANSMIT_PACKET(false, false, 11, 0x00, 0x00);
+  EXPECT_AND_CLEAR_SENT_DATA(0x00, 0x03, 0x10, 0x0b, 0x01, 0x03, 0x96, 0x6f, 0x00);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+}
+
+TEST_F(LinkLayerTransmitTest, Ring) {
+  DoLinkLayerTransmitRingInit(20);
+
+  // the frame should be started right away
+  TRANSMIT_PACKET(false, false, 11, 0x42);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x42, 0x83, 0x3b, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // the next frame should be queued until the first one completes
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x7e, 0x22, 0x7e, 0x33);
+  EXPECT_AND_CLEAR_WRITE_CALLS(0);
+  sonar_link_layer_transmit_complete(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x11, 0x7d, 0x5e, 0x22, 0x7d, 0x5e, 0x33, 0xf3, 0x8e, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // the ring is now full, with the next frame going at the start of it
+  TRANSMIT_PACKET(false, false, 11, 0x42);
+  EXPECT_AND_CLEAR_WRITE_CALLS(0);
+  sonar_link_layer_transmit_complete(handle_);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x42, 0x83, 0x3b, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  sonar_link_layer_transmit_complete(handle_);
+  EXPECT_AND_CLEAR_WRITE_CALLS(0);
+}
+
+TEST_F(LinkLayerTransmitTest, RingOverflow) {
+  DoLinkLayerTransmitRingInit(10);
+  TRANSMIT_PACKET(false, false, 11, 0x42);
+  EXPECT_AND_CLEAR_SENT_DATA(0x7e, 0x10, 0x0b, 0x42, 0x83, 0x3b, 0x7e);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+
+  // the next frame doesn't fit while the first is being sent, so should be dropped
+  TRANSMIT_PACKET(false, false, 12, 0x42);
+  sonar_link_layer_transmit_complete(handle_);
+  EXPECT_AND_CLEAR_WRITE_CALLS(0);
+
+  // the one after that should be sent in two parts as it wraps around the end of the ring
+  TRANSMIT_PACKET(false, false, 13, 0x42);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  EXPECT_EQ(m_transmit_sent_data.size(), 3);
+  sonar_link_layer_transmit_complete(handle_);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  EXPECT_EQ(m_transmit_sent_data.size(), 7);
+  EXPECT_EQ(m_transmit_sent_data[2], 13);
+  m_transmit_sent_data.clear();
+  sonar_link_layer_transmit_complete(handle_);
+}
+
+TEST_F(LinkLayerTransmitTest, RingCobs) {
+  DoLinkLayerTransmitRingInit(20, 64);
+  sonar_link_layer_transmit_set_cobs(handle_, true);
+  TRANSMIT_PACKET(false, false, 11, 0x11, 0x00, 0x22);
+  EXPECT_AND_CLEAR_SENT_DATA(0x00, 0x04, 0x10, 0x0b, 0x11, 0x04, 0x22, 0x3a, 0x7b, 0x00);
+  EXPECT_AND_CLEAR_WRITE_CALLS(1);
+  sonar_link_layer_transmit_complete(handle_);
+}
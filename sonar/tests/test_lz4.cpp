@@ -0,0 +1,86 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+
+#include "src/common/lz4.h"
+
+};
+
+#include <vector>
+
+static void ExpectRoundTrip(const std::vector<uint8_t>& data) {
+  std::vector<uint8_t> compressed(data.size() + data.size() / 255 + 16);
+  const uint32_t compressed_length = lz4_compress(data.data(), data.size(), compressed.data(), compressed.size());
+  ASSERT_NE(compressed_length, 0u);
+  std::vector<uint8_t> decompressed(data.size());
+  EXPECT_EQ(lz4_decompress(compressed.data(), compressed_length, decompressed.data(), decompressed.size()), data.size());
+  EXPECT_EQ(decompressed, data);
+}
+
+TEST(LZ4, Empty) {
+  uint8_t buffer[16];
+  EXPECT_EQ(lz4_compress(buffer, 0, buffer, sizeof(buffer)), 0u);
+}
+
+TEST(LZ4, Literals) {
+  // short data is stored as a single sequence of literals
+  const uint8_t data[] = {0x01, 0x02, 0x03};
+  uint8_t buffer[16];
+  ASSERT_EQ(lz4_compress(data, sizeof(data), buffer, sizeof(buffer)), 4u);
+  const uint8_t expected[] = {0x30, 0x01, 0x02, 0x03};
+  EXPECT_EQ(memcmp(buffer, expected, sizeof(expected)), 0);
+}
+
+TEST(LZ4, Repeated) {
+  // a run of the same byte is a single literal followed by an overlapping match, with the last 5 bytes as literals
+  const std::vector<uint8_t> data(300, 0xaa);
+  uint8_t buffer[16];
+  ASSERT_EQ(lz4_compress(data.data(), data.size(), buffer, sizeof(buffer)), 12u);
+  const uint8_t expected[] = {0x1f, 0xaa, 0x01, 0x00, 0xff, 0x14, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa};
+  EXPECT_EQ(memcmp(buffer, expected, sizeof(expected)), 0);
+  ExpectRoundTrip(data);
+}
+
+TEST(LZ4, RoundTrip) {
+  for (uint32_t length = 1; length <= 1024; length = length * 2 + 1) {
+    std::vector<uint8_t> random(length);
+    std::vector<uint8_t> text;
+    std::vector<uint8_t> samples;
+    for (uint32_t i = 0; i < length; i++) {
+      random[i] = rand();
+      text.push_back("the quick brown fox jumps over the lazy dog "[i % 44]);
+      samples.push_back(i % 2 ? 0x00 : (rand() % 8));
+    }
+    ExpectRoundTrip(random);
+    ExpectRoundTrip(text);
+    ExpectRoundTrip(samples);
+  }
+}
+
+TEST(LZ4, BufferTooSmall) {
+  const std::vector<uint8_t> data(300, 0xaa);
+  uint8_t buffer[16];
+  EXPECT_EQ(lz4_compress(data.data(), data.size(), buffer, 11), 0u);
+  ASSERT_EQ(lz4_compress(data.data(), data.size(), buffer, 12), 12u);
+  uint8_t decompressed[300];
+  EXPECT_EQ(lz4_decompress(buffer, 12, decompressed, sizeof(decompressed) - 1), 0u);
+}
+
+TEST(LZ4, Invalid) {
+  uint8_t buffer[32];
+  // a match with an offset of 0
+  const uint8_t zero_offset[] = {0x10, 0xaa, 0x00, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa};
+  EXPECT_EQ(lz4_decompress(zero_offset, sizeof(zero_offset), buffer, sizeof(buffer)), 0u);
+  // a match which refers to data before the start
+  const uint8_t past_start[] = {0x10, 0xaa, 0x02, 0x00, 0x50, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa};
+  EXPECT_EQ(lz4_decompress(past_start, sizeof(past_start), buffer, sizeof(buffer)), 0u);
+  // literals which extend past the end of the block
+  const uint8_t truncated_literals[] = {0x50, 0xaa, 0xaa};
+  EXPECT_EQ(lz4_decompress(truncated_literals, sizeof(truncated_literals), buffer, sizeof(buffer)), 0u);
+  // a truncated offset
+  const uint8_t truncated_offset[] = {0x10, 0xaa, 0x01};
+  EXPECT_EQ(lz4_decompress(truncated_offset, sizeof(truncated_offset), buffer, sizeof(buffer)), 0u);
+  // a truncated length
+  const uint8_t truncated_length[] = {0xf0, 0xff};
+  EXPECT_EQ(lz4_decompress(truncated_length, sizeof(truncated_length), buffer, sizeof(buffer)), 0u);
+}
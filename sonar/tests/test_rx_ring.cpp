@@ -0,0 +1,112 @@
+#include "gtest/gtest.h"
+
+extern "C" {
+
+#include "anchor/sonar/rx_ring.h"
+
+};
+
+#include <thread>
+#include <vector>
+
+static std::vector<uint8_t> ReadAll(sonar_rx_ring_handle_t ring) {
+  std::vector<uint8_t> result;
+  const uint8_t* data;
+  uint32_t length;
+  while ((length = sonar_rx_ring_peek(ring, &data)) != 0) {
+    result.insert(result.end(), data, data + length);
+    sonar_rx_ring_consume(ring, length);
+  }
+  return result;
+}
+
+TEST(RxRing, Basic) {
+  SONAR_RX_RING_DEF(ring, 8);
+  SONAR_RX_RING_INIT(ring);
+
+  // starts out empty
+  const uint8_t* data;
+  EXPECT_EQ(sonar_rx_ring_peek(ring, &data), 0u);
+
+  const uint8_t bytes[] = {0x01, 0x02, 0x03};
+  EXPECT_EQ(sonar_rx_ring_push(ring, bytes, sizeof(bytes)), sizeof(bytes));
+  EXPECT_TRUE(sonar_rx_ring_push_byte(ring, 0x04));
+  ASSERT_EQ(sonar_rx_ring_peek(ring, &data), 4u);
+  EXPECT_EQ(data[0], 0x01);
+  EXPECT_EQ(data[3], 0x04);
+
+  // consume part of the data
+  sonar_rx_ring_consume(ring, 2);
+  EXPECT_EQ(ReadAll(ring), std::vector<uint8_t>({0x03, 0x04}));
+}
+
+TEST(RxRing, Wrap) {
+  SONAR_RX_RING_DEF(ring, 8);
+  SONAR_RX_RING_INIT(ring);
+
+  // move the head and tail near the end of the buffer
+  const uint8_t padding[6] = {};
+  EXPECT_EQ(sonar_rx_ring_push(ring, padding, sizeof(padding)), sizeof(padding));
+  EXPECT_EQ(ReadAll(ring).size(), sizeof(padding));
+
+  // push data which wraps around and make sure it's returned as two contiguous spans
+  const uint8_t bytes[] = {0x01, 0x02, 0x03, 0x04, 0x05};
+  EXPECT_EQ(sonar_rx_ring_push(ring, bytes, sizeof(bytes)), sizeof(bytes));
+  const uint8_t* data;
+  ASSERT_EQ(sonar_rx_ring_peek(ring, &data), 2u);
+  EXPECT_EQ(data[0], 0x01);
+  EXPECT_EQ(data[1], 0x02);
+  sonar_rx_ring_consume(ring, 2);
+  ASSERT_EQ(sonar_rx_ring_peek(ring, &data), 3u);
+  EXPECT_EQ(data[0], 0x03);
+  EXPECT_EQ(data[2], 0x05);
+  sonar_rx_ring_consume(ring, 3);
+  EXPECT_EQ(sonar_rx_ring_peek(ring, &data), 0u);
+}
+
+TEST(RxRing, Full) {
+  SONAR_RX_RING_DEF(ring, 8);
+  SONAR_RX_RING_INIT(ring);
+
+  // the ring holds one byte less than its size
+  const uint8_t bytes[10] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a};
+  EXPECT_EQ(sonar_rx_ring_push(ring, bytes, sizeof(bytes)), 7u);
+  EXPECT_FALSE(sonar_rx_ring_push_byte(ring, 0xff));
+
+  // freeing space lets more data in
+  sonar_rx_ring_consume(ring, 1);
+  EXPECT_TRUE(sonar_rx_ring_push_byte(ring, 0x08));
+  EXPECT_FALSE(sonar_rx_ring_push_byte(ring, 0xff));
+  EXPECT_EQ(ReadAll(ring), std::vector<uint8_t>({0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08}));
+}
+
+TEST(RxRing, Concurrent) {
+  SONAR_RX_RING_DEF(ring, 64);
+  SONAR_RX_RING_INIT(ring);
+
+  // push a long sequence of bytes from another thread and make sure they're all received in order
+  const uint32_t num_bytes = 100000;
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < num_bytes; i++) {
+      while (!sonar_rx_ring_push_byte(ring, (uint8_t)i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint32_t num_received = 0;
+  bool in_order = true;
+  while (num_received < num_bytes) {
+    const uint8_t* data;
+    const uint32_t length = sonar_rx_ring_peek(ring, &data);
+    for (uint32_t i = 0; i < length; i++) {
+      in_order &= data[i] == (uint8_t)(num_received + i);
+    }
+    sonar_rx_ring_consume(ring, length);
+    num_received += length;
+    if (!length) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(in_order);
+}
@@ -14,16 +14,39 @@ extern "C" {
     sonar_server_process(handle_, _buffer, sizeof(_buffer)); \
   } while (0)
 
+#define PROCESS_LINK_RECEIVE_PACKET(LINK, ...) do { \
+    BUILD_PACKET_BUFFER(_buffer, __VA_ARGS__); \
+    sonar_server_process(LINK, _buffer, sizeof(_buffer)); \
+  } while (0)
+
+#define PUSH_RX_RING_PACKET(RING, ...) do { \
+    BUILD_PACKET_BUFFER(_buffer, __VA_ARGS__); \
+    for (uint32_t _i = 0; _i < sizeof(_buffer); _i++) { \
+      EXPECT_TRUE(sonar_rx_ring_push_byte(RING, _buffer[_i])); \
+    } \
+  } while (0)
+
 #define EXPECT_WRITE_PACKET(...) do { \
     BUILD_PACKET_BUFFER(_buffer, __VA_ARGS__); \
     EXPECT_TRUE(DataMatches(m_write_data, _buffer, sizeof(_buffer))); \
     m_write_data.clear(); \
   } while (0)
 
+#define EXPECT_LINK_WRITE_PACKET(...) do { \
+    BUILD_PACKET_BUFFER(_buffer, __VA_ARGS__); \
+    EXPECT_TRUE(DataMatches(m_link_write_data, _buffer, sizeof(_buffer))); \
+    m_link_write_data.clear(); \
+  } while (0)
+
 SONAR_SERVER_ATTR_DEF(TestAttr, TEST_ATTR, 0xfff, sizeof(uint32_t), RWN);
+SONAR_SERVER_ATTR_DEF(TestNotifyAttr, TEST_NOTIFY_ATTR, 0xffe, sizeof(uint8_t), RWN);
+SONAR_SERVER_ATTR_DEF(TestScheduledAttr, TEST_SCHEDULED_ATTR, 0xffc, sizeof(uint8_t), RWN);
+SONAR_SERVER_ATTR_DEF_COALESCED(TestCoalescedAttr, TEST_COALESCED_ATTR, 0xffd, sizeof(uint32_t), RWN);
+SONAR_SERVER_ATTR_DEF(TestLargeAttr, TEST_LARGE_ATTR, 0xffb, 16, RW);
 
 static sonar_server_handle_t m_handle;
 static std::vector<uint8_t> m_write_data;
+static std::vector<uint8_t> m_link_write_data;
 static uint64_t m_system_time;
 static int m_num_connections;
 static int m_num_disconnections;
@@ -31,12 +54,21 @@ static int m_attr_num_read;
 static int m_attr_num_write;
 static uint32_t m_attr_write_data;
 static int m_attr_num_notify_complete;
+static uint8_t m_scheduled_attr_value;
 static bool m_attr_notify_complete_success;
+static std::vector<uintptr_t> m_notify_callback_contexts;
+static bool m_notify_callback_success;
+static uint8_t m_large_attr_read_base;
+static std::vector<uint8_t> m_large_attr_write_data;
 
 static void write_byte(uint8_t byte) {
   m_write_data.push_back(byte);
 }
 
+static void link_write_byte(uint8_t byte) {
+  m_link_write_data.push_back(byte);
+}
+
 static uint64_t get_system_time_ms(void) {
   return m_system_time;
 }
@@ -68,21 +100,69 @@ static uint32_t TestAttr_read_handler(void* response_data, uint32_t response_max
   }
 }
 
+static uint32_t TestNotifyAttr_read_handler(void* response_data, uint32_t response_max_size) {
+  return 0;
+}
+
+static bool TestNotifyAttr_write_handler(const void* data, uint32_t length) {
+  return false;
+}
+
+static uint32_t TestScheduledAttr_read_handler(void* response_data, uint32_t response_max_size) {
+  *(uint8_t*)response_data = m_scheduled_attr_value;
+  return sizeof(uint8_t);
+}
+
+static bool TestScheduledAttr_write_handler(const void* data, uint32_t length) {
+  return false;
+}
+
+static uint32_t TestCoalescedAttr_read_handler(void* response_data, uint32_t response_max_size) {
+  return 0;
+}
+
+static bool TestCoalescedAttr_write_handler(const void* data, uint32_t length) {
+  return false;
+}
+
+static uint32_t TestLargeAttr_read_handler(void* response_data, uint32_t response_max_size) {
+  // each read returns different data so that it's obvious if one overwrote another
+  m_attr_num_read++;
+  for (uint32_t i = 0; i < response_max_size; i++) {
+    ((uint8_t*)response_data)[i] = m_large_attr_read_base + i;
+  }
+  m_large_attr_read_base += 0x10;
+  return response_max_size;
+}
+
+static bool TestLargeAttr_write_handler(const void* data, uint32_t length) {
+  m_attr_num_write++;
+  m_large_attr_write_data.assign((const uint8_t*)data, (const uint8_t*)data + length);
+  return true;
+}
+
 static void attribute_notify_complete_handler(sonar_server_handle_t handle, bool success) {
   m_attr_num_notify_complete++;
   m_attr_notify_complete_success = success;
 }
 
+static void notify_complete_callback(void* context, bool success) {
+  m_notify_callback_contexts.push_back((uintptr_t)context);
+  m_notify_callback_success = success;
+}
+
 class ServerTest : public ::testing::Test {
  protected:
   void SetUp() override {
     m_write_data.clear();
+    m_link_write_data.clear();
     m_system_time = 0;
     m_num_connections = 0;
     m_num_disconnections = 0;
     m_attr_num_read = 0;
     m_attr_num_write = 0;
     m_attr_num_notify_complete = 0;
+    m_notify_callback_contexts.clear();
 
     SONAR_SERVER_DEF(handle, 1024);
     handle_ = handle;
@@ -98,11 +178,13 @@ class ServerTest : public ::testing::Test {
 
   void TearDown() override {
     EXPECT_TRUE(m_write_data.empty());
+    EXPECT_TRUE(m_link_write_data.empty());
     EXPECT_EQ(m_num_connections, 0);
     EXPECT_EQ(m_num_disconnections, 0);
     EXPECT_EQ(m_attr_num_read, 0);
     EXPECT_EQ(m_attr_num_write, 0);
     EXPECT_EQ(m_attr_num_notify_complete, 0);
+    EXPECT_TRUE(m_notify_callback_contexts.empty());
   }
   sonar_server_handle_t handle_;
 };
@@ -155,6 +237,230 @@ TEST_F(ServerTest, Read) {
   m_attr_num_read = 0;
 }
 
+TEST_F(ServerTest, RxRing) {
+  SONAR_RX_RING_DEF(ring, 10);
+  SONAR_RX_RING_INIT(ring);
+
+  // register our attribute
+  sonar_server_register(handle_, TEST_ATTR);
+
+  // receive a connection request through the ring, one byte at a time as an ISR would
+  PUSH_RX_RING_PACKET(ring, 0x14, 0x00, 0x80);
+  sonar_server_process_rx_ring(handle_, ring);
+  EXPECT_WRITE_PACKET(0x17, 0x00);
+  EXPECT_TRUE(sonar_server_is_connected(handle_));
+  EXPECT_EQ(m_num_connections, 1);
+  m_num_connections = 0;
+
+  // receive a read request which wraps around the end of the ring
+  PUSH_RX_RING_PACKET(ring, 0x10, 0x01, 0xff, 0x1f);
+  sonar_server_process_rx_ring(handle_, ring);
+  EXPECT_WRITE_PACKET(0x13, 0x01, 0x44, 0x33, 0x22, 0x11);
+  EXPECT_EQ(m_attr_num_read, 1);
+  m_attr_num_read = 0;
+
+  // the ring should have been fully consumed
+  const uint8_t* data;
+  EXPECT_EQ(sonar_rx_ring_peek(ring, &data), 0u);
+}
+
+TEST_F(ServerTest, MultiLink) {
+  // register our attribute with the primary and add a second link which shares it
+  sonar_server_register(handle_, TEST_ATTR);
+  SONAR_SERVER_DEF(link, 1024);
+  const sonar_server_init_t init_link = {
+    .write_byte = link_write_byte,
+    .get_system_time_ms = get_system_time_ms,
+    .connection_changed_callback = connection_changed_callback,
+    .attribute_notify_complete_handler = attribute_notify_complete_handler,
+  };
+  sonar_server_init_link(link, handle_, &init_link);
+
+  // a notify fails while neither link is connected
+  const uint32_t data = 0x01020304;
+  EXPECT_FALSE(sonar_server_notify(handle_, TEST_ATTR, &data, sizeof(data)));
+
+  // connect both links
+  PROCESS_RECEIVE_PACKET(0x14, 0x00, 0x80);
+  EXPECT_WRITE_PACKET(0x17, 0x00);
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x14, 0x00, 0x80);
+  EXPECT_LINK_WRITE_PACKET(0x17, 0x00);
+  EXPECT_TRUE(sonar_server_is_connected(handle_));
+  EXPECT_TRUE(sonar_server_is_connected(link));
+  EXPECT_EQ(m_num_connections, 2);
+  m_num_connections = 0;
+
+  // read the attribute via the link
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x01, 0xff, 0x1f);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x01, 0x44, 0x33, 0x22, 0x11);
+  EXPECT_TRUE(m_write_data.empty());
+  EXPECT_EQ(m_attr_num_read, 1);
+  m_attr_num_read = 0;
+
+  // a notify via the link goes out on both links and only completes once both have responded
+  EXPECT_TRUE(sonar_server_notify(link, TEST_ATTR, &data, sizeof(data)));
+  EXPECT_WRITE_PACKET(0x12, 0x80, 0xff, 0x3f, 0x04, 0x03, 0x02, 0x1);
+  EXPECT_LINK_WRITE_PACKET(0x12, 0x80, 0xff, 0x3f, 0x04, 0x03, 0x02, 0x1);
+  EXPECT_FALSE(sonar_server_notify(handle_, TEST_ATTR, &data, sizeof(data)));
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x11, 0x80);
+  EXPECT_EQ(m_attr_num_notify_complete, 0);
+  PROCESS_RECEIVE_PACKET(0x11, 0x80);
+  EXPECT_TRUE(m_attr_notify_complete_success);
+  EXPECT_EQ(m_attr_num_notify_complete, 1);
+  m_attr_num_notify_complete = 0;
+
+  // disconnect the link and make sure notifies only go out on the primary
+  m_system_time += CONNECTION_TIMEOUT_MS / 2;
+  PROCESS_RECEIVE_PACKET(0x10, 0x01, 0xff, 0x1f);
+  EXPECT_WRITE_PACKET(0x13, 0x01, 0x44, 0x33, 0x22, 0x11);
+  m_attr_num_read = 0;
+  m_system_time += CONNECTION_TIMEOUT_MS / 2;
+  sonar_server_process(link, NULL, 0);
+  EXPECT_FALSE(sonar_server_is_connected(link));
+  EXPECT_EQ(m_num_disconnections, 1);
+  m_num_disconnections = 0;
+  EXPECT_TRUE(sonar_server_notify(handle_, TEST_ATTR, &data, sizeof(data)));
+  EXPECT_WRITE_PACKET(0x12, 0x81, 0xff, 0x3f, 0x04, 0x03, 0x02, 0x1);
+  PROCESS_RECEIVE_PACKET(0x11, 0x81);
+  EXPECT_TRUE(m_attr_notify_complete_success);
+  EXPECT_EQ(m_attr_num_notify_complete, 1);
+  m_attr_num_notify_complete = 0;
+}
+
+TEST_F(ServerTest, MultiLinkFragmented) {
+  // two links which share an attribute and each have room for 8 bytes of data per fragment
+  SONAR_SERVER_DEF(primary, 16);
+  SONAR_SERVER_DEF(link, 16);
+  const sonar_server_init_t init_primary = {
+    .write_byte = write_byte,
+    .get_system_time_ms = get_system_time_ms,
+    .connection_changed_callback = connection_changed_callback,
+    .attribute_notify_complete_handler = attribute_notify_complete_handler,
+    .enable_fragmentation = true,
+  };
+  sonar_server_init(primary, &init_primary);
+  sonar_server_register(primary, TEST_LARGE_ATTR);
+  const sonar_server_init_t init_link = {
+    .write_byte = link_write_byte,
+    .get_system_time_ms = get_system_time_ms,
+    .connection_changed_callback = connection_changed_callback,
+    .attribute_notify_complete_handler = attribute_notify_complete_handler,
+    .enable_fragmentation = true,
+  };
+  sonar_server_init_link(link, primary, &init_link);
+  m_large_attr_read_base = 0x80;
+  m_large_attr_write_data.clear();
+
+  // fragmentation is negotiated along with the receive buffer sizes (22 bytes)
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x14, 0x00, 0x80, 0x06, 0x01, 0x04, 0x16, 0x00);
+  EXPECT_WRITE_PACKET(0x17, 0x00, 0x06, 0x01, 0x04, 0x16, 0x00);
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x14, 0x00, 0x80, 0x06, 0x01, 0x04, 0x16, 0x00);
+  EXPECT_LINK_WRITE_PACKET(0x17, 0x00, 0x06, 0x01, 0x04, 0x16, 0x00);
+  EXPECT_EQ(m_num_connections, 2);
+  m_num_connections = 0;
+
+  // start a fragmented read on the link
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x01, 0xfb, 0x9f, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x01, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87);
+  EXPECT_EQ(m_attr_num_read, 1);
+
+  // the attribute's buffer is holding the rest of the read, so the primary can't read or write it in the meantime
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x10, 0x01, 0xfb, 0x9f, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00);
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x10, 0x02, 0xfb, 0xaf, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17);
+  EXPECT_TRUE(m_write_data.empty());
+  EXPECT_EQ(m_attr_num_read, 1);
+
+  // so the rest of the link's read is intact
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x02, 0xfb, 0x9f, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x02, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f);
+
+  // and the primary can then start its own fragmented read, which holds off a fragmented write from the link
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x10, 0x03, 0xfb, 0x9f, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00);
+  EXPECT_WRITE_PACKET(0x13, 0x03, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97);
+  EXPECT_EQ(m_attr_num_read, 2);
+  m_attr_num_read = 0;
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x03, 0xfb, 0xaf, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17);
+  EXPECT_TRUE(m_link_write_data.empty());
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x10, 0x04, 0xfb, 0x9f, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00);
+  EXPECT_WRITE_PACKET(0x13, 0x04, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f);
+
+  // the link's write then goes through once it's retried
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x04, 0xfb, 0xaf, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x04);
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x05, 0xfb, 0xaf, 0x08, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x05);
+  EXPECT_EQ(m_attr_num_write, 1);
+  m_attr_num_write = 0;
+  const std::vector<uint8_t> expected_write = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+    0x1c, 0x1d, 0x1e, 0x1f};
+  EXPECT_EQ(m_large_attr_write_data, expected_write);
+}
+
+TEST_F(ServerTest, MultiLinkLostReadResponse) {
+  // two links which share an attribute, without retransmit caches
+  SONAR_SERVER_DEF(primary, 16);
+  SONAR_SERVER_DEF(link, 16);
+  const sonar_server_init_t init_primary = {
+    .write_byte = write_byte,
+    .get_system_time_ms = get_system_time_ms,
+    .connection_changed_callback = connection_changed_callback,
+    .attribute_notify_complete_handler = attribute_notify_complete_handler,
+    .enable_fragmentation = true,
+  };
+  sonar_server_init(primary, &init_primary);
+  sonar_server_register(primary, TEST_LARGE_ATTR);
+  const sonar_server_init_t init_link = {
+    .write_byte = link_write_byte,
+    .get_system_time_ms = get_system_time_ms,
+    .connection_changed_callback = connection_changed_callback,
+    .attribute_notify_complete_handler = attribute_notify_complete_handler,
+  };
+  sonar_server_init_link(link, primary, &init_link);
+  m_large_attr_read_base = 0x80;
+  m_large_attr_write_data.clear();
+
+  // connect both links, with the primary also negotiating fragmentation
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x14, 0x00, 0x80, 0x06, 0x01, 0x04, 0x16, 0x00);
+  EXPECT_WRITE_PACKET(0x17, 0x00, 0x06, 0x01, 0x04, 0x16, 0x00);
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x14, 0x00, 0x80);
+  EXPECT_LINK_WRITE_PACKET(0x17, 0x00);
+  EXPECT_EQ(m_num_connections, 2);
+  m_num_connections = 0;
+
+  // read the attribute via the link, and then lose the response
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x01, 0xfb, 0x1f);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x01, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c,
+    0x8d, 0x8e, 0x8f);
+  EXPECT_EQ(m_attr_num_read, 1);
+
+  // a fragmented write via the primary is reassembled into the attribute's buffer, overwriting the read data
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x10, 0x01, 0xfb, 0xaf, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17);
+  EXPECT_WRITE_PACKET(0x13, 0x01);
+  PROCESS_LINK_RECEIVE_PACKET(primary, 0x10, 0x02, 0xfb, 0xaf, 0x08, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f);
+  EXPECT_WRITE_PACKET(0x13, 0x02);
+  EXPECT_EQ(m_attr_num_write, 1);
+  m_attr_num_write = 0;
+
+  // so the link reads the attribute again when the read is retried rather than sending the primary's write data
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x01, 0xfb, 0x1f);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x01, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c,
+    0x9d, 0x9e, 0x9f);
+  EXPECT_EQ(m_attr_num_read, 2);
+
+  // but the response is sent again as-is if the buffer hasn't been overwritten since
+  PROCESS_LINK_RECEIVE_PACKET(link, 0x10, 0x01, 0xfb, 0x1f);
+  EXPECT_LINK_WRITE_PACKET(0x13, 0x01, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c,
+    0x9d, 0x9e, 0x9f);
+  EXPECT_EQ(m_attr_num_read, 2);
+  m_attr_num_read = 0;
+}
+
 TEST_F(ServerTest, Write) {
   // register our attribute
   sonar_server_register(handle_, TEST_ATTR);
@@ -209,6 +515,38 @@ TEST_F(ServerTest, Notify) {
   m_attr_num_notify_complete = 0;
 }
 
+TEST_F(ServerTest, NotifyWithCallback) {
+  sonar_server_register(handle_, TEST_ATTR);
+  sonar_server_register(handle_, TEST_COALESCED_ATTR);
+
+  // connect (also tested by ServerTest.Connection)
+  PROCESS_RECEIVE_PACKET(0x14, 0x00, 0x80);
+  EXPECT_WRITE_PACKET(0x17, 0x00);
+  EXPECT_EQ(m_num_connections, 1);
+  m_num_connections = 0;
+
+  // the callback is called with its context instead of the notify complete handler
+  const uint32_t data = 0x01020304;
+  EXPECT_TRUE(sonar_server_notify_with_callback(handle_, TEST_ATTR, &data, sizeof(data), notify_complete_callback, (void*)1));
+  EXPECT_WRITE_PACKET(0x12, 0x80, 0xff, 0x3f, 0x04, 0x03, 0x02, 0x1);
+  PROCESS_RECEIVE_PACKET(0x11, 0x80);
+  EXPECT_EQ(m_notify_callback_contexts, std::vector<uintptr_t>({1}));
+  EXPECT_TRUE(m_notify_callback_success);
+  m_notify_callback_contexts.clear();
+
+  // also on failure
+  EXPECT_TRUE(sonar_server_notify_with_callback(handle_, TEST_ATTR, &data, sizeof(data), notify_complete_callback, (void*)2));
+  EXPECT_WRITE_PACKET(0x12, 0x81, 0xff, 0x3f, 0x04, 0x03, 0x02, 0x1);
+  m_system_time += REQUEST_TIMEOUT_MS;
+  sonar_server_process(handle_, NULL, 0);
+  EXPECT_EQ(m_notify_callback_contexts, std::vector<uintptr_t>({2}));
+  EXPECT_FALSE(m_notify_callback_success);
+  m_notify_callback_contexts.clear();
+
+  // callbacks aren't supported for coalesced attributes
+  EXPECT_FALSE(sonar_server_notify_with_callback(handle_, TEST_COALESCED_ATTR, &data, sizeof(data), notify_complete_callback, NULL));
+}
+
 TEST_F(ServerTest, ConcurrentReadNotify) {
   // register our attribute
   sonar_server_register(handle_, TEST_ATTR);
@@ -236,8 +574,8 @@ TEST_F(ServerTest, ConcurrentReadNotify) {
   EXPECT_EQ(m_attr_num_read, 1);
   m_attr_num_read = 0;
 
-  // retry the notify request again (should still send the original notify data and not the data we just read)
-  m_system_time += REQUEST_RETRY_INTERVAL_MS;
+  // retry the notify request again after backing off (should still send the original notify data and not the data we just read)
+  m_system_time += DEFAULT_MAX_REQUEST_RETRY_INTERVAL_MS;
   sonar_server_process(handle_, NULL, 0);
   EXPECT_WRITE_PACKET(0x12, 0x80, 0xff, 0x3f, 0x04, 0x03, 0x02, 0x1);
 
@@ -271,3 +609,130 @@ TEST_F(ServerTest, NotifyReadData) {
   EXPECT_EQ(m_attr_num_notify_complete, 1);
   m_attr_num_notify_complete = 0;
 }
+
+TEST_F(ServerTest, NotifyQueued) {
+  sonar_server_register(handle_, TEST_ATTR);
+  sonar_server_register(handle_, TEST_NOTIFY_ATTR);
+
+  // connect (also tested by ServerTest.Connection)
+  PROCESS_RECEIVE_PACKET(0x14, 0x00, 0x80);
+  EXPECT_WRITE_PACKET(0x17, 0x00);
+  EXPECT_EQ(m_num_connections, 1);
+  m_num_connections = 0;
+
+  // the second notify request is queued behind the first
+  const uint32_t data1 = 0x01020304;
+  EXPECT_TRUE(sonar_server_notify(handle_, TEST_ATTR, &data1, sizeof(data1)));
+  EXPECT_WRITE_PACKET(0x12, 0x80, 0xff, 0x3f, 0x04, 0x03, 0x02, 0x1);
+  const uint8_t data2 = 0x55;
+  EXPECT_TRUE(sonar_server_notify(handle_, TEST_NOTIFY_ATTR, &data2, sizeof(data2)));
+  EXPECT_TRUE(m_write_data.empty());
+
+  // can't notify an attribute which already has a notify request pending
+  EXPECT_FALSE(sonar_server_notify(handle_, TEST_ATTR, &data1, sizeof(data1)));
+
+  // the queued request is sent as soon as the first one completes
+  PROCESS_RECEIVE_PACKET(0x11, 0x80);
+  EXPECT_EQ(m_attr_num_notify_complete, 1);
+  m_attr_num_notify_complete = 0;
+  EXPECT_WRITE_PACKET(0x12, 0x81, 0xfe, 0x3f, 0x55);
+  PROCESS_RECEIVE_PACKET(0x11, 0x81);
+  EXPECT_TRUE(m_attr_notify_complete_success);
+  EXPECT_EQ(m_attr_num_notify_complete, 1);
+  m_attr_num_notify_complete = 0;
+}
+
+TEST_F(ServerTest, NotifyCoalesced) {
+  // register our attribute
+  sonar_server_register(handle_, TEST_COALESCED_ATTR);
+
+  // connect (also tested by ServerTest.Connection)
+  PROCESS_RECEIVE_PACKET(0x14, 0x00, 0x80);
+  EXPECT_WRITE_PACKET(0x17, 0x00);
+  EXPECT_TRUE(sonar_server_is_connected(handle_));
+  EXPECT_EQ(m_num_connections, 1);
+  m_num_connections = 0;
+
+  // send a notify request
+  uint32_t data = 0x01020304;
+  EXPECT_TRUE(sonar_server_notify(handle_, TEST_COALESCED_ATTR, &data, sizeof(data)));
+  EXPECT_WRITE_PACKET(0x12, 0x80, 0xfd, 0x3f, 0x04, 0x03, 0x02, 0x01);
+
+  // a burst of notifies while it's pending are coalesced rather than failing
+  for (uint32_t i = 0; i < 1000; i++) {
+    data = 0x11223300 + (i & 0xff);
+    EXPECT_TRUE(sonar_server_notify(handle_, TEST_COALESCED_ATTR, &data, sizeof(data)));
+  }
+  EXPECT_TRUE(m_write_data.empty());
+
+  // the latest value is sent once the pending notify completes, and the complete handler is called after that
+  PROCESS_RECEIVE_PACKET(0x11, 0x80);
+  EXPECT_WRITE_PACKET(0x12, 0x81, 0xfd, 0x3f, 0xe7, 0x33, 0x22, 0x11);
+  EXPECT_EQ(m_attr_num_notify_complete, 0);
+  PROCESS_RECEIVE_PACKET(0x11, 0x81);
+  EXPECT_TRUE(m_attr_notify_complete_success);
+  EXPECT_EQ(m_attr_num_notify_complete, 1);
+  m_attr_num_notify_complete = 0;
+}
+
+TEST_F(ServerTest, NotifySchedule) {
+  // register our attributes, with the scheduled one having a higher priority
+  TEST_SCHEDULED_ATTR->attr->priority = 1;
+  sonar_server_register(handle_, TEST_ATTR);
+  sonar_server_register(handle_, TEST_NOTIFY_ATTR);
+  sonar_server_register(handle_, TEST_SCHEDULED_ATTR);
+
+  // scheduled notifies aren't sent while disconnected
+  EXPECT_TRUE(sonar_server_notify_schedule(handle_, TEST_ATTR));
+  EXPECT_TRUE(m_write_data.empty());
+
+  // connect (also tested by ServerTest.Connection), after which the scheduled notify is sent
+  PROCESS_RECEIVE_PACKET(0x14, 0x00, 0x80);
+  std::vector<uint8_t> expected;
+  {
+    BUILD_PACKET_BUFFER(_buffer, 0x17, 0x00);
+    expected.insert(expected.end(), _buffer, _buffer + sizeof(_buffer));
+  }
+  {
+    BUILD_PACKET_BUFFER(_buffer, 0x12, 0x80, 0xff, 0x3f, 0x44, 0x33, 0x22, 0x11);
+    expected.insert(expected.end(), _buffer, _buffer + sizeof(_buffer));
+  }
+  EXPECT_TRUE(DataMatches(m_write_data, expected.data(), expected.size()));
+  m_write_data.clear();
+  EXPECT_TRUE(sonar_server_is_connected(handle_));
+  EXPECT_EQ(m_num_connections, 1);
+  m_num_connections = 0;
+  EXPECT_EQ(m_attr_num_read, 1);
+  m_attr_num_read = 0;
+
+  // schedule both attributes while the link is busy
+  EXPECT_TRUE(sonar_server_notify_schedule(handle_, TEST_ATTR));
+  EXPECT_TRUE(sonar_server_notify_schedule(handle_, TEST_SCHEDULED_ATTR));
+  EXPECT_TRUE(m_write_data.empty());
+
+  // the higher priority attribute is sent first once the link is free, with the data read at that point
+  m_scheduled_attr_value = 0x55;
+  PROCESS_RECEIVE_PACKET(0x11, 0x80);
+  EXPECT_WRITE_PACKET(0x12, 0x81, 0xfc, 0x3f, 0x55);
+  EXPECT_EQ(m_attr_num_read, 0);
+  PROCESS_RECEIVE_PACKET(0x11, 0x81);
+  EXPECT_WRITE_PACKET(0x12, 0x82, 0xff, 0x3f, 0x44, 0x33, 0x22, 0x11);
+  EXPECT_EQ(m_attr_num_read, 1);
+  m_attr_num_read = 0;
+  PROCESS_RECEIVE_PACKET(0x11, 0x82);
+  EXPECT_TRUE(m_write_data.empty());
+
+  // scheduled notifies wait for regular ones, and the complete handler is only called for the regular ones
+  const uint8_t data = 0x12;
+  EXPECT_TRUE(sonar_server_notify(handle_, TEST_NOTIFY_ATTR, &data, sizeof(data)));
+  EXPECT_WRITE_PACKET(0x12, 0x83, 0xfe, 0x3f, 0x12);
+  EXPECT_TRUE(sonar_server_notify_schedule(handle_, TEST_SCHEDULED_ATTR));
+  EXPECT_TRUE(m_write_data.empty());
+  PROCESS_RECEIVE_PACKET(0x11, 0x83);
+  EXPECT_WRITE_PACKET(0x12, 0x84, 0xfc, 0x3f, 0x55);
+  EXPECT_EQ(m_attr_num_notify_complete, 1);
+  m_attr_num_notify_complete = 0;
+  PROCESS_RECEIVE_PACKET(0x11, 0x84);
+  EXPECT_EQ(m_attr_num_notify_complete, 0);
+  TEST_SCHEDULED_ATTR->attr->priority = 0;
+}